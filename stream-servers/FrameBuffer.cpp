@@ -16,6 +16,7 @@
 
 #include "FrameBuffer.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -633,6 +634,16 @@ FrameBuffer::~FrameBuffer() {
 
     m_postWorker.reset();
 
+    if (m_vulkanEnabled) {
+        const auto stats = goldfish_vk::VkDecoderGlobalState::get()->getLockContentionStats();
+        INFO("Vulkan decoder lock contentions: global %" PRIu64 ", image %" PRIu64
+             ", buffer %" PRIu64 ", descriptor %" PRIu64 ", command buffer %" PRIu64
+             ", fence %" PRIu64,
+             stats.globalLockContentions, stats.imageLockContentions,
+             stats.bufferLockContentions, stats.descriptorLockContentions,
+             stats.cmdBufferLockContentions, stats.fenceLockContentions);
+    }
+
     goldfish_vk::teardownGlobalVkEmulation();
     SyncThread::destroy();
 }
@@ -2019,7 +2030,7 @@ void FrameBuffer::readColorBuffer(HandleType p_colorbuffer,
                                   GLenum type,
                                   void* pixels) {
     if (m_guestUsesAngle) {
-        goldfish_vk::readColorBufferToBytes(p_colorbuffer, x, y, width, height, pixels);
+        goldfish_vk::readColorBufferToRgbaBytes(p_colorbuffer, x, y, width, height, pixels);
         return;
     }
 
@@ -15,9 +15,11 @@
 */
 #include "ReadBuffer.h"
 
+#include "aemu/base/system/System.h"
 #include "host-common/logging.h"
 
 #include <algorithm>
+#include <atomic>
 
 #include <assert.h>
 #include <string.h>
@@ -25,21 +27,102 @@
 
 namespace emugl {
 
-ReadBuffer::ReadBuffer(size_t bufsize) {
+namespace {
+
+// Up to this size the buffer grows by doubling. Past it, it only grows to
+// what is needed, in whole chunks, so that a single huge upload doesn't leave
+// a buffer of twice its size behind.
+constexpr size_t kMaxDoublingSize = 8 * 1024 * 1024;
+constexpr size_t kGrowthChunkSize = 1024 * 1024;
+
+constexpr uint64_t kDefaultShrinkDelayUs = 5 * 1000 * 1000;
+
+std::atomic<size_t> sTotalAllocatedBytes{0};
+
+}  // namespace
+
+ReadBuffer::ReadBuffer(size_t bufsize)
+    : m_initialSize(bufsize), m_highWaterSize(bufsize), m_shrinkDelayUs(kDefaultShrinkDelayUs) {
     m_size = bufsize;
     m_buf = (unsigned char*)malloc(m_size);
     m_validData = 0;
     m_readPtr = m_buf;
+    sTotalAllocatedBytes += m_size;
 }
 
 ReadBuffer::~ReadBuffer() {
     free(m_buf);
+    sTotalAllocatedBytes -= m_size;
 }
 
 void ReadBuffer::setNeededFreeTailSize(size_t size) {
     m_neededFreeTailSize = size;
 }
 
+void ReadBuffer::setShrinkDelayUs(uint64_t delayUs) {
+    m_shrinkDelayUs = delayUs;
+}
+
+// static
+size_t ReadBuffer::totalAllocatedBytes() {
+    return sTotalAllocatedBytes.load(std::memory_order_relaxed);
+}
+
+size_t ReadBuffer::grownSize(size_t needed, size_t packetSize) const {
+    // Note: make sure we can fit at least two of the requested packets
+    //  into the new buffer to minimize the reallocations and
+    //  memmove()-ing stuff around.
+    size_t newSize = std::max(needed + packetSize, 2 * m_size);
+    if (newSize > kMaxDoublingSize) {
+        newSize = (needed + kGrowthChunkSize - 1) / kGrowthChunkSize * kGrowthChunkSize;
+    }
+    if (newSize < needed) {  // overflow check
+        newSize = needed;
+    }
+    return newSize;
+}
+
+// Moves the valid data to a new buffer of |newSize| bytes.
+bool ReadBuffer::replaceBuffer(size_t newSize) {
+    const auto newBuf = (unsigned char*)malloc(newSize);
+    if (!newBuf) {
+        ERR("Failed to alloc %zu bytes for ReadBuffer\n", newSize);
+        return false;
+    }
+
+    memcpy(newBuf, m_readPtr, m_validData);
+    free(m_buf);
+    sTotalAllocatedBytes += newSize;
+    sTotalAllocatedBytes -= m_size;
+    m_buf = newBuf;
+    m_readPtr = m_buf;
+    m_size = newSize;
+    m_highWaterSize = std::max(m_highWaterSize, m_size);
+    return true;
+}
+
+bool ReadBuffer::maybeShrink(uint64_t nowUs) {
+    if (m_size <= m_initialSize || nowUs - m_lastLargeUseUs < m_shrinkDelayUs) {
+        return false;
+    }
+    // Shrinking is a copy of the valid data, only do it when there is little.
+    if (m_validData > m_initialSize / 2) {
+        return false;
+    }
+    return replaceBuffer(m_initialSize);
+}
+
+bool ReadBuffer::onIdle() {
+    // External data, or a read of more than the initial size, needs the
+    // buffer as it is.
+    if (m_externalSize || m_readMinSize > m_initialSize ||
+        !maybeShrink(android::base::getHighResTimeUs())) {
+        return false;
+    }
+    m_shrunkWhileReading = m_readMinSize > 0;
+    return m_shrunkWhileReading;
+}
+
 int ReadBuffer::getData(IOStream* stream, size_t minSize) {
     assert(stream);
     assert(minSize > m_validData);
@@ -49,49 +132,45 @@ int ReadBuffer::getData(IOStream* stream, size_t minSize) {
         std::max(minSizeToRead,
                  m_neededFreeTailSize);
 
-    size_t maxSizeToRead;
-    const size_t freeTailSize = m_buf + m_size - (m_readPtr + m_validData);
-    if (freeTailSize >= neededFreeTailThisTime) {
-        maxSizeToRead = freeTailSize;
+    const uint64_t nowUs = android::base::getHighResTimeUs();
+    if (m_validData + neededFreeTailThisTime > m_initialSize) {
+        m_lastLargeUseUs = nowUs;
     } else {
+        maybeShrink(nowUs);
+    }
+
+    const size_t freeTailSize = m_buf + m_size - (m_readPtr + m_validData);
+    if (freeTailSize < neededFreeTailThisTime) {
         if (freeTailSize + (m_readPtr - m_buf) >= neededFreeTailThisTime) {
             // There's some gap in the beginning, if we move the data over it
             // that's going to be enough.
             memmove(m_buf, m_readPtr, m_validData);
         } else {
             // Not enough space even with moving, reallocate.
-            // Note: make sure we can fit at least two of the requested packets
-            //  into the new buffer to minimize the reallocations and
-            //  memmove()-ing stuff around.
-          size_t new_size = std::max(2 * minSizeToRead + m_validData, 2 * m_size);
-          if (new_size < m_size) {  // overflow check
-                new_size = INT_MAX;
-            }
-
-            const auto new_buf = (unsigned char*)malloc(new_size);
-            if (!new_buf) {
-                ERR("Failed to alloc %zu bytes for ReadBuffer\n", new_size);
+            if (!replaceBuffer(grownSize(m_validData + neededFreeTailThisTime, minSizeToRead))) {
                 return -1;
             }
-
-            memcpy(new_buf, m_readPtr, m_validData);
-            free(m_buf);
-            m_buf = new_buf;
-            m_size = new_size;
         }
         // We can read more now, let's request it in case all data is ready
         // for reading.
-        maxSizeToRead = m_size - m_validData;
         m_readPtr = m_buf;
     }
 
     // get fresh data into the buffer;
     int readTotal = 0;
+    m_readMinSize = minSize;
     do {
+        // The buffer may shrink under the read while the stream is idle, see
+        // onIdle(); then the read returns nothing and is retried.
         const size_t readNow = stream->read(m_readPtr + m_validData,
-                                            maxSizeToRead - readTotal);
+                                            m_buf + m_size - (m_readPtr + m_validData));
 
         if (!readNow) {
+            if (m_shrunkWhileReading) {
+                m_shrunkWhileReading = false;
+                continue;
+            }
+            m_readMinSize = 0;
             if (readTotal > 0) {
                 return readTotal;
             } else {
@@ -102,6 +181,7 @@ int ReadBuffer::getData(IOStream* stream, size_t minSize) {
         m_validData += readNow;
     } while (readTotal < minSizeToRead);
 
+    m_readMinSize = 0;
     return readTotal;
 }
 
@@ -111,6 +191,21 @@ void ReadBuffer::consume(size_t amount) {
     m_readPtr += amount;
 }
 
+void ReadBuffer::attachExternalData(unsigned char* data, size_t size) {
+    assert(!m_validData);
+    m_readPtr = data;
+    m_validData = size;
+    m_externalSize = size;
+}
+
+size_t ReadBuffer::detachExternalData() {
+    const size_t consumed = m_externalSize - m_validData;
+    m_readPtr = m_buf;
+    m_validData = 0;
+    m_externalSize = 0;
+    return consumed;
+}
+
 void ReadBuffer::onSave(android::base::Stream* stream) {
     stream->putBe32(m_size);
     stream->putBe32(m_validData);
@@ -119,20 +214,21 @@ void ReadBuffer::onSave(android::base::Stream* stream) {
 
 void ReadBuffer::onLoad(android::base::Stream* stream) {
     const auto size = stream->getBe32();
+    m_readPtr = m_buf;
+    m_validData = 0;
     if (size > m_size) {
-        m_size = size;
-        free(m_buf);
-        m_buf = (unsigned char*)malloc(m_size);
+        replaceBuffer(size);
     }
-    m_readPtr = m_buf;
     m_validData = stream->getBe32();
     assert(m_validData <= m_size);
     stream->read(m_readPtr, m_validData);
 }
 
 void ReadBuffer::printStats() {
-    printf("ReadBuffer::%s: tail move time %f ms\n", __func__,
-            (float)m_tailMoveTimeUs / 1000.0f);
+    printf("ReadBuffer::%s: tail move time %f ms, size %zu KiB (high water %zu KiB), "
+           "all threads %zu KiB\n", __func__,
+            (float)m_tailMoveTimeUs / 1000.0f, m_size / 1024, m_highWaterSize / 1024,
+            totalAllocatedBytes() / 1024);
     m_tailMoveTimeUs = 0;
 }
 }  // namespace emugl
@@ -17,6 +17,8 @@
 #include "aemu/base/files/Stream.h"
 #include "IOStream.h"
 
+#include <stdint.h>
+
 namespace emugl {
 
 class ReadBuffer {
@@ -25,20 +27,56 @@ public:
     ~ReadBuffer();
 
     void setNeededFreeTailSize(size_t size);
+    // Once the buffer has grown past its initial size, how long it has to go
+    // without needing the extra space before it shrinks back.
+    void setShrinkDelayUs(uint64_t delayUs);
     int getData(IOStream *stream, size_t minSize); // get fresh data from the stream
+    // To be called when the stream is about to block waiting for data.
+    // Shrinks the buffer if it has been idle long enough. Returns true if that
+    // happened in the middle of getData(), whose read then has to be given up
+    // and retried.
+    bool onIdle();
     unsigned char *buf() { return m_readPtr; } // return the next read location
     size_t validData() const { return m_validData; } // return the amount of valid data in readptr
     void consume(size_t amount); // notify that 'amount' data has been consumed;
 
+    // Makes buf(), validData() and consume() work on |size| bytes owned by the
+    // caller, e.g. to decode data in place, until detachExternalData() is
+    // called. The buffer must not have valid data.
+    void attachExternalData(unsigned char* data, size_t size);
+    // Switches back to the buffer, returning how much external data was
+    // consumed. Whatever was not consumed is dropped.
+    size_t detachExternalData();
+
     void onLoad(android::base::Stream* stream);
     void onSave(android::base::Stream* stream);
 
     void printStats();
+
+    size_t size() const { return m_size; }
+    size_t highWaterSize() const { return m_highWaterSize; }
+    // Total size of the buffers of all ReadBuffer instances.
+    static size_t totalAllocatedBytes();
+
 private:
+    size_t grownSize(size_t needed, size_t packetSize) const;
+    bool maybeShrink(uint64_t nowUs);
+    bool replaceBuffer(size_t newSize);
+
     unsigned char *m_buf;
     unsigned char *m_readPtr;
     size_t m_size;
     size_t m_validData;
+    size_t m_externalSize = 0;
+
+    const size_t m_initialSize;
+    size_t m_highWaterSize;
+    uint64_t m_shrinkDelayUs;
+    // Last time the data didn't fit in |m_initialSize|.
+    uint64_t m_lastLargeUseUs = 0;
+    // |minSize| of the getData() in progress, if any.
+    size_t m_readMinSize = 0;
+    bool m_shrunkWhileReading = false;
 
     uint64_t m_tailMoveTimeUs = 0;
     size_t m_neededFreeTailSize = 0;
@@ -25,7 +25,9 @@
 #include "RenderControl.h"
 #include "RenderThreadInfo.h"
 #include "RendererImpl.h"
+#include "ReplayStream.h"
 #include "RingStream.h"
+#include "StreamCapture.h"
 #include "VkDecoderContext.h"
 #include "apigen-codec-common/ChecksumCalculatorThreadInfo.h"
 #include "aemu/base/HealthMonitor.h"
@@ -50,6 +52,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include <optional>
 #include <unordered_map>
 
 using android::base::AutoLock;
@@ -72,6 +75,43 @@ static bool getBenchmarkEnabledFromEnv() {
     return false;
 }
 
+// How long a render thread's read buffer stays large after the last big
+// packet before shrinking back.
+static std::optional<uint64_t> getReadBufferShrinkDelayUsFromEnv() {
+    const std::string delayMs =
+        android::base::getEnvironmentVariable("ANDROID_EMUGL_READ_BUFFER_SHRINK_DELAY_MS");
+    if (delayMs.empty()) {
+        return std::nullopt;
+    }
+    return strtoull(delayMs.c_str(), nullptr, 10) * 1000;
+}
+
+// Decoding guest commands in place in the address space graphics shared
+// buffer saves copying them, but the guest can write to that memory while the
+// decoders parse it, so this is only for trusted guests.
+static bool getZeroCopyDecodeEnabledFromEnv() {
+    return android::base::getEnvironmentVariable("ANDROID_EMUGL_ZERO_COPY_DECODE") == "1";
+}
+
+// Points |readBuf| at the data pending in |ringStream| if it starts with a
+// complete packet, so that the decoders run on it in place.
+static bool attachPacketsInPlace(RingStream* ringStream, ReadBuffer* readBuf) {
+    if (readBuf->validData()) {
+        return false;
+    }
+    char* data = nullptr;
+    size_t size = 0;
+    if (!ringStream->peekContiguous(&data, &size)) {
+        return false;
+    }
+    // Partial packets are left to the copy path, which assembles them.
+    if (size < 8 || *(uint32_t*)(data + 4) > size) {
+        return false;
+    }
+    readBuf->attachExternalData((unsigned char*)data, size);
+    return true;
+}
+
 // Start with a smaller buffer to not waste memory on a low-used render threads.
 static constexpr int kStreamBufferSize = 128 * 1024;
 
@@ -122,6 +162,15 @@ RenderThread::RenderThread(
     }
 }
 
+RenderThread::RenderThread(std::unique_ptr<ReplayStream> replayStream,
+                           std::optional<std::string> nameOpt)
+    : android::base::Thread(android::base::ThreadFlags::MaskSignals, 2 * 1024 * 1024,
+                            std::move(nameOpt)),
+      mReplayStream(std::move(replayStream)),
+      mRunInLimitedMode(android::base::getCpuCoreCount() < kMinThreadsToRunUnlimited),
+      mCapsetId(mReplayStream->header().capsetId),
+      mContextId(mReplayStream->header().contextId) {}
+
 // Note: the RenderThread destructor might be called from a different thread
 // than from RenderThread::main() so thread specific cleanup likely belongs at
 // the end of RenderThread::main().
@@ -276,20 +325,24 @@ intptr_t RenderThread::main() {
 
     initRenderControlContext(&tInfo.m_rcDec);
 
-    if (!mChannel && !mRingStream) {
+    if (!mChannel && !mRingStream && !mReplayStream) {
         GL_LOG("Exited a loader RenderThread @%p", this);
         mFinished.store(true, std::memory_order_relaxed);
         return 0;
     }
 
     ChannelStream stream(mChannel, RenderChannel::Buffer::kSmallSize);
-    IOStream* ioStream =
-        mChannel ? (IOStream*)&stream : (IOStream*)mRingStream.get();
+    IOStream* ioStream = mChannel       ? (IOStream*)&stream
+                         : mRingStream  ? (IOStream*)mRingStream.get()
+                                        : (IOStream*)mReplayStream.get();
 
     ReadBuffer readBuf(kStreamBufferSize);
     if (mRingStream) {
         readBuf.setNeededFreeTailSize(0);
     }
+    if (const auto shrinkDelayUs = getReadBufferShrinkDelayUsFromEnv()) {
+        readBuf.setShrinkDelayUs(*shrinkDelayUs);
+    }
 
     const SnapshotObjects snapshotObjects = {
         &tInfo, &checksumCalc, &stream, mRingStream.get(), &readBuf,
@@ -329,22 +382,17 @@ intptr_t RenderThread::main() {
     uint64_t stats_progressTimeUs = 0;
     auto stats_t0 = android::base::getHighResTimeUs() / 1000;
     bool benchmarkEnabled = getBenchmarkEnabledFromEnv();
+    const bool zeroCopyDecode = mRingStream && getZeroCopyDecodeEnabledFromEnv();
 
     //
-    // open dump file if RENDER_DUMP_DIR is defined
+    // open a stream capture if RENDERER_DUMP_DIR is defined
     //
-    const char* dump_dir = getenv("RENDERER_DUMP_DIR");
-    FILE* dumpFP = nullptr;
-    if (dump_dir) {
-        // size_t bsize = strlen(dump_dir) + 32;
-        // char* fname = new char[bsize];
-        // snprintf(fname, bsize, "%s" PATH_SEP "stream_%p", dump_dir, this);
-        // dumpFP = android_fopen(fname, "wb");
-        // if (!dumpFP) {
-        //     fprintf(stderr, "Warning: stream dump failed to open file %s\n",
-        //             fname);
-        // }
-        // delete[] fname;
+    std::unique_ptr<StreamCaptureWriter> captureWriter;
+    if (!mReplayStream) {
+        const std::string dumpDir = android::base::getEnvironmentVariable("RENDERER_DUMP_DIR");
+        if (!dumpDir.empty()) {
+            captureWriter = StreamCaptureWriter::create(dumpDir, mContextId, mCapsetId);
+        }
     }
 
     GfxApiLogger gfxLogger;
@@ -352,6 +400,12 @@ intptr_t RenderThread::main() {
 
     const ProcessResources* processResources = nullptr;
 
+    // Give back a grown read buffer while waiting for the guest, rather than
+    // holding on to it until more data comes.
+    if (mRingStream) {
+        mRingStream->setOnIdleRead([&readBuf] { return readBuf.onIdle(); });
+    }
+
     while (true) {
         // Let's make sure we read enough data for at least some processing.
         uint32_t packetSize;
@@ -371,8 +425,16 @@ intptr_t RenderThread::main() {
         }
 
         int stat = 0;
+        bool decodingInPlace = false;
+        const unsigned char* inPlaceData = nullptr;
         if (packetSize > readBuf.validData()) {
-            stat = readBuf.getData(ioStream, packetSize);
+            decodingInPlace = zeroCopyDecode && attachPacketsInPlace(mRingStream.get(), &readBuf);
+            if (decodingInPlace) {
+                inPlaceData = readBuf.buf();
+                stat = readBuf.validData();
+            } else {
+                stat = readBuf.getData(ioStream, packetSize);
+            }
             if (stat <= 0) {
                 if (doSnapshotOperation(snapshotObjects, SnapshotState::StartSaving)) {
                     continue;
@@ -405,6 +467,9 @@ intptr_t RenderThread::main() {
                         stats_progressTimeUs / 1000.0f,
                         (float)dt);
                 readBuf.printStats();
+                if (mRingStream) {
+                    mRingStream->printStats();
+                }
                 stats_t0 = android::base::getHighResTimeUs() / 1000;
                 stats_progressTimeUs = 0;
                 stats_totalBytes = 0;
@@ -412,12 +477,12 @@ intptr_t RenderThread::main() {
         }
 
         //
-        // dump stream to file if needed
+        // capture the newly received bytes if needed. Data decoded in place
+        // is captured once we know how much of it was consumed, as the rest
+        // is read again later.
         //
-        if (dumpFP) {
-            int skip = readBuf.validData() - stat;
-            fwrite(readBuf.buf() + skip, 1, readBuf.validData() - skip, dumpFP);
-            fflush(dumpFP);
+        if (captureWriter && stat > 0 && !decodingInPlace) {
+            captureWriter->write(readBuf.buf() + readBuf.validData() - stat, stat);
         }
 
         bool progress;
@@ -463,6 +528,8 @@ intptr_t RenderThread::main() {
                 }
                 last = tInfo.m_vkInfo->m_vkDec.decode(readBuf.buf(), readBuf.validData(), ioStream,
                                                       seqno, context);
+                // VulkanStream defers its commits, send the replies of the whole batch at once.
+                ioStream->flush();
                 if (last > 0) {
                     if (!processResources) {
                         ERR("Processed some Vulkan packets without process resources created. "
@@ -539,11 +606,22 @@ intptr_t RenderThread::main() {
             }
 
         } while (progress);
+
+        // Only now let the guest reuse the memory, some commands keep pointers
+        // to the data of previous ones in the same batch.
+        if (decodingInPlace) {
+            const size_t consumed = readBuf.detachExternalData();
+            if (captureWriter && consumed) {
+                captureWriter->write(inPlaceData, consumed);
+            }
+            mRingStream->consumePeeked(consumed);
+        }
     }
 
-    if (dumpFP) {
-        fclose(dumpFP);
+    if (mRingStream) {
+        mRingStream->setOnIdleRead(nullptr);
     }
+    captureWriter.reset();
 
     if (tInfo.m_glInfo) {
         FrameBuffer::getFB()->drainGlRenderThreadResources();
@@ -30,6 +30,7 @@ namespace emugl {
 class RenderChannelImpl;
 class RendererImpl;
 class ReadBuffer;
+class ReplayStream;
 class RingStream;
 
 // A class used to model a thread of the RenderServer. Each one of them
@@ -49,6 +50,11 @@ public:
         android::emulation::asg::ConsumerCallbacks callbacks,
         uint32_t contextId, uint32_t capsetId,
         std::optional<std::string> nameOpt);
+
+    // Create a new RenderThread instance that decodes a previously captured stream. See
+    // StreamCapture.h.
+    RenderThread(std::unique_ptr<ReplayStream> replayStream,
+                 std::optional<std::string> nameOpt);
     virtual ~RenderThread();
 
     // Returns true iff the thread has finished.
@@ -92,6 +98,7 @@ private:
 
     RenderChannelImpl* mChannel = nullptr;
     std::unique_ptr<RingStream> mRingStream;
+    std::unique_ptr<ReplayStream> mReplayStream;
 
     SnapshotState mState = SnapshotState::Empty;
     std::atomic<bool> mFinished { false };
@@ -0,0 +1,123 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "ReplayStream.h"
+
+#include "aemu/base/system/System.h"
+#include "host-common/GfxstreamFatalError.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace emugl {
+
+using emugl::ABORT_REASON_OTHER;
+using emugl::FatalError;
+
+// Size of the scratch buffer the decoders encode replies into.
+static constexpr size_t kWriteBufferSize = 16 * 1024;
+
+ReplayStream::ReplayStream(std::unique_ptr<StreamCaptureReader> reader,
+                           std::optional<Clock> clock)
+    : IOStream(kWriteBufferSize), mReader(std::move(reader)), mClock(clock) {}
+
+void* ReplayStream::allocBuffer(size_t minSize) {
+    if (mWriteBuffer.size() < minSize) {
+        mWriteBuffer.resize(minSize);
+    }
+    return mWriteBuffer.data();
+}
+
+int ReplayStream::commitBuffer(size_t size) {
+    // Replies to the guest have nowhere to go.
+    return size;
+}
+
+int ReplayStream::writeFully(const void* buf, size_t len) {
+    return 0;
+}
+
+const unsigned char* ReplayStream::readFully(void* buf, size_t len) {
+    GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
+        << "not intended for use with ReplayStream";
+}
+
+bool ReplayStream::nextRecord() {
+    if (!mReader->next(&mRecord)) {
+        return false;
+    }
+    mRecordOffset = 0;
+
+    if (mClock) {
+        const uint64_t now = android::base::getHighResTimeUs();
+        const uint64_t due = mClock->replayStartUs +
+                             (mReader->header().startTimeUs - mClock->captureOriginUs) +
+                             mRecord.timestampUs;
+        if (due > now) {
+            android::base::sleepUs(due - now);
+        }
+    }
+    return true;
+}
+
+const unsigned char* ReplayStream::readRaw(void* buf, size_t* inout_len) {
+    const size_t wanted = *inout_len;
+    size_t count = 0;
+    auto dst = static_cast<uint8_t*>(buf);
+
+    if (!mFlagsSent) {
+        if (wanted < sizeof(uint32_t)) return nullptr;
+        memset(dst, 0, sizeof(uint32_t));
+        mFlagsSent = true;
+        *inout_len = sizeof(uint32_t);
+        return dst;
+    }
+
+    while (count < wanted) {
+        if (mRecordOffset < mRecord.data.size()) {
+            const size_t avail = std::min(wanted - count, mRecord.data.size() - mRecordOffset);
+            memcpy(dst + count, mRecord.data.data() + mRecordOffset, avail);
+            mRecordOffset += avail;
+            count += avail;
+            continue;
+        }
+        // Like a real transport, hand over what we have before waiting for the next batch.
+        if (count > 0 || !nextRecord()) {
+            break;
+        }
+    }
+
+    if (count == 0) {
+        return nullptr;
+    }
+    mBytesReplayed += count;
+    *inout_len = count;
+    return dst;
+}
+
+void* ReplayStream::getDmaForReading(uint64_t guest_paddr) {
+    GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
+        << "guest memory is not part of a stream capture";
+    return nullptr;
+}
+
+void ReplayStream::unlockDma(uint64_t guest_paddr) {}
+
+void ReplayStream::onSave(android::base::Stream* stream) {}
+
+unsigned char* ReplayStream::onLoad(android::base::Stream* stream) {
+    return nullptr;
+}
+
+}  // namespace emugl
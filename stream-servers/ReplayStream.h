@@ -0,0 +1,74 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include "IOStream.h"
+#include "StreamCapture.h"
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace emugl {
+
+// An IOStream instance that feeds a RenderThread with a stream captured through
+// RENDERER_DUMP_DIR. Everything the decoders write back to the guest is discarded.
+class ReplayStream final : public IOStream {
+public:
+    // Maps capture timestamps to the host clock, so that captures of several render threads
+    // replayed together keep their relative timing.
+    struct Clock {
+        uint64_t captureOriginUs;  // Earliest startTimeUs of the captures replayed together
+        uint64_t replayStartUs;    // Host time corresponding to captureOriginUs
+    };
+
+    // With a |clock|, each record is delivered no earlier than it was originally received.
+    // Otherwise records are delivered as fast as the decoders consume them.
+    ReplayStream(std::unique_ptr<StreamCaptureReader> reader, std::optional<Clock> clock);
+
+    const StreamCaptureHeader& header() const { return mReader->header(); }
+
+    // Number of captured bytes handed to the decoders so far.
+    uint64_t bytesReplayed() const { return mBytesReplayed; }
+
+    int writeFully(const void* buf, size_t len) override;
+    const unsigned char* readFully(void* buf, size_t len) override;
+
+protected:
+    void* allocBuffer(size_t minSize) override;
+    int commitBuffer(size_t size) override;
+    const unsigned char* readRaw(void* buf, size_t* inout_len) override;
+    void* getDmaForReading(uint64_t guest_paddr) override;
+    void unlockDma(uint64_t guest_paddr) override;
+
+    void onSave(android::base::Stream* stream) override;
+    unsigned char* onLoad(android::base::Stream* stream) override;
+
+private:
+    // Loads the next record, waiting for its timestamp in realtime mode. Returns false at the end
+    // of the capture.
+    bool nextRecord();
+
+    std::unique_ptr<StreamCaptureReader> mReader;
+    const std::optional<Clock> mClock;
+    // RenderThread reads a 32-bit flags word before the first packet. It is not part of the
+    // capture, and not used anymore, so we synthesize it.
+    bool mFlagsSent = false;
+    StreamCaptureRecord mRecord;
+    size_t mRecordOffset = 0;
+    uint64_t mBytesReplayed = 0;
+    std::vector<uint8_t> mWriteBuffer;
+};
+
+}  // namespace emugl
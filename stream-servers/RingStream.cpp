@@ -25,18 +25,40 @@
 #include <assert.h>
 #include <memory.h>
 
+#include <algorithm>
+
 using emugl::ABORT_REASON_OTHER;
 using emugl::FatalError;
 
 namespace emugl {
 
+namespace {
+
+// Bounds of the number of yields while the to host rings are empty before
+// calling onUnavailableRead(), which eventually blocks until the guest pings.
+constexpr uint32_t kInitialReadSpins = 30;
+constexpr uint32_t kMinReadSpins = 4;
+constexpr uint32_t kMaxReadSpins = 2048;
+
+// Same for the from host ring being full, after which the stream sleeps with
+// an exponential backoff until the guest reads.
+constexpr uint32_t kInitialWriteSpins = 256;
+constexpr uint32_t kMinWriteSpins = 16;
+constexpr uint32_t kMaxWriteSpins = 16384;
+constexpr uint32_t kMinWriteSleepUs = 10;
+constexpr uint32_t kMaxWriteSleepUs = 1000;
+
+}  // namespace
+
 RingStream::RingStream(
     struct asg_context context,
     android::emulation::asg::ConsumerCallbacks callbacks,
     size_t bufsize) :
     IOStream(bufsize),
     mContext(context),
-    mCallbacks(callbacks) { }
+    mCallbacks(callbacks),
+    mReadSpinBudget(kInitialReadSpins),
+    mWriteSpinBudget(kInitialWriteSpins) { }
 RingStream::~RingStream() = default;
 
 int RingStream::getNeededFreeTailSize() const {
@@ -54,29 +76,47 @@ int RingStream::commitBuffer(size_t size) {
     size_t sent = 0;
     auto data = mWriteBuffer.data();
 
-    size_t iters = 0;
-    size_t backedOffIters = 0;
-    const size_t kBackoffIters = 10000000ULL;
+    uint32_t spins = 0;
+    uint32_t sleepUs = kMinWriteSleepUs;
+    uint64_t spinStartUs = 0;
     while (sent < size) {
-        ++iters;
         auto avail = ring_buffer_available_write(
             mContext.from_host_large_xfer.ring,
             &mContext.from_host_large_xfer.view);
 
-        // Check if the guest process crashed.
         if (!avail) {
+            // Check if the guest process crashed.
             if (*(mContext.host_state) == ASG_HOST_STATE_EXIT) {
+                if (spins) {
+                    mStats.writeSpinTimeUs +=
+                        android::base::getHighResTimeUs() - spinStartUs;
+                }
                 return sent;
-            } else {
+            }
+            if (!spins) {
+                spinStartUs = android::base::getHighResTimeUs();
+            }
+            if (++spins < mWriteSpinBudget) {
                 ring_buffer_yield();
-                if (iters > kBackoffIters) {
-                    android::base::sleepUs(10);
-                    ++backedOffIters;
-                }
+            } else {
+                // The guest is slow to drain the ring, don't hog the CPU
+                // while waiting for it.
+                android::base::sleepUs(sleepUs);
+                sleepUs = std::min(sleepUs * 2, kMaxWriteSleepUs);
+                ++mStats.writeSleeps;
             }
             continue;
         }
 
+        if (spins) {
+            mStats.writeSpinTimeUs +=
+                android::base::getHighResTimeUs() - spinStartUs;
+            updateSpinBudget(&mWriteSpinBudget, spins < mWriteSpinBudget,
+                             spins, kMinWriteSpins, kMaxWriteSpins);
+            spins = 0;
+            sleepUs = kMinWriteSleepUs;
+        }
+
         auto remaining = size - sent;
         auto todo = remaining < avail ? remaining : avail;
 
@@ -88,11 +128,6 @@ int RingStream::commitBuffer(size_t size) {
         sent += todo;
     }
 
-    if (backedOffIters > 0) {
-        fprintf(stderr, "%s: warning: backed off %zu times due to guest slowness.\n",
-                __func__,
-                backedOffIters);
-    }
     return sent;
 }
 
@@ -104,8 +139,8 @@ const unsigned char* RingStream::readRaw(void* buf, size_t* inout_len) {
     uint32_t ringAvailable = 0;
     uint32_t ringLargeXferAvailable = 0;
 
-    const uint32_t maxSpins = 30;
     uint32_t spins = 0;
+    uint64_t spinStartUs = 0;
     bool inLargeXfer = true;
 
     *(mContext.host_state) = ASG_HOST_STATE_CAN_CONSUME;
@@ -151,6 +186,14 @@ const unsigned char* RingStream::readRaw(void* buf, size_t* inout_len) {
         auto current = dst + count;
         auto ptrEnd = dst + wanted;
 
+        if (spins && (ringAvailable || ringLargeXferAvailable)) {
+            mStats.readSpinTimeUs +=
+                android::base::getHighResTimeUs() - spinStartUs;
+            updateSpinBudget(&mReadSpinBudget, true, spins,
+                             kMinReadSpins, kMaxReadSpins);
+            spins = 0;
+        }
+
         if (ringAvailable) {
             inLargeXfer = false;
             uint32_t transferMode =
@@ -188,13 +231,22 @@ const unsigned char* RingStream::readRaw(void* buf, size_t* inout_len) {
                 inLargeXfer = false;
             }
 
-            if (++spins < maxSpins) {
+            if (!spins) {
+                spinStartUs = android::base::getHighResTimeUs();
+            }
+            if (++spins < mReadSpinBudget) {
                 ring_buffer_yield();
                 continue;
-            } else {
-                spins = 0;
             }
 
+            // Spinning didn't pay off this time: wait for the guest, and
+            // spin less next time.
+            mStats.readSpinTimeUs +=
+                android::base::getHighResTimeUs() - spinStartUs;
+            updateSpinBudget(&mReadSpinBudget, false, spins,
+                             kMinReadSpins, kMaxReadSpins);
+            spins = 0;
+
             if (mShouldExit) {
                 return nullptr;
             }
@@ -203,6 +255,12 @@ const unsigned char* RingStream::readRaw(void* buf, size_t* inout_len) {
                 return nullptr;
             }
 
+            // Nothing was read by this call yet, so giving up is fine.
+            if (mOnIdleRead && mOnIdleRead()) {
+                return nullptr;
+            }
+
+            ++mStats.readWaits;
             int unavailReadResult = mCallbacks.onUnavailableRead();
 
             if (-1 == unavailReadResult) {
@@ -232,6 +290,33 @@ const unsigned char* RingStream::readRaw(void* buf, size_t* inout_len) {
     return (const unsigned char*)buf;
 }
 
+// static
+void RingStream::updateSpinBudget(uint32_t* budget, bool paidOff,
+                                  uint32_t spins, uint32_t minSpins,
+                                  uint32_t maxSpins) {
+    if (paidOff) {
+        // Leave some headroom over what it took this time.
+        *budget = std::min(maxSpins, std::max(*budget, spins * 2));
+    } else {
+        *budget = std::max(minSpins, *budget / 2);
+    }
+}
+
+void RingStream::printStats() {
+    printf("RingStream::%s: %zu xfers, %.1f bytes/xfer, "
+           "read spin %.3f ms (budget %u), %llu waits, "
+           "write spin %.3f ms (budget %u), %llu sleeps\n",
+           __func__, mXmits,
+           mXmits ? (double)mTotalRecv / mXmits : 0.0,
+           mStats.readSpinTimeUs / 1000.0, mReadSpinBudget,
+           (unsigned long long)mStats.readWaits,
+           mStats.writeSpinTimeUs / 1000.0, mWriteSpinBudget,
+           (unsigned long long)mStats.writeSleeps);
+    mXmits = 0;
+    mTotalRecv = 0;
+    mStats = Stats();
+}
+
 void RingStream::type1Read(
     uint32_t available,
     char* begin,
@@ -248,32 +333,106 @@ void RingStream::type1Read(
     ring_buffer_copy_contents(
         mContext.to_host, 0, xferTotal * sizeof(struct asg_type1_xfer), (uint8_t*)xfersPtr);
 
+    // Copy as many transfers as fit, then release them all at once. The guest
+    // reuses the shared buffer as soon as host_consumed_pos covers it, so it
+    // must only move past data that has been copied out.
+    uint32_t xfersDone = 0;
+    uint32_t bytesDone = 0;
     for (uint32_t i = 0; i < xferTotal; ++i) {
-        if (*current + xfersPtr[i].size > ptrEnd) {
+        // The head transfer may have been partially consumed in place.
+        const uint32_t skip = i == 0 ? mType1HeadConsumed : 0;
+        const char* src = mContext.buffer + xfersPtr[i].offset + skip;
+        const uint32_t size = xfersPtr[i].size - skip;
+        if (*current + size > ptrEnd) {
             // Save in a temp buffer or we'll get stuck
             if (begin == *current && i == 0) {
-                const char* src = mContext.buffer + xfersPtr[i].offset;
-                mReadBuffer.resize_noinit(xfersPtr[i].size);
-                memcpy(mReadBuffer.data(), src, xfersPtr[i].size);
-                mReadBufferLeft = xfersPtr[i].size;
-                ring_buffer_advance_read(
-                        mContext.to_host, sizeof(struct asg_type1_xfer), 1);
-                __atomic_fetch_add(&mContext.ring_config->host_consumed_pos, xfersPtr[i].size, __ATOMIC_RELEASE);
+                mReadBuffer.resize_noinit(size);
+                memcpy(mReadBuffer.data(), src, size);
+                mReadBufferLeft = size;
+                xfersDone = 1;
+                bytesDone = size;
             }
-            return;
+            break;
         }
-        const char* src = mContext.buffer + xfersPtr[i].offset;
-        memcpy(*current, src, xfersPtr[i].size);
-        ring_buffer_advance_read(
-                mContext.to_host, sizeof(struct asg_type1_xfer), 1);
-        __atomic_fetch_add(&mContext.ring_config->host_consumed_pos, xfersPtr[i].size, __ATOMIC_RELEASE);
-        *current += xfersPtr[i].size;
-        *count += xfersPtr[i].size;
+        memcpy(*current, src, size);
+        *current += size;
+        *count += size;
+        ++xfersDone;
+        bytesDone += size;
+    }
+
+    if (!xfersDone) {
+        return;
+    }
+    mType1HeadConsumed = 0;
+    ring_buffer_advance_read(
+            mContext.to_host, sizeof(struct asg_type1_xfer), xfersDone);
+    __atomic_fetch_add(&mContext.ring_config->host_consumed_pos, bytesDone, __ATOMIC_RELEASE);
+}
+
+bool RingStream::peekContiguous(char** data, size_t* size) {
+    if (mReadBufferLeft || mShouldExit ||
+        mContext.ring_config->transfer_mode != 1) {
+        return false;
+    }
+
+    uint32_t available = ring_buffer_available_read(mContext.to_host, 0);
+    uint32_t xferTotal = available / sizeof(struct asg_type1_xfer);
+    if (!xferTotal) {
+        return false;
+    }
+
+    if (mType1Xfers.size() < xferTotal) {
+        mType1Xfers.resize(xferTotal * 2);
+    }
+    auto xfersPtr = mType1Xfers.data();
+    ring_buffer_copy_contents(
+        mContext.to_host, 0, xferTotal * sizeof(struct asg_type1_xfer), (uint8_t*)xfersPtr);
+
+    size_t total = xfersPtr[0].size - mType1HeadConsumed;
+    uint32_t i = 1;
+    for (; i < xferTotal; ++i) {
+        if (xfersPtr[i].offset != xfersPtr[i - 1].offset + xfersPtr[i - 1].size) {
+            break;
+        }
+        total += xfersPtr[i].size;
+    }
+
+    mType1Peeked = i;
+    *data = mContext.buffer + xfersPtr[0].offset + mType1HeadConsumed;
+    *size = total;
+    return true;
+}
 
-        // TODO: Figure out why running multiple xfers here can result in data
-        // corruption.
+void RingStream::consumePeeked(size_t size) {
+    if (!size) {
         return;
     }
+
+    const auto xfersPtr = mType1Xfers.data();
+    uint32_t xfersDone = 0;
+    size_t left = size;
+    while (left && xfersDone < mType1Peeked) {
+        const uint32_t remaining = xfersPtr[xfersDone].size - mType1HeadConsumed;
+        if (left < remaining) {
+            mType1HeadConsumed += left;
+            left = 0;
+            break;
+        }
+        left -= remaining;
+        mType1HeadConsumed = 0;
+        ++xfersDone;
+    }
+    assert(!left);
+
+    mType1Peeked = 0;
+    if (xfersDone) {
+        ring_buffer_advance_read(
+                mContext.to_host, sizeof(struct asg_type1_xfer), xfersDone);
+    }
+    ++mXmits;
+    mTotalRecv += size;
+    __atomic_fetch_add(&mContext.ring_config->host_consumed_pos, size, __ATOMIC_RELEASE);
 }
 
 void RingStream::type2Read(
@@ -20,6 +20,7 @@
 #include "host-common/address_space_graphics_types.h"
 
 #include <functional>
+#include <utility>
 #include <vector>
 
 namespace emugl {
@@ -31,6 +32,7 @@ namespace emugl {
 class RingStream final : public IOStream {
 public:
     using OnUnavailableReadCallback = std::function<int()>;
+    using OnIdleReadCallback = std::function<bool()>;
     using GetPtrAndSizeCallback =
         std::function<void(uint64_t, char**, size_t*)>;
 
@@ -45,8 +47,23 @@ public:
     int writeFully(const void* buf, size_t len) override;
     const unsigned char *readFully( void *buf, size_t len) override;
 
+    // Prints the transfer and waiting statistics since the last call.
     void printStats();
 
+    // Zero-copy access to type 1 transfers. peekContiguous() returns the
+    // pending data at the head of the to host ring that sits contiguously in
+    // the shared buffer, without consuming it: the guest doesn't reuse that
+    // memory until consumePeeked() releases it. Returns false if there is no
+    // such data, e.g. because readRaw() already copied it out.
+    bool peekContiguous(char** data, size_t* size);
+    // Releases the first |size| bytes of the data from the last
+    // peekContiguous().
+    void consumePeeked(size_t size);
+
+    // |callback| is called before blocking to wait for the guest. Returning
+    // true gives up the read in progress, which then returns no data.
+    void setOnIdleRead(OnIdleReadCallback callback) { mOnIdleRead = std::move(callback); }
+
     void pausePreSnapshot() {
         mInSnapshotOperation = true;
     }
@@ -73,10 +90,21 @@ protected:
     void type2Read(uint32_t available, size_t* count, char** current, const char* ptrEnd);
     void type3Read(uint32_t available, size_t* count, char** current, const char* ptrEnd);
 
+    // Adapts a spin budget to whether the last spin ended with the ring ready
+    // (|paidOff|) after |spins| iterations, or had to give up and wait.
+    static void updateSpinBudget(uint32_t* budget, bool paidOff, uint32_t spins,
+                                 uint32_t minSpins, uint32_t maxSpins);
+
     struct asg_context mContext;
     android::emulation::asg::ConsumerCallbacks mCallbacks;
+    OnIdleReadCallback mOnIdleRead;
 
     std::vector<asg_type1_xfer> mType1Xfers;
+    // Bytes already consumed from the transfer at the head of the to host ring,
+    // when consumePeeked() released part of it.
+    uint32_t mType1HeadConsumed = 0;
+    // Number of transfers covered by the last peekContiguous().
+    uint32_t mType1Peeked = 0;
     std::vector<asg_type2_xfer> mType2Xfers;
 
     RenderChannel::Buffer mReadBuffer;
@@ -85,6 +113,24 @@ protected:
 
     size_t mXmits = 0;
     size_t mTotalRecv = 0;
+
+    // How many times to yield while the rings are empty (reads) or full
+    // (writes) before waiting. Learned per stream: idle guests quickly fall
+    // back to waiting, busy ones keep spinning as long as it pays off.
+    uint32_t mReadSpinBudget;
+    uint32_t mWriteSpinBudget;
+
+    struct Stats {
+        uint64_t readSpinTimeUs = 0;
+        uint64_t writeSpinTimeUs = 0;
+        // Calls to onUnavailableRead(), which eventually blocks until the
+        // guest notifies the host.
+        uint64_t readWaits = 0;
+        // Sleeps while the guest doesn't drain the from host ring.
+        uint64_t writeSleeps = 0;
+    };
+    Stats mStats;
+
     bool mBenchmarkEnabled = false;
     bool mShouldExit = false;
     bool mShouldExitForSnapshot = false;
@@ -0,0 +1,158 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "StreamCapture.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#include "aemu/base/files/PathUtils.h"
+#include "aemu/base/system/System.h"
+#include "host-common/logging.h"
+
+namespace emugl {
+namespace {
+
+constexpr char kMagic[8] = "GFXSCAP";
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = sizeof(kMagic) + 4 * sizeof(uint32_t) + sizeof(uint64_t);
+constexpr size_t kRecordHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+// Used to give each capture of this process a distinct file name.
+std::atomic<uint32_t> sCaptureIndex = 0;
+
+void putLe32(uint8_t* dst, uint32_t value) {
+    for (int i = 0; i < 4; ++i) dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+void putLe64(uint8_t* dst, uint64_t value) {
+    for (int i = 0; i < 8; ++i) dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint32_t getLe32(const uint8_t* src) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) value |= static_cast<uint32_t>(src[i]) << (8 * i);
+    return value;
+}
+
+uint64_t getLe64(const uint8_t* src) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) value |= static_cast<uint64_t>(src[i]) << (8 * i);
+    return value;
+}
+
+}  // namespace
+
+std::unique_ptr<StreamCaptureWriter> StreamCaptureWriter::create(const std::string& dir,
+                                                                 uint32_t contextId,
+                                                                 uint32_t capsetId) {
+    const std::string name = "stream_" + std::to_string(contextId) + "_" +
+                             std::to_string(sCaptureIndex++) + ".gfxcap";
+    const std::string path = android::base::pj({dir, name});
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        ERR("Failed to open stream capture file %s", path.c_str());
+        return nullptr;
+    }
+
+    const uint64_t startTimeUs = android::base::getHighResTimeUs();
+    uint8_t header[kHeaderSize];
+    memcpy(header, kMagic, sizeof(kMagic));
+    putLe32(header + 8, kVersion);
+    putLe32(header + 12, contextId);
+    putLe32(header + 16, capsetId);
+    putLe32(header + 20, 0);
+    putLe64(header + 24, startTimeUs);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        ERR("Failed to write stream capture header to %s", path.c_str());
+        fclose(file);
+        return nullptr;
+    }
+
+    INFO("Capturing render thread stream to %s", path.c_str());
+    return std::unique_ptr<StreamCaptureWriter>(new StreamCaptureWriter(file, path, startTimeUs));
+}
+
+StreamCaptureWriter::StreamCaptureWriter(FILE* file, std::string path, uint64_t startTimeUs)
+    : mFile(file), mPath(std::move(path)), mStartTimeUs(startTimeUs) {}
+
+StreamCaptureWriter::~StreamCaptureWriter() {
+    if (mFile) fclose(mFile);
+}
+
+void StreamCaptureWriter::write(const void* data, size_t size) {
+    if (!mFile || size == 0) return;
+
+    uint8_t recordHeader[kRecordHeaderSize];
+    putLe64(recordHeader, android::base::getHighResTimeUs() - mStartTimeUs);
+    putLe32(recordHeader + 8, static_cast<uint32_t>(size));
+
+    // Flush every record so that the capture survives the emulator crashing, which is often the
+    // very thing we want to reproduce.
+    if (fwrite(recordHeader, 1, sizeof(recordHeader), mFile) != sizeof(recordHeader) ||
+        fwrite(data, 1, size, mFile) != size || fflush(mFile) != 0) {
+        ERR("Failed to write to stream capture %s, stopping capture", mPath.c_str());
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+std::unique_ptr<StreamCaptureReader> StreamCaptureReader::open(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        ERR("Failed to open stream capture %s", path.c_str());
+        return nullptr;
+    }
+
+    uint8_t header[kHeaderSize];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+        ERR("%s is not a stream capture", path.c_str());
+        fclose(file);
+        return nullptr;
+    }
+
+    StreamCaptureHeader parsed = {
+        .version = getLe32(header + 8),
+        .contextId = getLe32(header + 12),
+        .capsetId = getLe32(header + 16),
+        .startTimeUs = getLe64(header + 24),
+    };
+    if (parsed.version != kVersion) {
+        ERR("Unsupported stream capture version %u in %s", parsed.version, path.c_str());
+        fclose(file);
+        return nullptr;
+    }
+
+    return std::unique_ptr<StreamCaptureReader>(new StreamCaptureReader(file, parsed));
+}
+
+StreamCaptureReader::StreamCaptureReader(FILE* file, const StreamCaptureHeader& header)
+    : mFile(file), mHeader(header) {}
+
+StreamCaptureReader::~StreamCaptureReader() { fclose(mFile); }
+
+bool StreamCaptureReader::next(StreamCaptureRecord* record) {
+    uint8_t recordHeader[kRecordHeaderSize];
+    if (fread(recordHeader, 1, sizeof(recordHeader), mFile) != sizeof(recordHeader)) {
+        return false;
+    }
+    record->timestampUs = getLe64(recordHeader);
+    record->data.resize(getLe32(recordHeader + 8));
+    return fread(record->data.data(), 1, record->data.size(), mFile) == record->data.size();
+}
+
+}  // namespace emugl
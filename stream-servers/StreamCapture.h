@@ -0,0 +1,91 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace emugl {
+
+// Captures of the raw byte stream received by a RenderThread, used to replay guest workloads
+// offline. Captures are enabled by setting RENDERER_DUMP_DIR to an existing directory.
+//
+// File layout (all integers little-endian):
+//   Header:
+//     char     magic[8]      "GFXSCAP"
+//     uint32_t version
+//     uint32_t contextId     virtio-gpu context id, or 0 for pipe based render threads
+//     uint32_t capsetId
+//     uint32_t reserved
+//     uint64_t startTimeUs   host time at which the capture started
+//   Followed by any number of records:
+//     uint64_t timestampUs   time at which the data was received, relative to startTimeUs
+//     uint32_t size
+//     uint8_t  data[size]    bytes exactly as they were appended to the ReadBuffer
+struct StreamCaptureHeader {
+    uint32_t version = 0;
+    uint32_t contextId = 0;
+    uint32_t capsetId = 0;
+    uint64_t startTimeUs = 0;
+};
+
+struct StreamCaptureRecord {
+    uint64_t timestampUs = 0;
+    std::vector<uint8_t> data;
+};
+
+class StreamCaptureWriter {
+   public:
+    // Creates a new capture file in |dir|. Returns nullptr if the file can't be created.
+    static std::unique_ptr<StreamCaptureWriter> create(const std::string& dir, uint32_t contextId,
+                                                       uint32_t capsetId);
+    ~StreamCaptureWriter();
+
+    const std::string& path() const { return mPath; }
+
+    // Appends a record with the current time. Stops capturing after the first write error.
+    void write(const void* data, size_t size);
+
+   private:
+    StreamCaptureWriter(FILE* file, std::string path, uint64_t startTimeUs);
+
+    FILE* mFile;
+    const std::string mPath;
+    const uint64_t mStartTimeUs;
+};
+
+class StreamCaptureReader {
+   public:
+    // Opens a capture file. Returns nullptr if it doesn't exist or isn't a capture.
+    static std::unique_ptr<StreamCaptureReader> open(const std::string& path);
+    ~StreamCaptureReader();
+
+    const StreamCaptureHeader& header() const { return mHeader; }
+
+    // Reads the next record into |record|. Returns false at the end of the capture. A truncated
+    // trailing record, e.g. from an emulator that crashed mid-write, is treated as the end.
+    bool next(StreamCaptureRecord* record);
+
+   private:
+    StreamCaptureReader(FILE* file, const StreamCaptureHeader& header);
+
+    FILE* mFile;
+    const StreamCaptureHeader mHeader;
+};
+
+}  // namespace emugl
@@ -28,6 +28,9 @@
 #ifndef _MSC_VER
 #include <sys/time.h>
 #endif
+#include <inttypes.h>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 using android::base::EventHangMetadata;
@@ -98,6 +101,19 @@ static GlobalSyncThread* sGlobalSyncThread() {
 
 static const uint32_t kTimelineInterval = 1;
 static const uint64_t kDefaultTimeoutNsecs = 5ULL * 1000ULL * 1000ULL * 1000ULL;
+static const uint64_t kDefaultTimeoutUs = kDefaultTimeoutNsecs / 1000ULL;
+// Neither eglClientWaitSyncKHR() nor vkWaitForFences() can be woken up from the
+// host, so the fence waits block this long at most to pick up new waits.
+static const uint64_t kFenceWaitSliceUs = 1000ULL;
+
+static size_t statsBucket(uint64_t value) {
+    size_t bucket = 0;
+    while (value && bucket < SyncThread::Stats::kNumBuckets - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
 
 SyncThread::SyncThread(bool noGL, HealthMonitor<>& healthMonitor)
     : android::base::Thread(android::base::ThreadFlags::MaskSignals, 512 * 1024),
@@ -107,11 +123,12 @@ SyncThread::SyncThread(bool noGL, HealthMonitor<>& healthMonitor)
                         }),
       mNoGL(noGL),
       mHealthMonitor(healthMonitor) {
-    this->start();
     mWorkerThreadPool.start();
     if (!noGL) {
         initSyncEGLContext();
     }
+    // The thread function uses |mDisplay|, so start it last.
+    this->start();
 }
 
 SyncThread::~SyncThread() {
@@ -120,31 +137,28 @@ SyncThread::~SyncThread() {
 
 void SyncThread::triggerWait(EmulatedEglFenceSync* fenceSync,
                              uint64_t timeline) {
-    std::stringstream ss;
-    ss << "triggerWait fenceSyncInfo=0x" << std::hex << reinterpret_cast<uintptr_t>(fenceSync)
-       << " timeline=0x" << std::hex << timeline;
-    sendAsync(
-        [fenceSync, timeline, this](WorkerId) {
-            doSyncWait(fenceSync, [timeline] {
+    DPRINT("triggerWait fenceSyncInfo=%p timeline=0x%llx", fenceSync,
+           (unsigned long long)timeline);
+    enqueueFenceWait(FenceWait{
+        .fenceSync = fenceSync,
+        .onComplete =
+            [timeline] {
                 DPRINT("wait done (with fence), use goldfish sync timeline inc");
                 emugl::emugl_sync_timeline_inc(timeline, kTimelineInterval);
-            });
-        },
-        ss.str());
+            },
+    });
 }
 
 void SyncThread::triggerWaitVk(VkFence vkFence, uint64_t timeline) {
-    std::stringstream ss;
-    ss << "triggerWaitVk vkFence=0x" << std::hex << reinterpret_cast<uintptr_t>(vkFence)
-       << " timeline=0x" << std::hex << timeline;
-    sendAsync(
-        [vkFence, timeline](WorkerId) {
-            doSyncWaitVk(vkFence, [timeline] {
+    DPRINT("triggerWaitVk vkFence=%p timeline=0x%llx", vkFence, (unsigned long long)timeline);
+    enqueueFenceWait(FenceWait{
+        .vkFence = vkFence,
+        .onComplete =
+            [timeline] {
                 DPRINT("vk wait done, use goldfish sync timeline inc");
                 emugl::emugl_sync_timeline_inc(timeline, kTimelineInterval);
-            });
-        },
-        ss.str());
+            },
+    });
 }
 
 void SyncThread::triggerBlockedWaitNoTimeline(EmulatedEglFenceSync* fenceSync) {
@@ -160,21 +174,20 @@ void SyncThread::triggerBlockedWaitNoTimeline(EmulatedEglFenceSync* fenceSync) {
 }
 
 void SyncThread::triggerWaitWithCompletionCallback(EmulatedEglFenceSync* fenceSync, FenceCompletionCallback cb) {
-    std::stringstream ss;
-    ss << "triggerWaitWithCompletionCallback fenceSyncInfo=0x" << std::hex
-       << reinterpret_cast<uintptr_t>(fenceSync);
-    sendAsync(
-        [fenceSync, cb = std::move(cb), this](WorkerId) { doSyncWait(fenceSync, std::move(cb)); },
-        ss.str());
+    DPRINT("triggerWaitWithCompletionCallback fenceSyncInfo=%p", fenceSync);
+    enqueueFenceWait(FenceWait{
+        .fenceSync = fenceSync,
+        .onComplete = std::move(cb),
+    });
 }
 
 
 void SyncThread::triggerWaitVkWithCompletionCallback(VkFence vkFence, FenceCompletionCallback cb) {
-    std::stringstream ss;
-    ss << "triggerWaitVkWithCompletionCallback vkFence=0x" << std::hex
-       << reinterpret_cast<uintptr_t>(vkFence);
-    sendAsync([vkFence, cb = std::move(cb)](WorkerId) { doSyncWaitVk(vkFence, std::move(cb)); },
-              ss.str());
+    DPRINT("triggerWaitVkWithCompletionCallback vkFence=%p", vkFence);
+    enqueueFenceWait(FenceWait{
+        .vkFence = vkFence,
+        .onComplete = std::move(cb),
+    });
 }
 
 void SyncThread::triggerWaitVkQsriWithCompletionCallback(VkImage vkImage, FenceCompletionCallback cb) {
@@ -200,18 +213,36 @@ void SyncThread::triggerGeneral(FenceCompletionCallback cb, std::string descript
     sendAsync(std::bind(std::move(cb)), ss.str());
 }
 
+SyncThread::Stats SyncThread::getStats() {
+    android::base::AutoLock lock(mLock);
+    return mStats;
+}
+
+/* static */
+uint64_t SyncThread::Stats::percentile(const Histogram& histogram, uint32_t percent) {
+    uint64_t total = 0;
+    for (uint64_t count : histogram) {
+        total += count;
+    }
+    uint64_t count = 0;
+    size_t bucket = 0;
+    for (; bucket < kNumBuckets; ++bucket) {
+        count += histogram[bucket];
+        if (count * 100 >= total * percent) {
+            break;
+        }
+    }
+    if (bucket >= kNumBuckets - 1) {
+        return UINT64_MAX;
+    }
+    return (1ULL << bucket) - 1;
+}
+
 void SyncThread::cleanup() {
     sendAndWaitForResult(
         [this](WorkerId workerId) {
             if (!mNoGL) {
-                const EGLDispatch* egl = emugl::LazyLoadedEGLDispatch::get();
-
-                egl->eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-
-                egl->eglDestroyContext(mDisplay, mContext[workerId]);
-                egl->eglDestroySurface(mDisplay, mSurface[workerId]);
-                mContext[workerId] = EGL_NO_CONTEXT;
-                mSurface[workerId] = EGL_NO_SURFACE;
+                destroySyncEGLContext(workerId);
             }
             return 0;
         },
@@ -219,6 +250,7 @@ void SyncThread::cleanup() {
     DPRINT("signal");
     mLock.lock();
     mExiting = true;
+    mVkCv.broadcast();
     mCv.signalAndUnlock(&mLock);
     DPRINT("exit");
     // Wait for the control thread to exit. We can't destroy the SyncThread
@@ -226,21 +258,251 @@ void SyncThread::cleanup() {
     if (!wait(nullptr)) {
         ERR("Fail to wait the control thread of the SyncThread to exit.");
     }
+    // The Vulkan fence waiter isn't started once |mExiting| is set.
+    std::thread vkFenceWaiter;
+    {
+        android::base::AutoLock lock(mLock);
+        vkFenceWaiter.swap(mVkFenceWaiter);
+    }
+    if (vkFenceWaiter.joinable()) {
+        vkFenceWaiter.join();
+    }
+
+    const Stats stats = getStats();
+    uint64_t numFenceWaits = 0;
+    for (uint64_t count : stats.waitLatencyUs) {
+        numFenceWaits += count;
+    }
+    INFO("SyncThread fence waits: %" PRIu64 ", timed out: %" PRIu64 ", latency p50 <= %" PRIu64
+         " us, p99 <= %" PRIu64 " us, outstanding waits p99 <= %" PRIu64,
+         numFenceWaits, stats.timeouts, Stats::percentile(stats.waitLatencyUs, 50),
+         Stats::percentile(stats.waitLatencyUs, 99), Stats::percentile(stats.queueDepth, 99));
 }
 
 // Private methods below////////////////////////////////////////////////////////
 
 intptr_t SyncThread::main() {
     DPRINT("in sync thread");
-    mLock.lock();
-    mCv.wait(&mLock, [this] { return mExiting; });
+    if (!mNoGL) {
+        createSyncEGLContext(kFenceWaiterContextIndex);
+    }
+
+    std::vector<FenceWait> waits;
+    std::vector<FenceWait> completed;
+    bool exiting = false;
+    while (!exiting) {
+        {
+            android::base::AutoLock lock(mLock);
+            if (waits.empty()) {
+                mCv.wait(&lock, [this] { return mExiting || !mNewFenceWaits.empty(); });
+            }
+            exiting = mExiting;
+            for (auto& wait : mNewFenceWaits) {
+                waits.push_back(std::move(wait));
+            }
+            mNewFenceWaits.clear();
+        }
+
+        if (exiting) {
+            // Nobody is left to care about the fences, but the guest may still
+            // wait for the callbacks.
+            completed.insert(completed.end(), std::make_move_iterator(waits.begin()),
+                             std::make_move_iterator(waits.end()));
+            waits.clear();
+        } else {
+            waitForGlFences(&waits, &completed);
+        }
+        completeFenceWaits(&completed);
+    }
 
+    if (!mNoGL) {
+        destroySyncEGLContext(kFenceWaiterContextIndex);
+    }
     mWorkerThreadPool.done();
     mWorkerThreadPool.join();
     DPRINT("exited sync thread");
     return 0;
 }
 
+void SyncThread::vkFenceWaiterMain() {
+    std::vector<FenceWait> waits;
+    std::vector<FenceWait> completed;
+    bool exiting = false;
+    bool submitted = true;
+    while (!exiting) {
+        {
+            android::base::AutoLock lock(mLock);
+            if (waits.empty()) {
+                mVkCv.wait(&lock, [this] { return mExiting || !mNewVkFenceWaits.empty(); });
+            } else if (!submitted && !mExiting && mNewVkFenceWaits.empty()) {
+                // Nothing to block on until the guest submits the fences.
+                mVkCv.timedWait(&mLock, android::base::getUnixTimeUs() + kFenceWaitSliceUs);
+            }
+            exiting = mExiting;
+            for (auto& wait : mNewVkFenceWaits) {
+                waits.push_back(std::move(wait));
+            }
+            mNewVkFenceWaits.clear();
+        }
+
+        // As in |main|, the waits left over at exit complete right away.
+        if (exiting) {
+            completed.insert(completed.end(), std::make_move_iterator(waits.begin()),
+                             std::make_move_iterator(waits.end()));
+            waits.clear();
+        } else {
+            submitted = waitForVkFences(&waits, &completed);
+        }
+        completeFenceWaits(&completed);
+    }
+}
+
+void SyncThread::enqueueFenceWait(FenceWait wait) {
+    wait.triggerTimeUs = android::base::getHighResTimeUs();
+    wait.deadlineUs = wait.triggerTimeUs + kDefaultTimeoutUs;
+
+    android::base::AutoLock lock(mLock);
+    if (mExiting) {
+        lock.unlock();
+        // The thread function may be gone already.
+        if (wait.onComplete) {
+            wait.onComplete();
+        }
+        return;
+    }
+    mStats.queueDepth[statsBucket(++mNumPendingFenceWaits)]++;
+    if (wait.fenceSync) {
+        mNewFenceWaits.push_back(std::move(wait));
+        mCv.signalAndUnlock(&lock);
+        return;
+    }
+
+    mNewVkFenceWaits.push_back(std::move(wait));
+    if (!mVkFenceWaiter.joinable()) {
+        mVkFenceWaiter = std::thread([this] { vkFenceWaiterMain(); });
+    }
+    mVkCv.signalAndUnlock(&lock);
+}
+
+void SyncThread::waitForGlFences(std::vector<FenceWait>* waits,
+                                 std::vector<FenceWait>* completed) {
+    // The syncs of a context are signaled in order, so blocking on the oldest
+    // one only is enough for those of its context. The slice keeps it from
+    // holding up the syncs of other contexts.
+    std::vector<FenceWait> pending;
+    uint64_t numTimeouts = 0;
+    bool blocked = false;
+    for (auto& wait : *waits) {
+        if (!EmulatedEglFenceSync::getFromHandle((uint64_t)(uintptr_t)wait.fenceSync)) {
+            wait.fenceSync = nullptr;
+            completed->push_back(std::move(wait));
+            continue;
+        }
+        // We shouldn't use EmulatedEglFenceSync to wait, when SyncThread is initialized
+        // without GL enabled, because EmulatedEglFenceSync uses EGL/GLES.
+        SYNC_THREAD_CHECK(!mNoGL);
+
+        const uint64_t now = android::base::getHighResTimeUs();
+        const uint64_t timeoutUs = wait.deadlineUs > now ? wait.deadlineUs - now : 0;
+        const uint64_t waitUs = blocked ? 0 : std::min(timeoutUs, kFenceWaitSliceUs);
+        blocked = true;
+        // As in |doSyncWait|, errors complete the wait.
+        const EGLint waitResult = wait.fenceSync->wait(waitUs * 1000ULL);
+        if (waitResult != EGL_TIMEOUT_EXPIRED_KHR) {
+            completed->push_back(std::move(wait));
+        } else if (android::base::getHighResTimeUs() >= wait.deadlineUs) {
+            DPRINT("fence wait timeout: fenceSync=%p", wait.fenceSync);
+            ++numTimeouts;
+            completed->push_back(std::move(wait));
+        } else {
+            pending.push_back(std::move(wait));
+        }
+    }
+    waits->swap(pending);
+
+    if (numTimeouts) {
+        android::base::AutoLock lock(mLock);
+        mStats.timeouts += numTimeouts;
+    }
+}
+
+bool SyncThread::waitForVkFences(std::vector<FenceWait>* waits,
+                                 std::vector<FenceWait>* completed) {
+    const uint64_t now = android::base::getHighResTimeUs();
+    uint64_t timeoutUs = kFenceWaitSliceUs;
+    std::vector<VkFence> fences;
+    fences.reserve(waits->size());
+    for (const auto& wait : *waits) {
+        fences.push_back(wait.vkFence);
+        timeoutUs = std::min(timeoutUs, wait.deadlineUs > now ? wait.deadlineUs - now : 0);
+    }
+
+    // This also checks whether the guest has submitted the fences.
+    std::vector<VkBool32> waitCompleted(waits->size(), VK_FALSE);
+    const VkResult result = goldfish_vk::VkDecoderGlobalState::get()->waitForAnyFence(
+        static_cast<uint32_t>(fences.size()), fences.data(), timeoutUs * 1000ULL,
+        waitCompleted.data());
+    if (result != VK_SUCCESS && result != VK_TIMEOUT && result != VK_NOT_READY) {
+        DPRINT("SYNC_WAIT_VK error: %d", result);
+    }
+
+    // We always unconditionally complete the waits that are over, even if
+    // vkWaitForFences returned abnormally. See comments in |doSyncWait| about
+    // the rationale.
+    std::vector<FenceWait> pending;
+    uint64_t numTimeouts = 0;
+    const uint64_t end = android::base::getHighResTimeUs();
+    for (size_t i = 0; i < waits->size(); ++i) {
+        FenceWait& wait = (*waits)[i];
+        if (waitCompleted[i]) {
+            completed->push_back(std::move(wait));
+        } else if (end >= wait.deadlineUs) {
+            DPRINT("fence wait timeout: vkFence=%p", wait.vkFence);
+            ++numTimeouts;
+            completed->push_back(std::move(wait));
+        } else {
+            pending.push_back(std::move(wait));
+        }
+    }
+    waits->swap(pending);
+
+    if (numTimeouts) {
+        android::base::AutoLock lock(mLock);
+        mStats.timeouts += numTimeouts;
+    }
+    return result != VK_NOT_READY;
+}
+
+void SyncThread::completeFenceWaits(std::vector<FenceWait>* completed) {
+    if (completed->empty()) {
+        return;
+    }
+
+    auto watchdog = WATCHDOG_BUILDER(mHealthMonitor, "SyncThread fence wait completion")
+                        .setHangType(EventHangMetadata::HangType::kSyncThread)
+                        .build();
+    const uint64_t now = android::base::getHighResTimeUs();
+    {
+        android::base::AutoLock lock(mLock);
+        for (const auto& wait : *completed) {
+            mStats.waitLatencyUs[statsBucket(now - wait.triggerTimeUs)]++;
+        }
+        mNumPendingFenceWaits -= completed->size();
+    }
+
+    for (auto& wait : *completed) {
+        // See comments in |doSyncWait| about why the callback runs even if the
+        // fence is not signaled.
+        if (wait.onComplete) {
+            wait.onComplete();
+        }
+        if (wait.fenceSync) {
+            EmulatedEglFenceSync::incrementTimelineAndDeleteOldFences();
+        }
+    }
+    completed->clear();
+}
+
 int SyncThread::sendAndWaitForResult(std::function<int(WorkerId)> job, std::string description) {
     DPRINT("sendAndWaitForResult task(%s)", description.c_str());
     std::packaged_task<int(WorkerId)> task(std::move(job));
@@ -285,47 +547,7 @@ void SyncThread::initSyncEGLContext() {
         return Command{
             .mTask = std::packaged_task<int(WorkerId)>([this](WorkerId workerId) {
                 DPRINT("for worker id: %d", workerId);
-                // We shouldn't initialize EGL context, when SyncThread is initialized
-                // without GL enabled.
-                SYNC_THREAD_CHECK(!mNoGL);
-
-                const EGLDispatch* egl = emugl::LazyLoadedEGLDispatch::get();
-
-                mDisplay = egl->eglGetDisplay(EGL_DEFAULT_DISPLAY);
-                int eglMaj, eglMin;
-                egl->eglInitialize(mDisplay, &eglMaj, &eglMin);
-
-                const EGLint configAttribs[] = {
-                    EGL_SURFACE_TYPE,
-                    EGL_PBUFFER_BIT,
-                    EGL_RENDERABLE_TYPE,
-                    EGL_OPENGL_ES2_BIT,
-                    EGL_RED_SIZE,
-                    8,
-                    EGL_GREEN_SIZE,
-                    8,
-                    EGL_BLUE_SIZE,
-                    8,
-                    EGL_NONE,
-                };
-
-                EGLint nConfigs;
-                EGLConfig config;
-
-                egl->eglChooseConfig(mDisplay, configAttribs, &config, 1, &nConfigs);
-
-                const EGLint pbufferAttribs[] = {
-                    EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
-                };
-
-                mSurface[workerId] = egl->eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
-
-                const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
-                mContext[workerId] =
-                    egl->eglCreateContext(mDisplay, config, EGL_NO_CONTEXT, contextAttribs);
-
-                egl->eglMakeCurrent(mDisplay, mSurface[workerId], mSurface[workerId],
-                                    mContext[workerId]);
+                createSyncEGLContext(workerId);
                 return 0;
             }),
             .mDescription = "init sync EGL context",
@@ -334,6 +556,59 @@ void SyncThread::initSyncEGLContext() {
     mWorkerThreadPool.waitAllItems();
 }
 
+void SyncThread::createSyncEGLContext(uint32_t index) {
+    // We shouldn't initialize EGL context, when SyncThread is initialized
+    // without GL enabled.
+    SYNC_THREAD_CHECK(!mNoGL);
+
+    const EGLDispatch* egl = emugl::LazyLoadedEGLDispatch::get();
+
+    mDisplay = egl->eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    int eglMaj, eglMin;
+    egl->eglInitialize(mDisplay, &eglMaj, &eglMin);
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE,
+        EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE,
+        EGL_OPENGL_ES2_BIT,
+        EGL_RED_SIZE,
+        8,
+        EGL_GREEN_SIZE,
+        8,
+        EGL_BLUE_SIZE,
+        8,
+        EGL_NONE,
+    };
+
+    EGLint nConfigs;
+    EGLConfig config;
+
+    egl->eglChooseConfig(mDisplay, configAttribs, &config, 1, &nConfigs);
+
+    const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
+    };
+
+    mSurface[index] = egl->eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+
+    const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+    mContext[index] = egl->eglCreateContext(mDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+
+    egl->eglMakeCurrent(mDisplay, mSurface[index], mSurface[index], mContext[index]);
+}
+
+void SyncThread::destroySyncEGLContext(uint32_t index) {
+    const EGLDispatch* egl = emugl::LazyLoadedEGLDispatch::get();
+
+    egl->eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+    egl->eglDestroyContext(mDisplay, mContext[index]);
+    egl->eglDestroySurface(mDisplay, mSurface[index]);
+    mContext[index] = EGL_NO_CONTEXT;
+    mSurface[index] = EGL_NO_SURFACE;
+}
+
 void SyncThread::doSyncWait(EmulatedEglFenceSync* fenceSync, std::function<void()> onComplete) {
     DPRINT("enter");
 
@@ -399,32 +674,6 @@ void SyncThread::doSyncWait(EmulatedEglFenceSync* fenceSync, std::function<void(
     DPRINT("exit");
 }
 
-int SyncThread::doSyncWaitVk(VkFence vkFence, std::function<void()> onComplete) {
-    DPRINT("enter");
-
-    auto decoder = goldfish_vk::VkDecoderGlobalState::get();
-    auto result = decoder->waitForFence(vkFence, kDefaultTimeoutNsecs);
-    if (result == VK_TIMEOUT) {
-        DPRINT("SYNC_WAIT_VK timeout: vkFence=%p", vkFence);
-    } else if (result != VK_SUCCESS) {
-        DPRINT("SYNC_WAIT_VK error: %d vkFence=%p", result, vkFence);
-    }
-
-    DPRINT("issue timeline increment");
-
-    // We always unconditionally increment timeline at this point, even
-    // if the call to vkWaitForFences returned abnormally.
-    // See comments in |doSyncWait| about the rationale.
-    if (onComplete) {
-        onComplete();
-    }
-
-    DPRINT("done timeline increment");
-
-    DPRINT("exit");
-    return result;
-}
-
 /* static */
 SyncThread* SyncThread::get() {
     auto res = sGlobalSyncThread()->syncThreadPtr();
@@ -20,10 +20,13 @@
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <array>
 #include <functional>
 #include <future>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 #include "aemu/base/synchronization/ConditionVariable.h"
 #include "aemu/base/HealthMonitor.h"
@@ -42,6 +45,11 @@ using emugl::HealthWatchdog;
 // SyncThread///////////////////////////////////////////////////////////////////
 // The purpose of SyncThread is to track sync device timelines and give out +
 // signal FD's that correspond to the completion of host-side GL fence commands.
+//
+// Fence waits don't occupy a worker each, so that slow fences of one guest
+// process can't hold up the fences of others or the general tasks: the thread
+// itself (see |main|) waits for all outstanding GL fences, and the Vulkan fence
+// waiter thread (see |vkFenceWaiterMain|) for all outstanding Vulkan fences at once.
 
 struct RenderThreadInfo;
 class SyncThread : public android::base::Thread {
@@ -98,6 +106,26 @@ class SyncThread : public android::base::Thread {
     // Destroys and cleanup the global sync thread.
     static void destroy();
 
+    // Fence wait statistics since startup. |cleanup| logs a summary.
+    struct Stats {
+        // Log2 histograms: bucket 0 counts zeros, bucket i counts values in
+        // [2^(i-1), 2^i), and the last bucket counts everything above too.
+        static constexpr size_t kNumBuckets = 24;
+        using Histogram = std::array<uint64_t, kNumBuckets>;
+
+        // Number of outstanding fence waits, sampled whenever a wait is triggered.
+        Histogram queueDepth = {};
+        // Time from triggering a fence wait to running its completion callback.
+        Histogram waitLatencyUs = {};
+        // Waits completed because the fence was not signaled in time.
+        uint64_t timeouts = 0;
+
+        // An upper bound of the values in the lowest |percent| percent of
+        // |histogram|, or UINT64_MAX if some of them are in the last bucket.
+        static uint64_t percentile(const Histogram& histogram, uint32_t percent);
+    };
+    Stats getStats();
+
    private:
     using WorkerId = android::base::ThreadPoolWorkerId;
     struct Command {
@@ -112,10 +140,47 @@ class SyncThread : public android::base::Thread {
     // - Triggers a |SyncThreadCmd| with op code |SYNC_THREAD_EGL_INIT|
     void initSyncEGLContext();
 
+    // A fence wait handed over to the thread function. Exactly one of
+    // |fenceSync| and |vkFence| is set.
+    struct FenceWait {
+        gfxstream::EmulatedEglFenceSync* fenceSync = nullptr;
+        VkFence vkFence = VK_NULL_HANDLE;
+        std::function<void()> onComplete;
+        uint64_t triggerTimeUs = 0;
+        // When to give up on the fence, whether the guest has submitted it by
+        // then or not.
+        uint64_t deadlineUs = 0;
+    };
+
     // Thread function.
-    // It keeps the workers runner until |mExiting| is set.
+    // It waits for the GL fences of |triggerWait*| calls until |mExiting| is
+    // set, and keeps the workers running meanwhile.
     virtual intptr_t main() override final;
 
+    // Thread function of the Vulkan fence waiter.
+    // It waits for the Vulkan fences of |triggerWaitVk*| calls, all at once,
+    // until |mExiting| is set.
+    void vkFenceWaiterMain();
+
+    // Hands |wait| over to the thread function or the Vulkan fence waiter,
+    // starting the latter on the first Vulkan wait.
+    void enqueueFenceWait(FenceWait wait);
+
+    // Block on the fences of |waits| for a short slice at most, so that new
+    // waits are picked up in between, and move the waits that are over to
+    // |completed|. EGL can't wait for several syncs at once, so
+    // |waitForGlFences| blocks on the oldest GL fence and then checks the
+    // others. |waitForVkFences| returns false without blocking if the guest
+    // hasn't submitted any of the Vulkan fences yet.
+    void waitForGlFences(std::vector<FenceWait>* waits, std::vector<FenceWait>* completed);
+    bool waitForVkFences(std::vector<FenceWait>* waits, std::vector<FenceWait>* completed);
+    void completeFenceWaits(std::vector<FenceWait>* completed);
+
+    // Creates the EGL context used to wait on EmulatedEglFenceSync objects by
+    // the worker or thread function with the given context index.
+    void createSyncEGLContext(uint32_t index);
+    void destroySyncEGLContext(uint32_t index);
+
     // These two functions are used to communicate with the sync thread from another thread:
     // - |sendAndWaitForResult| issues |job| to the sync thread, and blocks until it receives the
     // result of the job.
@@ -129,19 +194,29 @@ class SyncThread : public android::base::Thread {
 
     void doSyncWait(gfxstream::EmulatedEglFenceSync* fenceSync,
                     std::function<void()> onComplete);
-    static int doSyncWaitVk(VkFence, std::function<void()> onComplete);
 
     // EGL objects / object handles specific to
     // a sync thread.
     static const uint32_t kNumWorkerThreads = 4u;
+    // The thread function has a context of its own, after the workers' ones.
+    static const uint32_t kFenceWaiterContextIndex = kNumWorkerThreads;
 
     EGLDisplay mDisplay = EGL_NO_DISPLAY;
-    EGLSurface mSurface[kNumWorkerThreads];
-    EGLContext mContext[kNumWorkerThreads];
+    EGLSurface mSurface[kNumWorkerThreads + 1];
+    EGLContext mContext[kNumWorkerThreads + 1];
 
     bool mExiting = false;
     android::base::Lock mLock;
     android::base::ConditionVariable mCv;
+    android::base::ConditionVariable mVkCv;
+    // GL waits not picked up by the thread function yet, Vulkan waits not
+    // picked up by the Vulkan fence waiter yet, and the number of waits not
+    // completed yet. Guarded by |mLock|, as are the waiter and |mStats|.
+    std::vector<FenceWait> mNewFenceWaits;
+    std::vector<FenceWait> mNewVkFenceWaits;
+    size_t mNumPendingFenceWaits = 0;
+    std::thread mVkFenceWaiter;
+    Stats mStats;
     ThreadPool mWorkerThreadPool;
     bool mNoGL;
 
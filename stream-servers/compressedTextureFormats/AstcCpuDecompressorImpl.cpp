@@ -12,9 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <array>
+#include <algorithm>
 #include <future>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "AstcCpuDecompressor.h"
 #include "astcenc.h"
@@ -22,7 +24,16 @@
 namespace goldfish_vk {
 namespace {
 
-constexpr uint32_t kNumThreads = 2;
+// Bounds for the number of threads used to decompress a single image. Each thread needs its own
+// scratch space in every astcenc_context, so we don't want to scale up indefinitely.
+constexpr uint32_t kMinNumThreads = 2;
+constexpr uint32_t kMaxNumThreads = 8;
+
+// Returns how many worker threads to use, based on the number of cores of the machine. We leave
+// half of the cores to the rest of the emulator (vCPUs, render threads, etc).
+uint32_t getNumWorkerThreads() {
+    return std::clamp(std::thread::hardware_concurrency() / 2, kMinNumThreads, kMaxNumThreads);
+}
 
 const astcenc_swizzle kSwizzle = {ASTCENC_SWZ_R, ASTCENC_SWZ_G, ASTCENC_SWZ_B, ASTCENC_SWZ_A};
 
@@ -36,10 +47,11 @@ using AstcencContextUniquePtr = std::unique_ptr<astcenc_context, AstcencContextD
 // Creates a new astcenc_context and wraps it in a smart pointer.
 // It is not needed to call astcenc_context_free() on the returned pointer.
 // blockWith, blockSize: ASTC block size for the context
+// numThreads: how many threads will call astcenc_decompress_image() concurrently with this context
 // Error: (output param) Where to put the error status. Must not be null.
 // Returns nullptr in case of error.
 AstcencContextUniquePtr makeDecoderContext(uint32_t blockWidth, uint32_t blockHeight,
-                                           astcenc_error* error) {
+                                           uint32_t numThreads, astcenc_error* error) {
     astcenc_config config = {};
     *error =
         // TODO(gregschlom): Do we need to pass ASTCENC_PRF_LDR_SRGB here?
@@ -50,7 +62,7 @@ AstcencContextUniquePtr makeDecoderContext(uint32_t blockWidth, uint32_t blockHe
     }
 
     astcenc_context* context;
-    *error = astcenc_context_alloc(&config, kNumThreads, &context);
+    *error = astcenc_context_alloc(&config, numThreads, &context);
     if (*error != ASTCENC_SUCCESS) {
         return nullptr;
     }
@@ -63,7 +75,7 @@ AstcencContextUniquePtr makeDecoderContext(uint32_t blockWidth, uint32_t blockHe
 bool isAstcDecoderAvailable() {
     astcenc_error error;
     // Try getting an arbitrary context. If it works, the decoder is available.
-    auto context = makeDecoderContext(5, 5, &error);
+    auto context = makeDecoderContext(5, 5, 1, &error);
     return context != nullptr;
 }
 
@@ -82,13 +94,15 @@ bool isAstcDecoderAvailable() {
 // Thread-safety: not thread safe.
 class AstcDecoderContextCache {
    public:
+    explicit AstcDecoderContextCache(uint32_t numThreads) : mNumThreads(numThreads) {}
+
     // Returns a context object for a given ASTC block size, along with the error code if the
     // context initialization failed.
     // In this case, the context will be null, and the status code will be non-zero.
     std::pair<astcenc_context*, astcenc_error> get(uint32_t blockWidth, uint32_t blockHeight) {
         Value& value = mContexts[{blockWidth, blockHeight}];
         if (value.context == nullptr) {
-            value.context = makeDecoderContext(blockWidth, blockHeight, &value.error);
+            value.context = makeDecoderContext(blockWidth, blockHeight, mNumThreads, &value.error);
         }
         return {value.context.get(), value.error};
     }
@@ -117,6 +131,7 @@ class AstcDecoderContextCache {
         }
     };
 
+    const uint32_t mNumThreads;
     std::unordered_map<Key, Value, KeyHash> mContexts;
 };
 
@@ -173,14 +188,21 @@ class WorkerThread {
 class AstcCpuDecompressorImpl : public AstcCpuDecompressor {
    public:
     AstcCpuDecompressorImpl()
-        : AstcCpuDecompressor(), mContextCache(std::make_unique<AstcDecoderContextCache>()) {}
+        : AstcCpuDecompressor(),
+          mNumThreads(getNumWorkerThreads()),
+          mContextCache(std::make_unique<AstcDecoderContextCache>(mNumThreads)) {
+        mWorkerThreads.reserve(mNumThreads);
+        for (uint32_t i = 0; i < mNumThreads; ++i) {
+            mWorkerThreads.push_back(std::make_unique<WorkerThread>());
+        }
+    }
 
     ~AstcCpuDecompressorImpl() override {
         // Stop the worker threads, otherwise the process would hang upon exit.
         std::lock_guard global_lock(mMutex);
         for (auto& worker : mWorkerThreads) {
-            worker.terminate();
-            worker.wait();
+            worker->terminate();
+            worker->wait();
         }
     }
 
@@ -192,7 +214,7 @@ class AstcCpuDecompressorImpl : public AstcCpuDecompressor {
     int32_t decompress(const uint32_t imgWidth, const uint32_t imgHeight, const uint32_t blockWidth,
                        const uint32_t blockHeight, const uint8_t* astcData, size_t astcDataLength,
                        uint8_t* output) override {
-        std::array<std::future<astcenc_error>, kNumThreads> futures;
+        std::vector<std::future<astcenc_error>> futures(mNumThreads);
 
         std::lock_guard global_lock(mMutex);
 
@@ -207,8 +229,9 @@ class AstcCpuDecompressorImpl : public AstcCpuDecompressor {
             .data = reinterpret_cast<void**>(&output),
         };
 
-        for (uint32_t i = 0; i < kNumThreads; ++i) {
-            futures[i] = mWorkerThreads[i].decompress(context, i, astcData, astcDataLength, &image);
+        for (uint32_t i = 0; i < mNumThreads; ++i) {
+            futures[i] =
+                mWorkerThreads[i]->decompress(context, i, astcData, astcDataLength, &image);
         }
 
         astcenc_error result = ASTCENC_SUCCESS;
@@ -232,9 +255,10 @@ class AstcCpuDecompressorImpl : public AstcCpuDecompressor {
     }
 
    private:
+    const uint32_t mNumThreads;
     std::unique_ptr<AstcDecoderContextCache> mContextCache;
     std::mutex mMutex;  // Locked while calling `decompress()`
-    std::array<WorkerThread, kNumThreads> mWorkerThreads;
+    std::vector<std::unique_ptr<WorkerThread>> mWorkerThreads;
 };
 
 }  // namespace
@@ -14,6 +14,9 @@
 
 #include <gmock/gmock.h>
 
+#include <thread>
+#include <vector>
+
 #include "AstcCpuDecompressor.h"
 
 namespace goldfish_vk {
@@ -68,6 +71,34 @@ TEST(AstcCpuDecompressor, Decompress) {
     ASSERT_THAT(output, ElementsAreArray(expected));
 }
 
+TEST(AstcCpuDecompressor, DecompressFromMultipleThreads) {
+    auto& decompressor = AstcCpuDecompressor::get();
+    if (!decompressor.available()) GTEST_SKIP() << "ASTC decompressor not available";
+
+    std::vector<Rgba> expected(16 * 16);
+    ASSERT_EQ(decompressor.decompress(16, 16, 8, 8, kCheckerboard, sizeof(kCheckerboard),
+                                      (uint8_t*)expected.data()),
+              0);
+
+    constexpr int kNumCallers = 4;
+    std::vector<std::vector<Rgba>> outputs(kNumCallers, std::vector<Rgba>(16 * 16));
+    std::vector<int32_t> statuses(kNumCallers, -1);
+    std::vector<std::thread> callers;
+    for (int i = 0; i < kNumCallers; ++i) {
+        callers.emplace_back([&, i] {
+            statuses[i] = decompressor.decompress(16, 16, 8, 8, kCheckerboard,
+                                                  sizeof(kCheckerboard),
+                                                  (uint8_t*)outputs[i].data());
+        });
+    }
+    for (auto& caller : callers) caller.join();
+
+    for (int i = 0; i < kNumCallers; ++i) {
+        EXPECT_EQ(statuses[i], 0);
+        EXPECT_THAT(outputs[i], ElementsAreArray(expected));
+    }
+}
+
 TEST(AstcCpuDecompressor, getStatusStringAlwaysNonNull) {
     EXPECT_THAT(AstcCpuDecompressor::get().getStatusString(-10000), NotNull());
 }
@@ -304,24 +304,24 @@ inline uint32_t alignToPower2(uint32_t val, uint32_t align) {
 // |yOffsetBytes|: offset into |yv12| of the start of the Y component
 // |uOffsetBytes|: offset into |yv12| of the start of the U component
 // |vOffsetBytes|: offset into |yv12| of the start of the V component
-static void getYUVOffsets(int width,
-                          int height,
-                          FrameworkFormat format,
-                          uint32_t* yWidth,
-                          uint32_t* yHeight,
-                          uint32_t* yOffsetBytes,
-                          uint32_t* yStridePixels,
-                          uint32_t* yStrideBytes,
-                          uint32_t* uWidth,
-                          uint32_t* uHeight,
-                          uint32_t* uOffsetBytes,
-                          uint32_t* uStridePixels,
-                          uint32_t* uStrideBytes,
-                          uint32_t* vWidth,
-                          uint32_t* vHeight,
-                          uint32_t* vOffsetBytes,
-                          uint32_t* vStridePixels,
-                          uint32_t* vStrideBytes) {
+void YUVConverter::getYUVOffsets(int width,
+                                 int height,
+                                 FrameworkFormat format,
+                                 uint32_t* yWidth,
+                                 uint32_t* yHeight,
+                                 uint32_t* yOffsetBytes,
+                                 uint32_t* yStridePixels,
+                                 uint32_t* yStrideBytes,
+                                 uint32_t* uWidth,
+                                 uint32_t* uHeight,
+                                 uint32_t* uOffsetBytes,
+                                 uint32_t* uStridePixels,
+                                 uint32_t* uStrideBytes,
+                                 uint32_t* vWidth,
+                                 uint32_t* vHeight,
+                                 uint32_t* vOffsetBytes,
+                                 uint32_t* vStridePixels,
+                                 uint32_t* vStrideBytes) {
     switch (format) {
         case FRAMEWORK_FORMAT_YV12: {
             *yWidth = width;
@@ -78,6 +78,28 @@ public:
                                FrameworkFormat format,
                                YUVPlane plane,
                                GLuint* outTextureName);
+
+    // Layout of the planes of a |width| x |height| guest YUV buffer of
+    // |format|, as written by rcUpdateColorBuffer and read back by
+    // rcReadColorBufferYUV. Other backends use it to stay byte compatible.
+    static void getYUVOffsets(int width,
+                              int height,
+                              FrameworkFormat format,
+                              uint32_t* yWidth,
+                              uint32_t* yHeight,
+                              uint32_t* yOffsetBytes,
+                              uint32_t* yStridePixels,
+                              uint32_t* yStrideBytes,
+                              uint32_t* uWidth,
+                              uint32_t* uHeight,
+                              uint32_t* uOffsetBytes,
+                              uint32_t* uStridePixels,
+                              uint32_t* uStrideBytes,
+                              uint32_t* vWidth,
+                              uint32_t* vHeight,
+                              uint32_t* vOffsetBytes,
+                              uint32_t* vStridePixels,
+                              uint32_t* vStrideBytes);
 private:
     void init(int w, int h, FrameworkFormat format);
     void reset();
@@ -34,10 +34,18 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <sys/stat.h>
 #include <cstring>
 #include <memory>
+#include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
 #define DEBUG 0
 #if DEBUG
 #define D(...) fprintf(stderr, __VA_ARGS__);
@@ -131,6 +139,33 @@ static const char* kGLES2LibName = "libGLESv2.dylib";
 namespace {
 using namespace EglOS;
 
+// Names the file of the library that |address| is in, along with its size and
+// modification time, so that a driver update invalidates blobs cached by the
+// old build even when the EGL vendor and version strings stay the same.
+std::string getLibraryFingerprint(const void* address) {
+    std::string path;
+#ifdef _WIN32
+    HMODULE module = nullptr;
+    char name[MAX_PATH];
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                               GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                           reinterpret_cast<LPCSTR>(address), &module) &&
+        GetModuleFileNameA(module, name, sizeof(name)) > 0) {
+        path = name;
+    }
+#else
+    Dl_info info;
+    if (dladdr(address, &info) && info.dli_fname) {
+        path = info.dli_fname;
+    }
+#endif
+    if (path.empty()) return "";
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return path;
+    return path + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+}
+
 class EglOsEglDispatcher {
 public:
 #define DECLARE_EGL_POINTER(return_type, function_name, signature) \
@@ -401,6 +436,10 @@ EglOsEglDisplay::EglOsEglDisplay(bool nullEgl) {
 #endif // __linux__
 
     if (clientExts != nullptr && emugl::hasExtension(clientExts, "EGL_ANDROID_blob_cache")) {
+        const char* version = mDispatcher.eglQueryString(mDisplay, EGL_VERSION);
+        InitBlobCache(mVendor + "|" + (version ? version : "") + "|" + mClientExts + "|" +
+                      getLibraryFingerprint(
+                          reinterpret_cast<const void*>(mDispatcher.eglQueryString)));
         mDispatcher.eglSetBlobCacheFuncsANDROID(mDisplay, SetBlob, GetBlob);
     }
 
@@ -0,0 +1,405 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "PersistentBlobCache.h"
+
+#include "aemu/base/files/PathUtils.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr char kBlobCacheMagic[8] = {'G', 'F', 'X', 'B', 'L', 'O', 'B', 'S'};
+    constexpr uint32_t kBlobCacheVersion = 1;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t identitySize;
+    };
+
+    struct RecordHeader {
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint64_t checksum;
+    };
+
+    constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+
+    uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    uint64_t recordChecksum(const void* key, size_t keySize, const void* value, size_t valueSize) {
+        uint64_t hash = kFnvOffsetBasis;
+        hash = fnv1a(hash, key, keySize);
+        return fnv1a(hash, value, valueSize);
+    }
+
+    bool writeFileHeader(FILE* file, const std::string& identity) {
+        FileHeader header = {};
+        memcpy(header.magic, kBlobCacheMagic, sizeof(kBlobCacheMagic));
+        header.version = kBlobCacheVersion;
+        header.identitySize = static_cast<uint32_t>(identity.size());
+        return fwrite(&header, sizeof(header), 1, file) == 1 &&
+               fwrite(identity.data(), 1, identity.size(), file) == identity.size();
+    }
+}
+
+PersistentBlobCache::~PersistentBlobCache() {
+    unmap();
+    if (mAppendFile) fclose(mAppendFile);
+    unlockFile();
+}
+
+void PersistentBlobCache::init(const std::string& dir, const std::string& identity,
+                               uint64_t maxFileSize) {
+    if (mInitialized) return;
+    mInitialized = true;
+
+    char name[64];
+    snprintf(name, sizeof(name), "egl_blob_cache_%016llx.bin",
+             (unsigned long long)fnv1a(kFnvOffsetBasis, identity.data(), identity.size()));
+    mPath = android::base::pj({dir, name});
+    mIdentity = identity;
+    mMaxFileSize = maxFileSize;
+
+    if (!lockFile()) {
+        fprintf(stderr, "%s: blob cache %s is in use by another process, not using it\n",
+                __func__, mPath.c_str());
+        return;
+    }
+
+    reload();
+
+    // Superseded records pile up across runs; drop them once they make up
+    // most of the file.
+    if (mFileSize > headerSize() && mLiveRecordSize < (mFileSize - headerSize()) / 2) {
+        compact();
+        return;
+    }
+    openForAppend();
+}
+
+bool PersistentBlobCache::get(const Blob& key, Blob* outValue) {
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) return false;
+
+    RecordHeader record;
+    memcpy(&record, mData + it->second, sizeof(record));
+    const uint8_t* keyData = mData + it->second + sizeof(record);
+    const uint8_t* valueData = keyData + record.keySize;
+    if (recordChecksum(keyData, record.keySize, valueData, record.valueSize) !=
+        record.checksum) {
+        mIndex.erase(it);
+        return false;
+    }
+
+    outValue->assign(valueData, valueData + record.valueSize);
+    return true;
+}
+
+void PersistentBlobCache::put(const Blob& key, const Blob& value) {
+    if (!mAppendFile) return;
+
+    const uint64_t recordSize = sizeof(RecordHeader) + key.size() + value.size();
+    // Compaction only guarantees half of the limit to be free.
+    if (headerSize() + recordSize > mMaxFileSize / 2) return;
+    if (mFileSize + recordSize > mMaxFileSize) {
+        compact();
+        if (!mAppendFile || mFileSize + recordSize > mMaxFileSize) return;
+    }
+
+    RecordHeader record = {
+        .keySize = static_cast<uint32_t>(key.size()),
+        .valueSize = static_cast<uint32_t>(value.size()),
+        .checksum = recordChecksum(key.data(), key.size(), value.data(), value.size()),
+    };
+    const bool written = fwrite(&record, sizeof(record), 1, mAppendFile) == 1 &&
+                         fwrite(key.data(), 1, key.size(), mAppendFile) == key.size() &&
+                         fwrite(value.data(), 1, value.size(), mAppendFile) == value.size() &&
+                         fflush(mAppendFile) == 0;
+    if (!written) {
+        discardPartialAppend();
+        return;
+    }
+
+    // The mapped record for this key, if any, is stale now.
+    mIndex.erase(key);
+    mFileSize += recordSize;
+}
+
+// Cuts whatever part of a failed append made it to the file, so that the file
+// ends with a complete record again. If that fails too, the file is dropped.
+void PersistentBlobCache::discardPartialAppend() {
+    // Closing may write out more of the record, which is cut along with the rest.
+    fclose(mAppendFile);
+    mAppendFile = nullptr;
+
+#ifdef _WIN32
+    bool truncated = false;
+    HANDLE file = CreateFileA(mPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(mFileSize);
+        truncated = SetFilePointerEx(file, size, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+        CloseHandle(file);
+    }
+#else
+    const bool truncated = truncate(mPath.c_str(), static_cast<off_t>(mFileSize)) == 0;
+#endif
+    if (!truncated) {
+        fprintf(stderr, "%s: dropping blob cache %s after a failed write\n", __func__,
+                mPath.c_str());
+        unmap();
+        mIndex.clear();
+        mLiveRecordSize = 0;
+        mFileSize = 0;
+        remove(mPath.c_str());
+    }
+    openForAppend();
+}
+
+bool PersistentBlobCache::lockFile() {
+    const std::string lockPath = mPath + ".lock";
+#ifdef _WIN32
+    // Nobody else can open the file while it is open without sharing.
+    mLockFile = CreateFileA(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
+                            nullptr);
+    return mLockFile != INVALID_HANDLE_VALUE;
+#else
+    mLockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mLockFd < 0) return false;
+    if (flock(mLockFd, LOCK_EX | LOCK_NB) != 0) {
+        close(mLockFd);
+        mLockFd = -1;
+        return false;
+    }
+    return true;
+#endif
+}
+
+void PersistentBlobCache::unlockFile() {
+#ifdef _WIN32
+    if (mLockFile != INVALID_HANDLE_VALUE) CloseHandle(mLockFile);
+    mLockFile = INVALID_HANDLE_VALUE;
+#else
+    // The lock file stays behind; removing it would race with other processes
+    // about to lock it.
+    if (mLockFd >= 0) close(mLockFd);
+    mLockFd = -1;
+#endif
+}
+
+bool PersistentBlobCache::map() {
+#ifdef _WIN32
+    mFile = CreateFileA(mPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+        unmap();
+        return false;
+    }
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mMapping) {
+        unmap();
+        return false;
+    }
+    mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    mMappedSize = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(mPath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    mData = data == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(data);
+    mMappedSize = st.st_size;
+#endif
+    if (!mData) {
+        unmap();
+        return false;
+    }
+    mFileSize = mMappedSize;
+    return true;
+}
+
+void PersistentBlobCache::unmap() {
+#ifdef _WIN32
+    if (mData) UnmapViewOfFile(mData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if (mData) munmap(const_cast<uint8_t*>(mData), mMappedSize);
+#endif
+    mData = nullptr;
+    mMappedSize = 0;
+}
+
+uint64_t PersistentBlobCache::headerSize() const {
+    return sizeof(FileHeader) + mIdentity.size();
+}
+
+uint64_t PersistentBlobCache::mappedRecordSize(size_t offset) const {
+    RecordHeader record;
+    memcpy(&record, mData + offset, sizeof(record));
+    return sizeof(record) + (uint64_t)record.keySize + record.valueSize;
+}
+
+// Walks the record headers only; a truncated or oversized file is thrown away
+// as a whole so that appends always follow a valid record.
+bool PersistentBlobCache::indexMapping() {
+    if (mMappedSize > mMaxFileSize) return false;
+    if (mMappedSize < sizeof(FileHeader)) return false;
+
+    FileHeader header;
+    memcpy(&header, mData, sizeof(header));
+    if (memcmp(header.magic, kBlobCacheMagic, sizeof(kBlobCacheMagic)) != 0 ||
+        header.version != kBlobCacheVersion || header.identitySize != mIdentity.size()) {
+        return false;
+    }
+    size_t offset = sizeof(header);
+    if (mMappedSize - offset < mIdentity.size() ||
+        memcmp(mData + offset, mIdentity.data(), mIdentity.size()) != 0) {
+        return false;
+    }
+    offset += mIdentity.size();
+
+    while (offset < mMappedSize) {
+        RecordHeader record;
+        if (mMappedSize - offset < sizeof(record)) return false;
+        memcpy(&record, mData + offset, sizeof(record));
+        const uint64_t recordSize = sizeof(record) + (uint64_t)record.keySize + record.valueSize;
+        if (mMappedSize - offset < recordSize) return false;
+
+        const uint8_t* keyData = mData + offset + sizeof(record);
+        auto [it, inserted] = mIndex.emplace(Blob(keyData, keyData + record.keySize), offset);
+        if (!inserted) {
+            mLiveRecordSize -= mappedRecordSize(it->second);
+            it->second = offset;
+        }
+        mLiveRecordSize += recordSize;
+        offset += recordSize;
+    }
+    return true;
+}
+
+// Maps the file as it is on disk now and indexes its records. A file that
+// can't be used leaves the cache empty, to be started over by the next append.
+void PersistentBlobCache::reload() {
+    unmap();
+    mIndex.clear();
+    mLiveRecordSize = 0;
+    mFileSize = 0;
+
+    if (map() && !indexMapping()) {
+        fprintf(stderr, "%s: discarding stale or corrupt blob cache %s\n", __func__,
+                mPath.c_str());
+        unmap();
+        mIndex.clear();
+        mLiveRecordSize = 0;
+        mFileSize = 0;
+    }
+}
+
+void PersistentBlobCache::openForAppend() {
+    if (mFileSize > 0) {
+        mAppendFile = fopen(mPath.c_str(), "ab");
+        return;
+    }
+
+    mAppendFile = fopen(mPath.c_str(), "wb");
+    if (!mAppendFile) return;
+    if (!writeFileHeader(mAppendFile, mIdentity) || fflush(mAppendFile) != 0) {
+        fclose(mAppendFile);
+        mAppendFile = nullptr;
+        remove(mPath.c_str());
+        return;
+    }
+    mFileSize = headerSize();
+}
+
+// Rewrites the file with only the latest record for each key. If those alone
+// would fill more than half of the size limit, starts over with an empty file
+// instead, so that appends can go on either way.
+void PersistentBlobCache::compact() {
+    if (mAppendFile) {
+        fclose(mAppendFile);
+        mAppendFile = nullptr;
+    }
+    // Pick up the records appended since the file was last mapped.
+    reload();
+
+    const bool keepRecords = mLiveRecordSize <= mMaxFileSize / 2;
+    const std::string tmpPath = mPath + ".tmp";
+    FILE* out = fopen(tmpPath.c_str(), "wb");
+    bool ok = out && writeFileHeader(out, mIdentity);
+    if (ok && keepRecords) {
+        for (const auto& [key, offset] : mIndex) {
+            RecordHeader record;
+            memcpy(&record, mData + offset, sizeof(record));
+            const uint8_t* keyData = mData + offset + sizeof(record);
+            const uint8_t* valueData = keyData + record.keySize;
+            if (recordChecksum(keyData, record.keySize, valueData, record.valueSize) !=
+                record.checksum) {
+                continue;
+            }
+            const uint64_t recordSize = mappedRecordSize(offset);
+            if (fwrite(mData + offset, 1, recordSize, out) != recordSize) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (out) ok = fclose(out) == 0 && ok;
+
+    // The mapping has to go before the file it maps can be replaced on Windows.
+    unmap();
+    mIndex.clear();
+    if (!ok) {
+        remove(tmpPath.c_str());
+        fprintf(stderr, "%s: failed to compact blob cache %s\n", __func__, mPath.c_str());
+        mFileSize = 0;
+        return;
+    }
+    remove(mPath.c_str());
+    if (rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        mFileSize = 0;
+        return;
+    }
+
+    reload();
+    openForAppend();
+}
@@ -0,0 +1,101 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PERSISTENT_BLOB_CACHE_H
+#define PERSISTENT_BLOB_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// File backed key/value store for EGL_ANDROID_blob_cache blobs.
+//
+// The file is a header naming the driver the blobs came from, followed by
+// records that are appended as blobs are set; a later record for the same key
+// supersedes earlier ones. The file as it was when last opened is mapped
+// read-only and record payloads are only checksummed and copied out when they
+// are first asked for.
+//
+// When an append would take the file past |maxFileSize|, the file is
+// rewritten with only the latest record for each key. An append that fails
+// part way, like on a full disk, is cut off the file again.
+//
+// A file is used by one process at a time, which holds a lock file next to it.
+// Other processes asking for the same file run without a persistent cache.
+// Not thread-safe.
+class PersistentBlobCache {
+public:
+    using Blob = std::vector<uint8_t>;
+
+    static constexpr uint64_t kDefaultMaxFileSize = 64 * 1024 * 1024;
+
+    PersistentBlobCache() = default;
+    ~PersistentBlobCache();
+
+    PersistentBlobCache(const PersistentBlobCache&) = delete;
+    PersistentBlobCache& operator=(const PersistentBlobCache&) = delete;
+
+    // Opens the file for |identity| under |dir|, or creates it. The file name
+    // is derived from |identity|; a file that turns out to have been written
+    // for a different identity, or a corrupt one, is replaced.
+    void init(const std::string& dir, const std::string& identity,
+              uint64_t maxFileSize = kDefaultMaxFileSize);
+
+    bool get(const Blob& key, Blob* outValue);
+    void put(const Blob& key, const Blob& value);
+
+    uint64_t fileSize() const { return mFileSize; }
+
+private:
+    bool lockFile();
+    void unlockFile();
+    bool map();
+    void unmap();
+    bool indexMapping();
+    void reload();
+    void openForAppend();
+    void compact();
+    void discardPartialAppend();
+    uint64_t headerSize() const;
+    uint64_t mappedRecordSize(size_t offset) const;
+
+    bool mInitialized = false;
+    std::string mPath;
+    std::string mIdentity;
+    uint64_t mMaxFileSize = kDefaultMaxFileSize;
+
+    const uint8_t* mData = nullptr;
+    size_t mMappedSize = 0;
+    uint64_t mFileSize = 0;
+    // Bytes taken by the latest record of each key in the mapping.
+    uint64_t mLiveRecordSize = 0;
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = nullptr;
+    HANDLE mLockFile = INVALID_HANDLE_VALUE;
+#else
+    int mLockFd = -1;
+#endif
+    FILE* mAppendFile = nullptr;
+    // Key -> offset of its latest record in the mapping.
+    std::map<Blob, size_t> mIndex;
+};
+
+#endif
@@ -14,13 +14,18 @@
 
 #include "ShaderCache.h"
 
+#include "PersistentBlobCache.h"
 #include "aemu/base/MruCache.h"
+#include "aemu/base/synchronization/Lock.h"
+#include "aemu/base/system/System.h"
 #include <string.h>
-#include <cstdio>
 
 #include <map>
 #include <vector>
 
+using android::base::AutoLock;
+using android::base::Lock;
+
 namespace {
     using BlobCacheType = std::vector<uint8_t>;
 
@@ -34,7 +39,7 @@ namespace {
         }
 
         void cacheChanged() override {
-            // TODO: This will dictate when we flatten the cache.
+            // Entries are persisted as they are put, see PersistentBlobCache.
         }
 
     private:
@@ -48,7 +53,7 @@ namespace {
 
     public:
         void handleFlatten(MruCache &mCache, void* buf, size_t bufSize) {
-            // TODO: This will handle the actual serialization.
+            // Entries are persisted as they are put, see PersistentBlobCache.
         }
     };
 
@@ -56,6 +61,18 @@ namespace {
     // 3200 is ~32MB of shaders, very rough estimate.
     android::base::MruCache<BlobCacheType, BlobCacheType> mruCache(3200, &testFlattener);
     CacheObserver<BlobCacheType, BlobCacheType> sss(&mruCache);
+    PersistentBlobCache persistentCache;
+    // The driver may call SetBlob/GetBlob from any of its threads.
+    Lock cacheLock;
+}
+
+void InitBlobCache(const std::string& driverIdentity) {
+    const std::string dir =
+        android::base::getEnvironmentVariable("ANDROID_EMUGL_SHADER_CACHE_DIR");
+    if (dir.empty()) return;
+
+    AutoLock lock(cacheLock);
+    persistentCache.init(dir, driverIdentity);
 }
 
 void SetBlob(const void* key, EGLsizeiANDROID keySize, const void* value, EGLsizeiANDROID valueSize) {
@@ -65,6 +82,8 @@ void SetBlob(const void* key, EGLsizeiANDROID keySize, const void* value, EGLsiz
     std::vector<uint8_t> valueVec(valueSize);
     memcpy(valueVec.data(), value, valueSize);
 
+    AutoLock lock(cacheLock);
+    persistentCache.put(keyVec, valueVec);
     mruCache.put(keyVec, keySize, std::move(valueVec), valueSize);
 }
 
@@ -72,11 +91,22 @@ EGLsizeiANDROID GetBlob(const void* key, EGLsizeiANDROID keySize, void* value, E
     std::vector<uint8_t> keyVec(keySize);
     memcpy(keyVec.data(), key, keySize);
 
+    AutoLock lock(cacheLock);
+
     const std::vector<uint8_t> *result;
     auto found = mruCache.get(keyVec, &result);
 
     if (!found) {
-        return 0;
+        // Pull blobs from previous runs into the in-memory cache on first use.
+        std::vector<uint8_t> persisted;
+        if (!persistentCache.get(keyVec, &persisted)) {
+            return 0;
+        }
+        const size_t persistedSize = persisted.size();
+        mruCache.put(keyVec, keySize, std::move(persisted), persistedSize);
+        if (!mruCache.get(keyVec, &result)) {
+            return 0;
+        }
     }
 
     if (result->size() <= static_cast<size_t>(valueSize)) {
@@ -18,8 +18,14 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <map>
+#include <string>
 #include <vector>
 
+// Backs the blob cache with a file under ANDROID_EMUGL_SHADER_CACHE_DIR, if
+// set. |driverIdentity| names the host driver the blobs were produced by; a
+// file written by a different driver is ignored.
+void InitBlobCache(const std::string& driverIdentity);
+
 void SetBlob(const void* key, EGLsizeiANDROID keySize, const void* value, EGLsizeiANDROID valueSize);
 
 EGLsizeiANDROID GetBlob(const void* key, EGLsizeiANDROID keySize, void* value, EGLsizeiANDROID valueSize);
@@ -16,13 +16,16 @@
 
 #include "ANGLEShaderParser.h"
 #include "ShaderTranslator.h"
+#include "TranslationCache.h"
 
 #include "aemu/base/SharedLibrary.h"
 #include "aemu/base/synchronization/Lock.h"
 #include "host-common/logging.h"
 
+#include <functional>
 #include <map>
 #include <string>
+#include <string_view>
 
 #include <string.h>
 
@@ -132,6 +135,7 @@ ShaderLinkInfo& ShaderLinkInfo::operator=(ShaderLinkInfo&& other) {
     varyings = std::move(other.varyings);
     attributes = std::move(other.attributes);
     outputVars = std::move(other.outputVars);
+    interfaceBlocks = std::move(other.interfaceBlocks);
     nameMap = std::move(other.nameMap);
     nameMapReverse = std::move(other.nameMapReverse);
 
@@ -240,6 +244,11 @@ static ST_Handle getShaderCompiler(bool coreProfileHost, ShaderSpecKey key) {
 
 android::base::Lock kCompilerLock;
 
+TranslationCache* getTranslationCache() {
+    static TranslationCache* c = new TranslationCache;
+    return c;
+}
+
 void initializeResources(
     BuiltinResourcesEditCallback callback) {
 
@@ -262,6 +271,12 @@ bool globalInitialize(
 
     initializeResources(editCallback);
 
+    // Translations depend on the built-in resources.
+    {
+        android::base::AutoLock autolock(kCompilerLock);
+        getTranslationCache()->clear();
+    }
+
     kInitialized = true;
     return true;
 }
@@ -404,6 +419,19 @@ bool translate(bool hostUsesCoreProfile,
     // at the same time.
     android::base::AutoLock autolock(kCompilerLock);
 
+    const TranslationKey translationKey = {
+        std::hash<std::string_view>()(src),
+        shaderType,
+        esslVersion,
+        hostUsesCoreProfile,
+    };
+    if (auto cached = getTranslationCache()->find(translationKey, src)) {
+        *outInfolog = cached->infoLog;
+        *outObjCode = cached->objCode;
+        if (outShaderLinkInfo) *outShaderLinkInfo = cached->linkInfo;
+        return cached->compileStatus;
+    }
+
     ShaderSpecKey key;
     key.shaderType = shaderType;
     key.esslVersion = esslVersion;
@@ -427,11 +455,18 @@ bool translate(bool hostUsesCoreProfile,
     *outInfolog = std::string(res->infoLog);
     *outObjCode = std::string(res->translatedSource);
 
-    if (outShaderLinkInfo) getShaderLinkInfo(esslVersion, res, outShaderLinkInfo);
-
-    bool ret = res->compileStatus == 1;
+    TranslationResult result;
+    result.src = src;
+    result.compileStatus = res->compileStatus == 1;
+    result.infoLog = *outInfolog;
+    result.objCode = *outObjCode;
+    getShaderLinkInfo(esslVersion, res, &result.linkInfo);
 
     st->freeShaderResolveState(res);
+
+    bool ret = result.compileStatus;
+    if (outShaderLinkInfo) *outShaderLinkInfo = result.linkInfo;
+    getTranslationCache()->add(translationKey, std::move(result));
     return ret;
 }
 
@@ -34,6 +34,14 @@ static const char kGLES32StringPart[] = "OpenGL ES 3.2";
 
 static GLESVersion s_maxGlesVersion = GLES_2_0;
 
+static constexpr GLsizeiptr kMinStreamingBufferSize = 4 * 1024 * 1024;
+// Enough for any vertex attribute or index type.
+static constexpr GLintptr kStreamingBufferAlignment = 16;
+
+static GLintptr alignStreamingBufferOffset(GLintptr offset) {
+    return (offset + kStreamingBufferAlignment - 1) & ~(kStreamingBufferAlignment - 1);
+}
+
 static const char* sPickVersionStringPart(int maj, int min) {
     switch (maj) {
         case 2:
@@ -134,21 +142,17 @@ void GLESv2Context::initEmulatedVAO() {
 }
 
 void GLESv2Context::initEmulatedBuffers() {
-    if (m_emulatedClientVBOs.empty()) {
-        // Create emulated client VBOs
-        GLint neededClientVBOs = 0;
-        dispatcher().glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &neededClientVBOs);
-
-        // Spec minimum: 16 attribs. Some drivers won't report the right values.
-        neededClientVBOs = std::max(neededClientVBOs, 16);
+    if (!m_clientArraysBuffer.buffer) {
+        dispatcher().glGenBuffers(1, &m_clientArraysBuffer.buffer);
+    }
 
-        m_emulatedClientVBOs.resize(neededClientVBOs, 0);
-        dispatcher().glGenBuffers(neededClientVBOs, &m_emulatedClientVBOs[0]);
+    if (!m_clientIndicesBuffer.buffer) {
+        dispatcher().glGenBuffers(1, &m_clientIndicesBuffer.buffer);
     }
 
-    if (!m_emulatedClientIBO) {
-        // Create emulated IBO
-        dispatcher().glGenBuffers(1, &m_emulatedClientIBO);
+    if (!m_att0Buffer) {
+        dispatcher().glGenBuffers(1, &m_att0Buffer);
+        m_att0BufferLength = 0;
     }
 }
 
@@ -188,14 +192,11 @@ GLESv2Context::GLESv2Context(int maj, int min, GlobalNameSpace* globalNameSpace,
 }
 
 GLESv2Context::~GLESv2Context() {
-    if (m_emulatedClientIBO) {
-        s_glDispatch.glDeleteBuffers(1, &m_emulatedClientIBO);
-    }
-
-    if (!m_emulatedClientVBOs.empty()) {
-        s_glDispatch.glDeleteBuffers(
-            m_emulatedClientVBOs.size(),
-            &m_emulatedClientVBOs[0]);
+    for (GLuint buffer : {m_clientArraysBuffer.buffer,
+                          m_clientIndicesBuffer.buffer, m_att0Buffer}) {
+        if (buffer) {
+            s_glDispatch.glDeleteBuffers(1, &buffer);
+        }
     }
 
     deleteVAO(0);
@@ -477,18 +478,23 @@ void GLESv2Context::validateAtt0PreDraw(unsigned int count)
                     sizeof(m_attribute0value));
         }
         m_attribute0valueChanged = false;
+        // Upload the new values below.
+        m_att0BufferLength = 0;
     }
 
-    GLuint prevArrayBuffer;
-    s_glDispatch.glGetIntegerv(GL_ARRAY_BUFFER_BINDING, (GLint*)&prevArrayBuffer);
-
-    s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, m_emulatedClientVBOs[0]);
-    s_glDispatch.glBufferData(GL_ARRAY_BUFFER, m_att0ArrayLength * sizeof(GLfloat), m_att0Array.get(), GL_STREAM_DRAW);
+    s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, m_att0Buffer);
+    if (m_att0BufferLength != m_att0ArrayLength) {
+        s_glDispatch.glBufferData(GL_ARRAY_BUFFER,
+                                  4 * m_att0ArrayLength * sizeof(GLfloat),
+                                  m_att0Array.get(), GL_STATIC_DRAW);
+        m_att0BufferLength = m_att0ArrayLength;
+    }
 
     s_glDispatch.glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
     s_glDispatch.glEnableVertexAttribArray(0);
 
-    s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, prevArrayBuffer);
+    s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER,
+                              getBoundBufferGlobalName(GL_ARRAY_BUFFER));
 
     m_att0NeedsDisable = true;
 }
@@ -563,7 +569,7 @@ void GLESv2Context::drawWithEmulations(
         }
     }
 
-    GLuint prevIBO;
+    GLintptr indicesOffset = 0;
     if (needClientIBOSetup) {
         int bpv = 2;
         switch (type) {
@@ -580,13 +586,15 @@ void GLESv2Context::drawWithEmulations(
 
         size_t dataSize = bpv * count;
 
-        s_glDispatch.glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, (GLint*)&prevIBO);
-        s_glDispatch.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_emulatedClientIBO);
-        s_glDispatch.glBufferData(GL_ELEMENT_ARRAY_BUFFER, dataSize, indices, GL_STREAM_DRAW);
+        s_glDispatch.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_clientIndicesBuffer.buffer);
+        reserveStreamingBuffer(&m_clientIndicesBuffer, GL_ELEMENT_ARRAY_BUFFER, dataSize);
+        indicesOffset = uploadToStreamingBuffer(&m_clientIndicesBuffer,
+                                                GL_ELEMENT_ARRAY_BUFFER,
+                                                indices, dataSize);
     }
 
     const GLvoid* indicesOrOffset =
-        needClientIBOSetup ? nullptr : indices;
+        needClientIBOSetup ? reinterpret_cast<const GLvoid*>(indicesOffset) : indices;
 
     switch (cmd) {
         case DrawCallCmd::Elements:
@@ -613,7 +621,8 @@ void GLESv2Context::drawWithEmulations(
     }
 
     if (needClientIBOSetup) {
-        s_glDispatch.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, prevIBO);
+        s_glDispatch.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                                  getBoundBufferGlobalName(GL_ELEMENT_ARRAY_BUFFER));
     }
 
     if (needClientVBOSetup) {
@@ -635,6 +644,21 @@ void GLESv2Context::drawWithEmulations(
 }
 
 void GLESv2Context::setupArraysPointers(GLESConversionArrays& cArrs,GLint first,GLsizei count,GLenum type,const GLvoid* indices,bool direct, bool* needEnablingPostDraw) {
+    // All client arrays of the draw have to end up in the same storage, so make
+    // room for them at once rather than orphaning the storage halfway through.
+    GLsizeiptr clientArraysSize = 0;
+    for (uint32_t i = 0; i < kMaxVertexAttributes; ++i) {
+        const GLESpointer* p = m_currVaoState.attribInfo().data() + i;
+        if (p->isEnable() && p->getAttribType() != GLESpointer::VALUE && p->getArrayData()) {
+            clientArraysSize += alignStreamingBufferOffset(p->getDataSize());
+        }
+    }
+    const bool clientArraysBufferBound = clientArraysSize > 0;
+    if (clientArraysBufferBound) {
+        s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, m_clientArraysBuffer.buffer);
+        reserveStreamingBuffer(&m_clientArraysBuffer, GL_ARRAY_BUFFER, clientArraysSize);
+    }
+
     //going over all clients arrays Pointers
     for (uint32_t i = 0; i < kMaxVertexAttributes; ++i) {
         GLESpointer* p = m_currVaoState.attribInfo().data() + i;
@@ -655,6 +679,44 @@ void GLESv2Context::setupArraysPointers(GLESConversionArrays& cArrs,GLint first,
             p->getBufferName(),
             needEnablingPostDraw);
     }
+
+    if (clientArraysBufferBound) {
+        s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER,
+                                  getBoundBufferGlobalName(GL_ARRAY_BUFFER));
+    }
+}
+
+void GLESv2Context::reserveStreamingBuffer(StreamingBuffer* streamingBuffer,
+                                           GLenum target, GLsizeiptr size) {
+    if (alignStreamingBufferOffset(streamingBuffer->offset) + size <= streamingBuffer->size) {
+        return;
+    }
+
+    GLsizeiptr bufferSize = std::max(streamingBuffer->size, kMinStreamingBufferSize);
+    while (bufferSize < size) {
+        bufferSize *= 2;
+    }
+    // Orphans the storage still in use by previous draws.
+    s_glDispatch.glBufferData(target, bufferSize, nullptr, GL_STREAM_DRAW);
+    streamingBuffer->size = bufferSize;
+    streamingBuffer->offset = 0;
+}
+
+GLintptr GLESv2Context::uploadToStreamingBuffer(StreamingBuffer* streamingBuffer,
+                                                GLenum target, const GLvoid* data,
+                                                GLsizeiptr dataSize) {
+    const GLintptr offset = alignStreamingBufferOffset(streamingBuffer->offset);
+    s_glDispatch.glBufferSubData(target, offset, dataSize, data);
+    streamingBuffer->offset = offset + dataSize;
+    return offset;
+}
+
+GLuint GLESv2Context::getBoundBufferGlobalName(GLenum target) {
+    const GLuint localName = getBuffer(target);
+    if (!localName || !shareGroup()) {
+        return 0;
+    }
+    return shareGroup()->getGlobalName(NamedObjectType::VERTEXBUFFER, localName);
 }
 
 //setting client side arr
@@ -663,9 +725,9 @@ void GLESv2Context::setupArrWithDataSize(GLsizei datasize, const GLvoid* arr,
                                          GLint size, GLsizei stride, GLboolean normalized, int index, bool isInt, GLuint ptrBufferName, bool* needEnablingPostDraw){
     // is not really a client side arr.
     if (arr == NULL) {
-        GLint isEnabled;
-        s_glDispatch.glGetVertexAttribiv((int)arrayType, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &isEnabled);
-        if (isEnabled && !ptrBufferName) {
+        // setupArraysPointers() only passes enabled arrays, and the host's
+        // enable state follows the guest's.
+        if (!ptrBufferName) {
             s_glDispatch.glDisableVertexAttribArray(arrayType);
             if (needEnablingPostDraw)
                 needEnablingPostDraw[arrayType] = true;
@@ -674,24 +736,17 @@ void GLESv2Context::setupArrWithDataSize(GLsizei datasize, const GLvoid* arr,
         return;
     }
 
-    GLuint prevArrayBuffer;
-    s_glDispatch.glGetIntegerv(GL_ARRAY_BUFFER_BINDING, (GLint*)&prevArrayBuffer);
-
-    if (arrayType < m_emulatedClientVBOs.size()) {
-        s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, m_emulatedClientVBOs[arrayType]);
-    } else {
-        fprintf(stderr, "%s: invalid attribute index: %d\n", __func__, (int)arrayType);
-    }
-
-    s_glDispatch.glBufferData(GL_ARRAY_BUFFER, datasize, arr, GL_STREAM_DRAW);
+    // setupArraysPointers() has bound m_clientArraysBuffer.
+    const GLintptr offset = uploadToStreamingBuffer(&m_clientArraysBuffer,
+                                                    GL_ARRAY_BUFFER, arr, datasize);
 
     if (isInt) {
-        s_glDispatch.glVertexAttribIPointer(arrayType, size, dataType, stride, 0);
+        s_glDispatch.glVertexAttribIPointer(arrayType, size, dataType, stride,
+                                            reinterpret_cast<const GLvoid*>(offset));
     } else {
-        s_glDispatch.glVertexAttribPointer(arrayType, size, dataType, normalized, stride, 0);
+        s_glDispatch.glVertexAttribPointer(arrayType, size, dataType, normalized, stride,
+                                           reinterpret_cast<const GLvoid*>(offset));
     }
-
-    s_glDispatch.glBindBuffer(GL_ARRAY_BUFFER, prevArrayBuffer);
 }
 
 void GLESv2Context::setVertexAttribDivisor(GLuint bindingindex, GLuint divisor) {
@@ -132,6 +132,31 @@ protected:
     virtual void postLoadRestoreCtx();
     bool needConvert(GLESConversionArrays& fArrs,GLint first,GLsizei count,GLenum type,const GLvoid* indices,bool direct,GLESpointer* p,GLenum array_id);
 private:
+    // Client-side arrays and indices are uploaded to these buffers, each draw
+    // right after the data of the previous one. When a buffer is full, its
+    // storage is orphaned and filled again from the start, so uploads neither
+    // reallocate storage every draw nor wait for draws using older data.
+    struct StreamingBuffer {
+        GLuint buffer = 0;
+        GLsizeiptr size = 0;
+        GLintptr offset = 0;
+    };
+    // Makes room for |size| bytes of uploads to |streamingBuffer|, which must
+    // be bound to |target|, orphaning its storage if they don't fit. The
+    // uploads of a draw must all be reserved at once, before the first one.
+    void reserveStreamingBuffer(StreamingBuffer* streamingBuffer, GLenum target,
+                                GLsizeiptr size);
+    // Uploads |data| to |streamingBuffer|, which must be bound to |target|,
+    // and returns the offset of the data in the buffer. The room for it must
+    // have been reserved.
+    GLintptr uploadToStreamingBuffer(StreamingBuffer* streamingBuffer,
+                                     GLenum target, const GLvoid* data,
+                                     GLsizeiptr dataSize);
+    // Host name of the buffer the guest has bound to |target|. We track
+    // bindings on our side, which is much cheaper than asking the driver
+    // before overriding them.
+    GLuint getBoundBufferGlobalName(GLenum target);
+
     void setupArrWithDataSize(GLsizei datasize, const GLvoid* arr,
                               GLenum arrayType, GLenum dataType,
                               GLint size, GLsizei stride, GLboolean normalized, int index, bool isInt, GLuint ptrBufferName, bool* needEnablingPostDraw);
@@ -146,8 +171,11 @@ private:
     ObjectDataPtr m_useProgramData = {};
     std::unordered_map<GLuint, GLuint> m_bindSampler;
 
-    std::vector<GLuint> m_emulatedClientVBOs;
-    GLuint m_emulatedClientIBO = 0;
+    StreamingBuffer m_clientArraysBuffer;
+    StreamingBuffer m_clientIndicesBuffer;
+    // Holds |m_att0Array|, which only changes with the attribute 0 value.
+    GLuint m_att0Buffer = 0;
+    unsigned int m_att0BufferLength = 0;
 
     NameSpace* m_transformFeedbackNameSpace = nullptr;
     ObjectLocalName m_bindTransformFeedback = 0;
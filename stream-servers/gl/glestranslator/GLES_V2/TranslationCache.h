@@ -0,0 +1,112 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef USE_ANGLE_SHADER_PARSER
+#pragma once
+
+#include <stddef.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "ANGLEShaderParser.h"
+
+namespace ANGLEShaderParser {
+
+// Translation results, keyed by everything the translation depends on. Apps
+// tend to compile the same shaders on each launch, and several processes may
+// share them, so this saves most of the ANGLE compiles. The translator owns
+// the memory of the shader variables and has no way to serialize them, so the
+// cache lives in memory only. |translate| uses it under its compiler lock.
+struct TranslationKey {
+    size_t srcHash;
+    GLenum shaderType;
+    int esslVersion;
+    bool coreProfileHost;
+
+    bool operator==(const TranslationKey& other) const {
+        return srcHash == other.srcHash && shaderType == other.shaderType &&
+               esslVersion == other.esslVersion &&
+               coreProfileHost == other.coreProfileHost;
+    }
+};
+
+struct TranslationKeyHash {
+    size_t operator()(const TranslationKey& key) const {
+        size_t hash = key.srcHash;
+        hash = hash * 31 + key.shaderType;
+        hash = hash * 31 + key.esslVersion;
+        hash = hash * 31 + key.coreProfileHost;
+        return hash;
+    }
+};
+
+struct TranslationResult {
+    // To tell apart sources with the same hash.
+    std::string src;
+    bool compileStatus;
+    std::string infoLog;
+    std::string objCode;
+    ShaderLinkInfo linkInfo;
+};
+
+constexpr size_t kMaxCachedTranslations = 4096;
+
+class TranslationCache {
+public:
+    const TranslationResult* find(const TranslationKey& key,
+                                  const char* src) const {
+        auto it = mResults.find(key);
+        if (it == mResults.end() || it->second.src != src) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    void add(const TranslationKey& key, TranslationResult&& result) {
+        if (mResults.count(key)) {
+            mResults.erase(key);
+        } else {
+            // Evict in insertion order, hits are unlikely to follow a pattern
+            // that would make LRU worth the bookkeeping.
+            if (mResults.size() >= kMaxCachedTranslations) {
+                mResults.erase(mKeys.front());
+                mKeys.pop_front();
+            }
+            mKeys.push_back(key);
+        }
+        mResults.emplace(key, std::move(result));
+    }
+
+    void clear() {
+        mResults.clear();
+        mKeys.clear();
+    }
+
+    size_t size() const { return mResults.size(); }
+
+private:
+    std::unordered_map<TranslationKey, TranslationResult, TranslationKeyHash>
+        mResults;
+    std::deque<TranslationKey> mKeys;
+};
+
+
+// The cache of |translate|, cleared by |globalInitialize|.
+TranslationCache* getTranslationCache();
+
+} // namespace ANGLEShaderParser
+
+#endif
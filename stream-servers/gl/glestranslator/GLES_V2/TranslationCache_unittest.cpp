@@ -0,0 +1,108 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "TranslationCache.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace ANGLEShaderParser {
+namespace {
+
+TranslationKey keyOf(size_t srcHash, GLenum shaderType = GL_VERTEX_SHADER) {
+    return {srcHash, shaderType, 300, false};
+}
+
+TranslationResult resultOf(const std::string& src) {
+    TranslationResult result;
+    result.src = src;
+    result.compileStatus = true;
+    result.objCode = "translated " + src;
+    return result;
+}
+
+class TranslationCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // GLES-to-GLES mode needs no shader translator library, so that the
+        // cached link infos can be created and destroyed without one.
+        ASSERT_TRUE(globalInitialize(/*isGles2Gles=*/true, [](ST_BuiltInResources&) {}));
+    }
+
+    TranslationCache mCache;
+};
+
+TEST_F(TranslationCacheTest, FindsAddedTranslations) {
+    EXPECT_EQ(nullptr, mCache.find(keyOf(1), "a"));
+    mCache.add(keyOf(1), resultOf("a"));
+    mCache.add(keyOf(2), resultOf("b"));
+
+    const TranslationResult* cached = mCache.find(keyOf(1), "a");
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ("translated a", cached->objCode);
+    cached = mCache.find(keyOf(2), "b");
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ("translated b", cached->objCode);
+
+    // Everything else the translation depends on is part of the key too.
+    EXPECT_EQ(nullptr, mCache.find(keyOf(1, GL_FRAGMENT_SHADER), "a"));
+    EXPECT_EQ(nullptr, mCache.find({1, GL_VERTEX_SHADER, 100, false}, "a"));
+    EXPECT_EQ(nullptr, mCache.find({1, GL_VERTEX_SHADER, 300, true}, "a"));
+}
+
+TEST_F(TranslationCacheTest, HashCollisionsDontReturnOtherSources) {
+    mCache.add(keyOf(7), resultOf("first"));
+    EXPECT_EQ(nullptr, mCache.find(keyOf(7), "second"));
+
+    // A colliding source replaces the earlier one.
+    mCache.add(keyOf(7), resultOf("second"));
+    EXPECT_EQ(1u, mCache.size());
+    EXPECT_EQ(nullptr, mCache.find(keyOf(7), "first"));
+    const TranslationResult* cached = mCache.find(keyOf(7), "second");
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ("translated second", cached->objCode);
+}
+
+TEST_F(TranslationCacheTest, EvictsOldestAtCapacity) {
+    for (size_t i = 0; i < kMaxCachedTranslations; i++) {
+        mCache.add(keyOf(i), resultOf(std::to_string(i)));
+    }
+    EXPECT_EQ(kMaxCachedTranslations, mCache.size());
+    ASSERT_NE(nullptr, mCache.find(keyOf(0), "0"));
+
+    mCache.add(keyOf(kMaxCachedTranslations), resultOf("new"));
+    EXPECT_EQ(kMaxCachedTranslations, mCache.size());
+    EXPECT_EQ(nullptr, mCache.find(keyOf(0), "0"));
+    EXPECT_NE(nullptr, mCache.find(keyOf(1), "1"));
+    EXPECT_NE(nullptr, mCache.find(keyOf(kMaxCachedTranslations), "new"));
+
+    // Replacing an entry doesn't evict another one.
+    mCache.add(keyOf(1), resultOf("1"));
+    EXPECT_EQ(kMaxCachedTranslations, mCache.size());
+    EXPECT_NE(nullptr, mCache.find(keyOf(2), "2"));
+}
+
+TEST_F(TranslationCacheTest, GlobalInitializeClearsCache) {
+    getTranslationCache()->add(keyOf(3), resultOf("c"));
+    ASSERT_NE(nullptr, getTranslationCache()->find(keyOf(3), "c"));
+
+    // The built-in resources may have changed.
+    ASSERT_TRUE(globalInitialize(/*isGles2Gles=*/true, [](ST_BuiltInResources&) {}));
+    EXPECT_EQ(0u, getTranslationCache()->size());
+    EXPECT_EQ(nullptr, getTranslationCache()->find(keyOf(3), "c"));
+}
+
+}  // namespace
+}  // namespace ANGLEShaderParser
@@ -0,0 +1,156 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <GLcommon/DenseNameTable.h>
+#include <GLcommon/ObjectNameSpace.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Small chunks, so that a few names span several of them.
+using SmallTable = DenseNameTable<uint32_t, 4, 8>;
+
+// The value a name is set to by the tests below, never T().
+uint32_t valueOf(uint64_t name) {
+    return static_cast<uint32_t>(name * 2 + 1);
+}
+
+class TestObjectData : public ObjectData {
+public:
+    void onSave(android::base::Stream*, unsigned int) const override {}
+    void restore(ObjectLocalName, const getGlobalName_t&) override {}
+};
+
+}  // namespace
+
+TEST(DenseNameTable, UnsetNamesAreDefault) {
+    SmallTable table;
+    for (uint64_t name = 0; name < SmallTable::kCapacity; name++) {
+        EXPECT_EQ(0u, table.get(name));
+    }
+    // Clearing a name of a chunk that doesn't exist yet is fine too.
+    table.set(9, 0);
+    EXPECT_EQ(0u, table.get(9));
+}
+
+TEST(DenseNameTable, GrowsAcrossChunkBoundaries) {
+    SmallTable table;
+    for (uint64_t name = 0; name < SmallTable::kCapacity; name++) {
+        table.set(name, valueOf(name));
+        // The names of the earlier chunks are still there, and those of the
+        // later ones are still unset.
+        for (uint64_t other = 0; other < SmallTable::kCapacity; other++) {
+            ASSERT_EQ(other <= name ? valueOf(other) : 0u, table.get(other))
+                    << "name " << other << " after setting " << name;
+        }
+    }
+
+    // Names on both sides of a chunk boundary are independent.
+    table.set(3, 0);
+    EXPECT_EQ(0u, table.get(3));
+    EXPECT_EQ(valueOf(2), table.get(2));
+    EXPECT_EQ(valueOf(4), table.get(4));
+}
+
+TEST(DenseNameTable, RangeEndsAtCapacity) {
+    EXPECT_EQ(32u, SmallTable::kCapacity);
+    EXPECT_TRUE(SmallTable::contains(0));
+    EXPECT_TRUE(SmallTable::contains(SmallTable::kCapacity - 1));
+    EXPECT_FALSE(SmallTable::contains(SmallTable::kCapacity));
+    EXPECT_FALSE(SmallTable::contains(~0ULL));
+}
+
+// Readers run without locks while a single writer inserts and removes names,
+// and must only ever see a name unset or set to its value.
+TEST(DenseNameTable, ConcurrentInsertLookupAndRemove) {
+    using Table = DenseNameTable<uint32_t, 16, 64>;
+    constexpr int kNumReaders = 4;
+    constexpr int kNumRounds = 50;
+    Table table;
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> numBadReads{0};
+    std::atomic<uint64_t> numSetReads{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < kNumReaders; i++) {
+        readers.emplace_back([&, i] {
+            std::mt19937 random(i);
+            while (!done.load(std::memory_order_acquire)) {
+                const uint64_t name = random() % Table::kCapacity;
+                const uint32_t value = table.get(name);
+                if (value == valueOf(name)) {
+                    numSetReads++;
+                } else if (value != 0) {
+                    numBadReads++;
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < kNumRounds; round++) {
+        for (uint64_t name = 0; name < Table::kCapacity; name++) {
+            table.set(name, valueOf(name));
+        }
+        for (uint64_t name = 0; name < Table::kCapacity; name += 2) {
+            table.set(name, 0);
+        }
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(0u, numBadReads.load());
+    EXPECT_GT(numSetReads.load(), 0u);
+    for (uint64_t name = 0; name < Table::kCapacity; name++) {
+        EXPECT_EQ(name % 2 ? valueOf(name) : 0u, table.get(name));
+    }
+}
+
+// NameSpace only mirrors small names in its dense tables. Larger ones must
+// be looked up in the maps, under the share group lock.
+TEST(DenseNameTable, NamesAboveDenseRangeFallBackToMaps) {
+    NameSpace nameSpace(NamedObjectType::TEXTURE, nullptr, nullptr,
+                        ObjectData::loadObject_t());
+    const ObjectLocalName smallName = 7;
+    const ObjectLocalName largeName = DenseNameTable<ObjectData*>::kCapacity + 7;
+    auto smallData = std::make_shared<TestObjectData>();
+    auto largeData = std::make_shared<TestObjectData>();
+    nameSpace.setObjectData(smallName, smallData);
+    nameSpace.setObjectData(largeName, largeData);
+
+    ObjectData* dense = nullptr;
+    ASSERT_TRUE(nameSpace.getObjectDataDense(smallName, &dense));
+    EXPECT_EQ(smallData.get(), dense);
+    EXPECT_FALSE(nameSpace.getObjectDataDense(largeName, &dense));
+    EXPECT_EQ(largeData.get(), nameSpace.getObjectDataPtr(largeName).get());
+
+    NameSpace::DenseLookup lookup;
+    EXPECT_TRUE(nameSpace.lookupDense(smallName, &lookup));
+    EXPECT_FALSE(lookup.found);
+    EXPECT_FALSE(nameSpace.lookupDense(largeName, &lookup));
+
+    nameSpace.deleteName(smallName);
+    nameSpace.deleteName(largeName);
+    ASSERT_TRUE(nameSpace.getObjectDataDense(smallName, &dense));
+    EXPECT_EQ(nullptr, dense);
+    EXPECT_EQ(nullptr, nameSpace.getObjectDataPtr(largeName).get());
+}
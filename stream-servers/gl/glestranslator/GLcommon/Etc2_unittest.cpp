@@ -17,6 +17,10 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <chrono>
+#include <random>
+#include <vector>
+
 namespace {
 class Etc2Test : public ::testing::Test {
 protected:
@@ -47,6 +51,37 @@ protected:
             EXPECT_EQ(expectedDecoded[i], decoded[i]);
         }
     }
+    // Builds a |width| x |height| image by repeating |blocks|.
+    static std::vector<etc1_byte> tileImage(ETC2ImageFormat format,
+                                            const std::vector<etc1_byte>& blocks,
+                                            int width, int height) {
+        std::vector<etc1_byte> encoded(etc_get_encoded_data_size(format, width, height));
+        for (size_t i = 0; i < encoded.size(); i++) {
+            encoded[i] = blocks[i % blocks.size()];
+        }
+        return encoded;
+    }
+    static int decodedStride(ETC2ImageFormat format, int width) {
+        return (width * etc_get_decoded_pixel_size(format) + 3) & ~3;
+    }
+    // Decodes |encoded| with both image decoders and asserts that they match.
+    void compareImageDecoders(ETC2ImageFormat format, const std::vector<etc1_byte>& encoded,
+                              int width, int height) {
+        SCOPED_TRACE(::testing::Message() << "format " << format << " " << width << "x"
+                                          << height);
+        const int stride = decodedStride(format, width);
+        std::vector<etc1_byte> expected(stride * height, 0xcd);
+        std::vector<etc1_byte> decoded(stride * height, 0xcd);
+        ASSERT_EQ(0, etc2_decode_image(encoded.data(), format, expected.data(), width, height,
+                                       stride));
+        ASSERT_EQ(0, etc2_decode_image_fast(encoded.data(), format, decoded.data(), width,
+                                            height, stride));
+        ASSERT_EQ(expected.size(), decoded.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i], decoded[i]) << "at byte " << i << " (row " << i / stride
+                                               << ", column byte " << i % stride << ")";
+        }
+    }
 };
 }
 
@@ -227,3 +262,82 @@ TEST_F(Etc2Test, ETC2RGB8A1_OP0_Planer) {
         118, 224, 245, 255, 113, 221, 244, 255, 107, 219, 243, 255, 102, 216, 242, 255};
     decodeRgb8A1Test((const etc1_byte*)encoded, (const etc1_byte*)expectedDecoded);
 }
+
+// etc2_decode_image_fast() tests. Both decoders must produce the same bytes,
+// on the blocks above and on random ones that cover every mode.
+
+TEST_F(Etc2Test, FastDecoderMatchesFixtures) {
+    const std::vector<etc1_byte> rgbBlocks = {
+        21, 101, 186, 135, 166, 238, 74, 106,   // T
+        110, 13, 228, 186, 119, 119, 255, 117,  // H
+        89, 138, 250, 79, 120, 181, 146, 29};   // Planar
+    const std::vector<etc1_byte> rgb8A1Blocks = {
+        133, 15, 243, 23, 187, 211, 189, 62,
+        118, 223, 240, 4, 193, 19, 210, 0,
+        6, 173, 5, 168, 230, 102, 76, 128,
+        149, 14, 131, 89, 19, 55, 117, 81,
+        35, 73, 249, 152, 191, 212, 60, 253};
+    const std::vector<etc1_byte> rgbaBlocks = {
+        101, 65, 229, 178, 147, 5, 32, 2,       // EAC alpha
+        89, 138, 250, 79, 120, 181, 146, 29};
+    const std::vector<etc1_byte> r11Blocks = {
+        45, 16, 23, 116, 38, 100, 86, 208,
+        198, 123, 74, 150, 120, 104, 6, 137};
+    for (int size : {4, 13, 64}) {
+        ASSERT_NO_FATAL_FAILURE(compareImageDecoders(
+                EtcRGB8, tileImage(EtcRGB8, rgbBlocks, size, size), size, size));
+        ASSERT_NO_FATAL_FAILURE(compareImageDecoders(
+                EtcRGB8A1, tileImage(EtcRGB8A1, rgb8A1Blocks, size, size), size, size));
+        ASSERT_NO_FATAL_FAILURE(compareImageDecoders(
+                EtcRGBA8, tileImage(EtcRGBA8, rgbaBlocks, size, size), size, size));
+        for (auto format : {EtcR11, EtcSignedR11, EtcRG11, EtcSignedRG11}) {
+            ASSERT_NO_FATAL_FAILURE(compareImageDecoders(
+                    format, tileImage(format, r11Blocks, size, size), size, size));
+        }
+    }
+}
+
+TEST_F(Etc2Test, FastDecoderMatchesRandomBlocks) {
+    std::mt19937 random(1234);
+    // The last size is large enough to be split across threads.
+    const std::pair<int, int> sizes[] = {{1, 1}, {3, 7}, {130, 67}, {1024, 515}};
+    for (auto format : {EtcRGB8, EtcRGBA8, EtcR11, EtcSignedR11, EtcRG11, EtcSignedRG11,
+                        EtcRGB8A1}) {
+        for (const auto& size : sizes) {
+            std::vector<etc1_byte> encoded(
+                    etc_get_encoded_data_size(format, size.first, size.second));
+            for (auto& byte : encoded) {
+                byte = random();
+            }
+            ASSERT_NO_FATAL_FAILURE(
+                    compareImageDecoders(format, encoded, size.first, size.second));
+        }
+    }
+}
+
+// Not a correctness test: prints how long both decoders take on a 2048x2048
+// image, e.g. to compare them on a given machine. Run it with
+// --gtest_also_run_disabled_tests.
+TEST_F(Etc2Test, DISABLED_DecodeImageBenchmark) {
+    const int size = 2048;
+    const std::vector<etc1_byte> rgbaBlocks = {
+        101, 65, 229, 178, 147, 5, 32, 2,
+        21, 101, 186, 135, 166, 238, 74, 106,
+        101, 65, 229, 178, 147, 5, 32, 2,
+        110, 13, 228, 186, 119, 119, 255, 117,
+        101, 65, 229, 178, 147, 5, 32, 2,
+        89, 138, 250, 79, 120, 181, 146, 29};
+    const auto encoded = tileImage(EtcRGBA8, rgbaBlocks, size, size);
+    const int stride = decodedStride(EtcRGBA8, size);
+    std::vector<etc1_byte> decoded(stride * size);
+    auto timeMs = [&](auto decode) {
+        const auto start = std::chrono::steady_clock::now();
+        decode(encoded.data(), EtcRGBA8, decoded.data(), size, size, stride);
+        return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    };
+    const double scalarMs = timeMs(etc2_decode_image);
+    const double fastMs = timeMs(etc2_decode_image_fast);
+    printf("RGBA8 %dx%d: etc2_decode_image %.2f ms, etc2_decode_image_fast %.2f ms\n",
+           size, size, scalarMs, fastMs);
+}
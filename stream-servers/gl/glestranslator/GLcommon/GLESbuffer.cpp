@@ -15,10 +15,12 @@
 */
 #include <GLcommon/GLESbuffer.h>
 #include <GLcommon/GLEScontext.h>
+#include <GLcommon/VertexConversion.h>
 #include <string.h>
 #include <limits.h>
 
 bool  GLESbuffer::setBuffer(GLuint size,GLuint usage,const GLvoid* data) {
+    android::base::AutoLock lock(m_indexRangeLock);
     m_size = size;
     m_usage = usage;
     if(m_data) {
@@ -32,17 +34,51 @@ bool  GLESbuffer::setBuffer(GLuint size,GLuint usage,const GLvoid* data) {
         }
         m_conversionManager.clear();
         m_conversionManager.addRange(Range(0,m_size));
+        m_numIndexRanges = 0;
         return true;
     }
     return false;
 }
 
 bool  GLESbuffer::setSubBuffer(GLuint offset, GLuint size, const GLvoid* data) {
+    android::base::AutoLock lock(m_indexRangeLock);
     if (UINT_MAX - offset < size) return false;
     if(offset + size > m_size) return false;
     memcpy(m_data+offset,data,size);
     m_conversionManager.addRange(Range(offset,size));
     m_conversionManager.merge();
+    m_numIndexRanges = 0;
+    return true;
+}
+
+bool GLESbuffer::getIndexRange(GLenum type, const GLvoid* indices, GLsizei count,
+                               GLuint* minIndex, GLuint* maxIndex) {
+    if (count < 0) return false;
+    const GLuint indexSize = type == GL_UNSIGNED_BYTE    ? 1
+                             : type == GL_UNSIGNED_SHORT ? 2
+                                                         : 4;
+    android::base::AutoLock lock(m_indexRangeLock);
+    const unsigned char* ptr = static_cast<const unsigned char*>(indices);
+    if (!m_data || ptr < m_data || ptr >= m_data + m_size) {
+        return false;
+    }
+    const GLuint offset = ptr - m_data;
+    if ((m_size - offset) / indexSize < (GLuint)count) {
+        return false;
+    }
+    for (size_t i = 0; i < m_numIndexRanges; i++) {
+        const IndexRange& range = m_indexRanges[i];
+        if (range.type == type && range.offset == offset && range.count == count) {
+            *minIndex = range.minIndex;
+            *maxIndex = range.maxIndex;
+            return true;
+        }
+    }
+    findIndexRange(type, m_data + offset, count, minIndex, maxIndex);
+    // Replaces the oldest entry once the cache is full.
+    m_indexRanges[m_nextIndexRange] = {type, offset, count, *minIndex, *maxIndex};
+    m_nextIndexRange = (m_nextIndexRange + 1) % kMaxIndexRanges;
+    if (m_numIndexRanges < kMaxIndexRanges) m_numIndexRanges++;
     return true;
 }
 
@@ -36,6 +36,7 @@
 #include <GLcommon/TextureUtils.h>
 #include <GLcommon/FramebufferData.h>
 #include <GLcommon/ScopedGLState.h>
+#include <GLcommon/VertexConversion.h>
 #ifndef _MSC_VER
 #include <strings.h>
 #endif
@@ -1011,13 +1012,16 @@ const GLESpointer* GLEScontext::getPointer(GLenum arrType) {
 }
 
 static void convertFixedDirectLoop(const char* dataIn,unsigned int strideIn,void* dataOut,unsigned int nBytes,unsigned int strideOut,int attribSize) {
-
-    for(unsigned int i = 0; i < nBytes;i+=strideOut) {
-        const GLfixed* fixed_data = (const GLfixed *)dataIn;
-        //filling attrib
-        for(int j=0;j<attribSize;j++) {
-            reinterpret_cast<GLfloat*>(&static_cast<unsigned char*>(dataOut)[i])[j] = X2F(fixed_data[j]);
-        }
+    const unsigned int nVertices = (nBytes + strideOut - 1) / strideOut;
+    // GLfixed and GLfloat have the same size, so tightly packed input converts in one go.
+    if (strideIn == strideOut) {
+        convertFixedToFloat((const GLfixed*)dataIn, (GLfloat*)dataOut, nVertices * attribSize);
+        return;
+    }
+    for(unsigned int i = 0; i < nVertices; i++) {
+        convertFixedToFloat((const GLfixed*)dataIn,
+                            reinterpret_cast<GLfloat*>(static_cast<unsigned char*>(dataOut) + i*strideOut),
+                            attribSize);
         dataIn += strideIn;
     }
 }
@@ -1028,21 +1032,20 @@ static void convertFixedIndirectLoop(const char* dataIn,unsigned int strideIn,vo
 
         const GLfixed* fixed_data = (GLfixed *)(dataIn  + index*strideIn);
         GLfloat* float_data = reinterpret_cast<GLfloat*>(static_cast<unsigned char*>(dataOut) + index*strideOut);
-
-        for(int j=0;j<attribSize;j++) {
-            float_data[j] = X2F(fixed_data[j]);
-         }
+        convertFixedToFloat(fixed_data, float_data, attribSize);
     }
 }
 
 static void convertByteDirectLoop(const char* dataIn,unsigned int strideIn,void* dataOut,unsigned int nBytes,unsigned int strideOut,int attribSize) {
-
-    for(unsigned int i = 0; i < nBytes;i+=strideOut) {
-        const GLbyte* byte_data = (const GLbyte *)dataIn;
-        //filling attrib
-        for(int j=0;j<attribSize;j++) {
-            reinterpret_cast<GLshort*>(&static_cast<unsigned char*>(dataOut)[i])[j] = B2S(byte_data[j]);
-        }
+    const unsigned int nVertices = (nBytes + strideOut - 1) / strideOut;
+    if (strideIn == (unsigned int)attribSize && strideOut == attribSize*sizeof(GLshort)) {
+        convertByteToShort((const GLbyte*)dataIn, (GLshort*)dataOut, nVertices * attribSize);
+        return;
+    }
+    for(unsigned int i = 0; i < nVertices; i++) {
+        convertByteToShort((const GLbyte*)dataIn,
+                           reinterpret_cast<GLshort*>(static_cast<unsigned char*>(dataOut) + i*strideOut),
+                           attribSize);
         dataIn += strideIn;
     }
 }
@@ -1052,10 +1055,7 @@ static void convertByteIndirectLoop(const char* dataIn,unsigned int strideIn,voi
         GLuint index = getIndex(indices_type, indices, i);
         const GLbyte* bytes_data = (GLbyte *)(dataIn  + index*strideIn);
         GLshort* short_data = reinterpret_cast<GLshort*>(static_cast<unsigned char*>(dataOut) + index*strideOut);
-
-        for(int j=0;j<attribSize;j++) {
-            short_data[j] = B2S(bytes_data[j]);
-         }
+        convertByteToShort(bytes_data, short_data, attribSize);
     }
 }
 static void directToBytesRanges(GLint first,GLsizei count,GLESpointer* p,RangeList& list) {
@@ -1142,30 +1142,31 @@ void GLEScontext::convertDirectVBO(GLESConversionArrays& cArrs,GLint first,GLsiz
 }
 
 unsigned int GLEScontext::findMaxIndex(GLsizei count,GLenum type,const GLvoid* indices) {
-    //finding max index
-    unsigned int max = 0;
-    if(type == GL_UNSIGNED_BYTE) {
-        GLubyte*  b_indices  =(GLubyte *)indices;
-        for(int i=0;i<count;i++) {
-            if(b_indices[i] > max) max = b_indices[i];
-        }
-    } else if (type == GL_UNSIGNED_SHORT) {
-        GLushort* us_indices =(GLushort *)indices;
-        for(int i=0;i<count;i++) {
-            if(us_indices[i] > max) max = us_indices[i];
-        }
-    } else { // type == GL_UNSIGNED_INT
-        GLuint* ui_indices =(GLuint *)indices;
-        for(int i=0;i<count;i++) {
-            if(ui_indices[i] > max) max = ui_indices[i];
-        }
+    GLuint minIndex, maxIndex;
+    findIndexRange(type, indices, count > 0 ? count : 0, &minIndex, &maxIndex);
+    return maxIndex;
+}
+
+unsigned int GLEScontext::findMaxIndexCached(GLsizei count,GLenum type,const GLvoid* indices) {
+    GLuint bufferName = getBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    // Holds a reference, as another context of the share group may delete the
+    // buffer meanwhile.
+    ObjectDataPtr ibo = bufferName ? m_shareGroup->getObjectDataPtr(
+                                         NamedObjectType::VERTEXBUFFER, bufferName)
+                                   : nullptr;
+    GLuint minIndex, maxIndex;
+    // Buffers that were never given data have no object data, and indices
+    // that don't come from the buffer can't be cached.
+    if (ibo && static_cast<GLESbuffer*>(ibo.get())->getIndexRange(type, indices, count,
+                                                                  &minIndex, &maxIndex)) {
+        return maxIndex;
     }
-    return max;
+    return findMaxIndex(count, type, indices);
 }
 
 void GLEScontext::convertIndirect(GLESConversionArrays& cArrs,GLsizei count,GLenum indices_type,const GLvoid* indices,GLenum array_id,GLESpointer* p) {
     GLenum type    = p->getType();
-    int maxElements = findMaxIndex(count,indices_type,indices) + 1;
+    int maxElements = findMaxIndexCached(count,indices_type,indices) + 1;
 
     int attribSize = p->getSize();
     int size = attribSize * maxElements;
@@ -164,6 +164,37 @@ void NameSpace::onSave(android::base::Stream* stream) {
 static ObjectDataPtr* nullObjectData = new ObjectDataPtr;
 static NamedObjectPtr* nullNamedObject = new NamedObjectPtr;
 
+// Flags of the NameSpace::m_denseNames entries.
+static constexpr uint64_t kDenseNameFound = 1ULL << 32;
+static constexpr uint64_t kDenseNameEverBound = 1ULL << 33;
+
+void NameSpace::setDenseName(ObjectLocalName p_localName,
+                             const NamedObjectPtr& p_namedObject) {
+    if (!m_denseNames.contains(p_localName)) return;
+    const uint64_t everBound =
+            m_denseNames.get(p_localName) & kDenseNameEverBound;
+    m_denseNames.set(p_localName, kDenseNameFound | everBound |
+                                          p_namedObject->getGlobalName());
+}
+
+bool NameSpace::lookupDense(ObjectLocalName p_localName,
+                            DenseLookup* result) const {
+    if (!m_denseNames.contains(p_localName)) return false;
+    const uint64_t entry = m_denseNames.get(p_localName);
+    // Like getExceptZero_const(), name 0 is never an object.
+    result->found = p_localName && (entry & kDenseNameFound);
+    result->everBound = entry & kDenseNameEverBound;
+    result->globalName = result->found ? (unsigned int)entry : 0;
+    return true;
+}
+
+bool NameSpace::getObjectDataDense(ObjectLocalName p_localName,
+                                   ObjectData** result) const {
+    if (!m_denseObjectData.contains(p_localName)) return false;
+    *result = m_denseObjectData.get(p_localName);
+    return true;
+}
+
 ObjectLocalName
 NameSpace::genName(GenNameInfo genNameInfo, ObjectLocalName p_localName, bool genLocal)
 {
@@ -178,6 +209,7 @@ NameSpace::genName(GenNameInfo genNameInfo, ObjectLocalName p_localName, bool ge
 
     auto newObjPtr = NamedObjectPtr( new NamedObject(genNameInfo, m_globalNameSpace));
     m_localToGlobalMap.add(localName, newObjPtr);
+    setDenseName(localName, newObjPtr);
 
     unsigned int globalName = newObjPtr->getGlobalName();
     m_globalToLocalMap.add(globalName, localName);
@@ -226,6 +258,10 @@ NameSpace::deleteName(ObjectLocalName p_localName)
 
     m_objectDataMap.erase(p_localName);
     m_boundMap.remove(p_localName);
+    if (m_denseNames.contains(p_localName)) {
+        m_denseNames.set(p_localName, 0);
+        m_denseObjectData.set(p_localName, nullptr);
+    }
 }
 
 bool
@@ -246,6 +282,7 @@ NameSpace::setGlobalObject(ObjectLocalName p_localName,
     } else {
         m_localToGlobalMap.add(p_localName, p_namedObject);
     }
+    setDenseName(p_localName, p_namedObject);
 
     m_globalToLocalMap.add(p_namedObject->getGlobalName(), p_localName);
 }
@@ -258,6 +295,7 @@ NameSpace::replaceGlobalObject(ObjectLocalName p_localName,
     if (objPtrPtr) {
         m_globalToLocalMap.remove((*objPtrPtr)->getGlobalName());
         *objPtrPtr = p_namedObject;
+        setDenseName(p_localName, p_namedObject);
         m_globalToLocalMap.add(p_namedObject->getGlobalName(), p_localName);
     }
 }
@@ -265,6 +303,10 @@ NameSpace::replaceGlobalObject(ObjectLocalName p_localName,
 // sets that the local name has been bound at least once, to save time later
 void NameSpace::setBoundAtLeastOnce(ObjectLocalName p_localName) {
     m_boundMap.add(p_localName, true);
+    if (m_denseNames.contains(p_localName)) {
+        m_denseNames.set(p_localName, m_denseNames.get(p_localName) |
+                                              kDenseNameEverBound);
+    }
 }
 
 // sets that the local name has been bound at least once, to save time later
@@ -293,6 +335,9 @@ const ObjectDataPtr& NameSpace::getObjectDataPtr(
 
 void NameSpace::setObjectData(ObjectLocalName p_localName,
         ObjectDataPtr data) {
+    if (m_denseObjectData.contains(p_localName)) {
+        m_denseObjectData.set(p_localName, data.get());
+    }
     m_objectDataMap[p_localName] = std::move(data);
 }
 
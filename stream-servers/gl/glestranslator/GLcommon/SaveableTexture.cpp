@@ -19,7 +19,10 @@
 #include "aemu/base/ArraySize.h"
 #include "aemu/base/containers/SmallVector.h"
 #include "aemu/base/files/StreamSerializing.h"
+#include "aemu/base/synchronization/ConditionVariable.h"
+#include "aemu/base/synchronization/Lock.h"
 #include "aemu/base/system/System.h"
+#include "aemu/base/threads/ThreadPool.h"
 
 #include "GLcommon/GLEScontext.h"
 #include "GLcommon/GLutils.h"
@@ -28,7 +31,12 @@
 #include "host-common/crash_reporter.h"
 #include "host-common/logging.h"
 
+#include "lz4.h"
+
 #include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
 
 #define SAVEABLE_TEXTURE_DEBUG 0
 
@@ -491,6 +499,101 @@ static TextureDataReader* sTextureDataReader() {
     return r;
 }
 
+// Texel payloads are LZ4 compressed when saved. Each level is written as its
+// raw size, its stored size and the stored bytes, which are left uncompressed
+// when LZ4 does not make them smaller. The (de)compression of large levels
+// runs on a worker pool, overlapping with the readback or stream reads of the
+// next levels.
+static constexpr size_t kMinPooledPayloadSize = 64 * 1024;
+static constexpr uint32_t kMaxNumPayloadThreads = 4;
+
+using PayloadTask = std::function<void()>;
+
+static android::base::ThreadPool<PayloadTask>& sPayloadThreadPool() {
+    // Never destroyed, so that a snapshot saved at exit doesn't use a joined
+    // pool.
+    static android::base::ThreadPool<PayloadTask>* sPool = [] {
+        const uint32_t numThreads =
+                std::clamp(std::thread::hardware_concurrency() / 2, 1u,
+                           kMaxNumPayloadThreads);
+        auto pool = new android::base::ThreadPool<PayloadTask>(
+                numThreads,
+                [](PayloadTask&& task, android::base::ThreadPoolWorkerId) {
+                    task();
+                });
+        pool->start();
+        return pool;
+    }();
+    return *sPool;
+}
+
+// Runs the (de)compression of one texture's levels, and waits for all of them
+// on destruction. Small payloads are processed inline.
+class PayloadTasks {
+public:
+    ~PayloadTasks() { wait(); }
+
+    void run(size_t payloadSize, PayloadTask&& task) {
+        if (payloadSize < kMinPooledPayloadSize) {
+            task();
+            return;
+        }
+        {
+            android::base::AutoLock lock(mLock);
+            mPending++;
+        }
+        sPayloadThreadPool().enqueue([this, task = std::move(task)] {
+            task();
+            android::base::AutoLock lock(mLock);
+            if (--mPending == 0) {
+                mCv.signalAndUnlock(&lock);
+            }
+        });
+    }
+
+    void wait() {
+        android::base::AutoLock lock(mLock);
+        mCv.wait(&lock, [this] { return mPending == 0; });
+    }
+
+private:
+    android::base::Lock mLock;
+    android::base::ConditionVariable mCv;
+    size_t mPending = 0;
+};
+
+// Leaves |compressed| empty if the payload is to be stored as is.
+static void s_compressPayload(const unsigned char* data, size_t size,
+                              std::vector<char>* compressed) {
+    compressed->clear();
+    if (!size || size > LZ4_MAX_INPUT_SIZE) {
+        return;
+    }
+    compressed->resize(LZ4_compressBound(static_cast<int>(size)));
+    const int compressedSize = LZ4_compress_default(
+            reinterpret_cast<const char*>(data), compressed->data(),
+            static_cast<int>(size), static_cast<int>(compressed->size()));
+    if (compressedSize <= 0 || static_cast<size_t>(compressedSize) >= size) {
+        compressed->clear();
+        return;
+    }
+    compressed->resize(compressedSize);
+}
+
+static void s_savePayload(
+        android::base::Stream* stream,
+        const android::base::SmallFixedVector<unsigned char, 16>& data,
+        const std::vector<char>& compressed) {
+    stream->putBe32(data.size());
+    if (compressed.empty()) {
+        stream->putBe32(data.size());
+        stream->write(data.data(), data.size());
+    } else {
+        stream->putBe32(compressed.size());
+        stream->write(compressed.data(), compressed.size());
+    }
+}
+
 void SaveableTexture::preSave() {
     sTextureDataReader()->preSave();
 }
@@ -540,14 +643,40 @@ void SaveableTexture::loadFromStream(android::base::Stream* stream) {
                                std::unique_ptr<LevelImageData[]>& levelData,
                                bool isDepth) {
             levelData.reset(new LevelImageData[numLevels]);
+            std::vector<std::vector<char>> compressed(numLevels);
+            PayloadTasks decompressions;
             for (unsigned int level = 0; level < numLevels; level++) {
                 levelData[level].m_width = stream->getBe32();
                 levelData[level].m_height = stream->getBe32();
                 if (isDepth) {
                     levelData[level].m_depth = stream->getBe32();
                 }
-                loadBuffer(stream, &levelData[level].m_data);
+                auto& data = levelData[level].m_data;
+                const uint32_t size = stream->getBe32();
+                const uint32_t storedSize = stream->getBe32();
+                data.resize_noinit(size);
+                if (storedSize == size) {
+                    stream->read(data.data(), size);
+                    continue;
+                }
+                auto& src = compressed[level];
+                src.resize(storedSize);
+                stream->read(src.data(), storedSize);
+                decompressions.run(size, [&data, &src] {
+                    const int decompressedSize = LZ4_decompress_safe(
+                            src.data(), reinterpret_cast<char*>(data.data()),
+                            static_cast<int>(src.size()),
+                            static_cast<int>(data.size()));
+                    if (decompressedSize != static_cast<int>(data.size())) {
+                        GL_LOG("SaveableTexture: corrupted texture data, "
+                               "%d of %zu bytes decompressed\n",
+                               decompressedSize, data.size());
+                        data.clear();
+                    }
+                    src = std::vector<char>();
+                });
             }
+            decompressions.wait();
         };
         switch (m_target) {
             case GL_TEXTURE_2D:
@@ -655,6 +784,17 @@ void SaveableTexture::onSave(
         auto saveTex = [this, stream, numLevels, &dispatcher, isLowMem](
                                 GLenum target, bool isDepth,
                                 std::unique_ptr<LevelImageData[]>& imgData) {
+            // Each level is compressed while the next ones are read back.
+            std::vector<std::vector<char>> compressed(numLevels);
+            PayloadTasks compressions;
+            auto compressLevel = [&imgData, &compressed,
+                                  &compressions](unsigned int level) {
+                const auto& data = imgData.get()[level].m_data;
+                auto* dst = &compressed[level];
+                compressions.run(data.size(), [&data, dst] {
+                    s_compressPayload(data.data(), data.size(), dst);
+                });
+            };
 
             if (m_isDirty) {
                 imgData.reset(new LevelImageData[numLevels]);
@@ -731,15 +871,22 @@ void SaveableTexture::onSave(
                         sTextureDataReader()->getTexImage(
                             m_globalName, target, level, neededBufferFormat, m_type, width, height, depth, buffer.data());
                     }
+                    compressLevel(level);
+                }
+            } else {
+                for (unsigned int level = 0; level < numLevels; level++) {
+                    compressLevel(level);
                 }
             }
+            compressions.wait();
             for (unsigned int level = 0; level < numLevels; level++) {
                 stream->putBe32(imgData.get()[level].m_width);
                 stream->putBe32(imgData.get()[level].m_height);
                 if (isDepth) {
                     stream->putBe32(imgData.get()[level].m_depth);
                 }
-                saveBuffer(stream, imgData.get()[level].m_data);
+                s_savePayload(stream, imgData.get()[level].m_data,
+                              compressed[level]);
             }
 
             // If under memory pressure, delete this intermediate buffer.
@@ -186,6 +186,11 @@ ShareGroup::getGlobalName(NamedObjectType p_type,
     if (toIndex(p_type) >= toIndex(NamedObjectType::NUM_OBJECT_TYPES)) {
         return 0;
     }
+    // This runs for about every GL call, so avoid the lock when we can.
+    NameSpace::DenseLookup lookup;
+    if (m_nameSpace[toIndex(p_type)]->lookupDense(p_localName, &lookup)) {
+        return lookup.globalName;
+    }
     android::base::AutoLock lock(m_namespaceLock);
     return m_nameSpace[toIndex(p_type)]->getGlobalName(p_localName);
 }
@@ -235,6 +240,10 @@ ShareGroup::isObject(NamedObjectType p_type, ObjectLocalName p_localName)
         return 0;
     }
 
+    NameSpace::DenseLookup lookup;
+    if (m_nameSpace[toIndex(p_type)]->lookupDense(p_localName, &lookup)) {
+        return lookup.found;
+    }
     android::base::AutoLock lock(m_namespaceLock);
     return m_nameSpace[toIndex(p_type)]->isObject(p_localName);
 }
@@ -301,6 +310,10 @@ ObjectData* ShareGroup::getObjectData(NamedObjectType p_type,
         toIndex(NamedObjectType::NUM_OBJECT_TYPES))
         return nullptr;
 
+    ObjectData* data;
+    if (m_nameSpace[toIndex(p_type)]->getObjectDataDense(p_localName, &data)) {
+        return data;
+    }
     ObjectDataAutoLock lock(this);
     return getObjectDataPtrNoLock(p_type, p_localName).get();
 }
@@ -320,11 +333,19 @@ ObjectDataPtr ShareGroup::getObjectDataPtr(NamedObjectType p_type,
 #define CC_UNLIKELY( exp )  (__builtin_expect( !!(exp), false ))
 
 unsigned int ShareGroup::ensureObjectOnBind(NamedObjectType p_type, ObjectLocalName p_localName) {
+    auto ns = m_nameSpace[toIndex(p_type)];
+
+    // Objects are only created and set up on their first bind, so the
+    // following ones don't need the locks.
+    NameSpace::DenseLookup lookup;
+    if (CC_LIKELY(ns->lookupDense(p_localName, &lookup)) && lookup.found &&
+        lookup.everBound) {
+        return lookup.globalName;
+    }
+
     android::base::AutoLock lock(m_namespaceLock);
     ObjectDataAutoLock objDataLock(this);
 
-    auto ns = m_nameSpace[toIndex(p_type)];
-
     bool isObj;
     unsigned int globalName = ns->getGlobalName(p_localName, &isObj);
 
@@ -22,6 +22,7 @@
 #include <memory>
 
 #include "aemu/base/AlignedBuf.h"
+#include "aemu/base/system/System.h"
 #include "compressedTextureFormats/AstcCpuDecompressor.h"
 
 using android::AlignedBuf;
@@ -34,6 +35,14 @@ using goldfish_vk::AstcCpuDecompressor;
 
 static constexpr size_t kASTCFormatsCount = 28;
 
+// ETC textures are decoded with etc2_decode_image_fast() unless
+// ANDROID_EMUGL_ETC_DECODER=scalar, which selects the original decoder.
+static bool useFastEtcDecoder() {
+    static const bool sUseFast =
+            android::base::getEnvironmentVariable("ANDROID_EMUGL_ETC_DECODER") != "scalar";
+    return sUseFast;
+}
+
 #define ASTC_FORMATS_LIST(EXPAND_MACRO) \
     EXPAND_MACRO(GL_COMPRESSED_RGBA_ASTC_4x4_KHR, 4, 4, false) \
     EXPAND_MACRO(GL_COMPRESSED_RGBA_ASTC_5x4_KHR, 5, 4, false) \
@@ -482,10 +491,10 @@ void doCompressedTexImage2D(GLEScontext* ctx, GLenum target, GLint level,
         const size_t size = bpr * height;
         std::unique_ptr<etc1_byte[]> pOut(new etc1_byte[size]);
 
+        const auto decode = useFastEtcDecoder() ? etc2_decode_image_fast : etc2_decode_image;
         int res =
-            etc2_decode_image(
-                    (const etc1_byte*)data, etcFormat, pOut.get(),
-                    width, height, bpr);
+            decode((const etc1_byte*)data, etcFormat, pOut.get(),
+                   width, height, bpr);
         SET_ERROR_IF(res!=0, GL_INVALID_VALUE);
 
         glTexImage2DPtr(target, level, convertedInternalFormat,
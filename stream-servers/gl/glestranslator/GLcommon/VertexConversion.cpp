@@ -0,0 +1,300 @@
+/*
+* Copyright (C) 2023 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "GLcommon/VertexConversion.h"
+
+#include "GLcommon/GLconversion_macros.h"
+
+#include <GLES/glext.h>
+#include <algorithm>
+#include <stdint.h>
+
+// SSE2 is part of x86-64, so only the wider instruction sets need checking
+// at runtime, which we only know how to do with GCC and clang.
+#if defined(__x86_64__) || defined(_M_X64)
+#define VERTEX_CONVERSION_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define VERTEX_CONVERSION_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace {
+
+// Scalar versions, also used for the remainders of the vectorized loops.
+
+void fixedToFloatScalar(const GLfixed* in, GLfloat* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = X2F(in[i]);
+    }
+}
+
+void byteToShortScalar(const GLbyte* in, GLshort* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = B2S(in[i]);
+    }
+}
+
+template <class T>
+void indexRangeScalar(const void* indices, size_t count, GLuint* minIndex,
+                      GLuint* maxIndex) {
+    const T* values = static_cast<const T*>(indices);
+    for (size_t i = 0; i < count; i++) {
+        *minIndex = std::min<GLuint>(*minIndex, values[i]);
+        *maxIndex = std::max<GLuint>(*maxIndex, values[i]);
+    }
+}
+
+// Folds the lanes of the vector min and max accumulators into the results.
+template <class T, size_t N>
+void reduceLanes(const T (&mins)[N], const T (&maxs)[N], GLuint* minIndex,
+                 GLuint* maxIndex) {
+    for (size_t i = 0; i < N; i++) {
+        *minIndex = std::min<GLuint>(*minIndex, mins[i]);
+        *maxIndex = std::max<GLuint>(*maxIndex, maxs[i]);
+    }
+}
+
+#ifdef VERTEX_CONVERSION_SSE2
+
+void fixedToFloatSse2(const GLfixed* in, GLfloat* out, size_t count) {
+    const __m128 scale = _mm_set1_ps(1.0f / 65536.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i fixed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        // Scaling by a power of 2 is exact, so this matches X2F().
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(fixed), scale));
+    }
+    fixedToFloatScalar(in + i, out + i, count - i);
+}
+
+void byteToShortSse2(const GLbyte* in, GLshort* out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        // Puts each byte in the high half of a 16-bit lane, then sign extends.
+        const __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+        const __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(bytes, bytes), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), hi);
+    }
+    byteToShortScalar(in + i, out + i, count - i);
+}
+
+void indexRangeU8Sse2(const void* indices, size_t count, GLuint* minIndex,
+                      GLuint* maxIndex) {
+    const GLubyte* values = static_cast<const GLubyte*>(indices);
+    size_t i = 0;
+    if (count >= 16) {
+        __m128i mins = _mm_set1_epi8(-1);
+        __m128i maxs = _mm_setzero_si128();
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            mins = _mm_min_epu8(mins, v);
+            maxs = _mm_max_epu8(maxs, v);
+        }
+        GLubyte minLanes[16], maxLanes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(minLanes), mins);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(maxLanes), maxs);
+        reduceLanes(minLanes, maxLanes, minIndex, maxIndex);
+    }
+    indexRangeScalar<GLubyte>(values + i, count - i, minIndex, maxIndex);
+}
+
+void indexRangeU16Sse2(const void* indices, size_t count, GLuint* minIndex,
+                       GLuint* maxIndex) {
+    const GLushort* values = static_cast<const GLushort*>(indices);
+    size_t i = 0;
+    if (count >= 8) {
+        // SSE2 only compares signed 16-bit values, so flip the sign bits to
+        // map the unsigned range onto the signed one.
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i mins = _mm_set1_epi16(0x7fff);
+        __m128i maxs = _mm_set1_epi16(static_cast<short>(0x8000));
+        for (; i + 8 <= count; i += 8) {
+            const __m128i v = _mm_xor_si128(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)), bias);
+            mins = _mm_min_epi16(mins, v);
+            maxs = _mm_max_epi16(maxs, v);
+        }
+        GLushort minLanes[8], maxLanes[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(minLanes), _mm_xor_si128(mins, bias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(maxLanes), _mm_xor_si128(maxs, bias));
+        reduceLanes(minLanes, maxLanes, minIndex, maxIndex);
+    }
+    indexRangeScalar<GLushort>(values + i, count - i, minIndex, maxIndex);
+}
+
+#endif  // VERTEX_CONVERSION_SSE2
+
+#ifdef VERTEX_CONVERSION_AVX2
+
+__attribute__((target("sse4.1")))
+void indexRangeU32Sse41(const void* indices, size_t count, GLuint* minIndex,
+                        GLuint* maxIndex) {
+    const GLuint* values = static_cast<const GLuint*>(indices);
+    size_t i = 0;
+    if (count >= 4) {
+        __m128i mins = _mm_set1_epi32(-1);
+        __m128i maxs = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            mins = _mm_min_epu32(mins, v);
+            maxs = _mm_max_epu32(maxs, v);
+        }
+        GLuint minLanes[4], maxLanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(minLanes), mins);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(maxLanes), maxs);
+        reduceLanes(minLanes, maxLanes, minIndex, maxIndex);
+    }
+    indexRangeScalar<GLuint>(values + i, count - i, minIndex, maxIndex);
+}
+
+__attribute__((target("avx2")))
+void fixedToFloatAvx2(const GLfixed* in, GLfloat* out, size_t count) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 65536.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i fixed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(fixed), scale));
+    }
+    fixedToFloatScalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void byteToShortAvx2(const GLbyte* in, GLshort* out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepi8_epi16(bytes));
+    }
+    byteToShortScalar(in + i, out + i, count - i);
+}
+
+// The three index types only differ in lane width.
+#define DEFINE_INDEX_RANGE_AVX2(name, T, lanes, set1, min, max)                          \
+    __attribute__((target("avx2")))                                                    \
+    void name(const void* indices, size_t count, GLuint* minIndex, GLuint* maxIndex) { \
+        const T* values = static_cast<const T*>(indices);                              \
+        size_t i = 0;                                                                  \
+        if (count >= lanes) {                                                          \
+            __m256i mins = set1(-1);                                                   \
+            __m256i maxs = _mm256_setzero_si256();                                     \
+            for (; i + lanes <= count; i += lanes) {                                   \
+                const __m256i v =                                                      \
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)); \
+                mins = min(mins, v);                                                   \
+                maxs = max(maxs, v);                                                   \
+            }                                                                          \
+            T minLanes[lanes], maxLanes[lanes];                                        \
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(minLanes), mins);           \
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxLanes), maxs);           \
+            reduceLanes(minLanes, maxLanes, minIndex, maxIndex);                       \
+        }                                                                              \
+        indexRangeScalar<T>(values + i, count - i, minIndex, maxIndex);                \
+    }
+
+DEFINE_INDEX_RANGE_AVX2(indexRangeU8Avx2, GLubyte, 32, _mm256_set1_epi8,
+                        _mm256_min_epu8, _mm256_max_epu8)
+DEFINE_INDEX_RANGE_AVX2(indexRangeU16Avx2, GLushort, 16, _mm256_set1_epi16,
+                        _mm256_min_epu16, _mm256_max_epu16)
+DEFINE_INDEX_RANGE_AVX2(indexRangeU32Avx2, GLuint, 8, _mm256_set1_epi32,
+                        _mm256_min_epu32, _mm256_max_epu32)
+
+#undef DEFINE_INDEX_RANGE_AVX2
+
+#endif  // VERTEX_CONVERSION_AVX2
+
+std::vector<VertexConversionKernels> availableKernels() {
+    std::vector<VertexConversionKernels> available;
+    VertexConversionKernels kernels = {
+        "scalar",
+        fixedToFloatScalar,
+        byteToShortScalar,
+        indexRangeScalar<GLubyte>,
+        indexRangeScalar<GLushort>,
+        indexRangeScalar<GLuint>,
+    };
+    available.push_back(kernels);
+#ifdef VERTEX_CONVERSION_SSE2
+    kernels.name = "sse2";
+    kernels.fixedToFloat = fixedToFloatSse2;
+    kernels.byteToShort = byteToShortSse2;
+    kernels.indexRangeU8 = indexRangeU8Sse2;
+    kernels.indexRangeU16 = indexRangeU16Sse2;
+    available.push_back(kernels);
+#endif
+#ifdef VERTEX_CONVERSION_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels.name = "sse4.1";
+        kernels.indexRangeU32 = indexRangeU32Sse41;
+        available.push_back(kernels);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.name = "avx2";
+        kernels.fixedToFloat = fixedToFloatAvx2;
+        kernels.byteToShort = byteToShortAvx2;
+        kernels.indexRangeU8 = indexRangeU8Avx2;
+        kernels.indexRangeU16 = indexRangeU16Avx2;
+        kernels.indexRangeU32 = indexRangeU32Avx2;
+        available.push_back(kernels);
+    }
+#endif
+    return available;
+}
+
+const VertexConversionKernels& kernels() {
+    static const VertexConversionKernels sKernels = availableKernels().back();
+    return sKernels;
+}
+
+}  // namespace
+
+std::vector<VertexConversionKernels> getVertexConversionKernelsForTesting() {
+    return availableKernels();
+}
+
+void convertFixedToFloat(const GLfixed* in, GLfloat* out, size_t count) {
+    kernels().fixedToFloat(in, out, count);
+}
+
+void convertByteToShort(const GLbyte* in, GLshort* out, size_t count) {
+    kernels().byteToShort(in, out, count);
+}
+
+void findIndexRange(GLenum type, const GLvoid* indices, size_t count,
+                    GLuint* minIndex, GLuint* maxIndex) {
+    if (!count) {
+        *minIndex = 0;
+        *maxIndex = 0;
+        return;
+    }
+    *minIndex = UINT32_MAX;
+    *maxIndex = 0;
+    switch (type) {
+        case GL_UNSIGNED_BYTE:
+            kernels().indexRangeU8(indices, count, minIndex, maxIndex);
+            break;
+        case GL_UNSIGNED_SHORT:
+            kernels().indexRangeU16(indices, count, minIndex, maxIndex);
+            break;
+        default:  // GL_UNSIGNED_INT
+            kernels().indexRangeU32(indices, count, minIndex, maxIndex);
+            break;
+    }
+}
@@ -0,0 +1,229 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <GLcommon/GLESbuffer.h>
+#include <GLcommon/VertexConversion.h>
+
+#include <GLES/glext.h>
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Odd lengths around the vector widths, so that every kernel runs both its
+// vector loop and its scalar remainder.
+const size_t kCounts[] = {0, 1, 3, 7, 15, 17, 31, 33, 63, 65, 1001};
+// Offsets from a 32-byte aligned address, in elements, so that the vector
+// loads and stores are unaligned.
+const size_t kMisalignments[] = {0, 1, 3};
+
+template <class T>
+std::vector<T> randomValues(std::mt19937* random, size_t count) {
+    std::vector<T> values(count);
+    for (auto& value : values) {
+        value = static_cast<T>((*random)());
+    }
+    return values;
+}
+
+// A copy of |values| starting |misalignment| elements after a 32-byte
+// boundary.
+template <class T>
+class UnalignedArray {
+public:
+    UnalignedArray(const std::vector<T>& values, size_t misalignment)
+        : m_storage((values.size() + misalignment) * sizeof(T) + 32) {
+        const uintptr_t aligned =
+                (reinterpret_cast<uintptr_t>(m_storage.data()) + 31) & ~uintptr_t(31);
+        m_data = reinterpret_cast<T*>(aligned) + misalignment;
+        if (!values.empty()) {
+            memcpy(m_data, values.data(), values.size() * sizeof(T));
+        }
+    }
+    T* data() { return m_data; }
+
+private:
+    std::vector<unsigned char> m_storage;
+    T* m_data;
+};
+
+using IndexRangeFunc = void (*)(const void*, size_t, GLuint*, GLuint*);
+
+template <class T>
+void compareIndexRange(IndexRangeFunc scalar, IndexRangeFunc kernel, const std::vector<T>& values,
+                       size_t misalignment) {
+    UnalignedArray<T> indices(values, misalignment);
+    GLuint expectedMin = UINT32_MAX, expectedMax = 0;
+    scalar(indices.data(), values.size(), &expectedMin, &expectedMax);
+    GLuint min = UINT32_MAX, max = 0;
+    kernel(indices.data(), values.size(), &min, &max);
+    ASSERT_EQ(expectedMin, min);
+    ASSERT_EQ(expectedMax, max);
+}
+
+}  // namespace
+
+TEST(VertexConversion, KernelsMatchScalar) {
+    const auto allKernels = getVertexConversionKernelsForTesting();
+    ASSERT_FALSE(allKernels.empty());
+    const VertexConversionKernels& scalar = allKernels.front();
+    std::mt19937 random(1234);
+    for (const auto& kernels : allKernels) {
+        for (size_t count : kCounts) {
+            for (size_t misalignment : kMisalignments) {
+                SCOPED_TRACE(::testing::Message() << kernels.name << " count " << count
+                                                  << " misalignment " << misalignment);
+
+                const auto fixed = randomValues<GLfixed>(&random, count);
+                UnalignedArray<GLfixed> fixedIn(fixed, misalignment);
+                std::vector<GLfloat> expectedFloats(count);
+                UnalignedArray<GLfloat> floats(expectedFloats, misalignment);
+                scalar.fixedToFloat(fixedIn.data(), expectedFloats.data(), count);
+                kernels.fixedToFloat(fixedIn.data(), floats.data(), count);
+                for (size_t i = 0; i < count; i++) {
+                    ASSERT_EQ(expectedFloats[i], floats.data()[i]) << "at " << i;
+                }
+
+                const auto bytes = randomValues<GLbyte>(&random, count);
+                UnalignedArray<GLbyte> bytesIn(bytes, misalignment);
+                std::vector<GLshort> expectedShorts(count);
+                UnalignedArray<GLshort> shorts(expectedShorts, misalignment);
+                scalar.byteToShort(bytesIn.data(), expectedShorts.data(), count);
+                kernels.byteToShort(bytesIn.data(), shorts.data(), count);
+                for (size_t i = 0; i < count; i++) {
+                    ASSERT_EQ(expectedShorts[i], shorts.data()[i]) << "at " << i;
+                }
+
+                ASSERT_NO_FATAL_FAILURE(compareIndexRange(
+                        scalar.indexRangeU8, kernels.indexRangeU8,
+                        randomValues<GLubyte>(&random, count), misalignment));
+                ASSERT_NO_FATAL_FAILURE(compareIndexRange(
+                        scalar.indexRangeU16, kernels.indexRangeU16,
+                        randomValues<GLushort>(&random, count), misalignment));
+                ASSERT_NO_FATAL_FAILURE(compareIndexRange(
+                        scalar.indexRangeU32, kernels.indexRangeU32,
+                        randomValues<GLuint>(&random, count), misalignment));
+            }
+        }
+    }
+}
+
+// The extremes of each index type, including the values that unsigned
+// comparisons emulated with signed ones get wrong.
+TEST(VertexConversion, KernelsHandleIndexExtremes) {
+    const auto allKernels = getVertexConversionKernelsForTesting();
+    const VertexConversionKernels& scalar = allKernels.front();
+    for (const auto& kernels : allKernels) {
+        SCOPED_TRACE(kernels.name);
+        for (size_t count : {17u, 33u, 65u}) {
+            std::vector<GLubyte> u8(count, 0x80);
+            u8[count - 1] = 0xff;
+            u8[1] = 0x7f;
+            ASSERT_NO_FATAL_FAILURE(
+                    compareIndexRange(scalar.indexRangeU8, kernels.indexRangeU8, u8, 1));
+            std::vector<GLushort> u16(count, 0x8000);
+            u16[count - 1] = 0xffff;
+            u16[2] = 0x7fff;
+            ASSERT_NO_FATAL_FAILURE(
+                    compareIndexRange(scalar.indexRangeU16, kernels.indexRangeU16, u16, 1));
+            std::vector<GLuint> u32(count, 0x80000000u);
+            u32[count - 1] = 0xffffffffu;
+            u32[3] = 0x7fffffffu;
+            ASSERT_NO_FATAL_FAILURE(
+                    compareIndexRange(scalar.indexRangeU32, kernels.indexRangeU32, u32, 1));
+        }
+    }
+}
+
+TEST(VertexConversion, FindIndexRangeOfNoIndices) {
+    GLuint min = 1, max = 1;
+    findIndexRange(GL_UNSIGNED_SHORT, nullptr, 0, &min, &max);
+    EXPECT_EQ(0u, min);
+    EXPECT_EQ(0u, max);
+}
+
+class GLESbufferIndexRangeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        const GLushort indices[] = {5, 3, 9, 4, 7, 6, 2, 8};
+        ASSERT_TRUE(m_buffer.setBuffer(sizeof(indices), GL_STATIC_DRAW, indices));
+    }
+
+    const GLushort* indices(size_t first = 0) {
+        return static_cast<const GLushort*>(m_buffer.getData()) + first;
+    }
+
+    void expectRange(size_t first, GLsizei count, GLuint expectedMin, GLuint expectedMax) {
+        GLuint min = 0, max = 0;
+        ASSERT_TRUE(m_buffer.getIndexRange(GL_UNSIGNED_SHORT, indices(first), count, &min,
+                                           &max));
+        EXPECT_EQ(expectedMin, min);
+        EXPECT_EQ(expectedMax, max);
+    }
+
+    GLESbuffer m_buffer;
+};
+
+TEST_F(GLESbufferIndexRangeTest, CachedRangesAreReused) {
+    expectRange(0, 8, 2, 9);
+    expectRange(0, 8, 2, 9);
+    expectRange(0, 4, 3, 9);
+    expectRange(4, 4, 2, 8);
+}
+
+TEST_F(GLESbufferIndexRangeTest, SubDataInvalidatesCache) {
+    expectRange(0, 8, 2, 9);
+    expectRange(4, 4, 2, 8);
+    const GLushort update[] = {1, 20};
+    ASSERT_TRUE(m_buffer.setSubBuffer(2 * sizeof(GLushort), sizeof(update), update));
+    expectRange(0, 8, 1, 20);
+    // Ranges the update doesn't overlap are still right too.
+    expectRange(4, 4, 2, 8);
+}
+
+TEST_F(GLESbufferIndexRangeTest, DataInvalidatesCache) {
+    expectRange(0, 8, 2, 9);
+    const GLushort replacement[] = {100, 50, 75, 60, 90, 80, 70, 65};
+    ASSERT_TRUE(m_buffer.setBuffer(sizeof(replacement), GL_STATIC_DRAW, replacement));
+    expectRange(0, 8, 50, 100);
+}
+
+TEST_F(GLESbufferIndexRangeTest, EvictedRangesAreRecomputed) {
+    // More ranges than the cache holds, then the first ones again.
+    for (int round = 0; round < 2; round++) {
+        for (size_t first = 0; first < 8; first++) {
+            for (GLsizei count = 1; first + count <= 8; count += 3) {
+                GLuint expectedMin = UINT32_MAX, expectedMax = 0;
+                for (GLsizei i = 0; i < count; i++) {
+                    expectedMin = std::min<GLuint>(expectedMin, indices(first)[i]);
+                    expectedMax = std::max<GLuint>(expectedMax, indices(first)[i]);
+                }
+                expectRange(first, count, expectedMin, expectedMax);
+            }
+        }
+    }
+}
+
+TEST_F(GLESbufferIndexRangeTest, RejectsIndicesOutsideData) {
+    GLuint min = 0, max = 0;
+    const GLushort outside[8] = {};
+    EXPECT_FALSE(m_buffer.getIndexRange(GL_UNSIGNED_SHORT, outside, 8, &min, &max));
+    EXPECT_FALSE(m_buffer.getIndexRange(GL_UNSIGNED_SHORT, indices(4), 5, &min, &max));
+    EXPECT_FALSE(m_buffer.getIndexRange(GL_UNSIGNED_SHORT, indices(), -1, &min, &max));
+}
@@ -14,11 +14,22 @@
 
 #include <GLcommon/etc.h>
 
+#include "aemu/base/synchronization/ConditionVariable.h"
+#include "aemu/base/synchronization/Lock.h"
+#include "aemu/base/threads/ThreadPool.h"
+
 #include <algorithm>
 #include <assert.h>
+#include <functional>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ETC_DECODE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 typedef uint16_t etc1_uint16;
 
@@ -293,8 +304,8 @@ static void etc2_T_H_index(const int* clrTable, etc1_uint32 low,
 //     from https://www.khronos.org/registry/gles/specs/3.0/es_spec_3.0.4.pdf
 //     page 289
 
-static void etc2_decode_block_T(etc1_uint32 high, etc1_uint32 low,
-        bool isPunchthroughAlpha, bool opaque, etc1_byte* pOut) {
+// Computes the 4 colors of a T mode block, as R, G, B triplets.
+static void etc2_T_colors(etc1_uint32 high, int* clrTable) {
     const int LUT[] = {3, 6, 11, 16, 23, 32, 41, 64};
     int r1, r2, g1, g2, b1, b2;
     r1 = convert4To8((((high >> 27) & 3) << 2) | ((high >> 24) & 3));
@@ -306,7 +317,6 @@ static void etc2_decode_block_T(etc1_uint32 high, etc1_uint32 low,
     // 3 bits intense modifier
     int intenseIdx = (((high >> 2) & 3) << 1) | (high & 1);
     int intenseMod = LUT[intenseIdx];
-    int clrTable[12];
     clrTable[0] = r1;
     clrTable[1] = g1;
     clrTable[2] = b1;
@@ -319,11 +329,17 @@ static void etc2_decode_block_T(etc1_uint32 high, etc1_uint32 low,
     clrTable[9] = clamp(r2 - intenseMod);
     clrTable[10] = clamp(g2 - intenseMod);
     clrTable[11] = clamp(b2 - intenseMod);
-    etc2_T_H_index(clrTable, low, isPunchthroughAlpha, opaque, pOut);
 }
 
-static void etc2_decode_block_H(etc1_uint32 high, etc1_uint32 low,
+static void etc2_decode_block_T(etc1_uint32 high, etc1_uint32 low,
         bool isPunchthroughAlpha, bool opaque, etc1_byte* pOut) {
+    int clrTable[12];
+    etc2_T_colors(high, clrTable);
+    etc2_T_H_index(clrTable, low, isPunchthroughAlpha, opaque, pOut);
+}
+
+// Computes the 4 colors of an H mode block, as R, G, B triplets.
+static void etc2_H_colors(etc1_uint32 high, int* clrTable) {
     const int LUT[] = {3, 6, 11, 16, 23, 32, 41, 64};
     int r1, r2, g1, g2, b1, b2;
     r1 = convert4To8(high >> 27);
@@ -337,7 +353,6 @@ static void etc2_decode_block_H(etc1_uint32 high, etc1_uint32 low,
     intenseIdx |= (high & 1) << 1;
     intenseIdx |= (((r1 << 16) | (g1 << 8) | b1) >= ((r2 << 16) | (g2 << 8) | b2));
     int intenseMod = LUT[intenseIdx];
-    int clrTable[12];
     clrTable[0] = clamp(r1 + intenseMod);
     clrTable[1] = clamp(g1 + intenseMod);
     clrTable[2] = clamp(b1 + intenseMod);
@@ -350,25 +365,40 @@ static void etc2_decode_block_H(etc1_uint32 high, etc1_uint32 low,
     clrTable[9] = clamp(r2 - intenseMod);
     clrTable[10] = clamp(g2 - intenseMod);
     clrTable[11] = clamp(b2 - intenseMod);
+}
+
+static void etc2_decode_block_H(etc1_uint32 high, etc1_uint32 low,
+        bool isPunchthroughAlpha, bool opaque, etc1_byte* pOut) {
+    int clrTable[12];
+    etc2_H_colors(high, clrTable);
     etc2_T_H_index(clrTable, low, isPunchthroughAlpha, opaque, pOut);
 }
 
-static void etc2_decode_block_P(etc1_uint32 high, etc1_uint32 low,
-        bool isPunchthroughAlpha, etc1_byte* pOut) {
-    int ro, go, bo, rh, gh, bh, rv, gv, bv;
+// Computes the origin, horizontal and vertical colors of a planar mode block,
+// as R, G, B triplets.
+static void etc2_P_colors(etc1_uint32 high, etc1_uint32 low, int* clrTable) {
     uint64_t data = high;
     data = data << 32 | low;
-    ro = convert6To8(data >> 57);
-    go = convert7To8((data >> 56 << 6) | ((data >> 49) & 63));
-    bo = convert6To8((data >> 48 << 5)
+    clrTable[0] = convert6To8(data >> 57);
+    clrTable[1] = convert7To8((data >> 56 << 6) | ((data >> 49) & 63));
+    clrTable[2] = convert6To8((data >> 48 << 5)
             | (((data >> 43) & 3 ) << 3)
             | ((data >> 39) & 7));
-    rh = convert6To8((data >> 34 << 1) | ((data >> 32) & 1));
-    gh = convert7To8(data >> 25);
-    bh = convert6To8(data >> 19);
-    rv = convert6To8(data >> 13);
-    gv = convert7To8(data >> 6);
-    bv = convert6To8(data);
+    clrTable[3] = convert6To8((data >> 34 << 1) | ((data >> 32) & 1));
+    clrTable[4] = convert7To8(data >> 25);
+    clrTable[5] = convert6To8(data >> 19);
+    clrTable[6] = convert6To8(data >> 13);
+    clrTable[7] = convert7To8(data >> 6);
+    clrTable[8] = convert6To8(data);
+}
+
+static void etc2_decode_block_P(etc1_uint32 high, etc1_uint32 low,
+        bool isPunchthroughAlpha, etc1_byte* pOut) {
+    int clrTable[9];
+    etc2_P_colors(high, low, clrTable);
+    const int ro = clrTable[0], go = clrTable[1], bo = clrTable[2];
+    const int rh = clrTable[3], gh = clrTable[4], bh = clrTable[5];
+    const int rv = clrTable[6], gv = clrTable[7], bv = clrTable[8];
     etc1_byte* q = pOut;
     for (int i = 0; i < 16; i++) {
         int y = i >> 2;
@@ -969,6 +999,388 @@ int etc2_decode_image(const etc1_byte* pIn, ETC2ImageFormat format,
     return 0;
 }
 
+// Fast image decoder.
+//
+// Color blocks are decoded to a palette of 8 packed RGBA colors (4 per
+// subblock) that pixels index into, instead of clamping every channel of
+// every pixel. Planar blocks and EAC channels are computed 8 pixels per
+// instruction with SSE2 on x86-64. Packed colors are stored with memcpy and
+// assume a little endian host, like the rest of the renderer.
+//
+// Images with many blocks are split by rows of blocks across a thread pool
+// shared by all the callers. The calling thread decodes one of the slices.
+
+namespace {
+
+// Below this many blocks per slice, the cost of waking up a worker thread
+// outweighs the decoding work it takes off the caller.
+constexpr etc1_uint32 kMinBlocksPerSlice = 4096;
+
+// Same bounds as the ASTC CPU decoder: leave half of the cores to the rest
+// of the emulator.
+constexpr uint32_t kMinNumDecodeThreads = 2;
+constexpr uint32_t kMaxNumDecodeThreads = 8;
+
+inline etc1_uint32 packRgba(int r, int g, int b, int a) {
+    return etc1_uint32(r) | etc1_uint32(g) << 8 | etc1_uint32(b) << 16 |
+           etc1_uint32(a) << 24;
+}
+
+void etc2_decode_block_P_fast(etc1_uint32 high, etc1_uint32 low,
+                              etc1_uint32* pixels) {
+    int clrTable[9];
+    etc2_P_colors(high, low, clrTable);
+#ifdef ETC_DECODE_SSE2
+    // Pixels of rows 0-1 and 2-3 in 16-bit lanes. The largest intermediate
+    // value is 3 * 255 * 2 + 4 * 255 + 2, which fits.
+    const __m128i x = _mm_setr_epi16(0, 1, 2, 3, 0, 1, 2, 3);
+    const __m128i yTop = _mm_setr_epi16(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m128i yBottom = _mm_setr_epi16(2, 2, 2, 2, 3, 3, 3, 3);
+    auto channel = [&](int o, int h, int v) {
+        const __m128i dh = _mm_mullo_epi16(x, _mm_set1_epi16(h - o));
+        const __m128i dv = _mm_set1_epi16(v - o);
+        const __m128i base = _mm_add_epi16(dh, _mm_set1_epi16(4 * o + 2));
+        const __m128i top =
+                _mm_srai_epi16(_mm_add_epi16(base, _mm_mullo_epi16(yTop, dv)), 2);
+        const __m128i bottom =
+                _mm_srai_epi16(_mm_add_epi16(base, _mm_mullo_epi16(yBottom, dv)), 2);
+        // Saturating to unsigned bytes is clamp().
+        return _mm_packus_epi16(top, bottom);
+    };
+    const __m128i r = channel(clrTable[0], clrTable[3], clrTable[6]);
+    const __m128i g = channel(clrTable[1], clrTable[4], clrTable[7]);
+    const __m128i b = channel(clrTable[2], clrTable[5], clrTable[8]);
+    const __m128i a = _mm_set1_epi8(-1);
+    const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    const __m128i baLo = _mm_unpacklo_epi8(b, a);
+    const __m128i baHi = _mm_unpackhi_epi8(b, a);
+    __m128i* out = reinterpret_cast<__m128i*>(pixels);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(rgLo, baLo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLo, baLo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHi, baHi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHi, baHi));
+#else
+    for (int i = 0; i < 16; i++) {
+        int y = i >> 2;
+        int x = i & 3;
+        int c[3];
+        for (int j = 0; j < 3; j++) {
+            const int o = clrTable[j];
+            const int h = clrTable[3 + j];
+            const int v = clrTable[6 + j];
+            c[j] = clamp((x * (h - o) + y * (v - o) + 4 * o + 2) >> 2);
+        }
+        pixels[i] = packRgba(c[0], c[1], c[2], 255);
+    }
+#endif
+}
+
+// Decodes a color block to 16 packed RGBA pixels, in row major order. Alpha
+// is 255 unless the block has punchthrough alpha.
+void etc2_decode_rgb_block_fast(const etc1_byte* pIn, bool isPunchthroughAlpha,
+                                etc1_uint32* pixels) {
+    etc1_uint32 high = (pIn[0] << 24) | (pIn[1] << 16) | (pIn[2] << 8) | pIn[3];
+    etc1_uint32 low = (pIn[4] << 24) | (pIn[5] << 16) | (pIn[6] << 8) | pIn[7];
+    bool opaque = (high >> 1) & 1;
+    bool flipped = (high & 1) != 0;
+    // Colors 0-3 are for the first subblock, 4-7 for the second one.
+    etc1_uint32 palette[8];
+    int clrTable[12];
+    bool singlePalette = false;
+    int r1, r2, g1, g2, b1, b2;
+    if (isPunchthroughAlpha || high & 2) {
+        // differential
+        int rBase = high >> 27;
+        int gBase = high >> 19;
+        int bBase = high >> 11;
+        if (isOverflowed(rBase, high >> 24)) {
+            etc2_T_colors(high, clrTable);
+            singlePalette = true;
+        } else if (isOverflowed(gBase, high >> 16)) {
+            etc2_H_colors(high, clrTable);
+            singlePalette = true;
+        } else if (isOverflowed(bBase, high >> 8)) {
+            etc2_decode_block_P_fast(high, low, pixels);
+            return;
+        } else {
+            r1 = convert5To8(rBase);
+            r2 = convertDiff(rBase, high >> 24);
+            g1 = convert5To8(gBase);
+            g2 = convertDiff(gBase, high >> 16);
+            b1 = convert5To8(bBase);
+            b2 = convertDiff(bBase, high >> 8);
+        }
+    } else {
+        // not differential
+        r1 = convert4To8(high >> 28);
+        r2 = convert4To8(high >> 24);
+        g1 = convert4To8(high >> 20);
+        g2 = convert4To8(high >> 16);
+        b1 = convert4To8(high >> 12);
+        b2 = convert4To8(high >> 8);
+    }
+    if (singlePalette) {
+        for (int i = 0; i < 4; i++) {
+            palette[i] = palette[i + 4] = packRgba(clrTable[i * 3], clrTable[i * 3 + 1],
+                                                   clrTable[i * 3 + 2], 255);
+        }
+        // The subblock doesn't matter.
+        flipped = false;
+    } else {
+        const int* rgbModifierTable = opaque || !isPunchthroughAlpha ?
+                                      kRGBModifierTable : kRGBOpaqueModifierTable;
+        const int* tableA = rgbModifierTable + (7 & (high >> 5)) * 4;
+        const int* tableB = rgbModifierTable + (7 & (high >> 2)) * 4;
+        for (int i = 0; i < 4; i++) {
+            palette[i] = packRgba(clamp(r1 + tableA[i]), clamp(g1 + tableA[i]),
+                                  clamp(b1 + tableA[i]), 255);
+            palette[i + 4] = packRgba(clamp(r2 + tableB[i]), clamp(g2 + tableB[i]),
+                                      clamp(b2 + tableB[i]), 255);
+        }
+    }
+    if (isPunchthroughAlpha && !opaque) {
+        // rgba all 0
+        palette[2] = 0;
+        palette[6] = 0;
+    }
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int k = y + x * 4;
+            int msb = (low >> (k + 15)) & 2;
+            int lsb = (low >> k) & 1;
+            int subblock = flipped ? (y >> 1) : (x >> 1);
+            pixels[y * 4 + x] = palette[subblock * 4 + (msb | lsb)];
+        }
+    }
+}
+
+// Computes the values of an EAC block before clamping, in row major order.
+// With |elevenBits|, these are the values of R11 / RG11 formats, otherwise
+// the values of the alpha channel of RGBA8.
+void eac_decode_values_fast(const etc1_byte* pIn, bool isSigned, bool elevenBits,
+                            int16_t* values) {
+    int base_codeword = isSigned ? reinterpret_cast<const signed char*>(pIn)[0]
+                                 : pIn[0];
+    if (base_codeword == -128) base_codeword = -127;
+    int multiplier = pIn[1] >> 4;
+    const int* table = kAlphaModifierTable + (pIn[1] & 15) * 8;
+    uint64_t indices = 0;
+    for (int i = 2; i < 8; i++) {
+        indices = indices << 8 | pIn[i];
+    }
+    // Indices are stored column by column, from the most significant bits.
+    int16_t modifiers[16];
+    for (int i = 0; i < 16; i++) {
+        modifiers[(i % 4) * 4 + i / 4] = table[(indices >> (45 - 3 * i)) & 7];
+    }
+    const int offset = elevenBits && !isSigned ? 4 : 0;
+#ifdef ETC_DECODE_SSE2
+    const __m128i base = _mm_set1_epi16(base_codeword);
+    const __m128i mult = _mm_set1_epi16(multiplier);
+    for (int i = 0; i < 16; i += 8) {
+        const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(modifiers + i));
+        __m128i v = _mm_add_epi16(base, _mm_mullo_epi16(m, mult));
+        if (elevenBits) {
+            v = _mm_slli_epi16(v, 3);
+            if (multiplier == 0) {
+                v = _mm_add_epi16(v, m);
+            }
+            v = _mm_add_epi16(v, _mm_set1_epi16(offset));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), v);
+    }
+#else
+    for (int i = 0; i < 16; i++) {
+        int decoded = base_codeword + modifiers[i] * multiplier;
+        if (elevenBits) {
+            decoded *= 8;
+            if (multiplier == 0) {
+                decoded += modifiers[i];
+            }
+            decoded += offset;
+        }
+        values[i] = decoded;
+    }
+#endif
+}
+
+void eac_decode_alpha_block_fast(const etc1_byte* pIn, etc1_byte* alpha) {
+    int16_t values[16];
+    eac_decode_values_fast(pIn, false, false, values);
+#ifdef ETC_DECODE_SSE2
+    const __m128i* v = reinterpret_cast<const __m128i*>(values);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(alpha),
+                     _mm_packus_epi16(_mm_loadu_si128(v), _mm_loadu_si128(v + 1)));
+#else
+    for (int i = 0; i < 16; i++) {
+        alpha[i] = clamp(values[i]);
+    }
+#endif
+}
+
+// Converts clamped 11 bit EAC values to floats, with the same rounding as
+// eac_decode_single_channel_block().
+struct EacFloatTables {
+    EacFloatTables() {
+        for (int i = 0; i <= 2047; i++) {
+            unsignedValues[i] = (float)i / 2047.0;
+        }
+        for (int i = -1023; i <= 1023; i++) {
+            signedValues[i + 1023] = (float)i / 1023.0;
+        }
+    }
+    float unsignedValues[2048];
+    float signedValues[2047];
+};
+
+const EacFloatTables& eacFloatTables() {
+    static const EacFloatTables sTables;
+    return sTables;
+}
+
+// Decodes an R11 block to 16 floats in row major order, |pixelStride| floats
+// apart.
+void eac_decode_r11_block_fast(const etc1_byte* pIn, bool isSigned, float* out,
+                               int pixelStride) {
+    int16_t values[16];
+    eac_decode_values_fast(pIn, isSigned, true, values);
+    const EacFloatTables& tables = eacFloatTables();
+    for (int i = 0; i < 16; i++) {
+        out[i * pixelStride] =
+                isSigned ? tables.signedValues[clampSigned1023(values[i]) + 1023]
+                         : tables.unsignedValues[clamp2047(values[i])];
+    }
+}
+
+// Decodes a block to a 4x4 tile in the output pixel format. Returns the
+// number of bytes of encoded data consumed.
+etc1_uint32 decode_block_fast(const etc1_byte* pIn, ETC2ImageFormat format,
+                              etc1_byte* tile) {
+    etc1_uint32 pixels[16];
+    switch (format) {
+        case EtcRGB8:
+            etc2_decode_rgb_block_fast(pIn, false, pixels);
+            for (int i = 0; i < 16; i++) {
+                memcpy(tile + i * 3, &pixels[i], 3);
+            }
+            return ETC1_ENCODED_BLOCK_SIZE;
+        case EtcRGBA8: {
+            etc1_byte alpha[16];
+            eac_decode_alpha_block_fast(pIn, alpha);
+            etc2_decode_rgb_block_fast(pIn + EAC_ENCODE_ALPHA_BLOCK_SIZE, false, pixels);
+            for (int i = 0; i < 16; i++) {
+                pixels[i] = (pixels[i] & 0x00ffffff) | etc1_uint32(alpha[i]) << 24;
+            }
+            memcpy(tile, pixels, sizeof(pixels));
+            return EAC_ENCODE_ALPHA_BLOCK_SIZE + ETC1_ENCODED_BLOCK_SIZE;
+        }
+        case EtcRGB8A1:
+            etc2_decode_rgb_block_fast(pIn, true, pixels);
+            memcpy(tile, pixels, sizeof(pixels));
+            return ETC1_ENCODED_BLOCK_SIZE;
+        case EtcR11:
+        case EtcSignedR11:
+            eac_decode_r11_block_fast(pIn, format == EtcSignedR11,
+                                      reinterpret_cast<float*>(tile), 1);
+            return EAC_ENCODE_R11_BLOCK_SIZE;
+        case EtcRG11:
+        case EtcSignedRG11:
+            // r channel
+            eac_decode_r11_block_fast(pIn, format == EtcSignedRG11,
+                                      reinterpret_cast<float*>(tile), 2);
+            // g channel
+            eac_decode_r11_block_fast(pIn + EAC_ENCODE_R11_BLOCK_SIZE,
+                                      format == EtcSignedRG11,
+                                      reinterpret_cast<float*>(tile) + 1, 2);
+            return EAC_ENCODE_R11_BLOCK_SIZE * 2;
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+// Decodes the rows of blocks [firstRow, endRow) of an image.
+void decode_block_rows_fast(const etc1_byte* pIn, ETC2ImageFormat format,
+                            etc1_byte* pOut, etc1_uint32 width,
+                            etc1_uint32 height, etc1_uint32 stride,
+                            etc1_uint32 firstRow, etc1_uint32 endRow) {
+    // Tiles are at most 4x4 RG11 pixels, and floats need aligned storage.
+    alignas(16) etc1_byte tile[EAC_DECODED_RG11_BLOCK_SIZE];
+    const etc1_uint32 pixelSize = etc_get_decoded_pixel_size(format);
+    const etc1_uint32 encodedWidth = (width + 3) & ~3;
+    const etc1_uint32 encodedRowSize = etc_get_encoded_data_size(format, width, 4);
+    pIn += firstRow * encodedRowSize;
+    for (etc1_uint32 row = firstRow; row < endRow; row++) {
+        const etc1_uint32 y = row * 4;
+        const etc1_uint32 yEnd = std::min<etc1_uint32>(height - y, 4);
+        for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
+            const etc1_uint32 xEnd = std::min<etc1_uint32>(width - x, 4);
+            pIn += decode_block_fast(pIn, format, tile);
+            for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
+                memcpy(pOut + pixelSize * x + stride * (y + cy),
+                       tile + cy * 4 * pixelSize, xEnd * pixelSize);
+            }
+        }
+    }
+}
+
+using DecodeTask = std::function<void()>;
+
+android::base::ThreadPool<DecodeTask>& decodeThreadPool() {
+    // Never destroyed, so that decodes running at exit don't use a joined pool.
+    static android::base::ThreadPool<DecodeTask>* sPool = [] {
+        const uint32_t numThreads = std::clamp(std::thread::hardware_concurrency() / 2,
+                                               kMinNumDecodeThreads, kMaxNumDecodeThreads);
+        auto pool = new android::base::ThreadPool<DecodeTask>(
+                numThreads,
+                [](DecodeTask&& task, android::base::ThreadPoolWorkerId) { task(); });
+        pool->start();
+        return pool;
+    }();
+    return *sPool;
+}
+
+}  // namespace
+
+int etc2_decode_image_fast(const etc1_byte* pIn, ETC2ImageFormat format,
+        etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 stride) {
+    const etc1_uint32 blockRows = (height + 3) / 4;
+    const etc1_uint32 blocksPerRow = (width + 3) / 4;
+    const uint64_t numBlocks = uint64_t(blockRows) * blocksPerRow;
+    etc1_uint32 numSlices = std::min<uint64_t>(
+            {numBlocks / kMinBlocksPerSlice, blockRows, kMaxNumDecodeThreads + 1});
+    if (numSlices <= 1) {
+        decode_block_rows_fast(pIn, format, pOut, width, height, stride, 0, blockRows);
+        return 0;
+    }
+
+    android::base::Lock lock;
+    android::base::ConditionVariable cv;
+    etc1_uint32 pendingSlices = numSlices - 1;
+    const etc1_uint32 rowsPerSlice = (blockRows + numSlices - 1) / numSlices;
+    for (etc1_uint32 slice = 1; slice < numSlices; slice++) {
+        const etc1_uint32 firstRow = std::min(slice * rowsPerSlice, blockRows);
+        const etc1_uint32 endRow = std::min(firstRow + rowsPerSlice, blockRows);
+        decodeThreadPool().enqueue([=, &lock, &cv, &pendingSlices] {
+            decode_block_rows_fast(pIn, format, pOut, width, height, stride, firstRow,
+                                   endRow);
+            android::base::AutoLock autoLock(lock);
+            if (--pendingSlices == 0) {
+                cv.signalAndUnlock(&autoLock);
+            }
+        });
+    }
+    decode_block_rows_fast(pIn, format, pOut, width, height, stride, 0,
+                           std::min(rowsPerSlice, blockRows));
+
+    android::base::AutoLock autoLock(lock);
+    cv.wait(&autoLock, [&pendingSlices] { return pendingSlices == 0; });
+    return 0;
+}
+
 static const char kMagic[] = { 'P', 'K', 'M', ' ', '1', '0' };
 
 static const etc1_uint32 ETC1_PKM_FORMAT_OFFSET = 6;
@@ -0,0 +1,88 @@
+/*
+* Copyright (C) 2023 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+//
+// DenseNameTable - a table of values indexed by GL object names, which are
+//                  mostly small integers allocated sequentially.
+//
+//   get() does not take any lock, and can run concurrently with set().
+//   Calls to set() must be serialized by the caller. The table is made of
+//   fixed size chunks that are allocated on demand and only freed by the
+//   destructor, so a reader never sees the memory it reads go away.
+//   Names from |kCapacity| onwards are not stored: callers keep them in a
+//   regular map.
+//
+template <class T, size_t kChunkSize = 1024, size_t kMaxChunks = 64>
+class DenseNameTable {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "DenseNameTable values are read and written atomically");
+
+public:
+    static constexpr uint64_t kCapacity = uint64_t(kChunkSize) * kMaxChunks;
+
+    DenseNameTable() {
+        for (auto& chunk : m_chunks) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ~DenseNameTable() {
+        for (auto& chunk : m_chunks) {
+            delete chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    DenseNameTable(const DenseNameTable&) = delete;
+    DenseNameTable& operator=(const DenseNameTable&) = delete;
+
+    static bool contains(uint64_t name) { return name < kCapacity; }
+
+    // Returns T() for names that have never been set. |name| must be in range.
+    T get(uint64_t name) const {
+        const Chunk* chunk =
+                m_chunks[name / kChunkSize].load(std::memory_order_acquire);
+        if (!chunk) return T();
+        return chunk->values[name % kChunkSize].load(std::memory_order_acquire);
+    }
+
+    // |name| must be in range.
+    void set(uint64_t name, T value) {
+        auto& chunkSlot = m_chunks[name / kChunkSize];
+        Chunk* chunk = chunkSlot.load(std::memory_order_relaxed);
+        if (!chunk) {
+            if (value == T()) return;
+            chunk = new Chunk;
+            for (auto& v : chunk->values) {
+                v.store(T(), std::memory_order_relaxed);
+            }
+            // Publishes the initialized chunk to readers.
+            chunkSlot.store(chunk, std::memory_order_release);
+        }
+        chunk->values[name % kChunkSize].store(value, std::memory_order_release);
+    }
+
+private:
+    struct Chunk {
+        std::atomic<T> values[kChunkSize];
+    };
+    std::atomic<Chunk*> m_chunks[kMaxChunks];
+};
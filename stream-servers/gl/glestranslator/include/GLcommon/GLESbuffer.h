@@ -17,6 +17,7 @@
 #define GLES_BUFFER_H
 
 #include "aemu/base/files/Stream.h"
+#include "aemu/base/synchronization/Lock.h"
 #include <stdio.h>
 #include <GLES/gl.h>
 #include <GLcommon/ObjectData.h>
@@ -39,6 +40,13 @@ public:
    bool  fullyConverted(){return m_conversionManager.size() == 0;};
    void  setBinded(){m_wasBound = true;};
    bool  wasBinded(){return m_wasBound;};
+   // Finds the smallest and largest of |count| indices of |type| at |indices|,
+   // which must point into the buffer data. Results are cached until the
+   // buffer data changes, as GLES1 draws with converted arrays scan the same
+   // index ranges again and again. Safe to call from any context of the share
+   // group while others update the buffer.
+   bool  getIndexRange(GLenum type, const GLvoid* indices, GLsizei count,
+                       GLuint* minIndex, GLuint* maxIndex);
    ~GLESbuffer();
 
 private:
@@ -47,6 +55,21 @@ private:
     unsigned char* m_data = nullptr;
     RangeList      m_conversionManager;
     bool           m_wasBound = false;
+
+    struct IndexRange {
+        GLenum type;
+        GLuint offset;
+        GLsizei count;
+        GLuint minIndex;
+        GLuint maxIndex;
+    };
+    static constexpr size_t kMaxIndexRanges = 16;
+    // Guards the index range cache, and the data against being changed or
+    // freed while it is scanned.
+    android::base::Lock m_indexRangeLock;
+    IndexRange     m_indexRanges[kMaxIndexRanges];
+    size_t         m_numIndexRanges = 0;
+    size_t         m_nextIndexRange = 0;
 };
 
 #endif
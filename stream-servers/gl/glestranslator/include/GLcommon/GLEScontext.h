@@ -427,6 +427,9 @@ public:
     static bool isAutoMipmapSupported(){return s_glSupport.GL_SGIS_GENERATE_MIPMAP;}
     static TextureTarget GLTextureTargetToLocal(GLenum target);
     static unsigned int findMaxIndex(GLsizei count,GLenum type,const GLvoid* indices);
+    // Same as findMaxIndex(), but uses the index range cache of the bound
+    // element array buffer when |indices| points into its data.
+    unsigned int findMaxIndexCached(GLsizei count,GLenum type,const GLvoid* indices);
 
     virtual bool glGetIntegerv(GLenum pname, GLint *params);
     virtual bool glGetBooleanv(GLenum pname, GLboolean *params);
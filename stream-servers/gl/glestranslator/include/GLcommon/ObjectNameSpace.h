@@ -19,6 +19,7 @@
 #include "aemu/base/containers/HybridComponentManager.h"
 #include "aemu/base/synchronization/Lock.h"
 #include "snapshot/common.h"
+#include "GLcommon/DenseNameTable.h"
 #include "GLcommon/GLBackgroundLoader.h"
 #include "GLcommon/NamedObject.h"
 #include "GLcommon/ObjectData.h"
@@ -108,6 +109,21 @@ public:
 
     const ObjectDataPtr& getObjectDataPtr(ObjectLocalName p_localName);
     void setObjectData(ObjectLocalName p_localName, ObjectDataPtr data);
+
+    //
+    // Lock-free lookups, for the hot paths of ShareGroup. They only know
+    // about local names small enough to fit in the dense tables, which is
+    // the case of most of them, and return false for other names, which
+    // must be looked up with the functions above instead.
+    //
+    struct DenseLookup {
+        bool found = false;
+        bool everBound = false;
+        unsigned int globalName = 0;
+    };
+    bool lookupDense(ObjectLocalName p_localName, DenseLookup* result) const;
+    bool getObjectDataDense(ObjectLocalName p_localName,
+                            ObjectData** result) const;
     // snapshot functions
     void postLoad(const ObjectData::getObjDataPtr_t& getObjDataPtr);
     void postLoadRestore(const ObjectData::getGlobalName_t& getGlobalName);
@@ -116,8 +132,15 @@ public:
     ObjectDataMap::const_iterator objDataMapBegin() const;
     ObjectDataMap::const_iterator objDataMapEnd() const;
 private:
+    void setDenseName(ObjectLocalName p_localName, const NamedObjectPtr& p_namedObject);
+
     ObjectLocalName m_nextName = 0;
     NamesMap m_localToGlobalMap;
+    // Mirrors |m_localToGlobalMap| and |m_boundMap| for small local names:
+    // the global name in the low 32 bits, and the flags below.
+    DenseNameTable<uint64_t> m_denseNames;
+    // Mirrors |m_objectDataMap| for small local names.
+    DenseNameTable<ObjectData*> m_denseObjectData;
     ObjectDataMap m_objectDataMap;
     BoundAtLeastOnceMap m_boundMap;
     GlobalToLocalNamesMap m_globalToLocalMap;
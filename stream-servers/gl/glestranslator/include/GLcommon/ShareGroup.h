@@ -41,7 +41,9 @@ class NameSpace;
 //   there will be one inctance of ShareGroup for each user OpenGL context
 //   unless the user context share with another user context. In that case they
 //   both will share the same ShareGroup instance.
-//   calls into that class gets serialized through a lock so it is thread safe.
+//   calls into that class gets serialized through a lock so it is thread safe,
+//   except lookups of small local names, which use lock-free tables (see
+//   DenseNameTable).
 //
 class ShareGroup
 {
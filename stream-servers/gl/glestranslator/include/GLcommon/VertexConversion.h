@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2023 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <GLES/gl.h>
+#include <stddef.h>
+
+#include <vector>
+
+//
+// Vectorized kernels for the conversions of vertex attributes and index scans
+// that run on draws with client arrays. The implementation is picked at
+// runtime according to the host CPU, and gives the same results as the scalar
+// macros of GLconversion_macros.h.
+//
+
+// Applies X2F() to |count| values. |in| and |out| may be the same array.
+void convertFixedToFloat(const GLfixed* in, GLfloat* out, size_t count);
+
+// Applies B2S() to |count| values.
+void convertByteToShort(const GLbyte* in, GLshort* out, size_t count);
+
+// Computes the smallest and largest of |count| indices of |type|
+// (GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT). Both are 0 if
+// |count| is 0.
+void findIndexRange(GLenum type, const GLvoid* indices, size_t count,
+                    GLuint* minIndex, GLuint* maxIndex);
+
+// The kernels of one instruction set. Those it has no version of are the
+// scalar ones. The index range kernels fold the indices into |minIndex| and
+// |maxIndex|, which must be initialized.
+struct VertexConversionKernels {
+    const char* name;
+    void (*fixedToFloat)(const GLfixed* in, GLfloat* out, size_t count);
+    void (*byteToShort)(const GLbyte* in, GLshort* out, size_t count);
+    void (*indexRangeU8)(const void* indices, size_t count, GLuint* minIndex,
+                         GLuint* maxIndex);
+    void (*indexRangeU16)(const void* indices, size_t count, GLuint* minIndex,
+                          GLuint* maxIndex);
+    void (*indexRangeU32)(const void* indices, size_t count, GLuint* minIndex,
+                          GLuint* maxIndex);
+};
+
+// The kernels of every instruction set the host CPU supports, from the
+// scalar ones to those the functions above use. For tests.
+std::vector<VertexConversionKernels> getVertexConversionKernelsForTesting();
@@ -105,6 +105,15 @@ int etc2_decode_image(const etc1_byte* pIn, ETC2ImageFormat format,
         etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 stride);
 
+// Same as etc2_decode_image(), with identical output. Decodes blocks with
+// vector instructions where available, and splits large images across a
+// pool of threads shared by all callers.
+
+int etc2_decode_image_fast(const etc1_byte* pIn, ETC2ImageFormat format,
+        etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 stride);
+
 // Size of a PKM header, in bytes.
 
 #define ETC_PKM_HEADER_SIZE 16
@@ -0,0 +1,138 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "OpenGLTestContext.h"
+#include "ShaderUtils.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace emugl {
+
+static const char kVertexShader[] = R"(
+attribute vec2 a_position;
+attribute vec4 a_color;
+attribute float a_colorScale;
+varying vec4 v_color;
+void main() {
+    gl_Position = vec4(a_position, 0.0, 1.0);
+    v_color = a_color * a_colorScale;
+}
+)";
+
+static const char kFragmentShader[] = R"(
+precision mediump float;
+varying vec4 v_color;
+void main() {
+    gl_FragColor = v_color;
+}
+)";
+
+// Each draw streams 28 bytes per vertex of client arrays, so that the arrays
+// of a draw every now and then have to go past the end of the streaming buffer
+// together.
+static constexpr GLsizei kNumVertices = 3 * 20000;
+static constexpr int kNumDraws = 16;
+
+class ClientArraysTest : public GLTest {
+protected:
+    void SetUp() override {
+        GLTest::SetUp();
+
+        mProgram = compileAndLinkShaderProgram(kVertexShader, kFragmentShader);
+        ASSERT_NE(0u, mProgram);
+        gl->glUseProgram(mProgram);
+
+        // A full screen quad, followed by degenerate triangles.
+        mPositions.resize(2 * kNumVertices, 0.0f);
+        const GLfloat quad[] = {-1, -1, 1, -1, -1, 1, -1, 1, 1, -1, 1, 1};
+        std::copy(std::begin(quad), std::end(quad), mPositions.begin());
+
+        mColors.resize(4 * kNumVertices);
+        for (GLsizei i = 0; i < kNumVertices; ++i) {
+            const GLfloat green[] = {0, 1, 0, 1};
+            std::copy(std::begin(green), std::end(green), mColors.begin() + 4 * i);
+        }
+        mColorScales.resize(kNumVertices, 1.0f);
+    }
+
+    void TearDown() override {
+        gl->glUseProgram(0);
+        gl->glDeleteProgram(mProgram);
+        GLTest::TearDown();
+    }
+
+    void setUpClientArrays() {
+        const GLint position = gl->glGetAttribLocation(mProgram, "a_position");
+        const GLint color = gl->glGetAttribLocation(mProgram, "a_color");
+        const GLint colorScale = gl->glGetAttribLocation(mProgram, "a_colorScale");
+        ASSERT_GE(position, 0);
+        ASSERT_GE(color, 0);
+        ASSERT_GE(colorScale, 0);
+
+        gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+        gl->glVertexAttribPointer(position, 2, GL_FLOAT, GL_FALSE, 0, mPositions.data());
+        gl->glVertexAttribPointer(color, 4, GL_FLOAT, GL_FALSE, 0, mColors.data());
+        gl->glVertexAttribPointer(colorScale, 1, GL_FLOAT, GL_FALSE, 0, mColorScales.data());
+        gl->glEnableVertexAttribArray(position);
+        gl->glEnableVertexAttribArray(color);
+        gl->glEnableVertexAttribArray(colorScale);
+    }
+
+    void expectCenterPixelGreen(int draw) {
+        GLubyte pixel[4] = {};
+        gl->glReadPixels(kTestSurfaceSize[0] / 2, kTestSurfaceSize[1] / 2, 1, 1, GL_RGBA,
+                         GL_UNSIGNED_BYTE, pixel);
+        EXPECT_EQ(0, pixel[0]) << "draw " << draw;
+        EXPECT_EQ(255, pixel[1]) << "draw " << draw;
+        EXPECT_EQ(0, pixel[2]) << "draw " << draw;
+    }
+
+    GLuint mProgram = 0;
+    std::vector<GLfloat> mPositions;
+    std::vector<GLfloat> mColors;
+    std::vector<GLfloat> mColorScales;
+};
+
+TEST_F(ClientArraysTest, DrawArraysAcrossStreamingBufferEnd) {
+    setUpClientArrays();
+    for (int i = 0; i < kNumDraws; ++i) {
+        gl->glClearColor(1, 0, 0, 1);
+        gl->glClear(GL_COLOR_BUFFER_BIT);
+        gl->glDrawArrays(GL_TRIANGLES, 0, kNumVertices);
+        EXPECT_EQ(GL_NO_ERROR, gl->glGetError());
+        expectCenterPixelGreen(i);
+    }
+}
+
+TEST_F(ClientArraysTest, DrawElementsAcrossStreamingBufferEnd) {
+    setUpClientArrays();
+    std::vector<GLuint> indices(kNumVertices);
+    for (GLsizei i = 0; i < kNumVertices; ++i) {
+        indices[i] = i;
+    }
+    gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    for (int i = 0; i < kNumDraws; ++i) {
+        gl->glClearColor(1, 0, 0, 1);
+        gl->glClear(GL_COLOR_BUFFER_BIT);
+        gl->glDrawElements(GL_TRIANGLES, kNumVertices, GL_UNSIGNED_INT, indices.data());
+        EXPECT_EQ(GL_NO_ERROR, gl->glGetError());
+        expectCenterPixelGreen(i);
+    }
+}
+
+}  // namespace emugl
@@ -14,10 +14,13 @@
 
 #include "GLSnapshotTestStateUtils.h"
 #include "GLSnapshotTesting.h"
+#include "aemu/base/files/PathUtils.h"
 #include "apigen-codec-common/glUtils.h"
 
 #include <gtest/gtest.h>
 
+#include <fstream>
+
 namespace emugl {
 
 struct GlTextureUnitState {
@@ -478,4 +481,33 @@ TEST_F(SnapshotGlTextureObjectTest, CreateCubeMap) {
     doCheckedSnapshot();
 }
 
+TEST_F(SnapshotTest, CompressesTextureData) {
+    constexpr GLsizei kSize = 256;
+    std::vector<GLubyte> bytes(kSize * kSize * 4);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bytes[i] = static_cast<GLubyte>((i / 4) % kSize);
+    }
+    GLuint texture;
+    gl->glGenTextures(1, &texture);
+    gl->glBindTexture(GL_TEXTURE_2D, texture);
+    gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, kSize, kSize, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, bytes.data());
+    ASSERT_EQ(GL_NO_ERROR, gl->glGetError());
+
+    const std::string snapshotFile =
+            android::base::pj({mSnapshotPath, "compressed.snap"});
+    const std::string textureFile =
+            android::base::pj({mSnapshotPath, "compressed.stex"});
+    saveSnapshot(snapshotFile, textureFile);
+
+    std::ifstream textures(textureFile, std::ios::binary | std::ios::ate);
+    ASSERT_TRUE(textures.good());
+    EXPECT_LT(static_cast<size_t>(textures.tellg()), bytes.size() / 4);
+
+    preloadReset();
+    loadSnapshot(snapshotFile, textureFile);
+    EXPECT_EQ(bytes, getTextureImageData(gl, texture, GL_TEXTURE_2D, 0, kSize,
+                                         kSize, GL_RGBA, GL_UNSIGNED_BYTE));
+}
+
 }  // namespace emugl
@@ -0,0 +1,189 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gl/glestranslator/EGL/PersistentBlobCache.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+
+#include "aemu/base/testing/TestSystem.h"
+
+namespace {
+
+using Blob = PersistentBlobCache::Blob;
+
+Blob makeBlob(const std::string& str) { return Blob(str.begin(), str.end()); }
+
+class PersistentBlobCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mTestSystem.getTempRoot()->makeSubDir("BlobCache");
+        mDir = mTestSystem.getTempRoot()->makeSubPath("BlobCache");
+    }
+
+    std::unique_ptr<PersistentBlobCache> open(const std::string& identity,
+                                              uint64_t maxFileSize =
+                                                  PersistentBlobCache::kDefaultMaxFileSize) {
+        auto cache = std::make_unique<PersistentBlobCache>();
+        cache->init(mDir, identity, maxFileSize);
+        return cache;
+    }
+
+    android::base::TestSystem mTestSystem;
+    std::string mDir;
+};
+
+TEST_F(PersistentBlobCacheTest, RoundTrip) {
+    {
+        auto cache = open("driver");
+        cache->put(makeBlob("key0"), makeBlob("value0"));
+        cache->put(makeBlob("key1"), makeBlob("value1"));
+    }
+
+    auto cache = open("driver");
+    Blob value;
+    ASSERT_TRUE(cache->get(makeBlob("key0"), &value));
+    EXPECT_EQ(value, makeBlob("value0"));
+    ASSERT_TRUE(cache->get(makeBlob("key1"), &value));
+    EXPECT_EQ(value, makeBlob("value1"));
+    EXPECT_FALSE(cache->get(makeBlob("key2"), &value));
+}
+
+TEST_F(PersistentBlobCacheTest, LatestValueWins) {
+    {
+        auto cache = open("driver");
+        cache->put(makeBlob("key"), makeBlob("old"));
+        cache->put(makeBlob("key"), makeBlob("new"));
+    }
+
+    auto cache = open("driver");
+    Blob value;
+    ASSERT_TRUE(cache->get(makeBlob("key"), &value));
+    EXPECT_EQ(value, makeBlob("new"));
+}
+
+TEST_F(PersistentBlobCacheTest, OtherDriverStartsEmpty) {
+    {
+        auto cache = open("driver");
+        cache->put(makeBlob("key"), makeBlob("value"));
+    }
+
+    auto cache = open("other driver");
+    Blob value;
+    EXPECT_FALSE(cache->get(makeBlob("key"), &value));
+}
+
+TEST_F(PersistentBlobCacheTest, CompactsAtSizeLimit) {
+    constexpr uint64_t kMaxFileSize = 4096;
+    const Blob payload(100, 0xab);
+    {
+        auto cache = open("driver", kMaxFileSize);
+        // Overwriting the same few keys well past the limit must keep the
+        // file under it and keep accepting new values.
+        for (int i = 0; i < 200; ++i) {
+            Blob value = payload;
+            value[0] = static_cast<uint8_t>(i);
+            cache->put(makeBlob("key" + std::to_string(i % 4)), value);
+            EXPECT_LE(cache->fileSize(), kMaxFileSize);
+        }
+    }
+
+    auto cache = open("driver", kMaxFileSize);
+    for (int i = 196; i < 200; ++i) {
+        Blob value;
+        ASSERT_TRUE(cache->get(makeBlob("key" + std::to_string(i % 4)), &value));
+        EXPECT_EQ(value[0], static_cast<uint8_t>(i));
+    }
+}
+
+TEST_F(PersistentBlobCacheTest, KeepsAppendingWhenLiveDataFillsTheLimit) {
+    constexpr uint64_t kMaxFileSize = 4096;
+    const Blob payload(100, 0xcd);
+    {
+        auto cache = open("driver", kMaxFileSize);
+        for (int i = 0; i < 200; ++i) {
+            cache->put(makeBlob("key" + std::to_string(i)), payload);
+            EXPECT_LE(cache->fileSize(), kMaxFileSize);
+        }
+    }
+
+    auto cache = open("driver", kMaxFileSize);
+    Blob value;
+    ASSERT_TRUE(cache->get(makeBlob("key199"), &value));
+    EXPECT_EQ(value, payload);
+}
+
+TEST_F(PersistentBlobCacheTest, OnlyOneCacheUsesTheFile) {
+    {
+        auto cache = open("driver");
+        cache->put(makeBlob("key0"), makeBlob("value0"));
+
+        // Stands in for another emulator process using the same directory.
+        auto other = open("driver");
+        Blob value;
+        EXPECT_FALSE(other->get(makeBlob("key0"), &value));
+        other->put(makeBlob("key1"), makeBlob("value1"));
+
+        cache->put(makeBlob("key2"), makeBlob("value2"));
+    }
+
+    auto cache = open("driver");
+    Blob value;
+    ASSERT_TRUE(cache->get(makeBlob("key0"), &value));
+    EXPECT_EQ(value, makeBlob("value0"));
+    EXPECT_FALSE(cache->get(makeBlob("key1"), &value));
+    ASSERT_TRUE(cache->get(makeBlob("key2"), &value));
+    EXPECT_EQ(value, makeBlob("value2"));
+}
+
+#ifdef __linux__
+TEST_F(PersistentBlobCacheTest, FailedAppendIsCutOff) {
+    {
+        auto cache = open("driver");
+        cache->put(makeBlob("key0"), makeBlob("value0"));
+        const uint64_t sizeBefore = cache->fileSize();
+
+        // Let only part of the next record reach the disk, like a full disk.
+        struct rlimit oldLimit;
+        ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &oldLimit), 0);
+        auto oldHandler = signal(SIGXFSZ, SIG_IGN);
+        struct rlimit limit = oldLimit;
+        limit.rlim_cur = sizeBefore + 16;
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+        cache->put(makeBlob("key1"), Blob(1000, 0xab));
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &oldLimit), 0);
+        signal(SIGXFSZ, oldHandler);
+
+        EXPECT_EQ(cache->fileSize(), sizeBefore);
+        cache->put(makeBlob("key2"), makeBlob("value2"));
+    }
+
+    auto cache = open("driver");
+    Blob value;
+    ASSERT_TRUE(cache->get(makeBlob("key0"), &value));
+    EXPECT_EQ(value, makeBlob("value0"));
+    EXPECT_FALSE(cache->get(makeBlob("key1"), &value));
+    ASSERT_TRUE(cache->get(makeBlob("key2"), &value));
+    EXPECT_EQ(value, makeBlob("value2"));
+}
+#endif
+
+}  // namespace
@@ -0,0 +1,161 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "ReadBuffer.h"
+
+namespace emugl {
+namespace {
+
+constexpr size_t kInitialSize = 128 * 1024;
+
+// Delivers |pending| bytes of a counting pattern, as much as asked per read.
+class PatternStream : public IOStream {
+public:
+    PatternStream() : IOStream(0) {}
+
+    void send(size_t size) { mPending += size; }
+    // Called when a read finds no data, like RingStream's idle callback.
+    void setOnIdle(std::function<bool()> onIdle) { mOnIdle = std::move(onIdle); }
+
+    void* allocBuffer(size_t) override { return nullptr; }
+    int commitBuffer(size_t) override { return 0; }
+    int writeFully(const void*, size_t) override { return 0; }
+    const unsigned char* readFully(void*, size_t) override { return nullptr; }
+    void* getDmaForReading(uint64_t) override { return nullptr; }
+    void unlockDma(uint64_t) override {}
+
+protected:
+    const unsigned char* readRaw(void* buf, size_t* inout_len) override {
+        if (!mPending && mOnIdle && mOnIdle()) {
+            return nullptr;
+        }
+        const size_t count = std::min(*inout_len, mPending);
+        if (!count) {
+            return nullptr;
+        }
+        auto dst = static_cast<unsigned char*>(buf);
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = static_cast<unsigned char>(mSent++);
+        }
+        mPending -= count;
+        *inout_len = count;
+        return dst;
+    }
+    void onSave(android::base::Stream*) override {}
+    unsigned char* onLoad(android::base::Stream*) override { return nullptr; }
+
+private:
+    size_t mPending = 0;
+    size_t mSent = 0;
+    std::function<bool()> mOnIdle;
+};
+
+TEST(ReadBuffer, GrowsByChunksForHugePackets) {
+    PatternStream stream;
+    ReadBuffer readBuf(kInitialSize);
+    const size_t totalBefore = ReadBuffer::totalAllocatedBytes();
+
+    const size_t packetSize = 100 * 1024 * 1024 + 1;
+    stream.send(packetSize);
+    ASSERT_EQ(readBuf.getData(&stream, packetSize), packetSize);
+    EXPECT_EQ(readBuf.validData(), packetSize);
+    EXPECT_EQ(readBuf.buf()[packetSize - 1], static_cast<unsigned char>(packetSize - 1));
+
+    // Not twice the packet size, as doubling would give.
+    EXPECT_GE(readBuf.size(), packetSize);
+    EXPECT_LE(readBuf.size(), packetSize + 1024 * 1024);
+    EXPECT_EQ(readBuf.highWaterSize(), readBuf.size());
+    EXPECT_EQ(ReadBuffer::totalAllocatedBytes(), totalBefore + readBuf.size() - kInitialSize);
+}
+
+TEST(ReadBuffer, ShrinksWhenIdle) {
+    PatternStream stream;
+    ReadBuffer readBuf(kInitialSize);
+    readBuf.setShrinkDelayUs(0);
+
+    const size_t largeSize = 4 * kInitialSize;
+    stream.send(largeSize);
+    ASSERT_EQ(readBuf.getData(&stream, largeSize), largeSize);
+    const size_t grownSize = readBuf.size();
+    EXPECT_GT(grownSize, kInitialSize);
+    readBuf.consume(largeSize - 2);
+
+    // The leftover data must survive the shrink.
+    stream.send(16);
+    ASSERT_EQ(readBuf.getData(&stream, 8), 16);
+    EXPECT_EQ(readBuf.size(), kInitialSize);
+    EXPECT_EQ(readBuf.highWaterSize(), grownSize);
+    ASSERT_EQ(readBuf.validData(), 18);
+    for (size_t i = 0; i < 18; ++i) {
+        EXPECT_EQ(readBuf.buf()[i], static_cast<unsigned char>(largeSize - 2 + i));
+    }
+}
+
+TEST(ReadBuffer, ShrinksWhileWaitingForData) {
+    PatternStream stream;
+    ReadBuffer readBuf(kInitialSize);
+    readBuf.setShrinkDelayUs(60 * 1000 * 1000);
+
+    const size_t largeSize = 4 * kInitialSize;
+    stream.send(largeSize);
+    ASSERT_EQ(readBuf.getData(&stream, largeSize), largeSize);
+    const size_t grownSize = readBuf.size();
+    readBuf.consume(largeSize - 2);
+
+    // The stream waits long enough for the buffer to shrink before the next
+    // data comes.
+    stream.setOnIdle([&] {
+        readBuf.setShrinkDelayUs(0);
+        const bool gaveUp = readBuf.onIdle();
+        EXPECT_TRUE(gaveUp);
+        EXPECT_EQ(readBuf.size(), kInitialSize);
+        stream.send(16);
+        return gaveUp;
+    });
+    ASSERT_EQ(readBuf.getData(&stream, 8), 16);
+    EXPECT_EQ(readBuf.size(), kInitialSize);
+    EXPECT_EQ(readBuf.highWaterSize(), grownSize);
+    ASSERT_EQ(readBuf.validData(), 18);
+    for (size_t i = 0; i < 18; ++i) {
+        EXPECT_EQ(readBuf.buf()[i], static_cast<unsigned char>(largeSize - 2 + i));
+    }
+}
+
+TEST(ReadBuffer, KeepsLargeBufferWhileInUse) {
+    PatternStream stream;
+    ReadBuffer readBuf(kInitialSize);
+    readBuf.setShrinkDelayUs(60 * 1000 * 1000);
+
+    const size_t largeSize = 4 * kInitialSize;
+    stream.send(largeSize);
+    ASSERT_EQ(readBuf.getData(&stream, largeSize), largeSize);
+    const size_t grownSize = readBuf.size();
+    readBuf.consume(largeSize);
+
+    stream.send(16);
+    ASSERT_EQ(readBuf.getData(&stream, 8), 16);
+    EXPECT_EQ(readBuf.size(), grownSize);
+}
+
+}  // namespace
+}  // namespace emugl
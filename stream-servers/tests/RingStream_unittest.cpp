@@ -0,0 +1,266 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "RingStream.h"
+
+namespace emugl {
+namespace {
+
+constexpr uint32_t kBufferSize = 64 * 1024;
+constexpr uint32_t kLargeXferRingSize = 16 * 1024;
+
+// The shared memory of an address space graphics context, and the guest side
+// of type 1 transfers: data is written to the shared buffer, then described
+// by an xfer in the to host ring.
+class FakeGuest {
+public:
+    FakeGuest() {
+        ring_buffer_init(mToHost.get());
+        ring_buffer_view_init(mToHostLarge.get(), &mContext.to_host_large_xfer.view,
+                              mToHostLargeBuffer.data(), kLargeXferRingSize);
+        ring_buffer_view_init(mFromHostLarge.get(), &mContext.from_host_large_xfer.view,
+                              mFromHostLargeBuffer.data(), kLargeXferRingSize);
+        mConfig.buffer_size = kBufferSize;
+        mConfig.flush_interval = 4096;
+        mConfig.host_consumed_pos = 0;
+        mConfig.transfer_mode = 1;
+        mConfig.transfer_size = 0;
+        mConfig.in_error = 0;
+
+        mContext.to_host = mToHost.get();
+        mContext.buffer = mBuffer.data();
+        mContext.host_state = &mHostState;
+        mContext.ring_config = &mConfig;
+        mContext.to_host_large_xfer.ring = mToHostLarge.get();
+        mContext.from_host_large_xfer.ring = mFromHostLarge.get();
+    }
+
+    std::unique_ptr<RingStream> createStream() {
+        android::emulation::asg::ConsumerCallbacks callbacks;
+        callbacks.onUnavailableRead = [] {
+            std::this_thread::yield();
+            return 0;
+        };
+        callbacks.getPtr = [](uint64_t) -> char* { return nullptr; };
+        return std::make_unique<RingStream>(mContext, callbacks, 4096);
+    }
+
+    // Sends |size| bytes, waiting for the host to free space when needed.
+    // Data that would cross the end of the shared buffer is split in two
+    // transfers.
+    void flush(const char* data, uint32_t size) {
+        while (size) {
+            const uint32_t offset = mWritePos % kBufferSize;
+            const uint32_t todo = std::min(size, kBufferSize - offset);
+            while (mWritePos + todo - consumedPos() > kBufferSize) {
+                std::this_thread::yield();
+            }
+            memcpy(mBuffer.data() + offset, data, todo);
+            const asg_type1_xfer xfer = {offset, todo};
+            while (ring_buffer_write(mToHost.get(), &xfer, sizeof(xfer), 1) != 1) {
+                std::this_thread::yield();
+            }
+            mWritePos += todo;
+            data += todo;
+            size -= todo;
+        }
+    }
+
+    uint32_t consumedPos() const {
+        return __atomic_load_n(&mConfig.host_consumed_pos, __ATOMIC_ACQUIRE);
+    }
+
+    uint32_t pendingXfers() const {
+        return ring_buffer_available_read(mToHost.get(), nullptr) / sizeof(asg_type1_xfer);
+    }
+
+private:
+    std::unique_ptr<ring_buffer> mToHost = std::make_unique<ring_buffer>();
+    std::unique_ptr<ring_buffer> mToHostLarge = std::make_unique<ring_buffer>();
+    std::unique_ptr<ring_buffer> mFromHostLarge = std::make_unique<ring_buffer>();
+    std::vector<uint8_t> mToHostLargeBuffer = std::vector<uint8_t>(kLargeXferRingSize);
+    std::vector<uint8_t> mFromHostLargeBuffer = std::vector<uint8_t>(kLargeXferRingSize);
+    std::vector<char> mBuffer = std::vector<char>(kBufferSize);
+    uint32_t mHostState = 0;
+    asg_ring_config mConfig = {};
+    asg_context mContext = {};
+    uint32_t mWritePos = 0;
+};
+
+std::vector<char> makeData(size_t size, uint32_t seed) {
+    std::vector<char> data(size);
+    std::mt19937 gen(seed);
+    for (auto& c : data) {
+        c = static_cast<char>(gen());
+    }
+    return data;
+}
+
+TEST(RingStream, ReadsBurstOfTransfersAtOnce) {
+    FakeGuest guest;
+    auto stream = guest.createStream();
+
+    const std::vector<char> data = makeData(100 * 16, 1);
+    for (size_t i = 0; i < 100; ++i) {
+        guest.flush(data.data() + i * 16, 16);
+    }
+    EXPECT_EQ(guest.pendingXfers(), 100);
+
+    std::vector<char> received(4096);
+    ASSERT_EQ(stream->read(received.data(), received.size()), data.size());
+    received.resize(data.size());
+    EXPECT_EQ(received, data);
+    EXPECT_EQ(guest.pendingXfers(), 0);
+    EXPECT_EQ(guest.consumedPos(), data.size());
+}
+
+TEST(RingStream, StopsAtTransferThatDoesNotFit) {
+    FakeGuest guest;
+    auto stream = guest.createStream();
+
+    const std::vector<char> data = makeData(300, 2);
+    guest.flush(data.data(), 100);
+    guest.flush(data.data() + 100, 200);
+
+    std::vector<char> received(300);
+    ASSERT_EQ(stream->read(received.data(), 250), 100);
+    EXPECT_EQ(guest.pendingXfers(), 1);
+    EXPECT_EQ(guest.consumedPos(), 100);
+
+    ASSERT_EQ(stream->read(received.data() + 100, 150), 150);
+    ASSERT_EQ(stream->read(received.data() + 250, 50), 50);
+    EXPECT_EQ(received, data);
+    EXPECT_EQ(guest.pendingXfers(), 0);
+    EXPECT_EQ(guest.consumedPos(), 300);
+}
+
+TEST(RingStream, PeekAndConsumeInPlace) {
+    FakeGuest guest;
+    auto stream = guest.createStream();
+
+    const std::vector<char> data = makeData(300, 6);
+    guest.flush(data.data(), 100);
+    guest.flush(data.data() + 100, 100);
+    guest.flush(data.data() + 200, 100);
+
+    char* peeked = nullptr;
+    size_t peekedSize = 0;
+    ASSERT_TRUE(stream->peekContiguous(&peeked, &peekedSize));
+    ASSERT_EQ(peekedSize, 300);
+    EXPECT_EQ(std::vector<char>(peeked, peeked + peekedSize), data);
+
+    // Stop in the middle of the second transfer.
+    stream->consumePeeked(150);
+    EXPECT_EQ(guest.pendingXfers(), 2);
+    EXPECT_EQ(guest.consumedPos(), 150);
+
+    ASSERT_TRUE(stream->peekContiguous(&peeked, &peekedSize));
+    ASSERT_EQ(peekedSize, 150);
+    EXPECT_EQ(std::vector<char>(peeked, peeked + peekedSize),
+              std::vector<char>(data.begin() + 150, data.end()));
+
+    // The copy path picks up where in place decoding stopped.
+    std::vector<char> received(150);
+    ASSERT_EQ(stream->read(received.data(), received.size()), 150);
+    EXPECT_EQ(received, std::vector<char>(data.begin() + 150, data.end()));
+    EXPECT_EQ(guest.pendingXfers(), 0);
+    EXPECT_EQ(guest.consumedPos(), 300);
+    EXPECT_FALSE(stream->peekContiguous(&peeked, &peekedSize));
+}
+
+TEST(RingStream, PeekStopsAtWrap) {
+    FakeGuest guest;
+    auto stream = guest.createStream();
+
+    const std::vector<char> filler = makeData(kBufferSize - 100, 7);
+    guest.flush(filler.data(), filler.size());
+    std::vector<char> received(filler.size());
+    ASSERT_EQ(stream->read(received.data(), received.size()), filler.size());
+
+    // Split in two transfers by the end of the shared buffer.
+    const std::vector<char> data = makeData(300, 8);
+    guest.flush(data.data(), data.size());
+    EXPECT_EQ(guest.pendingXfers(), 2);
+
+    char* peeked = nullptr;
+    size_t peekedSize = 0;
+    ASSERT_TRUE(stream->peekContiguous(&peeked, &peekedSize));
+    EXPECT_EQ(peekedSize, 100);
+    stream->consumePeeked(peekedSize);
+
+    ASSERT_TRUE(stream->peekContiguous(&peeked, &peekedSize));
+    ASSERT_EQ(peekedSize, 200);
+    EXPECT_EQ(std::vector<char>(peeked, peeked + peekedSize),
+              std::vector<char>(data.begin() + 100, data.end()));
+    stream->consumePeeked(peekedSize);
+    EXPECT_EQ(guest.pendingXfers(), 0);
+    EXPECT_EQ(guest.consumedPos(), kBufferSize + 200);
+}
+
+TEST(RingStream, StressConcurrentGuest) {
+    FakeGuest guest;
+    auto stream = guest.createStream();
+
+    const std::vector<char> data = makeData(16 * 1024 * 1024, 3);
+    std::thread guestThread([&guest, &data] {
+        std::mt19937 gen(4);
+        std::uniform_int_distribution<uint32_t> flushSize(1, 2048);
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const uint32_t size = std::min<size_t>(flushSize(gen), data.size() - sent);
+            guest.flush(data.data() + sent, size);
+            sent += size;
+        }
+    });
+
+    // Mix copies with in place consumption of random parts of the data.
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<size_t> readSize(1, 64 * 1024);
+    std::bernoulli_distribution inPlace(0.3);
+    std::vector<char> received(data.size());
+    size_t total = 0;
+    while (total < data.size()) {
+        char* peeked = nullptr;
+        size_t peekedSize = 0;
+        if (inPlace(gen) && stream->peekContiguous(&peeked, &peekedSize)) {
+            const size_t consumed = std::min(readSize(gen), peekedSize);
+            memcpy(received.data() + total, peeked, consumed);
+            stream->consumePeeked(consumed);
+            total += consumed;
+            continue;
+        }
+        const size_t wanted = std::min(readSize(gen), data.size() - total);
+        const size_t got = stream->read(received.data() + total, wanted);
+        ASSERT_GT(got, 0);
+        ASSERT_LE(got, wanted);
+        total += got;
+    }
+    guestThread.join();
+
+    EXPECT_TRUE(received == data);
+    EXPECT_EQ(guest.pendingXfers(), 0);
+    EXPECT_EQ(guest.consumedPos(), static_cast<uint32_t>(data.size()));
+}
+
+}  // namespace
+}  // namespace emugl
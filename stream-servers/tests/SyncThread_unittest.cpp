@@ -0,0 +1,134 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SyncThread.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "aemu/base/Metrics.h"
+
+namespace {
+
+using android::base::CreateMetricsLogger;
+using emugl::MetricsLogger;
+using gfxstream::EmulatedEglFenceSync;
+
+constexpr auto kCompletionTimeout = std::chrono::seconds(1);
+
+// Fence handles that were never registered, like those of destroyed fences,
+// don't need GL to wait for.
+EmulatedEglFenceSync* staleFenceSync(uintptr_t i) {
+    return reinterpret_cast<EmulatedEglFenceSync*>(0x1000 + i);
+}
+
+class SyncThreadTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mSyncThread = std::make_unique<SyncThread>(/*noGL=*/true, mHealthMonitor);
+    }
+
+    void TearDown() override { mSyncThread.reset(); }
+
+    std::unique_ptr<MetricsLogger> mLogger = CreateMetricsLogger();
+    HealthMonitor<> mHealthMonitor{*mLogger};
+    std::unique_ptr<SyncThread> mSyncThread;
+};
+
+TEST_F(SyncThreadTest, CompletesFenceWaitsInOrder) {
+    constexpr int kNumWaits = 64;
+    std::mutex mutex;
+    std::vector<int> order;
+    std::promise<void> done;
+    for (int i = 0; i < kNumWaits; ++i) {
+        mSyncThread->triggerWaitWithCompletionCallback(staleFenceSync(i), [&, i] {
+            std::unique_lock<std::mutex> lock(mutex);
+            order.push_back(i);
+            const bool last = order.size() == kNumWaits;
+            lock.unlock();
+            if (last) {
+                done.set_value();
+            }
+        });
+    }
+
+    ASSERT_EQ(done.get_future().wait_for(kCompletionTimeout), std::future_status::ready);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < kNumWaits; ++i) {
+        EXPECT_EQ(order[i], i);
+    }
+}
+
+TEST_F(SyncThreadTest, FenceWaitsDontWaitForBusyWorkers) {
+    // Keep every worker busy with general tasks.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    for (int i = 0; i < 8; ++i) {
+        mSyncThread->triggerGeneral([released] { released.wait(); }, "blocked task");
+    }
+
+    std::promise<void> done;
+    mSyncThread->triggerWaitWithCompletionCallback(staleFenceSync(0),
+                                                   [&done] { done.set_value(); });
+    EXPECT_EQ(done.get_future().wait_for(kCompletionTimeout), std::future_status::ready);
+    release.set_value();
+}
+
+TEST_F(SyncThreadTest, StatsCountCompletedWaits) {
+    constexpr int kNumWaits = 16;
+    std::mutex mutex;
+    int numCompleted = 0;
+    std::promise<void> done;
+    for (int i = 0; i < kNumWaits; ++i) {
+        mSyncThread->triggerWaitWithCompletionCallback(staleFenceSync(i), [&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            const bool last = ++numCompleted == kNumWaits;
+            lock.unlock();
+            if (last) {
+                done.set_value();
+            }
+        });
+    }
+    ASSERT_EQ(done.get_future().wait_for(kCompletionTimeout), std::future_status::ready);
+
+    const SyncThread::Stats stats = mSyncThread->getStats();
+    uint64_t numWaits = 0;
+    for (uint64_t count : stats.waitLatencyUs) {
+        numWaits += count;
+    }
+    EXPECT_EQ(numWaits, static_cast<uint64_t>(kNumWaits));
+    EXPECT_EQ(stats.timeouts, 0u);
+    // None of the fences had to be waited for.
+    EXPECT_LT(SyncThread::Stats::percentile(stats.waitLatencyUs, 99),
+              static_cast<uint64_t>(std::chrono::microseconds(kCompletionTimeout).count()));
+}
+
+TEST(SyncThreadStatsTest, Percentile) {
+    SyncThread::Stats::Histogram histogram = {};
+    EXPECT_EQ(SyncThread::Stats::percentile(histogram, 99), 0u);
+
+    histogram[0] = 50;
+    histogram[4] = 49;
+    histogram[10] = 1;
+    EXPECT_EQ(SyncThread::Stats::percentile(histogram, 50), 0u);
+    EXPECT_EQ(SyncThread::Stats::percentile(histogram, 99), 15u);
+    EXPECT_EQ(SyncThread::Stats::percentile(histogram, 100), 1023u);
+}
+
+}  // namespace
@@ -17,6 +17,7 @@
 #include "FrameBuffer.h"
 #include "VkCommonOperations.h"
 #include "VulkanDispatch.h"
+#include "gl/YUVConverter.h"
 #include "host-common/feature_control.h"
 
 #include "aemu/base/ArraySize.h"
@@ -29,6 +30,9 @@
 
 #include "Standalone.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vulkan/vulkan.h>
@@ -587,5 +591,100 @@ TEST_F(VulkanFrameBufferTest, VkColorBufferWithMemoryPropertyFlags) {
     EXPECT_TRUE(goldfish_vk::teardownVkColorBuffer(colorBuffer));
     mFb->closeColorBuffer(colorBuffer);
 }
+
+// A guest buffer of |format|, laid out as getYUVOffsets() says, with smooth
+// luma and chroma gradients.
+static std::vector<uint8_t> makeYUVGuestBuffer(uint32_t width, uint32_t height,
+                                               FrameworkFormat format) {
+    uint32_t yWidth, yHeight, yOffsetBytes, yStridePixels, yStrideBytes;
+    uint32_t uWidth, uHeight, uOffsetBytes, uStridePixels, uStrideBytes;
+    uint32_t vWidth, vHeight, vOffsetBytes, vStridePixels, vStrideBytes;
+    YUVConverter::getYUVOffsets(width, height, format, &yWidth, &yHeight, &yOffsetBytes,
+                                &yStridePixels, &yStrideBytes, &uWidth, &uHeight, &uOffsetBytes,
+                                &uStridePixels, &uStrideBytes, &vWidth, &vHeight, &vOffsetBytes,
+                                &vStridePixels, &vStrideBytes);
+    const size_t size = std::max({yOffsetBytes + yStrideBytes * yHeight,
+                                  uOffsetBytes + uStrideBytes * uHeight,
+                                  vOffsetBytes + vStrideBytes * vHeight});
+    std::vector<uint8_t> bytes(size, 0);
+    // Interleaved chroma has its samples 2 bytes apart.
+    const uint32_t chromaStep =
+        std::max(uOffsetBytes, vOffsetBytes) - std::min(uOffsetBytes, vOffsetBytes) <
+                uStrideBytes * uHeight
+            ? 2
+            : 1;
+    for (uint32_t row = 0; row < yHeight; row++) {
+        for (uint32_t col = 0; col < yWidth; col++) {
+            bytes[yOffsetBytes + row * yStrideBytes + col] =
+                16 + (row + col) * 219 / (yWidth + yHeight);
+        }
+    }
+    for (uint32_t row = 0; row < uHeight; row++) {
+        for (uint32_t col = 0; col < uWidth; col++) {
+            bytes[uOffsetBytes + row * uStrideBytes + col * chromaStep] = 96 + col * 64 / uWidth;
+            bytes[vOffsetBytes + row * vStrideBytes + col * chromaStep] = 96 + row * 64 / uHeight;
+        }
+    }
+    return bytes;
+}
+
+// The RGBA pixels of a YUV ColorBuffer read through the Vulkan path match the
+// ones YUVConverter draws on the GL path.
+TEST_F(VulkanFrameBufferTest, YUVColorBufferRgbaReadbackMatchesYUVConverter) {
+    auto* vkEmulation = goldfish_vk::getGlobalVkEmulation();
+    if (!vkEmulation->yuvConverterVk) {
+        GTEST_SKIP() << "No sampler Y'CbCr conversion support.";
+    }
+
+    // YUVConverter scales Cb by 0.96, which a sampler Y'CbCr conversion can't.
+    constexpr int kTolerance = 12;
+    constexpr uint32_t kWidth = 64;
+    constexpr uint32_t kHeight = 32;
+
+    for (FrameworkFormat format : {FRAMEWORK_FORMAT_NV12, FRAMEWORK_FORMAT_YV12}) {
+        SCOPED_TRACE(::testing::Message() << "framework format " << format);
+
+        HandleType colorBuffer = mFb->createColorBuffer(kWidth, kHeight, GL_RGBA, format);
+        ASSERT_NE(colorBuffer, 0u);
+        std::vector<uint8_t> guestBytes = makeYUVGuestBuffer(kWidth, kHeight, format);
+        ASSERT_TRUE(mFb->updateColorBuffer(colorBuffer, 0, 0, kWidth, kHeight, GL_RGBA,
+                                           GL_UNSIGNED_BYTE, guestBytes.data()));
+        std::vector<uint8_t> glPixels(kWidth * kHeight * 4);
+        mFb->readColorBuffer(colorBuffer, 0, 0, kWidth, kHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                             glPixels.data());
+
+        ASSERT_TRUE(goldfish_vk::setupVkColorBuffer(colorBuffer, true /* vulkanOnly */));
+        const auto info = goldfish_vk::getColorBufferInfo(colorBuffer);
+        if (!vkEmulation->yuvConverterVk->canConvert(info.imageCreateInfoShallow.format,
+                                                     info.imageCreateInfoShallow.tiling)) {
+            EXPECT_TRUE(goldfish_vk::teardownVkColorBuffer(colorBuffer));
+            mFb->closeColorBuffer(colorBuffer);
+            continue;
+        }
+        ASSERT_TRUE(goldfish_vk::updateColorBufferFromBytes(colorBuffer, 0, 0, kWidth, kHeight,
+                                                            guestBytes.data()));
+        std::vector<uint8_t> vkPixels(kWidth * kHeight * 4);
+        ASSERT_TRUE(goldfish_vk::readColorBufferToRgbaBytes(colorBuffer, 0, 0, kWidth, kHeight,
+                                                            vkPixels.data()));
+        for (size_t i = 0; i < vkPixels.size(); i++) {
+            ASSERT_LE(std::abs(int(glPixels[i]) - int(vkPixels[i])), kTolerance)
+                << "pixel " << i / 4 << " channel " << i % 4;
+        }
+
+        // Subrects are cut out of the converted image.
+        constexpr uint32_t kX = 5, kY = 3, kSubWidth = 17, kSubHeight = 9;
+        std::vector<uint8_t> subrectPixels(kSubWidth * kSubHeight * 4);
+        ASSERT_TRUE(goldfish_vk::readColorBufferToRgbaBytes(colorBuffer, kX, kY, kSubWidth,
+                                                            kSubHeight, subrectPixels.data()));
+        for (uint32_t row = 0; row < kSubHeight; row++) {
+            ASSERT_EQ(0, memcmp(&subrectPixels[row * kSubWidth * 4],
+                                &vkPixels[((kY + row) * kWidth + kX) * 4], kSubWidth * 4))
+                << "row " << row;
+        }
+
+        EXPECT_TRUE(goldfish_vk::teardownVkColorBuffer(colorBuffer));
+        mFb->closeColorBuffer(colorBuffer);
+    }
+}
 #endif // !_WIN32
 } // namespace emugl
@@ -0,0 +1,180 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays render thread streams captured with RENDERER_DUMP_DIR through the host decoders, e.g.
+// to reproduce a guest workload or benchmark the renderer on a machine without a guest:
+//
+//   RENDERER_DUMP_DIR=/tmp/capture <run the emulator and the workload>
+//   gfxstream_replay [--realtime] [--host-gpu] /tmp/capture/stream_*.gfxcap
+//
+// The replay uses the same feature set as the virtio-gpu backend, which must match the
+// configuration the capture was taken with. Only the byte streams are captured: data the guest
+// shares through mapped memory (host visible Vulkan memory, GL DMA) is not part of a capture.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "FrameBuffer.h"
+#include "GfxStreamAgents.h"
+#include "OpenGLESDispatch/OpenGLDispatchLoader.h"
+#include "RenderThread.h"
+#include "ReplayStream.h"
+#include "StreamCapture.h"
+#include "aemu/base/GLObjectCounter.h"
+#include "aemu/base/system/System.h"
+#include "host-common/GraphicsAgentFactory.h"
+#include "host-common/feature_control.h"
+#include "host-common/misc.h"
+
+namespace {
+
+struct Options {
+    bool realtime = false;
+    bool hostGpu = false;
+    bool vulkan = true;
+    int width = 1280;
+    int height = 720;
+    std::vector<std::string> captures;
+};
+
+void printUsage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] capture...\n"
+            "  --realtime       Deliver data at the pace it was captured at\n"
+            "  --host-gpu       Use the host GPU instead of SwiftShader\n"
+            "  --no-vulkan      Disable Vulkan emulation\n"
+            "  --width N        Display width (default 1280)\n"
+            "  --height N       Display height (default 720)\n",
+            argv0);
+}
+
+std::optional<Options> parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "--realtime")) {
+            options.realtime = true;
+        } else if (!strcmp(arg, "--host-gpu")) {
+            options.hostGpu = true;
+        } else if (!strcmp(arg, "--no-vulkan")) {
+            options.vulkan = false;
+        } else if (!strcmp(arg, "--width") && i + 1 < argc) {
+            options.width = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--height") && i + 1 < argc) {
+            options.height = atoi(argv[++i]);
+        } else if (arg[0] == '-') {
+            return std::nullopt;
+        } else {
+            options.captures.push_back(arg);
+        }
+    }
+    if (options.captures.empty() || options.width <= 0 || options.height <= 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+// Mirrors the features enabled by the virtio-gpu backend, which is where captures usually come
+// from. The guest negotiated its protocol against these, so they must match.
+void setFeatures(const Options& options) {
+    feature_set_enabled_override(kFeature_GLPipeChecksum, false);
+    feature_set_enabled_override(kFeature_GLESDynamicVersion, true);
+    feature_set_enabled_override(kFeature_GLDMA, false);
+    feature_set_enabled_override(kFeature_GLAsyncSwap, false);
+    feature_set_enabled_override(kFeature_RefCountPipe, false);
+    feature_set_enabled_override(kFeature_NoDelayCloseColorBuffer, true);
+    feature_set_enabled_override(kFeature_GLDirectMem, false);
+    feature_set_enabled_override(kFeature_Vulkan, options.vulkan);
+    feature_set_enabled_override(kFeature_VulkanSnapshots, false);
+    feature_set_enabled_override(kFeature_VulkanNullOptionalStrings, true);
+    feature_set_enabled_override(kFeature_VulkanShaderFloat16Int8, true);
+    feature_set_enabled_override(kFeature_HostComposition, true);
+    feature_set_enabled_override(kFeature_VulkanIgnoredHandles, true);
+    feature_set_enabled_override(kFeature_VirtioGpuNext, true);
+    feature_set_enabled_override(kFeature_VirtioGpuNativeSync, true);
+    feature_set_enabled_override(kFeature_VulkanQueueSubmitWithCommands, true);
+    feature_set_enabled_override(kFeature_VulkanBatchedDescriptorSetUpdate, true);
+    feature_set_enabled_override(kFeature_VulkanAstcLdrEmulation, true);
+    feature_set_enabled_override(kFeature_VulkanEtc2Emulation, true);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::optional<Options> options = parseOptions(argc, argv);
+    if (!options) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Open everything upfront so that a typo doesn't waste a renderer initialization.
+    std::vector<std::unique_ptr<emugl::StreamCaptureReader>> readers;
+    uint64_t captureOriginUs = UINT64_MAX;
+    for (const auto& path : options->captures) {
+        auto reader = emugl::StreamCaptureReader::open(path);
+        if (!reader) return 1;
+        captureOriginUs = std::min(captureOriginUs, reader->header().startTimeUs);
+        readers.push_back(std::move(reader));
+    }
+
+    setFeatures(*options);
+    android::emulation::injectGraphicsAgents(android::emulation::GfxStreamGraphicsAgentFactory());
+    emugl::setGLObjectCounter(android::base::GLObjectCounter::get());
+    emugl::set_emugl_window_operations(*getGraphicsAgents()->emu);
+    emugl::set_emugl_multi_display_operations(*getGraphicsAgents()->multi_display);
+    if (!LazyLoadedEGLDispatch::get() || !LazyLoadedGLESv1Dispatch::get() ||
+        !LazyLoadedGLESv2Dispatch::get()) {
+        fprintf(stderr, "%s: failed to load the GLES translator libraries\n", __func__);
+        return 1;
+    }
+    if (!FrameBuffer::initialize(options->width, options->height, false /* useSubWindow */,
+                                 !options->hostGpu /* egl2egl */)) {
+        fprintf(stderr, "%s: failed to initialize the renderer\n", __func__);
+        return 1;
+    }
+
+    const uint64_t startUs = android::base::getHighResTimeUs();
+    std::optional<emugl::ReplayStream::Clock> clock;
+    if (options->realtime) {
+        clock = emugl::ReplayStream::Clock{
+            .captureOriginUs = captureOriginUs,
+            .replayStartUs = startUs,
+        };
+    }
+
+    std::vector<std::unique_ptr<emugl::RenderThread>> threads;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        auto stream = std::make_unique<emugl::ReplayStream>(std::move(readers[i]), clock);
+        threads.push_back(std::make_unique<emugl::RenderThread>(
+            std::move(stream), "Replay RenderThread " + std::to_string(i)));
+        threads.back()->start();
+    }
+    for (auto& thread : threads) {
+        thread->wait();
+    }
+
+    const uint64_t elapsedUs = android::base::getHighResTimeUs() - startUs;
+    printf("Replayed %zu capture(s) in %.3f ms\n", threads.size(), elapsedUs / 1000.0);
+
+    threads.clear();
+    delete FrameBuffer::getFB();
+    return 0;
+}
@@ -31,8 +31,17 @@
 #define GFXSTREAM_CREATE_IMPORT_SYNC_VK         0xa001
 #define GFXSTREAM_CREATE_QSRI_EXPORT_VK         0xa002
 
+// Set in gfxstreamHeader::flags when ringIdx names the ring of the guest
+// context that the command's fence waits on. Without it the command uses the
+// global ring.
+#define GFXSTREAM_FLAG_RING_IDX                 0x1
+
+// Overlays what used to be a 32 bit opcode, so guests that only write the
+// opcode leave ringIdx and flags zero.
 struct gfxstreamHeader {
-    uint32_t opCode;
+    uint16_t opCode;
+    uint8_t ringIdx;
+    uint8_t flags;
 };
 
 struct gfxstreamContextCreate {
@@ -13,9 +13,11 @@
 // limitations under the License.
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
 #include <deque>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include "FrameBuffer.h"
 #include "GfxStreamAgents.h"
@@ -223,6 +225,10 @@ struct PipeResEntry {
     uint32_t numIovs;
     void* linear;
     size_t linearSize;
+    // Prefix sums of iov lengths: iovOffsets[i] is the linear offset where
+    // iov[i] starts, with a trailing entry for the total size. Built when the
+    // iovs are attached; empty for ad-hoc iov lists passed to a transfer.
+    std::vector<size_t> iovOffsets;
     GoldfishHostPipe* hostPipe;
     VirtioGpuCtxId ctxId;
     void* hva;
@@ -358,6 +364,29 @@ static inline uint32_t gl_format_to_natural_type(uint32_t format) {
     }
 }
 
+// Bytes per pixel of a non-YUV format.
+static inline uint32_t virgl_format_to_bpp(uint32_t format) {
+    switch (format) {
+        case VIRGL_FORMAT_R16G16B16A16_FLOAT:
+            return 8;
+        case VIRGL_FORMAT_B8G8R8X8_UNORM:
+        case VIRGL_FORMAT_B8G8R8A8_UNORM:
+        case VIRGL_FORMAT_R8G8B8X8_UNORM:
+        case VIRGL_FORMAT_R8G8B8A8_UNORM:
+        case VIRGL_FORMAT_R10G10B10A2_UNORM:
+            return 4;
+        case VIRGL_FORMAT_B5G6R5_UNORM:
+        case VIRGL_FORMAT_R8G8_UNORM:
+        case VIRGL_FORMAT_R16_UNORM:
+            return 2;
+        case VIRGL_FORMAT_R8_UNORM:
+            return 1;
+        default:
+            VGP_FATAL() << "Unknown format: 0x" << std::hex << format;
+    }
+    return 4;
+}
+
 static inline size_t virgl_format_to_linear_base(
     uint32_t format,
     uint32_t totalWidth, uint32_t totalHeight,
@@ -365,30 +394,7 @@ static inline size_t virgl_format_to_linear_base(
     if (virgl_format_is_yuv(format)) {
         return 0;
     } else {
-        uint32_t bpp = 4;
-        switch (format) {
-            case VIRGL_FORMAT_R16G16B16A16_FLOAT:
-                bpp = 8;
-                break;
-            case VIRGL_FORMAT_B8G8R8X8_UNORM:
-            case VIRGL_FORMAT_B8G8R8A8_UNORM:
-            case VIRGL_FORMAT_R8G8B8X8_UNORM:
-            case VIRGL_FORMAT_R8G8B8A8_UNORM:
-            case VIRGL_FORMAT_R10G10B10A2_UNORM:
-                bpp = 4;
-                break;
-            case VIRGL_FORMAT_B5G6R5_UNORM:
-            case VIRGL_FORMAT_R8G8_UNORM:
-            case VIRGL_FORMAT_R16_UNORM:
-                bpp = 2;
-                break;
-            case VIRGL_FORMAT_R8_UNORM:
-                bpp = 1;
-                break;
-            default:
-                VGP_FATAL() << "Unknown format: 0x" << std::hex << format;
-        }
-
+        uint32_t bpp = virgl_format_to_bpp(format);
         uint32_t stride = totalWidth * bpp;
         return y * stride + x * bpp;
     }
@@ -438,30 +444,7 @@ static inline size_t virgl_format_to_total_xfer_len(
         uint32_t dataSize = ySize + uvSize;
         return dataSize;
     } else {
-        uint32_t bpp = 4;
-        switch (format) {
-            case VIRGL_FORMAT_R16G16B16A16_FLOAT:
-                bpp = 8;
-                break;
-            case VIRGL_FORMAT_B8G8R8X8_UNORM:
-            case VIRGL_FORMAT_B8G8R8A8_UNORM:
-            case VIRGL_FORMAT_R8G8B8X8_UNORM:
-            case VIRGL_FORMAT_R8G8B8A8_UNORM:
-            case VIRGL_FORMAT_R10G10B10A2_UNORM:
-                bpp = 4;
-                break;
-            case VIRGL_FORMAT_B5G6R5_UNORM:
-            case VIRGL_FORMAT_R16_UNORM:
-            case VIRGL_FORMAT_R8G8_UNORM:
-                bpp = 2;
-                break;
-            case VIRGL_FORMAT_R8_UNORM:
-                bpp = 1;
-                break;
-            default:
-                VGP_FATAL() << "Unknown format: 0x" << std::hex << format;
-        }
-
+        uint32_t bpp = virgl_format_to_bpp(format);
         uint32_t stride = totalWidth * bpp;
         return (h - 1U) * stride + w * bpp;
     }
@@ -515,42 +498,52 @@ static int sync_iov(PipeResEntry* res, uint64_t offset, const virgl_box* box, Io
 
     uint32_t iovIndex = 0;
     size_t iovOffset = 0;
-    size_t written = 0;
-    char* linear = static_cast<char*>(res->linear);
+    if (res->iovOffsets.size() == res->numIovs + 1) {
+        // Last iov starting at or before |start|.
+        auto it = std::upper_bound(res->iovOffsets.begin(), res->iovOffsets.end() - 1, start);
+        iovIndex = (uint32_t)(it - res->iovOffsets.begin() - 1);
+        iovOffset = res->iovOffsets[iovIndex];
+    } else {
+        while (iovIndex < res->numIovs && iovOffset + res->iov[iovIndex].iov_len <= start) {
+            iovOffset += res->iov[iovIndex].iov_len;
+            ++iovIndex;
+        }
+    }
 
-    while (written < length) {
+    size_t pos = start;
+    char* linear = static_cast<char*>(res->linear);
 
+    while (pos < end) {
         if (iovIndex >= res->numIovs) {
             VGP_FATAL() << "write request overflowed numIovs";
         }
 
-        const char* iovBase_const = static_cast<const char*>(res->iov[iovIndex].iov_base);
-        char* iovBase = static_cast<char*>(res->iov[iovIndex].iov_base);
-        size_t iovLen = res->iov[iovIndex].iov_len;
-        size_t iovOffsetEnd = iovOffset + iovLen;
-
-        auto lower_intersect = std::max(iovOffset, start);
-        auto upper_intersect = std::min(iovOffsetEnd, end);
-        if (lower_intersect < upper_intersect) {
-            size_t toWrite = upper_intersect - lower_intersect;
-            switch (dir) {
-                case IOV_TO_LINEAR:
-                    memcpy(linear + lower_intersect,
-                           iovBase_const + lower_intersect - iovOffset,
-                           toWrite);
-                    break;
-                case LINEAR_TO_IOV:
-                    memcpy(iovBase + lower_intersect - iovOffset,
-                           linear + lower_intersect,
-                           toWrite);
-                    break;
-                default:
-                    VGP_FATAL() << "Invalid sync dir " << dir;
-            }
-            written += toWrite;
-        }
+        // Guest pages backing a resource are often physically contiguous, so
+        // coalesce adjacent iovs into a single copy.
+        char* iovBase = static_cast<char*>(res->iov[iovIndex].iov_base) + (pos - iovOffset);
+        size_t runEnd = iovOffset + res->iov[iovIndex].iov_len;
         ++iovIndex;
-        iovOffset += iovLen;
+        while (runEnd < end && iovIndex < res->numIovs &&
+               static_cast<char*>(res->iov[iovIndex - 1].iov_base) +
+                       res->iov[iovIndex - 1].iov_len ==
+                   res->iov[iovIndex].iov_base) {
+            runEnd += res->iov[iovIndex].iov_len;
+            ++iovIndex;
+        }
+        iovOffset = runEnd;
+
+        size_t toCopy = std::min(runEnd, end) - pos;
+        switch (dir) {
+            case IOV_TO_LINEAR:
+                memcpy(linear + pos, iovBase, toCopy);
+                break;
+            case LINEAR_TO_IOV:
+                memcpy(iovBase, linear + pos, toCopy);
+                break;
+            default:
+                VGP_FATAL() << "Invalid sync dir " << dir;
+        }
+        pos += toCopy;
     }
 
     return 0;
@@ -781,12 +774,6 @@ public:
     }
 
     int submitCmd(VirtioGpuCtxId ctxId, void* buffer, int dwordCount) {
-        // TODO(kaiyili): embed the ring_idx into the command buffer to make it possible to dispatch
-        // commands on different ring.
-        VirtioGpuRing ring = VirtioGpuRingGlobal{};
-        VGPLOG("ctx: %" PRIu32 ", ring: %s buffer: %p dwords: %d", ctxId, to_string(ring).c_str(),
-               buffer, dwordCount);
-
         if (!buffer) {
             fprintf(stderr, "%s: error: buffer null\n", __func__);
             return -1;
@@ -798,6 +785,19 @@ public:
         }
 
         DECODE(header, gfxstreamHeader, buffer);
+
+        // Commands that name a ring get their own timeline, so a slow wait in
+        // one context does not hold up fences of the others.
+        VirtioGpuRing ring = VirtioGpuRingGlobal{};
+        if (header.flags & GFXSTREAM_FLAG_RING_IDX) {
+            ring = VirtioGpuRingContextSpecific{
+                .mCtxId = ctxId,
+                .mRingIdx = header.ringIdx,
+            };
+        }
+        VGPLOG("ctx: %" PRIu32 ", ring: %s buffer: %p dwords: %d", ctxId, to_string(ring).c_str(),
+               buffer, dwordCount);
+
         switch (header.opCode) {
             case GFXSTREAM_CONTEXT_CREATE:
             case GFXSTREAM_CONTEXT_PING:
@@ -839,10 +839,12 @@ public:
                 // VIRTGPU_EXECBUF_RING_IDX. With this, the task created here must use
                 // the same ring as the fence created for the virtio gpu command or the
                 // fence may be signaled without properly waiting for the task to complete.
-                ring = VirtioGpuRingContextSpecific{
-                    .mCtxId = ctxId,
-                    .mRingIdx = 0,
-                };
+                if (!(header.flags & GFXSTREAM_FLAG_RING_IDX)) {
+                    ring = VirtioGpuRingContextSpecific{
+                        .mCtxId = ctxId,
+                        .mRingIdx = 0,
+                    };
+                }
 
                 DECODE(exportQSRI, gfxstreamCreateQSRIExportVK, buffer)
 
@@ -1056,6 +1058,7 @@ public:
             free(entry.iov);
             entry.iov = nullptr;
             entry.numIovs = 0;
+            entry.iovOffsets.clear();
         }
 
         if (entry.externalAddr && !entry.ringBlob) {
@@ -1193,6 +1196,47 @@ public:
         return 0;
     }
 
+    // Computes the byte range of a BUFFER resource covered by |box|, the same
+    // range that sync_iov() copies. Boxes that do not fit in the resource fall
+    // back to the whole buffer.
+    void getBufferTransferRange(const PipeResEntry* res, const virgl_box* box,
+                                uint64_t* outStart, uint64_t* outLength) {
+        const uint64_t bufferSize = (uint64_t)res->args.width * res->args.height;
+
+        uint64_t requested = 0;
+        bool inBounds = box->w != 0 && box->h != 0 &&
+                        (uint64_t)box->x + box->w <= res->args.width &&
+                        (uint64_t)box->y + box->h <= res->args.height;
+        if (inBounds) {
+            *outStart = virgl_format_to_linear_base(res->args.format, res->args.width,
+                                                    res->args.height, box->x, box->y, box->w,
+                                                    box->h);
+            *outLength = virgl_format_to_total_xfer_len(res->args.format, res->args.width,
+                                                        res->args.height, box->x, box->y,
+                                                        box->w, box->h);
+            requested = *outLength;
+        } else {
+            *outStart = 0;
+            *outLength = bufferSize;
+            requested = (uint64_t)box->w * box->h;
+        }
+
+        mBufferTransferStats.transfers++;
+        mBufferTransferStats.bytesRequested += requested;
+        mBufferTransferStats.bytesMoved += *outLength;
+        if (!inBounds) {
+            mBufferTransferStats.wholeBufferFallbacks++;
+        }
+    }
+
+    void logBufferTransferStats() {
+        AutoLock lock(mLock);
+        INFO("virtio-gpu buffer transfers: %" PRIu64 " requested bytes: %" PRIu64
+             " moved bytes: %" PRIu64 " whole buffer fallbacks: %" PRIu64,
+             mBufferTransferStats.transfers, mBufferTransferStats.bytesRequested,
+             mBufferTransferStats.bytesMoved, mBufferTransferStats.wholeBufferFallbacks);
+    }
+
     int handleTransferReadBuffer(PipeResEntry* res, uint64_t offset, virgl_box* box) {
         if (res->type != ResType::BUFFER) {
             GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
@@ -1200,8 +1244,10 @@ public:
             return -1;
         }
 
-        mVirtioGpuOps->read_buffer(res->args.handle, 0, res->args.width * res->args.height,
-                                   res->linear);
+        uint64_t start;
+        uint64_t length;
+        getBufferTransferRange(res, box, &start, &length);
+        mVirtioGpuOps->read_buffer(res->args.handle, start, length, res->linear);
         return 0;
     }
 
@@ -1212,11 +1258,22 @@ public:
             return -1;
         }
 
-        mVirtioGpuOps->update_buffer(res->args.handle, 0, res->args.width * res->args.height,
-                                     res->linear);
+        uint64_t start;
+        uint64_t length;
+        getBufferTransferRange(res, box, &start, &length);
+        mVirtioGpuOps->update_buffer(res->args.handle, start, length, res->linear);
         return 0;
     }
 
+    // Falls back to the whole resource for full, empty or out-of-bounds boxes.
+    static bool isWholeResourceBox(const PipeResEntry* res, const virgl_box* box) {
+        if (box->w == 0 || box->h == 0) return true;
+        if ((uint64_t)box->x + box->w > res->args.width) return true;
+        if ((uint64_t)box->y + box->h > res->args.height) return true;
+        return box->x == 0 && box->y == 0 && box->w == res->args.width &&
+               box->h == res->args.height;
+    }
+
     void handleTransferReadColorBuffer(PipeResEntry* res, uint64_t offset, virgl_box* box) {
         if (res->type != ResType::COLOR_BUFFER) {
             GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
@@ -1227,14 +1284,35 @@ public:
         auto glformat = virgl_format_to_gl(res->args.format);
         auto gltype = gl_format_to_natural_type(glformat);
 
-        // We always xfer the whole thing again from GL
-        // since it's fiddly to calc / copy-out subregions
+        // YUV planes are subsampled, so always xfer the whole thing for those.
         if (virgl_format_is_yuv(res->args.format)) {
             mVirtioGpuOps->read_color_buffer_yuv(res->args.handle, 0, 0, res->args.width,
                                                  res->args.height, res->linear, res->linearSize);
-        } else {
+            return;
+        }
+
+        if (isWholeResourceBox(res, box)) {
             mVirtioGpuOps->read_color_buffer(res->args.handle, 0, 0, res->args.width,
                                              res->args.height, glformat, gltype, res->linear);
+            return;
+        }
+
+        // The box comes back tightly packed; spread its rows out over the
+        // resource's linear copy.
+        const uint32_t bpp = virgl_format_to_bpp(res->args.format);
+        const size_t srcStride = (size_t)box->w * bpp;
+        const size_t dstStride = (size_t)res->args.width * bpp;
+        mColorBufferTransferScratch.resize(srcStride * box->h);
+        mVirtioGpuOps->read_color_buffer(res->args.handle, box->x, box->y, box->w, box->h,
+                                         glformat, gltype, mColorBufferTransferScratch.data());
+
+        char* dst = static_cast<char*>(res->linear) + (size_t)box->y * dstStride +
+                    (size_t)box->x * bpp;
+        const uint8_t* src = mColorBufferTransferScratch.data();
+        for (uint32_t row = 0; row < box->h; ++row) {
+            memcpy(dst, src, srcStride);
+            dst += dstStride;
+            src += srcStride;
         }
     }
 
@@ -1248,10 +1326,30 @@ public:
         auto glformat = virgl_format_to_gl(res->args.format);
         auto gltype = gl_format_to_natural_type(glformat);
 
-        // We always xfer the whole thing again to GL
-        // since it's fiddly to calc / copy-out subregions
-        mVirtioGpuOps->update_color_buffer(res->args.handle, 0, 0, res->args.width,
-                                           res->args.height, glformat, gltype, res->linear);
+        // YUV planes are subsampled, so always xfer the whole thing for those.
+        if (virgl_format_is_yuv(res->args.format) || isWholeResourceBox(res, box)) {
+            mVirtioGpuOps->update_color_buffer(res->args.handle, 0, 0, res->args.width,
+                                               res->args.height, glformat, gltype, res->linear);
+            return;
+        }
+
+        // Pack the box's rows out of the resource's linear copy.
+        const uint32_t bpp = virgl_format_to_bpp(res->args.format);
+        const size_t dstStride = (size_t)box->w * bpp;
+        const size_t srcStride = (size_t)res->args.width * bpp;
+        mColorBufferTransferScratch.resize(dstStride * box->h);
+
+        const char* src = static_cast<const char*>(res->linear) + (size_t)box->y * srcStride +
+                          (size_t)box->x * bpp;
+        uint8_t* dst = mColorBufferTransferScratch.data();
+        for (uint32_t row = 0; row < box->h; ++row) {
+            memcpy(dst, src, dstStride);
+            dst += dstStride;
+            src += srcStride;
+        }
+
+        mVirtioGpuOps->update_color_buffer(res->args.handle, box->x, box->y, box->w, box->h,
+                                           glformat, gltype, mColorBufferTransferScratch.data());
     }
 
     int transferReadIov(int resId, uint64_t offset, virgl_box* box, struct iovec* iov, int iovec_cnt) {
@@ -1702,6 +1800,12 @@ private:
         entry.iov = (iovec*)malloc(sizeof(*iov) * num_iovs);
         entry.numIovs = num_iovs;
         memcpy(entry.iov, iov, num_iovs * sizeof(*iov));
+
+        entry.iovOffsets.resize(num_iovs + 1);
+        entry.iovOffsets[0] = 0;
+        for (uint32_t i = 0; i < num_iovs; ++i) {
+            entry.iovOffsets[i + 1] = entry.iovOffsets[i] + iov[i].iov_len;
+        }
         entry.linear = linear;
         entry.linearSize = linearSize;
 
@@ -1765,6 +1869,18 @@ private:
     std::unordered_map<VirtioGpuCtxId, std::vector<VirtioGpuResId>> mContextResources;
     std::unordered_map<VirtioGpuResId, std::vector<VirtioGpuCtxId>> mResourceContexts;
 
+    // Packed staging for color buffer transfers of a sub-box.
+    std::vector<uint8_t> mColorBufferTransferScratch;
+
+    // Guest-requested vs. actually transferred bytes for BUFFER resources.
+    struct BufferTransferStats {
+        uint64_t transfers = 0;
+        uint64_t bytesRequested = 0;
+        uint64_t bytesMoved = 0;
+        uint64_t wholeBufferFallbacks = 0;
+    };
+    BufferTransferStats mBufferTransferStats;
+
     // When we wait for gpu or wait for gpu vulkan, the next (and subsequent)
     // fences created for that context should not be signaled immediately.
     // Rather, they should get in line.
@@ -2503,6 +2619,7 @@ VG_EXPORT void gfxstream_backend_setup_window(
 }
 
 VG_EXPORT void gfxstream_backend_teardown() {
+    sRenderer()->logBufferTransferStats();
     android_finishOpenglesRenderer();
     android_hideOpenglesWindow();
     android_stopOpenglesRenderer(true);
@@ -20,18 +20,25 @@
 #include <string.h>
 #include <vulkan/vk_enum_string_helper.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <iomanip>
+#include <numeric>
+#include <optional>
 #include <ostream>
 #include <sstream>
+#include <tuple>
 #include <unordered_set>
 
 #include "FrameBuffer.h"
 #include "VkFormatUtils.h"
 #include "VulkanDispatch.h"
+#include "gl/YUVConverter.h"
 #include "aemu/base/synchronization/Lock.h"
 #include "aemu/base/containers/Lookup.h"
 #include "aemu/base/Optional.h"
 #include "aemu/base/containers/StaticMap.h"
+#include "aemu/base/files/PathUtils.h"
 #include "aemu/base/system/System.h"
 #include "aemu/base/Tracing.h"
 #include "common/goldfish_vk_dispatch.h"
@@ -79,6 +86,9 @@ constexpr size_t kPageSize = 1u << kPageBits;
 static StaticMap<VkDevice, uint32_t> sKnownStagingTypeIndices;
 
 static android::base::StaticLock sVkEmulationLock;
+// Serializes writes of persistent pipeline cache files. Taken before
+// sVkEmulationLock when both are needed.
+static android::base::StaticLock sPipelineCacheFileLock;
 
 VK_EXT_MEMORY_HANDLE dupExternalMemory(VK_EXT_MEMORY_HANDLE h) {
 #ifdef _WIN32
@@ -1052,43 +1062,12 @@ VkEmulation* createGlobalVkEmulation(VulkanDispatch* vk) {
                                              string_VkResult(poolCreateRes));
     }
 
-    VkCommandBufferAllocateInfo cbAi = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        0,
-        sVkEmulation->commandPool,
-        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        1,
-    };
-
-    VkResult cbAllocRes =
-        dvk->vkAllocateCommandBuffers(sVkEmulation->device, &cbAi, &sVkEmulation->commandBuffer);
-
-    if (cbAllocRes != VK_SUCCESS) {
-        VK_EMU_INIT_RETURN_OR_ABORT_ON_ERROR(cbAllocRes,
-                                             "Failed to allocate command buffer. Error: %s.",
-                                             string_VkResult(cbAllocRes));
-    }
-
-    VkFenceCreateInfo fenceCi = {
-        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        0,
-        0,
-    };
-
-    VkResult fenceCreateRes = dvk->vkCreateFence(sVkEmulation->device, &fenceCi, nullptr,
-                                                 &sVkEmulation->commandBufferFence);
-
-    if (fenceCreateRes != VK_SUCCESS) {
-        VK_EMU_INIT_RETURN_OR_ABORT_ON_ERROR(
-            fenceCreateRes, "Failed to create fence for command buffer. Error: %s.",
-            string_VkResult(fenceCreateRes));
-    }
-
     // At this point, the global emulation state's logical device can alloc
     // memory and send commands. However, it can't really do much yet to
     // communicate the results without the staging buffer. Set that up here.
     // Note that the staging buffer is meant to use external memory, with a
-    // non-external-memory fallback.
+    // non-external-memory fallback. Command buffers for staging transfers are
+    // allocated from |commandPool| on demand; see acquireStagingTransferLocked().
 
     VkBufferCreateInfo bufCi = {
         VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -1146,6 +1125,11 @@ VkEmulation* createGlobalVkEmulation(VulkanDispatch* vk) {
                                              string_VkResult(stagingBufferBindRes));
     }
 
+    if (sVkEmulation->deviceInfo.supportsSamplerYcbcrConversion) {
+        sVkEmulation->yuvConverterVk =
+            YUVConverterVk::create(*ivk, sVkEmulation->device, sVkEmulation->physdev);
+    }
+
     // LOG(VERBOSE) << "Vulkan global emulation state successfully initialized.";
     sVkEmulation->live = true;
 
@@ -1216,15 +1200,27 @@ void teardownGlobalVkEmulation() {
     sVkEmulation->compositorVk.reset();
     sVkEmulation->displayVk.reset();
 
-    freeExternalMemoryLocked(sVkEmulation->dvk, &sVkEmulation->staging.memory);
+    {
+        android::base::AutoLock lock(*sVkEmulation->queueLock);
+        VK_CHECK(sVkEmulation->dvk->vkQueueWaitIdle(sVkEmulation->queue));
+    }
+    sVkEmulation->yuvConverterVk.reset();
 
-    sVkEmulation->dvk->vkDestroyBuffer(sVkEmulation->device, sVkEmulation->staging.buffer, nullptr);
+    auto& stagingRing = sVkEmulation->stagingRing;
+    for (const auto& transfer : stagingRing.inFlight) {
+        stagingRing.freeCommandBuffers.emplace_back(transfer.commandBuffer, transfer.fence);
+    }
+    stagingRing.inFlight.clear();
+    for (auto& [commandBuffer, fence] : stagingRing.freeCommandBuffers) {
+        sVkEmulation->dvk->vkDestroyFence(sVkEmulation->device, fence, nullptr);
+        sVkEmulation->dvk->vkFreeCommandBuffers(sVkEmulation->device, sVkEmulation->commandPool, 1,
+                                                &commandBuffer);
+    }
+    stagingRing.freeCommandBuffers.clear();
 
-    sVkEmulation->dvk->vkDestroyFence(sVkEmulation->device, sVkEmulation->commandBufferFence,
-                                      nullptr);
+    freeExternalMemoryLocked(sVkEmulation->dvk, &sVkEmulation->staging.memory);
 
-    sVkEmulation->dvk->vkFreeCommandBuffers(sVkEmulation->device, sVkEmulation->commandPool, 1,
-                                            &sVkEmulation->commandBuffer);
+    sVkEmulation->dvk->vkDestroyBuffer(sVkEmulation->device, sVkEmulation->staging.buffer, nullptr);
 
     sVkEmulation->dvk->vkDestroyCommandPool(sVkEmulation->device, sVkEmulation->commandPool,
                                             nullptr);
@@ -1942,6 +1938,360 @@ bool colorBufferNeedsTransferBetweenGlAndVk(const VkEmulation::ColorBufferInfo&
     return true;
 }
 
+static constexpr uint64_t kStagingTransferMaxWaitNs = 5ULL * 1000ULL * 1000ULL * 1000ULL;
+
+// Every staging range starts at a multiple of this, which satisfies the copy
+// offset requirements of all color formats (including 3 and 12 byte texels)
+// and lets each range be flushed/invalidated on its own.
+static VkDeviceSize getStagingTransferAlignmentLocked() {
+    const auto& limits = sVkEmulation->deviceInfo.physdevProps.limits;
+    VkDeviceSize alignment = 256;
+    alignment = std::max(alignment, limits.optimalBufferCopyOffsetAlignment);
+    alignment = std::max(alignment, limits.nonCoherentAtomSize);
+    return alignment;
+}
+
+static VkDeviceSize getColorBufferTexelBlockSizeLocked(
+    const VkEmulation::ColorBufferInfo& colorBufferInfo) {
+    const VkFormat format = colorBufferInfo.imageCreateInfoShallow.format;
+    // Plane texels are at most 2 bytes, which the staging alignment covers.
+    if (formatRequiresSamplerYcbcrConversion(format)) return 1;
+    return std::max(1, getLinearFormatPixelSize(format));
+}
+
+// A slow GPU only gets the wait logged; it is not a reason to give up on the
+// transfer.
+static VkResult waitForStagingTransferFence(VkFence fence) {
+    auto vk = sVkEmulation->dvk;
+    VkResult res;
+    while ((res = vk->vkWaitForFences(sVkEmulation->device, 1, &fence, VK_TRUE,
+                                      kStagingTransferMaxWaitNs)) == VK_TIMEOUT) {
+        VK_COMMON_ERROR("Staging transfer still pending after %" PRIu64 " ms, waiting on.",
+                        kStagingTransferMaxWaitNs / 1000000);
+    }
+    return res;
+}
+
+static bool hasPendingStagingReaderLocked(const VkEmulation::StagingTransfer& transfer) {
+    auto& ring = sVkEmulation->stagingRing;
+    AutoLock readersLock(ring.readersLock);
+    return ring.pendingReaders.count(transfer.serial) > 0;
+}
+
+// Releases the range of the oldest transfer, after waiting for its reader to
+// be done with it if there is one.
+static void retireOldestStagingTransferLocked() {
+    auto vk = sVkEmulation->dvk;
+    auto& ring = sVkEmulation->stagingRing;
+
+    VkEmulation::StagingTransfer transfer = ring.inFlight.front();
+    {
+        AutoLock readersLock(ring.readersLock);
+        ring.readersDone.wait(&readersLock,
+                              [&] { return !ring.pendingReaders.count(transfer.serial); });
+    }
+    VK_CHECK(waitForStagingTransferFence(transfer.fence));
+    VK_CHECK(vk->vkResetFences(sVkEmulation->device, 1, &transfer.fence));
+
+    ring.inFlight.pop_front();
+    if (transfer.isUpload) {
+        ring.pendingUploads.fetch_sub(1);
+    }
+    ring.freeCommandBuffers.emplace_back(transfer.commandBuffer, transfer.fence);
+}
+
+static void retireCompletedStagingTransfersLocked() {
+    auto vk = sVkEmulation->dvk;
+    auto& ring = sVkEmulation->stagingRing;
+    while (!ring.inFlight.empty() && !hasPendingStagingReaderLocked(ring.inFlight.front())) {
+        VkResult res = vk->vkGetFenceStatus(sVkEmulation->device, ring.inFlight.front().fence);
+        if (res == VK_NOT_READY) {
+            return;
+        }
+        VK_CHECK(res);
+        retireOldestStagingTransferLocked();
+    }
+}
+
+// Returns the offset of a free range of |size| bytes in the staging ring, if any.
+// The offset is a multiple of |alignment|.
+static std::optional<VkDeviceSize> findFreeStagingRangeLocked(VkDeviceSize size,
+                                                              VkDeviceSize alignment) {
+    auto& ring = sVkEmulation->stagingRing;
+    const VkDeviceSize capacity = sVkEmulation->staging.size;
+
+    if (ring.inFlight.empty()) {
+        ring.head = 0;
+        return size <= capacity ? std::make_optional<VkDeviceSize>(0) : std::nullopt;
+    }
+
+    const VkDeviceSize tail = ring.inFlight.front().stagingOffset;
+    const VkDeviceSize head = (ring.head + alignment - 1) / alignment * alignment;
+    if (ring.head > tail) {
+        // In use: [tail, head). Free: [head, capacity) and [0, tail).
+        if (head + size <= capacity) return head;
+        if (size <= tail) return 0;
+        return std::nullopt;
+    }
+    // In use: [tail, capacity) and [0, head). Free: [head, tail).
+    if (head + size <= tail) return head;
+    return std::nullopt;
+}
+
+// Reserves |size| bytes of the staging buffer and a command buffer to record
+// the copy into. Waits for older transfers to retire if the ring is full. The
+// caller must record into |commandBuffer| and hand the transfer to
+// submitStagingTransferLocked() without releasing sVkEmulationLock.
+// Buffer to image copies need the offset to be a multiple of the texel block
+// size, which isn't a power of two for formats like VK_FORMAT_R8G8B8_UNORM.
+static std::optional<VkEmulation::StagingTransfer> acquireStagingTransferLocked(
+    VkDeviceSize size, bool isUpload, VkDeviceSize texelBlockSize = 1) {
+    auto vk = sVkEmulation->dvk;
+    auto& ring = sVkEmulation->stagingRing;
+
+    const VkDeviceSize alignment = getStagingTransferAlignmentLocked();
+    const VkDeviceSize offsetAlignment = std::lcm(alignment, texelBlockSize);
+    const VkDeviceSize alignedSize =
+        std::max(alignment, (size + alignment - 1) / alignment * alignment);
+    if (alignedSize > sVkEmulation->staging.size) {
+        return std::nullopt;
+    }
+
+    retireCompletedStagingTransfersLocked();
+    while (ring.inFlight.size() >= VkEmulation::kMaxStagingTransfersInFlight) {
+        retireOldestStagingTransferLocked();
+    }
+
+    std::optional<VkDeviceSize> offset = findFreeStagingRangeLocked(alignedSize, offsetAlignment);
+    while (!offset) {
+        retireOldestStagingTransferLocked();
+        offset = findFreeStagingRangeLocked(alignedSize, offsetAlignment);
+    }
+
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    if (!ring.freeCommandBuffers.empty()) {
+        std::tie(commandBuffer, fence) = ring.freeCommandBuffers.back();
+        ring.freeCommandBuffers.pop_back();
+    } else {
+        const VkCommandBufferAllocateInfo allocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = nullptr,
+            .commandPool = sVkEmulation->commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        VK_CHECK(vk->vkAllocateCommandBuffers(sVkEmulation->device, &allocateInfo, &commandBuffer));
+
+        const VkFenceCreateInfo fenceCi = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+        };
+        VK_CHECK(vk->vkCreateFence(sVkEmulation->device, &fenceCi, nullptr, &fence));
+    }
+
+    ring.head = *offset + alignedSize;
+
+    return VkEmulation::StagingTransfer{
+        .serial = ring.nextSerial++,
+        .commandBuffer = commandBuffer,
+        .fence = fence,
+        .stagingOffset = *offset,
+        .stagingSize = alignedSize,
+        .isUpload = isUpload,
+    };
+}
+
+static void submitStagingTransferLocked(const VkEmulation::StagingTransfer& transfer) {
+    auto vk = sVkEmulation->dvk;
+    auto& ring = sVkEmulation->stagingRing;
+
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = nullptr,
+        .pWaitDstStageMask = nullptr,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &transfer.commandBuffer,
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = nullptr,
+    };
+
+    {
+        android::base::AutoLock lock(*sVkEmulation->queueLock);
+        VK_CHECK(vk->vkQueueSubmit(sVkEmulation->queue, 1, &submitInfo, transfer.fence));
+    }
+
+    ring.inFlight.push_back(transfer);
+    if (transfer.isUpload) {
+        ring.pendingUploads.fetch_add(1);
+    }
+}
+
+static void* getStagingTransferPtr(const VkEmulation::StagingTransfer& transfer) {
+    return static_cast<char*>(sVkEmulation->staging.memory.mappedPtr) + transfer.stagingOffset;
+}
+
+static VkMappedMemoryRange getStagingTransferMemoryRange(
+    const VkEmulation::StagingTransfer& transfer) {
+    return VkMappedMemoryRange{
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .pNext = nullptr,
+        .memory = sVkEmulation->staging.memory.memory,
+        .offset = transfer.stagingOffset,
+        .size = transfer.stagingSize,
+    };
+}
+
+// Submits the readback |transfer|, waits for it and copies the first |size|
+// bytes of its staging range to |outBytes|. sVkEmulationLock is released during
+// the wait and the copy so that other transfers can go on, and is held again on
+// return. The range stays reserved until the copy is done.
+static void readStagingTransferLocked(const VkEmulation::StagingTransfer& transfer,
+                                      void* outBytes, VkDeviceSize size) {
+    auto vk = sVkEmulation->dvk;
+    auto& ring = sVkEmulation->stagingRing;
+
+    {
+        AutoLock readersLock(ring.readersLock);
+        ring.pendingReaders.insert(transfer.serial);
+    }
+    submitStagingTransferLocked(transfer);
+
+    sVkEmulationLock.unlock();
+    const VkResult res = waitForStagingTransferFence(transfer.fence);
+    if (res == VK_SUCCESS) {
+        const VkMappedMemoryRange toInvalidate = getStagingTransferMemoryRange(transfer);
+        VK_CHECK(vk->vkInvalidateMappedMemoryRanges(sVkEmulation->device, 1, &toInvalidate));
+        std::memcpy(outBytes, getStagingTransferPtr(transfer), size);
+    }
+    {
+        AutoLock readersLock(ring.readersLock);
+        ring.pendingReaders.erase(transfer.serial);
+        ring.readersDone.broadcast();
+    }
+    sVkEmulationLock.lock();
+    VK_CHECK(res);
+}
+
+void waitForPendingStagingUploads() {
+    if (!sVkEmulation || !sVkEmulation->live) return;
+
+    if (sVkEmulation->stagingRing.pendingUploads.load() == 0) return;
+
+    AutoLock lock(sVkEmulationLock);
+
+    auto& ring = sVkEmulation->stagingRing;
+    while (ring.pendingUploads.load() > 0 && !ring.inFlight.empty()) {
+        retireOldestStagingTransferLocked();
+    }
+}
+
+// YUV ColorBuffers are transferred in the layout the guest uses for them, the
+// same one YUVConverter uses on the GL path. The copies place each plane, so
+// neither the padded strides nor the V before U order of YV12 need a CPU pass.
+static bool getYUVColorBufferTransferInfoLocked(
+    const VkEmulation::ColorBufferInfo& colorBufferInfo, VkDeviceSize* outBufferCopySize,
+    std::vector<VkBufferImageCopy>* outBufferImageCopies) {
+    const auto frameworkFormat = static_cast<FrameworkFormat>(colorBufferInfo.frameworkFormat);
+    const VkFormat format = colorBufferInfo.imageCreateInfoShallow.format;
+    const VkExtent3D& extent = colorBufferInfo.imageCreateInfoShallow.extent;
+
+    bool interleavedChroma = false;
+    switch (format) {
+        case VK_FORMAT_G8_B8R8_2PLANE_420_UNORM:
+        case VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16:
+            interleavedChroma = true;
+            break;
+        case VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM:
+            break;
+        default:
+            VK_COMMON_ERROR("ColorBuffer:%d, framework format %d with unexpected format %s.",
+                            colorBufferInfo.handle, frameworkFormat, string_VkFormat(format));
+            return false;
+    }
+
+    uint32_t yWidth, yHeight, yOffsetBytes, yStridePixels, yStrideBytes;
+    uint32_t uWidth, uHeight, uOffsetBytes, uStridePixels, uStrideBytes;
+    uint32_t vWidth, vHeight, vOffsetBytes, vStridePixels, vStrideBytes;
+    YUVConverter::getYUVOffsets(extent.width, extent.height, frameworkFormat, &yWidth, &yHeight,
+                                &yOffsetBytes, &yStridePixels, &yStrideBytes, &uWidth, &uHeight,
+                                &uOffsetBytes, &uStridePixels, &uStrideBytes, &vWidth, &vHeight,
+                                &vOffsetBytes, &vStridePixels, &vStrideBytes);
+
+    // The image can only take chroma interleaved in Cb Cr order (NV12), or in
+    // separate planes (I420, YV12). NV21 guest buffers need a real repack.
+    const bool guestInterleavedChroma =
+        std::max(uOffsetBytes, vOffsetBytes) - std::min(uOffsetBytes, vOffsetBytes) <
+        uStrideBytes * uHeight;
+    if (guestInterleavedChroma != interleavedChroma ||
+        (interleavedChroma && vOffsetBytes < uOffsetBytes)) {
+        VK_COMMON_ERROR("ColorBuffer:%d, guest layout of framework format %d does not match %s.",
+                        colorBufferInfo.handle, frameworkFormat, string_VkFormat(format));
+        return false;
+    }
+
+    // The GL layout drops the last chroma column and row of odd sized buffers,
+    // while the chroma planes of the image round up. Grow the chroma rows, and
+    // move the second chroma plane down, to fit them. Even sizes, which are all
+    // Android allows for these formats, keep the GL layout.
+    const uint32_t chromaWidth = (extent.width + 1) / 2;
+    const uint32_t chromaHeight = (extent.height + 1) / 2;
+    uStridePixels = std::max(uStridePixels, chromaWidth);
+    vStridePixels = std::max(vStridePixels, chromaWidth);
+    if (!interleavedChroma) {
+        // Separate chroma planes have 1 byte texels.
+        if (uOffsetBytes < vOffsetBytes) {
+            vOffsetBytes = std::max(vOffsetBytes, uOffsetBytes + uStridePixels * chromaHeight);
+        } else {
+            uOffsetBytes = std::max(uOffsetBytes, vOffsetBytes + vStridePixels * chromaHeight);
+        }
+    }
+
+    std::vector<VkDeviceSize> planeOffsets = {yOffsetBytes, uOffsetBytes};
+    std::vector<uint32_t> planeRowLengths = {yStridePixels, uStridePixels};
+    if (!interleavedChroma) {
+        planeOffsets.push_back(vOffsetBytes);
+        planeRowLengths.push_back(vStridePixels);
+    }
+    return getFormatTransferInfoWithPlaneLayout(format, extent.width, extent.height, planeOffsets,
+                                                planeRowLengths, outBufferCopySize,
+                                                outBufferImageCopies);
+}
+
+// Fills in the staging size and copy regions for transferring the given
+// region of a ColorBuffer. Whole image transfers go through the plane aware
+// path so that multi-planar formats keep working.
+static bool getColorBufferTransferInfoLocked(const VkEmulation::ColorBufferInfo& colorBufferInfo,
+                                             uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                                             VkDeviceSize* outBufferCopySize,
+                                             std::vector<VkBufferImageCopy>* outBufferImageCopies) {
+    const VkExtent3D& extent = colorBufferInfo.imageCreateInfoShallow.extent;
+    if (colorBufferInfo.frameworkFormat != FRAMEWORK_FORMAT_GL_COMPATIBLE) {
+        if (x != 0 || y != 0 || w != extent.width || h != extent.height) {
+            VK_COMMON_ERROR("ColorBuffer:%d, subrect (%u, %u, %u, %u) transfer of a YUV image.",
+                            colorBufferInfo.handle, x, y, w, h);
+            return false;
+        }
+        return getYUVColorBufferTransferInfoLocked(colorBufferInfo, outBufferCopySize,
+                                                   outBufferImageCopies);
+    }
+    if (x == 0 && y == 0 && w == extent.width && h == extent.height) {
+        return getFormatTransferInfo(colorBufferInfo.imageCreateInfoShallow.format, w, h,
+                                     outBufferCopySize, outBufferImageCopies);
+    }
+    if (w == 0 || h == 0 || x > extent.width || w > extent.width - x || y > extent.height ||
+        h > extent.height - y) {
+        VK_COMMON_ERROR("ColorBuffer:%d, subrect (%u, %u, %u, %u) out of bounds of %ux%u.",
+                        colorBufferInfo.handle, x, y, w, h, extent.width, extent.height);
+        return false;
+    }
+    return getFormatTransferInfo(colorBufferInfo.imageCreateInfoShallow.format, x, y, w, h,
+                                 outBufferCopySize, outBufferImageCopies);
+}
+
 bool readColorBufferToGl(uint32_t colorBufferHandle) {
     if (!sVkEmulation || !sVkEmulation->live) {
         VK_COMMON_VERBOSE("VkEmulation not available.");
@@ -1961,10 +2311,9 @@ bool readColorBufferToGl(uint32_t colorBufferHandle) {
     }
 
     VkDeviceSize bytesNeeded = 0;
-    bool result = getFormatTransferInfo(colorBufferInfo->imageCreateInfoShallow.format,
-                                        colorBufferInfo->imageCreateInfoShallow.extent.width,
-                                        colorBufferInfo->imageCreateInfoShallow.extent.height,
-                                        &bytesNeeded, nullptr);
+    bool result = getColorBufferTransferInfoLocked(
+        *colorBufferInfo, 0, 0, colorBufferInfo->imageCreateInfoShallow.extent.width,
+        colorBufferInfo->imageCreateInfoShallow.extent.height, &bytesNeeded, nullptr);
     if (!result) {
         VK_COMMON_ERROR("Failed to read from ColorBuffer:%d, failed to get read size.",
                         colorBufferHandle);
@@ -2017,24 +2366,27 @@ bool readColorBufferToBytesLocked(uint32_t colorBufferHandle, uint32_t x, uint32
         return false;
     }
 
-    if (x != 0 || y != 0 || w != colorBufferInfo->imageCreateInfoShallow.extent.width ||
-        h != colorBufferInfo->imageCreateInfoShallow.extent.height) {
-        VK_COMMON_ERROR("Failed to read from ColorBuffer:%d, unhandled subrect.",
-                        colorBufferHandle);
-        return false;
-    }
-
     VkDeviceSize bufferCopySize = 0;
     std::vector<VkBufferImageCopy> bufferImageCopies;
-    if (!getFormatTransferInfo(colorBufferInfo->imageCreateInfoShallow.format,
-                               colorBufferInfo->imageCreateInfoShallow.extent.width,
-                               colorBufferInfo->imageCreateInfoShallow.extent.height,
-                               &bufferCopySize, &bufferImageCopies)) {
+    if (!getColorBufferTransferInfoLocked(*colorBufferInfo, x, y, w, h, &bufferCopySize,
+                                          &bufferImageCopies)) {
         VK_COMMON_ERROR("Failed to read ColorBuffer:%d, unable to get transfer info.",
                         colorBufferHandle);
         return false;
     }
 
+    auto transfer = acquireStagingTransferLocked(
+        bufferCopySize, /*isUpload=*/false, getColorBufferTexelBlockSizeLocked(*colorBufferInfo));
+    if (!transfer) {
+        VK_COMMON_ERROR("Failed to read ColorBuffer:%d, transfer size %" PRIu64
+                        " too large for staging buffer size:%" PRIu64 ".",
+                        colorBufferHandle, bufferCopySize, sVkEmulation->staging.size);
+        return false;
+    }
+    for (auto& bufferImageCopy : bufferImageCopies) {
+        bufferImageCopy.bufferOffset += transfer->stagingOffset;
+    }
+
     // Avoid transitioning from VK_IMAGE_LAYOUT_UNDEFINED. Unfortunetly, Android does not
     // yet have a mechanism for sharing the expected VkImageLayout. However, the Vulkan
     // spec's image layout transition sections says "If the old layout is
@@ -2053,14 +2405,14 @@ bool readColorBufferToBytesLocked(uint32_t colorBufferHandle, uint32_t x, uint32
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
-    VkCommandBuffer commandBuffer = sVkEmulation->commandBuffer;
+    VkCommandBuffer commandBuffer = transfer->commandBuffer;
 
     VK_CHECK(vk->vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
     const VkImageMemoryBarrier toTransferSrcImageBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .pNext = nullptr,
-        .srcAccessMask = 0,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
         .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
         .oldLayout = colorBufferInfo->currentLayout,
         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -2089,47 +2441,138 @@ bool readColorBufferToBytesLocked(uint32_t colorBufferHandle, uint32_t x, uint32
 
     VK_CHECK(vk->vkEndCommandBuffer(commandBuffer));
 
-    const VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = nullptr,
-        .waitSemaphoreCount = 0,
-        .pWaitSemaphores = nullptr,
-        .pWaitDstStageMask = nullptr,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
-    };
+    readStagingTransferLocked(*transfer, outPixels, bufferCopySize);
 
-    {
-        android::base::AutoLock lock(*sVkEmulation->queueLock);
-        VK_CHECK(vk->vkQueueSubmit(sVkEmulation->queue, 1, &submitInfo,
-                                   sVkEmulation->commandBufferFence));
+    return true;
+}
+
+// Draws the YUV ColorBuffer to RGBA8 with YUVConverterVk, and reads the region
+// back through the staging ring.
+static bool readYUVColorBufferToRgbaBytesLocked(VkEmulation::ColorBufferInfo* colorBufferInfo,
+                                                uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                                                void* outPixels) {
+    auto vk = sVkEmulation->dvk;
+    const VkImageCreateInfo& imageCi = colorBufferInfo->imageCreateInfoShallow;
+
+    YUVConverterVk* converter = sVkEmulation->yuvConverterVk.get();
+    if (!converter || !(imageCi.usage & VK_IMAGE_USAGE_SAMPLED_BIT) ||
+        !converter->canConvert(imageCi.format, imageCi.tiling)) {
+        VK_COMMON_ERROR("Failed to read ColorBuffer:%d, no RGBA conversion for %s.",
+                        colorBufferInfo->handle, string_VkFormat(imageCi.format));
+        return false;
+    }
+    if (w == 0 || h == 0 || x > imageCi.extent.width || w > imageCi.extent.width - x ||
+        y > imageCi.extent.height || h > imageCi.extent.height - y) {
+        VK_COMMON_ERROR("ColorBuffer:%d, subrect (%u, %u, %u, %u) out of bounds of %ux%u.",
+                        colorBufferInfo->handle, x, y, w, h, imageCi.extent.width,
+                        imageCi.extent.height);
+        return false;
     }
 
-    static constexpr uint64_t ANB_MAX_WAIT_NS = 5ULL * 1000ULL * 1000ULL * 1000ULL;
+    const VkDeviceSize bufferCopySize = static_cast<VkDeviceSize>(w) * h * 4;
+    auto transfer = acquireStagingTransferLocked(bufferCopySize, /*isUpload=*/false,
+                                                 /*texelBlockSize=*/4);
+    if (!transfer) {
+        VK_COMMON_ERROR("Failed to read ColorBuffer:%d, transfer size %" PRIu64
+                        " too large for staging buffer size:%" PRIu64 ".",
+                        colorBufferInfo->handle, bufferCopySize, sVkEmulation->staging.size);
+        return false;
+    }
 
-    VK_CHECK(vk->vkWaitForFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence,
-                                 VK_TRUE, ANB_MAX_WAIT_NS));
+    // Avoid transitioning from VK_IMAGE_LAYOUT_UNDEFINED, see
+    // readColorBufferToBytesLocked().
+    if (colorBufferInfo->currentLayout == VK_IMAGE_LAYOUT_UNDEFINED) {
+        colorBufferInfo->currentLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    const VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = nullptr,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
 
-    VK_CHECK(vk->vkResetFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence));
+    VkCommandBuffer commandBuffer = transfer->commandBuffer;
 
-    const VkMappedMemoryRange toInvalidate = {
-        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+    VK_CHECK(vk->vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    const VkImageMemoryBarrier toShaderReadImageBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .pNext = nullptr,
-        .memory = sVkEmulation->staging.memory.memory,
-        .offset = 0,
-        .size = VK_WHOLE_SIZE,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout = colorBufferInfo->currentLayout,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = colorBufferInfo->image,
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
     };
 
-    VK_CHECK(vk->vkInvalidateMappedMemoryRanges(sVkEmulation->device, 1, &toInvalidate));
+    vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &toShaderReadImageBarrier);
+
+    colorBufferInfo->currentLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    const auto* stagingBufferPtr = sVkEmulation->staging.memory.mappedPtr;
-    std::memcpy(outPixels, stagingBufferPtr, bufferCopySize);
+    const VkRect2D region = {
+        .offset = {static_cast<int32_t>(x), static_cast<int32_t>(y)},
+        .extent = {w, h},
+    };
+    // Must outlive the command buffer, so it is only freed once the read is done.
+    auto conversion = converter->recordConversion(
+        commandBuffer, colorBufferInfo->image, imageCi.format,
+        {imageCi.extent.width, imageCi.extent.height}, region, sVkEmulation->staging.buffer,
+        transfer->stagingOffset);
+
+    VK_CHECK(vk->vkEndCommandBuffer(commandBuffer));
+
+    if (!conversion) {
+        // The staging range is given back once the barrier alone completes.
+        submitStagingTransferLocked(*transfer);
+        VK_COMMON_ERROR("Failed to read ColorBuffer:%d, failed to record the RGBA conversion.",
+                        colorBufferInfo->handle);
+        return false;
+    }
+
+    readStagingTransferLocked(*transfer, outPixels, bufferCopySize);
 
     return true;
 }
 
+bool readColorBufferToRgbaBytes(uint32_t colorBufferHandle, uint32_t x, uint32_t y, uint32_t w,
+                                uint32_t h, void* outPixels) {
+    if (!sVkEmulation || !sVkEmulation->live) {
+        VK_COMMON_ERROR("VkEmulation not available.");
+        return false;
+    }
+
+    AutoLock lock(sVkEmulationLock);
+
+    auto colorBufferInfo = android::base::find(sVkEmulation->colorBuffers, colorBufferHandle);
+    if (!colorBufferInfo) {
+        VK_COMMON_ERROR("Failed to read from ColorBuffer:%d, not found.", colorBufferHandle);
+        return false;
+    }
+
+    if (colorBufferInfo->frameworkFormat == FRAMEWORK_FORMAT_GL_COMPATIBLE) {
+        return readColorBufferToBytesLocked(colorBufferHandle, x, y, w, h, outPixels);
+    }
+
+    if (!colorBufferInfo->image) {
+        VK_COMMON_ERROR("Failed to read from ColorBuffer:%d, no VkImage.", colorBufferHandle);
+        return false;
+    }
+
+    return readYUVColorBufferToRgbaBytesLocked(colorBufferInfo, x, y, w, h, outPixels);
+}
+
 bool updateColorBufferFromGl(uint32_t colorBufferHandle) {
     if (!sVkEmulation || !sVkEmulation->live) {
         VK_COMMON_VERBOSE("VkEmulation not available.");
@@ -2202,33 +2645,31 @@ bool updateColorBufferFromBytesLocked(uint32_t colorBufferHandle, uint32_t x, ui
         return false;
     }
 
-    if (x != 0 || y != 0 || w != colorBufferInfo->imageCreateInfoShallow.extent.width ||
-        h != colorBufferInfo->imageCreateInfoShallow.extent.height) {
-        VK_COMMON_ERROR("Failed to update ColorBuffer:%d, unhandled subrect.", colorBufferHandle);
-        return false;
-    }
-
     VkDeviceSize bufferCopySize = 0;
     std::vector<VkBufferImageCopy> bufferImageCopies;
-    if (!getFormatTransferInfo(colorBufferInfo->imageCreateInfoShallow.format,
-                               colorBufferInfo->imageCreateInfoShallow.extent.width,
-                               colorBufferInfo->imageCreateInfoShallow.extent.height,
-                               &bufferCopySize, &bufferImageCopies)) {
+    if (!getColorBufferTransferInfoLocked(*colorBufferInfo, x, y, w, h, &bufferCopySize,
+                                          &bufferImageCopies)) {
         VK_COMMON_ERROR("Failed to update ColorBuffer:%d, unable to get transfer info.",
                         colorBufferHandle);
         return false;
     }
 
-    const VkDeviceSize stagingBufferSize = sVkEmulation->staging.size;
-    if (bufferCopySize > stagingBufferSize) {
+    auto transfer = acquireStagingTransferLocked(
+        bufferCopySize, /*isUpload=*/true, getColorBufferTexelBlockSizeLocked(*colorBufferInfo));
+    if (!transfer) {
         VK_COMMON_ERROR("Failed to update ColorBuffer:%d, transfer size %" PRIu64
                         " too large for staging buffer size:%" PRIu64 ".",
-                        colorBufferHandle, bufferCopySize, stagingBufferSize);
+                        colorBufferHandle, bufferCopySize, sVkEmulation->staging.size);
         return false;
     }
+    for (auto& bufferImageCopy : bufferImageCopies) {
+        bufferImageCopy.bufferOffset += transfer->stagingOffset;
+    }
+
+    std::memcpy(getStagingTransferPtr(*transfer), pixels, bufferCopySize);
 
-    auto* stagingBufferPtr = sVkEmulation->staging.memory.mappedPtr;
-    std::memcpy(stagingBufferPtr, pixels, bufferCopySize);
+    const VkMappedMemoryRange toFlush = getStagingTransferMemoryRange(*transfer);
+    VK_CHECK(vk->vkFlushMappedMemoryRanges(sVkEmulation->device, 1, &toFlush));
 
     // Avoid transitioning from VK_IMAGE_LAYOUT_UNDEFINED. Unfortunetly, Android does not
     // yet have a mechanism for sharing the expected VkImageLayout. However, the Vulkan
@@ -2248,14 +2689,14 @@ bool updateColorBufferFromBytesLocked(uint32_t colorBufferHandle, uint32_t x, ui
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
-    VkCommandBuffer commandBuffer = sVkEmulation->commandBuffer;
+    VkCommandBuffer commandBuffer = transfer->commandBuffer;
 
     VK_CHECK(vk->vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
     const VkImageMemoryBarrier toTransferDstImageBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .pNext = nullptr,
-        .srcAccessMask = 0,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
         .dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
         .oldLayout = colorBufferInfo->currentLayout,
         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -2285,39 +2726,9 @@ bool updateColorBufferFromBytesLocked(uint32_t colorBufferHandle, uint32_t x, ui
 
     VK_CHECK(vk->vkEndCommandBuffer(commandBuffer));
 
-    const VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = nullptr,
-        .waitSemaphoreCount = 0,
-        .pWaitSemaphores = nullptr,
-        .pWaitDstStageMask = nullptr,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
-    };
-
-    {
-        android::base::AutoLock lock(*sVkEmulation->queueLock);
-        VK_CHECK(vk->vkQueueSubmit(sVkEmulation->queue, 1, &submitInfo,
-                                   sVkEmulation->commandBufferFence));
-    }
-
-    static constexpr uint64_t ANB_MAX_WAIT_NS = 5ULL * 1000ULL * 1000ULL * 1000ULL;
-
-    VK_CHECK(vk->vkWaitForFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence,
-                                 VK_TRUE, ANB_MAX_WAIT_NS));
-
-    VK_CHECK(vk->vkResetFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence));
-
-    const VkMappedMemoryRange toInvalidate = {
-        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        .pNext = nullptr,
-        .memory = sVkEmulation->staging.memory.memory,
-        .offset = 0,
-        .size = VK_WHOLE_SIZE,
-    };
-    VK_CHECK(vk->vkInvalidateMappedMemoryRanges(sVkEmulation->device, 1, &toInvalidate));
+    // Later work on the emulation queue is ordered after this copy. Work on
+    // other devices syncs up through waitForPendingStagingUploads().
+    submitStagingTransferLocked(*transfer);
 
     return true;
 }
@@ -2425,6 +2836,106 @@ int32_t mapGpaToBufferHandle(uint32_t bufferHandle, uint64_t gpa, uint64_t size)
     return memoryInfoPtr->pageOffset;
 }
 
+static std::string getPipelineCachePath(const VkPhysicalDeviceProperties& props) {
+    const std::string dir =
+        android::base::getEnvironmentVariable("ANDROID_EMUGL_SHADER_CACHE_DIR");
+    if (dir.empty()) return "";
+
+    std::stringstream name;
+    name << "vk_pipeline_cache_" << std::hex << std::setfill('0') << std::setw(8)
+         << props.vendorID << "_" << std::setw(8) << props.deviceID << ".bin";
+    return android::base::pj({dir, name.str()});
+}
+
+static std::vector<uint8_t> loadPipelineCacheData(const VkPhysicalDeviceProperties& props) {
+    const std::string path = getPipelineCachePath(props);
+    if (path.empty()) return {};
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return {};
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[64 * 1024];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+    fclose(file);
+
+    if (!isPipelineCacheDataCompatible(props, data.data(), data.size())) {
+        VK_COMMON_VERBOSE("Ignoring pipeline cache %s from a different driver.", path.c_str());
+        return {};
+    }
+    return data;
+}
+
+bool isPipelineCacheDataCompatible(const VkPhysicalDeviceProperties& props, const uint8_t* data,
+                                   size_t size) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (!data || size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props.vendorID && header.deviceID == props.deviceID &&
+           memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+std::vector<uint8_t> getPersistentPipelineCacheData(const VkPhysicalDeviceProperties& props) {
+    if (!sVkEmulation || !sVkEmulation->live) return {};
+
+    AutoLock lock(sVkEmulationLock);
+    auto& pipelineCacheData = sVkEmulation->pipelineCacheData;
+    auto it = pipelineCacheData.find({props.vendorID, props.deviceID});
+    if (it == pipelineCacheData.end()) {
+        it = pipelineCacheData.emplace(std::make_pair(props.vendorID, props.deviceID),
+                                       loadPipelineCacheData(props))
+                 .first;
+    }
+    const auto& data = it->second;
+    if (!isPipelineCacheDataCompatible(props, data.data(), data.size())) return {};
+    return data;
+}
+
+void savePersistentPipelineCacheData(const VkPhysicalDeviceProperties& props,
+                                     std::vector<uint8_t> data) {
+    if (!sVkEmulation || !sVkEmulation->live) return;
+    if (!isPipelineCacheDataCompatible(props, data.data(), data.size())) return;
+
+    AutoLock lock(sVkEmulationLock);
+    sVkEmulation->pipelineCacheData[{props.vendorID, props.deviceID}] = std::move(data);
+}
+
+void writePersistentPipelineCacheData(const VkPhysicalDeviceProperties& props) {
+    if (!sVkEmulation || !sVkEmulation->live) return;
+
+    const std::string path = getPipelineCachePath(props);
+    if (path.empty()) return;
+
+    // The last writer to get here writes the latest data.
+    AutoLock fileLock(sPipelineCacheFileLock);
+
+    std::vector<uint8_t> data;
+    {
+        AutoLock lock(sVkEmulationLock);
+        auto* saved = android::base::find(sVkEmulation->pipelineCacheData,
+                                          std::make_pair(props.vendorID, props.deviceID));
+        if (!saved || saved->empty()) return;
+        data = *saved;
+    }
+
+    // Write to the side so that a crash never leaves a truncated cache.
+    const std::string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) return;
+    const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    std::remove(path.c_str());
+    if (!written || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        VK_COMMON_ERROR("Failed to write pipeline cache %s.", path.c_str());
+        std::remove(tmpPath.c_str());
+    }
+}
+
 bool setupVkBuffer(uint32_t bufferHandle, bool vulkanOnly, uint32_t memoryProperty, bool* exported,
                    VkDeviceSize* allocSize, uint32_t* typeIndex) {
     if (vulkanOnly == false) {
@@ -2618,8 +3129,17 @@ bool readBufferToBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size, vo
         return false;
     }
 
-    const auto& stagingBufferInfo = sVkEmulation->staging;
-    if (size > stagingBufferInfo.size) {
+    if (offset > bufferInfo->size || size > bufferInfo->size - offset) {
+        VK_COMMON_ERROR("Failed to read from Buffer:%d, range [%llu, +%llu) out of bounds.",
+                        bufferHandle, (unsigned long long)offset, (unsigned long long)size);
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+
+    auto transfer = acquireStagingTransferLocked(size, /*isUpload=*/false);
+    if (!transfer) {
         VK_COMMON_ERROR("Failed to read from Buffer:%d, staging buffer too small.", bufferHandle);
         return false;
     }
@@ -2630,60 +3150,34 @@ bool readBufferToBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size, vo
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
-    VkCommandBuffer commandBuffer = sVkEmulation->commandBuffer;
+    VkCommandBuffer commandBuffer = transfer->commandBuffer;
 
     VK_CHECK(vk->vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+    // Uploads are not waited on before returning, so order this copy after
+    // any earlier writes to the buffer.
+    const VkMemoryBarrier memoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+    };
+    vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr,
+                             0, nullptr);
+
     const VkBufferCopy bufferCopy = {
         .srcOffset = offset,
-        .dstOffset = 0,
+        .dstOffset = transfer->stagingOffset,
         .size = size,
     };
-    vk->vkCmdCopyBuffer(commandBuffer, bufferInfo->buffer, stagingBufferInfo.buffer, 1,
+    vk->vkCmdCopyBuffer(commandBuffer, bufferInfo->buffer, sVkEmulation->staging.buffer, 1,
                         &bufferCopy);
 
     VK_CHECK(vk->vkEndCommandBuffer(commandBuffer));
 
-    const VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = nullptr,
-        .waitSemaphoreCount = 0,
-        .pWaitSemaphores = nullptr,
-        .pWaitDstStageMask = nullptr,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
-    };
-
-    {
-        android::base::AutoLock lock(*sVkEmulation->queueLock);
-        VK_CHECK(vk->vkQueueSubmit(sVkEmulation->queue, 1, &submitInfo,
-                                   sVkEmulation->commandBufferFence));
-    }
-
-    static constexpr uint64_t ANB_MAX_WAIT_NS = 5ULL * 1000ULL * 1000ULL * 1000ULL;
-
-    VK_CHECK(vk->vkWaitForFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence,
-                                 VK_TRUE, ANB_MAX_WAIT_NS));
-
-    VK_CHECK(vk->vkResetFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence));
-
-    const VkMappedMemoryRange toInvalidate = {
-        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        .pNext = nullptr,
-        .memory = stagingBufferInfo.memory.memory,
-        .offset = 0,
-        .size = size,
-    };
-
-    VK_CHECK(vk->vkInvalidateMappedMemoryRanges(sVkEmulation->device, 1, &toInvalidate));
-
-    const void* srcPtr = reinterpret_cast<const void*>(
-        reinterpret_cast<const char*>(stagingBufferInfo.memory.mappedPtr));
-    void* dstPtr = outBytes;
-    void* dstPtrOffset = reinterpret_cast<void*>(reinterpret_cast<char*>(dstPtr) + offset);
-    std::memcpy(dstPtrOffset, srcPtr, size);
+    void* dstPtrOffset = reinterpret_cast<void*>(reinterpret_cast<char*>(outBytes) + offset);
+    readStagingTransferLocked(*transfer, dstPtrOffset, size);
 
     return true;
 }
@@ -2704,8 +3198,17 @@ bool updateBufferFromBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size
         return false;
     }
 
-    const auto& stagingBufferInfo = sVkEmulation->staging;
-    if (size > stagingBufferInfo.size) {
+    if (offset > bufferInfo->size || size > bufferInfo->size - offset) {
+        VK_COMMON_ERROR("Failed to update Buffer:%d, range [%llu, +%llu) out of bounds.",
+                        bufferHandle, (unsigned long long)offset, (unsigned long long)size);
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+
+    auto transfer = acquireStagingTransferLocked(size, /*isUpload=*/true);
+    if (!transfer) {
         VK_COMMON_ERROR("Failed to update Buffer:%d, staging buffer too small.", bufferHandle);
         return false;
     }
@@ -2713,16 +3216,10 @@ bool updateBufferFromBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size
     const void* srcPtr = bytes;
     const void* srcPtrOffset =
         reinterpret_cast<const void*>(reinterpret_cast<const char*>(srcPtr) + offset);
-    void* dstPtr = stagingBufferInfo.memory.mappedPtr;
+    void* dstPtr = getStagingTransferPtr(*transfer);
     std::memcpy(dstPtr, srcPtrOffset, size);
 
-    const VkMappedMemoryRange toFlush = {
-        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        .pNext = nullptr,
-        .memory = stagingBufferInfo.memory.memory,
-        .offset = 0,
-        .size = size,
-    };
+    const VkMappedMemoryRange toFlush = getStagingTransferMemoryRange(*transfer);
     VK_CHECK(vk->vkFlushMappedMemoryRanges(sVkEmulation->device, 1, &toFlush));
 
     const VkCommandBufferBeginInfo beginInfo = {
@@ -2731,44 +3228,33 @@ bool updateBufferFromBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
-    VkCommandBuffer commandBuffer = sVkEmulation->commandBuffer;
+    VkCommandBuffer commandBuffer = transfer->commandBuffer;
 
     VK_CHECK(vk->vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+    // Uploads are not waited on before returning, so order this copy after
+    // any earlier writes to the buffer.
+    const VkMemoryBarrier memoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+    };
+    vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr,
+                             0, nullptr);
+
     const VkBufferCopy bufferCopy = {
-        .srcOffset = 0,
+        .srcOffset = transfer->stagingOffset,
         .dstOffset = offset,
         .size = size,
     };
-    vk->vkCmdCopyBuffer(commandBuffer, stagingBufferInfo.buffer, bufferInfo->buffer, 1,
+    vk->vkCmdCopyBuffer(commandBuffer, sVkEmulation->staging.buffer, bufferInfo->buffer, 1,
                         &bufferCopy);
 
     VK_CHECK(vk->vkEndCommandBuffer(commandBuffer));
 
-    const VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = nullptr,
-        .waitSemaphoreCount = 0,
-        .pWaitSemaphores = nullptr,
-        .pWaitDstStageMask = nullptr,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
-    };
-
-    {
-        android::base::AutoLock lock(*sVkEmulation->queueLock);
-        VK_CHECK(vk->vkQueueSubmit(sVkEmulation->queue, 1, &submitInfo,
-                                   sVkEmulation->commandBufferFence));
-    }
-
-    static constexpr uint64_t ANB_MAX_WAIT_NS = 5ULL * 1000ULL * 1000ULL * 1000ULL;
-
-    VK_CHECK(vk->vkWaitForFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence,
-                                 VK_TRUE, ANB_MAX_WAIT_NS));
-
-    VK_CHECK(vk->vkResetFences(sVkEmulation->device, 1, &sVkEmulation->commandBufferFence));
+    submitStagingTransferLocked(*transfer);
 
     return true;
 }
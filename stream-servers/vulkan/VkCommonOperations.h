@@ -16,7 +16,9 @@
 #include <vulkan/vulkan.h>
 
 #include <atomic>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
@@ -25,6 +27,8 @@
 #include "BorrowedImageVk.h"
 #include "CompositorVk.h"
 #include "DisplayVk.h"
+#include "YUVConverterVk.h"
+#include "aemu/base/synchronization/ConditionVariable.h"
 #include "aemu/base/synchronization/Lock.h"
 #include "aemu/base/ManagedDescriptor.hpp"
 #include "aemu/base/Optional.h"
@@ -127,8 +131,6 @@ struct VkEmulation {
     std::shared_ptr<android::base::Lock> queueLock = nullptr;
     uint32_t queueFamilyIndex = 0;
     VkCommandPool commandPool = VK_NULL_HANDLE;
-    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-    VkFence commandBufferFence = VK_NULL_HANDLE;
 
     struct ImageSupportInfo {
         // Input parameters
@@ -227,6 +229,42 @@ struct VkEmulation {
         VkDeviceSize size = kDefaultStagingBufferSize;
     };
 
+    // Maximum number of staging transfers that may be submitted but not yet
+    // retired at any time.
+    static constexpr size_t kMaxStagingTransfersInFlight = 8;
+
+    // A ColorBuffer or Buffer transfer that owns the range
+    // [stagingOffset, stagingOffset + stagingSize) of |staging| until |fence|
+    // signals.
+    struct StagingTransfer {
+        uint64_t serial = 0;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkDeviceSize stagingOffset = 0;
+        VkDeviceSize stagingSize = 0;
+        bool isUpload = false;
+    };
+
+    // |staging| is sub-allocated as a ring buffer: transfers are carved out at
+    // |head| and released in submission order once their fence has signaled.
+    struct StagingRing {
+        VkDeviceSize head = 0;
+        uint64_t nextSerial = 1;
+        std::deque<StagingTransfer> inFlight;
+        // Command buffers and fences of retired transfers, ready for reuse.
+        std::vector<std::tuple<VkCommandBuffer, VkFence>> freeCommandBuffers;
+        // Number of uploads in |inFlight|. Read without the emulation lock to
+        // skip waiting when there is nothing pending.
+        std::atomic<uint32_t> pendingUploads{0};
+        // Serials of readbacks whose reader waits for the fence and copies the
+        // range out without the emulation lock. Their ranges are not released
+        // until the reader is done. Guarded by |readersLock|, which may be
+        // taken while holding the emulation lock but not the other way round.
+        android::base::Lock readersLock;
+        android::base::ConditionVariable readersDone;
+        std::unordered_set<uint64_t> pendingReaders;
+    };
+
     enum class VulkanMode {
         // Default: ColorBuffers can still be used with the existing GL-based
         // API.  Synchronization with (if it exists) Vulkan images happens on
@@ -317,6 +355,7 @@ struct VkEmulation {
     // buffer is not; other users need to create buffers that
     // bind to imported versions of the memory.
     StagingBufferInfo staging;
+    StagingRing stagingRing;
 
     // ColorBuffers are intended to back the guest's shareable images.
     // For example:
@@ -328,6 +367,12 @@ struct VkEmulation {
     // Buffers are intended to back the guest's shareable Vulkan buffers.
     std::unordered_map<uint32_t, BufferInfo> buffers;
 
+    // Pipeline cache data saved by a previous run, keyed by the vendor and
+    // device ID of the physical device it is for, and read from disk when a
+    // guest first creates a device on it. Seeds the host pipeline cache of
+    // every guest VkDevice and is replaced as those devices are destroyed.
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<uint8_t>> pipelineCacheData;
+
     // In order to support VK_KHR_external_memory_(fd|win32) we need also to
     // support the concept of plain external memories that are just memory and
     // not necessarily images. These are then intended to pass through to the
@@ -363,6 +408,10 @@ struct VkEmulation {
     // The implementation for Vulkan native swapchain. Only initialized in initVkEmulationFeatures
     // if useVulkanNativeSwapchain is set.
     std::unique_ptr<DisplayVk> displayVk;
+
+    // Converts YUV ColorBuffers to RGBA for readColorBufferToRgbaBytes(). Only
+    // set if the device supports sampler Y'CbCr conversions.
+    std::unique_ptr<YUVConverterVk> yuvConverterVk;
 };
 
 VkEmulation* createGlobalVkEmulation(VulkanDispatch* vk);
@@ -421,15 +470,43 @@ int32_t mapGpaToBufferHandle(uint32_t bufferHandle, uint64_t gpa, uint64_t size
 bool readColorBufferToGl(uint32_t colorBufferHandle);
 bool readColorBufferToBytes(uint32_t colorBufferHandle, uint32_t x, uint32_t y, uint32_t w,
                             uint32_t h, void* outPixels);
+// Lets go of the emulation lock while waiting for the GPU copy.
 bool readColorBufferToBytesLocked(uint32_t colorBufferHandle, uint32_t x, uint32_t y, uint32_t w,
                                   uint32_t h, void* outPixels);
 
+// Same as readColorBufferToBytes(), except that YUV ColorBuffers are converted
+// to RGBA8 on the GPU, as rcReadColorBuffer returns them on the GL path.
+bool readColorBufferToRgbaBytes(uint32_t colorBufferHandle, uint32_t x, uint32_t y, uint32_t w,
+                                uint32_t h, void* outPixels);
+
 bool updateColorBufferFromGl(uint32_t colorBufferHandle);
 bool updateColorBufferFromBytes(uint32_t colorBufferHandle, uint32_t x, uint32_t y, uint32_t w,
                                 uint32_t h, const void* pixels);
 bool updateColorBufferFromBytesLocked(uint32_t colorBufferHandle, uint32_t x, uint32_t y,
                                       uint32_t w, uint32_t h, const void* pixels);
 
+// ColorBuffer and Buffer uploads return once their copy has been submitted.
+// Blocks until every upload submitted so far has completed on the GPU, so
+// that work submitted afterwards on another VkDevice observes the results.
+void waitForPendingStagingUploads();
+
+// Persistent pipeline cache operations
+
+// Whether |data| starts with a VkPipelineCacheHeaderVersionOne matching the
+// driver described by |props|.
+bool isPipelineCacheDataCompatible(const VkPhysicalDeviceProperties& props, const uint8_t* data,
+                                   size_t size);
+// Returns the saved pipeline cache data if it is compatible with |props|, or
+// an empty vector.
+std::vector<uint8_t> getPersistentPipelineCacheData(const VkPhysicalDeviceProperties& props);
+// Replaces the saved pipeline cache data for the physical device |props|
+// describes. Doesn't touch the disk.
+void savePersistentPipelineCacheData(const VkPhysicalDeviceProperties& props,
+                                     std::vector<uint8_t> data);
+// Writes the saved pipeline cache data for |props| to disk, if a cache
+// directory is configured.
+void writePersistentPipelineCacheData(const VkPhysicalDeviceProperties& props);
+
 // Data buffer operations
 
 bool setupVkBuffer(uint32_t bufferHandle, bool vulkanOnly = false, uint32_t memoryProperty = 0,
@@ -438,6 +515,8 @@ bool setupVkBuffer(uint32_t bufferHandle, bool vulkanOnly = false, uint32_t memo
 bool teardownVkBuffer(uint32_t bufferHandle);
 VK_EXT_MEMORY_HANDLE getBufferExtMemoryHandle(uint32_t bufferHandle);
 
+// Transfers only the byte range [offset, offset + size) of the buffer. |outBytes| and
+// |bytes| point at a mirror of the whole buffer; the same range of it is touched.
 bool readBufferToBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size, void* outBytes);
 bool updateBufferFromBytes(uint32_t bufferHandle, uint64_t offset, uint64_t size, void* bytes);
 
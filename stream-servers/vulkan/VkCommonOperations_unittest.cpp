@@ -0,0 +1,75 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "VkCommonOperations.h"
+
+namespace goldfish_vk {
+namespace {
+
+VkPhysicalDeviceProperties makeProperties() {
+    VkPhysicalDeviceProperties props = {};
+    props.vendorID = 0x10de;
+    props.deviceID = 0x1234;
+    for (uint32_t i = 0; i < VK_UUID_SIZE; ++i) {
+        props.pipelineCacheUUID[i] = static_cast<uint8_t>(i);
+    }
+    return props;
+}
+
+std::vector<uint8_t> makeCacheData(const VkPhysicalDeviceProperties& props) {
+    VkPipelineCacheHeaderVersionOne header = {
+        .headerSize = sizeof(VkPipelineCacheHeaderVersionOne),
+        .headerVersion = VK_PIPELINE_CACHE_HEADER_VERSION_ONE,
+        .vendorID = props.vendorID,
+        .deviceID = props.deviceID,
+    };
+    memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+    std::vector<uint8_t> data(sizeof(header) + 16, 0xab);
+    memcpy(data.data(), &header, sizeof(header));
+    return data;
+}
+
+TEST(VkCommonOperationsTest, PipelineCacheDataCompatible) {
+    const auto props = makeProperties();
+    const auto data = makeCacheData(props);
+    EXPECT_TRUE(isPipelineCacheDataCompatible(props, data.data(), data.size()));
+}
+
+TEST(VkCommonOperationsTest, PipelineCacheDataFromOtherDriver) {
+    const auto props = makeProperties();
+    const auto data = makeCacheData(props);
+
+    auto otherProps = props;
+    otherProps.pipelineCacheUUID[0] ^= 0xff;
+    EXPECT_FALSE(isPipelineCacheDataCompatible(otherProps, data.data(), data.size()));
+
+    otherProps = props;
+    otherProps.deviceID++;
+    EXPECT_FALSE(isPipelineCacheDataCompatible(otherProps, data.data(), data.size()));
+}
+
+TEST(VkCommonOperationsTest, PipelineCacheDataTruncated) {
+    const auto props = makeProperties();
+    const auto data = makeCacheData(props);
+    EXPECT_FALSE(isPipelineCacheDataCompatible(props, data.data(), 8));
+    EXPECT_FALSE(isPipelineCacheDataCompatible(props, nullptr, 0));
+}
+
+}  // namespace
+}  // namespace goldfish_vk
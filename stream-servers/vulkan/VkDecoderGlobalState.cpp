@@ -14,10 +14,14 @@
 #include "VkDecoderGlobalState.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <future>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -26,6 +30,7 @@
 #include "VkCommonOperations.h"
 #include "VkDecoderContext.h"
 #include "VkDecoderSnapshot.h"
+#include "VkFormatUtils.h"
 #include "VulkanDispatch.h"
 #include "VulkanStream.h"
 #include "aemu/base/ManagedDescriptor.hpp"
@@ -52,6 +57,7 @@
 #include "vk_util.h"
 #include "vulkan/emulated_textures/AstcTexture.h"
 #include "vulkan/emulated_textures/CompressedImageInfo.h"
+#include "vulkan/emulated_textures/GpuDecompressionPipeline.h"
 #include "vulkan/vk_enum_string_helper.h"
 
 #ifndef _WIN32
@@ -94,6 +100,28 @@ using emugl::GfxApiLogger;
 
 namespace goldfish_vk {
 
+// A recursive mutex that counts how many acquisitions found it already held
+// by another thread. Used for the locks guarding the object tracking tables so
+// that contention between RenderThreads can be inspected.
+class ContentionCountingLock {
+   public:
+    void lock() {
+        if (mMutex.try_lock()) return;
+        mContentionCount.fetch_add(1, std::memory_order_relaxed);
+        mMutex.lock();
+    }
+
+    bool try_lock() { return mMutex.try_lock(); }
+
+    void unlock() { mMutex.unlock(); }
+
+    uint64_t contentionCount() const { return mContentionCount.load(std::memory_order_relaxed); }
+
+   private:
+    std::recursive_mutex mMutex;
+    std::atomic<uint64_t> mContentionCount{0};
+};
+
 // A list of device extensions that should not be passed to the host driver.
 // These will mainly include Vulkan features that we emulate ourselves.
 static constexpr const char* const kEmulatedDeviceExtensions[] = {
@@ -122,6 +150,10 @@ static constexpr const char* const kEmulatedInstanceExtensions[] = {
 static constexpr uint32_t kMaxSafeVersion = VK_MAKE_VERSION(1, 1, 0);
 static constexpr uint32_t kMinVersion = VK_MAKE_VERSION(1, 0, 0);
 
+// The layout of the VkDeviceMemory contents in snapshots. Contents of
+// another version are skipped on load rather than misread.
+static constexpr uint32_t kMemoryContentsVersion = 1;
+
 static constexpr uint64_t kPageSizeforBlob = 4096;
 static constexpr uint64_t kPageMaskForBlob = ~(0xfff);
 
@@ -301,15 +333,24 @@ class VkDecoderGlobalState::Impl {
         mInstanceInfo.clear();
         mPhysdevInfo.clear();
         mDeviceInfo.clear();
-        mImageInfo.clear();
-        mImageViewInfo.clear();
-        mSamplerInfo.clear();
-        mCmdBufferInfo.clear();
-        mCmdPoolInfo.clear();
+        {
+            std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+            mImageInfo.clear();
+            mImageViewInfo.clear();
+            mSamplerInfo.clear();
+        }
+        {
+            std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
+            mCmdBufferInfo.clear();
+            mCmdPoolInfo.clear();
+        }
         mDeviceToPhysicalDevice.clear();
         mPhysicalDeviceToInstance.clear();
         mQueueInfo.clear();
-        mBufferInfo.clear();
+        {
+            std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
+            mBufferInfo.clear();
+        }
         mMapInfo.clear();
         mShaderModuleInfo.clear();
         mPipelineCacheInfo.clear();
@@ -317,7 +358,10 @@ class VkDecoderGlobalState::Impl {
         mRenderPassInfo.clear();
         mFramebufferInfo.clear();
         mSemaphoreInfo.clear();
-        mFenceInfo.clear();
+        {
+            std::lock_guard<ContentionCountingLock> fenceLock(mFenceLock);
+            mFenceInfo.clear();
+        }
 #ifdef _WIN32
         mSemaphoreId = 1;
         mExternalSemaphoresById.clear();
@@ -334,7 +378,10 @@ class VkDecoderGlobalState::Impl {
 
     bool vkCleanupEnabled() const { return mVkCleanupEnabled; }
 
-    void save(android::base::Stream* stream) { snapshot()->save(stream); }
+    void save(android::base::Stream* stream) {
+        snapshot()->save(stream);
+        saveMemoryContents(stream);
+    }
 
     void load(android::base::Stream* stream, GfxApiLogger& gfxLogger,
               HealthMonitor<>& healthMonitor) {
@@ -346,6 +393,635 @@ class VkDecoderGlobalState::Impl {
 
         // this part will replay in the decoder
         snapshot()->load(stream, gfxLogger, healthMonitor);
+
+        // The replay recreated the allocations under their old boxed handles,
+        // fill them back in before the guest sees them again.
+        loadMemoryContents(stream);
+    }
+
+    // The contents of VkDeviceMemory are not part of the API trace. Memory the
+    // host has mapped is saved from the mapping. Other memory is read through
+    // the image or buffer it is dedicated to, or else through a buffer aliasing
+    // the whole allocation. Imported memory belongs to ColorBuffers and
+    // Buffers, which save their own contents, and is not saved here.
+    //
+    // The contents go in the stream after kMemoryContentsVersion and their
+    // size in bytes. Each allocation goes in as its boxed handle, the layout
+    // its dedicated image is in, and the size and bytes of its contents.
+    void saveMemoryContents(android::base::Stream* stream) {
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
+
+        // Work the guest submitted must be done with the memory, including
+        // memory that is read through the host mapping.
+        waitForDevicesIdleLocked();
+
+        struct SavedMemory {
+            VkDeviceMemory memory;
+            const MappedMemoryInfo* info;
+            VkDeviceSize size;
+        };
+        std::vector<SavedMemory> memories;
+        uint64_t sectionSize = sizeof(uint32_t);
+        for (const auto& it : mMapInfo) {
+            if (!it.second.imported) {
+                const VkDeviceSize size =
+                    it.second.ptr ? it.second.size : getMemoryContentsSizeLocked(it.first);
+                memories.push_back({it.first, &it.second, size});
+                sectionSize += sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + size;
+            }
+        }
+
+        stream->putBe32(kMemoryContentsVersion);
+        stream->putBe64(sectionSize);
+        stream->putBe32(static_cast<uint32_t>(memories.size()));
+        std::vector<uint8_t> contents;
+        for (const auto& [memory, info, size] : memories) {
+            VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            const uint8_t* data = static_cast<const uint8_t*>(info->ptr);
+            if (data) {
+                invalidateMappedMemoryLocked(memory);
+            } else {
+                // Keep the stream in sync on failure, the memory just comes
+                // back zeroed.
+                contents.assign(size, 0);
+                if (info->dedicatedImage) {
+                    transferImageContentsLocked(memory, contents.data(), /*toImage=*/false,
+                                                &layout);
+                } else {
+                    transferBufferContentsLocked(memory, contents.data(), /*toMemory=*/false);
+                }
+                data = contents.data();
+            }
+            stream->putBe64(
+                (uint64_t)(uintptr_t)unboxed_to_boxed_non_dispatchable_VkDeviceMemory(memory));
+            stream->putBe32(static_cast<uint32_t>(layout));
+            stream->putBe64(size);
+            stream->write(data, size);
+        }
+        VKDGS_LOG("saved the contents of %zu of %zu allocations", memories.size(),
+                  mMapInfo.size());
+    }
+
+    void loadMemoryContents(android::base::Stream* stream) {
+        const uint32_t version = stream->getBe32();
+        uint64_t sectionSize = stream->getBe64();
+        if (version != kMemoryContentsVersion) {
+            fprintf(stderr, "%s: memory contents version %u, expected %u, not restored\n",
+                    __func__, version, kMemoryContentsVersion);
+            std::vector<uint8_t> skipped(std::min<uint64_t>(sectionSize, 1 << 20));
+            while (sectionSize) {
+                const size_t chunk = std::min<uint64_t>(sectionSize, skipped.size());
+                stream->read(skipped.data(), chunk);
+                sectionSize -= chunk;
+            }
+            return;
+        }
+
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
+
+        waitForDevicesIdleLocked();
+
+        const uint32_t count = stream->getBe32();
+        std::vector<uint8_t> contents;
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint64_t boxed = stream->getBe64();
+            VkImageLayout layout = static_cast<VkImageLayout>(stream->getBe32());
+            const uint64_t size = stream->getBe64();
+            contents.resize(size);
+            stream->read(contents.data(), size);
+
+            auto* elt = sBoxedHandleManager.get(boxed);
+            auto memory = elt ? (VkDeviceMemory)elt->underlying : VK_NULL_HANDLE;
+            auto* info = android::base::find(mMapInfo, memory);
+            if (!info || size != (info->ptr ? info->size : getMemoryContentsSizeLocked(memory))) {
+                fprintf(stderr, "%s: memory 0x%llx with %llu bytes not restored\n", __func__,
+                        (unsigned long long)boxed, (unsigned long long)size);
+                continue;
+            }
+            if (info->ptr) {
+                memcpy(info->ptr, contents.data(), size);
+                flushMappedMemoryLocked(memory);
+            } else if (info->dedicatedImage) {
+                transferImageContentsLocked(memory, contents.data(), /*toImage=*/true, &layout);
+            } else {
+                transferBufferContentsLocked(memory, contents.data(), /*toMemory=*/true);
+            }
+        }
+    }
+
+    // Waits for each device with all of its queues held, so that nothing is
+    // submitted in the meantime.
+    void waitForDevicesIdleLocked() {
+        for (const auto& [device, deviceInfo] : mDeviceInfo) {
+            std::vector<Lock*> queueLocks;
+            for (const auto& [familyIndex, queues] : deviceInfo.queues) {
+                for (VkQueue queue : queues) {
+                    auto* queueInfo = android::base::find(mQueueInfo, queue);
+                    if (queueInfo && queueInfo->lock) {
+                        queueLocks.push_back(queueInfo->lock);
+                    }
+                }
+            }
+            for (Lock* queueLock : queueLocks) {
+                queueLock->lock();
+            }
+            dispatch_VkDevice(deviceInfo.boxed)->vkDeviceWaitIdle(device);
+            for (Lock* queueLock : queueLocks) {
+                queueLock->unlock();
+            }
+        }
+    }
+
+    VkMemoryPropertyFlags getMemoryPropertyFlagsLocked(VkDeviceMemory memory) {
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return 0;
+        auto* physdev = android::base::find(mDeviceToPhysicalDevice, info->device);
+        if (!physdev) return 0;
+        auto* physdevInfo = android::base::find(mPhysdevInfo, *physdev);
+        if (!physdevInfo || info->memoryIndex >= physdevInfo->memoryProperties.memoryTypeCount) {
+            return 0;
+        }
+        return physdevInfo->memoryProperties.memoryTypes[info->memoryIndex].propertyFlags;
+    }
+
+    void invalidateMappedMemoryLocked(VkDeviceMemory memory) {
+        if (getMemoryPropertyFlagsLocked(memory) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) return;
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return;
+        auto* deviceInfo = android::base::find(mDeviceInfo, info->device);
+        if (!deviceInfo) return;
+        const VkMappedMemoryRange range = {
+            VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, memory, 0, VK_WHOLE_SIZE,
+        };
+        dispatch_VkDevice(deviceInfo->boxed)
+            ->vkInvalidateMappedMemoryRanges(info->device, 1, &range);
+    }
+
+    void flushMappedMemoryLocked(VkDeviceMemory memory) {
+        if (getMemoryPropertyFlagsLocked(memory) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) return;
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return;
+        auto* deviceInfo = android::base::find(mDeviceInfo, info->device);
+        if (!deviceInfo) return;
+        const VkMappedMemoryRange range = {
+            VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, memory, 0, VK_WHOLE_SIZE,
+        };
+        dispatch_VkDevice(deviceInfo->boxed)->vkFlushMappedMemoryRanges(info->device, 1, &range);
+    }
+
+    // Size of the contents saved for unmapped memory: the texels of its
+    // dedicated image, packed, or else the whole allocation. 0 for images that
+    // can't be saved.
+    VkDeviceSize getMemoryContentsSizeLocked(VkDeviceMemory memory) {
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return 0;
+        if (!info->dedicatedImage) return info->size;
+        VkDeviceSize size = 0;
+        if (!getImageContentsRegionsLocked(info->dedicatedImage, nullptr, &size)) return 0;
+        return size;
+    }
+
+    // Copy regions for all aspects, mip levels and layers of an image, packed
+    // one after the other in a buffer of |outSize| bytes. Fails for images
+    // that can't be copied to buffers.
+    bool getImageContentsRegionsLocked(VkImage image, std::vector<VkBufferImageCopy>* outRegions,
+                                       VkDeviceSize* outSize) {
+        auto* imageInfo = android::base::find(mImageInfo, image);
+        if (!imageInfo) return false;
+        const VkFormat format = imageInfo->format;
+        if (!imageInfo->transferable || imageInfo->samples != VK_SAMPLE_COUNT_1_BIT ||
+            imageInfo->cmpInfo.isCompressed || formatRequiresSamplerYcbcrConversion(format)) {
+            return false;
+        }
+
+        // Texel sizes as laid out in buffer copies, which for depth and
+        // stencil differ from those of the format.
+        std::vector<std::pair<VkImageAspectFlagBits, uint32_t>> aspects;
+        if (!formatIsDepthOrStencil(format)) {
+            aspects.emplace_back(VK_IMAGE_ASPECT_COLOR_BIT,
+                                 std::max(0, getLinearFormatPixelSize(format)));
+        } else {
+            if (!formatIsStencilOnly(format)) {
+                const bool depth16 =
+                    format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D16_UNORM_S8_UINT;
+                aspects.emplace_back(VK_IMAGE_ASPECT_DEPTH_BIT, depth16 ? 2 : 4);
+            }
+            if (!formatIsDepthOnly(format)) {
+                aspects.emplace_back(VK_IMAGE_ASPECT_STENCIL_BIT, 1);
+            }
+        }
+
+        VkDeviceSize size = 0;
+        for (const auto& [aspect, texelSize] : aspects) {
+            if (!texelSize) return false;
+            for (uint32_t mipLevel = 0; mipLevel < imageInfo->mipLevels; ++mipLevel) {
+                // Buffer offsets must be multiples of both 4 and the texel size.
+                const VkDeviceSize alignment = 4 * texelSize;
+                size = (size + alignment - 1) / alignment * alignment;
+                const VkExtent3D extent = {
+                    std::max(1u, imageInfo->extent.width >> mipLevel),
+                    std::max(1u, imageInfo->extent.height >> mipLevel),
+                    std::max(1u, imageInfo->extent.depth >> mipLevel),
+                };
+                if (outRegions) {
+                    outRegions->push_back(VkBufferImageCopy{
+                        .bufferOffset = size,
+                        .bufferRowLength = 0,
+                        .bufferImageHeight = 0,
+                        .imageSubresource =
+                            {
+                                .aspectMask = aspect,
+                                .mipLevel = mipLevel,
+                                .baseArrayLayer = 0,
+                                .layerCount = imageInfo->arrayLayers,
+                            },
+                        .imageOffset = {0, 0, 0},
+                        .imageExtent = extent,
+                    });
+                }
+                size += static_cast<VkDeviceSize>(extent.width) * extent.height * extent.depth *
+                        imageInfo->arrayLayers * texelSize;
+            }
+        }
+        *outSize = size;
+        return true;
+    }
+
+    // A host visible staging buffer and a command buffer for one-off copies on
+    // one of a device's queues.
+    struct SnapshotTransfer {
+        VkDevice device = VK_NULL_HANDLE;
+        VulkanDispatch* vk = nullptr;
+        VkQueue queue = VK_NULL_HANDLE;
+        Lock* queueLock = nullptr;
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+        bool stagingCoherent = false;
+        uint8_t* stagingPtr = nullptr;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    // On failure, |transfer| still has to be ended.
+    bool beginSnapshotTransferLocked(VkDevice device, VkDeviceSize stagingSize,
+                                     SnapshotTransfer* transfer) {
+        auto* deviceInfo = android::base::find(mDeviceInfo, device);
+        if (!deviceInfo) return false;
+        auto* physdevInfo = android::base::find(mPhysdevInfo, deviceInfo->physicalDevice);
+        if (!physdevInfo) return false;
+        transfer->device = device;
+        transfer->vk = dispatch_VkDevice(deviceInfo->boxed);
+        VulkanDispatch* vk = transfer->vk;
+
+        // Any queue can do transfers, except for sparse binding only families.
+        uint32_t queueFamilyIndex = 0;
+        for (const auto& [familyIndex, queues] : deviceInfo->queues) {
+            const VkQueueFlags flags =
+                physdevInfo->queueFamilyProperties[familyIndex].queueFlags;
+            if (!queues.empty() && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT |
+                                             VK_QUEUE_TRANSFER_BIT))) {
+                transfer->queue = queues[0];
+                queueFamilyIndex = familyIndex;
+                break;
+            }
+        }
+        auto* queueInfo = android::base::find(mQueueInfo, transfer->queue);
+        if (!queueInfo) return false;
+        transfer->queueLock = queueInfo->lock;
+
+        const VkBufferCreateInfo bufferCi = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = stagingSize,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        if (vk->vkCreateBuffer(device, &bufferCi, nullptr, &transfer->stagingBuffer) !=
+            VK_SUCCESS) {
+            return false;
+        }
+        VkMemoryRequirements memReqs;
+        vk->vkGetBufferMemoryRequirements(device, transfer->stagingBuffer, &memReqs);
+        const auto& memProps = physdevInfo->memoryProperties;
+        std::optional<uint32_t> stagingTypeIndex;
+        for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
+            const VkMemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+            if (!(memReqs.memoryTypeBits & (1u << i)) ||
+                !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+                continue;
+            }
+            const bool coherent = flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            if (!stagingTypeIndex || (coherent && !transfer->stagingCoherent)) {
+                stagingTypeIndex = i;
+                transfer->stagingCoherent = coherent;
+            }
+        }
+        if (!stagingTypeIndex) return false;
+        const VkMemoryAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = memReqs.size,
+            .memoryTypeIndex = *stagingTypeIndex,
+        };
+        void* stagingPtr = nullptr;
+        if (vk->vkAllocateMemory(device, &allocInfo, nullptr, &transfer->stagingMemory) !=
+                VK_SUCCESS ||
+            vk->vkBindBufferMemory(device, transfer->stagingBuffer, transfer->stagingMemory, 0) !=
+                VK_SUCCESS ||
+            vk->vkMapMemory(device, transfer->stagingMemory, 0, VK_WHOLE_SIZE, 0, &stagingPtr) !=
+                VK_SUCCESS) {
+            return false;
+        }
+        transfer->stagingPtr = static_cast<uint8_t*>(stagingPtr);
+
+        const VkCommandPoolCreateInfo poolCi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = queueFamilyIndex,
+        };
+        if (vk->vkCreateCommandPool(device, &poolCi, nullptr, &transfer->commandPool) !=
+            VK_SUCCESS) {
+            return false;
+        }
+        const VkCommandBufferAllocateInfo commandBufferAi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = transfer->commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        const VkFenceCreateInfo fenceCi = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        return vk->vkAllocateCommandBuffers(device, &commandBufferAi,
+                                            &transfer->commandBuffer) == VK_SUCCESS &&
+               vk->vkCreateFence(device, &fenceCi, nullptr, &transfer->fence) == VK_SUCCESS;
+    }
+
+    // Records the commands with |record|, then runs them and waits for them.
+    // The staging buffer is flushed before and invalidated after.
+    bool runSnapshotTransferLocked(const SnapshotTransfer& transfer,
+                                   const std::function<void(VkCommandBuffer)>& record) {
+        VulkanDispatch* vk = transfer.vk;
+        const VkMappedMemoryRange stagingRange = {
+            VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, transfer.stagingMemory, 0,
+            VK_WHOLE_SIZE,
+        };
+        if (!transfer.stagingCoherent) {
+            vk->vkFlushMappedMemoryRanges(transfer.device, 1, &stagingRange);
+        }
+
+        const VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        vk->vkBeginCommandBuffer(transfer.commandBuffer, &beginInfo);
+        record(transfer.commandBuffer);
+        vk->vkEndCommandBuffer(transfer.commandBuffer);
+
+        const VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &transfer.commandBuffer,
+        };
+        bool success;
+        {
+            AutoLock qlock(*transfer.queueLock);
+            success = vk->vkQueueSubmit(transfer.queue, 1, &submitInfo, transfer.fence) ==
+                      VK_SUCCESS;
+        }
+        success = success &&
+                  vk->vkWaitForFences(transfer.device, 1, &transfer.fence, VK_TRUE,
+                                      UINT64_MAX) == VK_SUCCESS &&
+                  vk->vkResetFences(transfer.device, 1, &transfer.fence) == VK_SUCCESS;
+
+        if (success && !transfer.stagingCoherent) {
+            vk->vkInvalidateMappedMemoryRanges(transfer.device, 1, &stagingRange);
+        }
+        return success;
+    }
+
+    void endSnapshotTransferLocked(const SnapshotTransfer& transfer) {
+        VulkanDispatch* vk = transfer.vk;
+        if (!vk) return;
+        if (transfer.fence) vk->vkDestroyFence(transfer.device, transfer.fence, nullptr);
+        if (transfer.commandPool) {
+            vk->vkDestroyCommandPool(transfer.device, transfer.commandPool, nullptr);
+        }
+        if (transfer.stagingMemory) {
+            vk->vkFreeMemory(transfer.device, transfer.stagingMemory, nullptr);
+        }
+        if (transfer.stagingBuffer) {
+            vk->vkDestroyBuffer(transfer.device, transfer.stagingBuffer, nullptr);
+        }
+    }
+
+    // Copies the whole of |memory| from or to |data|, a chunk at a time, through
+    // the buffer it is dedicated to, or else through a buffer aliasing it.
+    bool transferBufferContentsLocked(VkDeviceMemory memory, uint8_t* data, bool toMemory) {
+        static constexpr VkDeviceSize kStagingChunkSize = 16 * 1024 * 1024;
+
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return false;
+        auto* deviceInfo = android::base::find(mDeviceInfo, info->device);
+        if (!deviceInfo) return false;
+        VkDevice device = info->device;
+        VulkanDispatch* vk = dispatch_VkDevice(deviceInfo->boxed);
+
+        bool success = false;
+        VkBuffer buffer = info->dedicatedBuffer;
+        VkBuffer aliasBuffer = VK_NULL_HANDLE;
+        VkDeviceSize size = info->size;
+        SnapshotTransfer transfer;
+
+        do {
+            if (buffer) {
+                auto* bufferInfo = android::base::find(mBufferInfo, buffer);
+                if (!bufferInfo || !bufferInfo->transferable) break;
+                // A dedicated buffer is bound at offset 0, the memory past its
+                // end is not used.
+                size = std::min(size, bufferInfo->size);
+            } else {
+                const VkBufferCreateInfo bufferCi = {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                    .size = info->size,
+                    .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                };
+                if (vk->vkCreateBuffer(device, &bufferCi, nullptr, &aliasBuffer) != VK_SUCCESS) {
+                    break;
+                }
+                VkMemoryRequirements memReqs;
+                vk->vkGetBufferMemoryRequirements(device, aliasBuffer, &memReqs);
+                if (!(memReqs.memoryTypeBits & (1u << info->memoryIndex)) ||
+                    memReqs.size > info->size ||
+                    vk->vkBindBufferMemory(device, aliasBuffer, memory, 0) != VK_SUCCESS) {
+                    break;
+                }
+                buffer = aliasBuffer;
+            }
+            if (!size) {
+                success = true;
+                break;
+            }
+
+            const VkDeviceSize stagingSize = std::min(size, kStagingChunkSize);
+            if (!beginSnapshotTransferLocked(device, stagingSize, &transfer)) break;
+            success = true;
+            for (VkDeviceSize offset = 0; success && offset < size; offset += stagingSize) {
+                const VkDeviceSize chunkSize = std::min(stagingSize, size - offset);
+                if (toMemory) {
+                    memcpy(transfer.stagingPtr, data + offset, chunkSize);
+                }
+                success = runSnapshotTransferLocked(transfer, [&](VkCommandBuffer commandBuffer) {
+                    const VkBufferCopy region = {
+                        .srcOffset = toMemory ? 0 : offset,
+                        .dstOffset = toMemory ? offset : 0,
+                        .size = chunkSize,
+                    };
+                    vk->vkCmdCopyBuffer(commandBuffer, toMemory ? transfer.stagingBuffer : buffer,
+                                        toMemory ? buffer : transfer.stagingBuffer, 1, &region);
+                    const VkAccessFlags dstAccessMask =
+                        toMemory ? VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT
+                                 : VK_ACCESS_HOST_READ_BIT;
+                    const VkMemoryBarrier barrier = {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = dstAccessMask,
+                    };
+                    vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                             toMemory ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+                                                      : VK_PIPELINE_STAGE_HOST_BIT,
+                                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+                });
+                if (success && !toMemory) {
+                    memcpy(data + offset, transfer.stagingPtr, chunkSize);
+                }
+            }
+        } while (0);
+
+        endSnapshotTransferLocked(transfer);
+        if (aliasBuffer) vk->vkDestroyBuffer(device, aliasBuffer, nullptr);
+
+        if (!success) {
+            fprintf(stderr, "%s: failed to %s the contents of memory %p\n", __func__,
+                    toMemory ? "restore" : "save", memory);
+        }
+        return success;
+    }
+
+    // Copies the texels of the image |memory| is dedicated to from or to
+    // |data|, packed as by getImageContentsRegionsLocked(). Saving leaves the
+    // image in the layout it was found in and returns that in |layout|,
+    // restoring puts the image in |layout|.
+    bool transferImageContentsLocked(VkDeviceMemory memory, uint8_t* data, bool toImage,
+                                     VkImageLayout* layout) {
+        auto* info = android::base::find(mMapInfo, memory);
+        if (!info) return false;
+        VkImage image = info->dedicatedImage;
+        auto* imageInfo = android::base::find(mImageInfo, image);
+        std::vector<VkBufferImageCopy> regions;
+        VkDeviceSize size = 0;
+        if (!imageInfo || !getImageContentsRegionsLocked(image, &regions, &size) || !size) {
+            fprintf(stderr, "%s: can't %s the contents of image %p\n", __func__,
+                    toImage ? "restore" : "save", image);
+            return false;
+        }
+
+        if (!toImage) {
+            // An image no submitted work transitioned has nothing defined to
+            // keep, unless it was transitioned by a synchronization2 barrier,
+            // which is not tracked. Like for ColorBuffers, assume a layout
+            // rather than transitioning from VK_IMAGE_LAYOUT_UNDEFINED, which
+            // may discard the contents.
+            *layout = imageInfo->layout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_IMAGE_LAYOUT_GENERAL
+                                                                     : imageInfo->layout;
+        } else if (*layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+                   *layout == VK_IMAGE_LAYOUT_PREINITIALIZED) {
+            *layout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+        const VkImageLayout transferLayout = toImage ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+                                                     : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        VkImageAspectFlags aspectMask = 0;
+        for (const VkBufferImageCopy& region : regions) {
+            aspectMask |= region.imageSubresource.aspectMask;
+        }
+        const VkImageSubresourceRange range = {
+            .aspectMask = aspectMask,
+            .baseMipLevel = 0,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
+            .baseArrayLayer = 0,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+        };
+
+        SnapshotTransfer transfer;
+        bool success = beginSnapshotTransferLocked(info->device, size, &transfer);
+        if (success) {
+            VulkanDispatch* vk = transfer.vk;
+            if (toImage) {
+                memcpy(transfer.stagingPtr, data, size);
+            }
+            success = runSnapshotTransferLocked(transfer, [&](VkCommandBuffer commandBuffer) {
+                VkImageMemoryBarrier barrier = {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+                    .dstAccessMask = toImage ? VK_ACCESS_TRANSFER_WRITE_BIT
+                                             : VK_ACCESS_TRANSFER_READ_BIT,
+                    // The image has nothing worth keeping before a restore.
+                    .oldLayout = toImage ? VK_IMAGE_LAYOUT_UNDEFINED : *layout,
+                    .newLayout = transferLayout,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .image = image,
+                    .subresourceRange = range,
+                };
+                vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                                         nullptr, 1, &barrier);
+                if (toImage) {
+                    vk->vkCmdCopyBufferToImage(commandBuffer, transfer.stagingBuffer, image,
+                                               transferLayout,
+                                               static_cast<uint32_t>(regions.size()),
+                                               regions.data());
+                } else {
+                    vk->vkCmdCopyImageToBuffer(commandBuffer, image, transferLayout,
+                                               transfer.stagingBuffer,
+                                               static_cast<uint32_t>(regions.size()),
+                                               regions.data());
+                }
+                barrier.srcAccessMask = toImage ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+                barrier.oldLayout = transferLayout;
+                barrier.newLayout = *layout;
+                vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                                         nullptr, 1, &barrier);
+                if (!toImage) {
+                    const VkMemoryBarrier hostBarrier = {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                    };
+                    vk->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                             VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0,
+                                             nullptr, 0, nullptr);
+                }
+            });
+            if (success && !toImage) {
+                memcpy(data, transfer.stagingPtr, size);
+            }
+        }
+        endSnapshotTransferLocked(transfer);
+
+        if (success) {
+            imageInfo->layout = *layout;
+        } else {
+            fprintf(stderr, "%s: failed to %s the contents of image %p\n", __func__,
+                    toImage ? "restore" : "save", image);
+        }
+        return success;
     }
 
     void lock() { mLock.lock(); }
@@ -456,13 +1132,13 @@ class VkDecoderGlobalState::Impl {
         bool swiftshader =
             (android::base::getEnvironmentVariable("ANDROID_EMU_VK_ICD").compare("swiftshader") ==
              0);
-        std::unique_ptr<std::lock_guard<std::recursive_mutex>> lock = nullptr;
+        std::unique_ptr<std::lock_guard<ContentionCountingLock>> lock = nullptr;
 
         if (swiftshader) {
             if (mLogging) {
                 fprintf(stderr, "%s: acquire lock\n", __func__);
             }
-            lock = std::make_unique<std::lock_guard<std::recursive_mutex>>(mLock);
+            lock = std::make_unique<std::lock_guard<ContentionCountingLock>>(mLock);
         }
 
         VkResult res = m_vk->vkCreateInstance(&createInfoFiltered, pAllocator, pInstance);
@@ -472,7 +1148,7 @@ class VkDecoderGlobalState::Impl {
         }
 
         if (!swiftshader) {
-            lock = std::make_unique<std::lock_guard<std::recursive_mutex>>(mLock);
+            lock = std::make_unique<std::lock_guard<ContentionCountingLock>>(mLock);
         }
 
         // TODO: bug 129484301
@@ -532,7 +1208,7 @@ class VkDecoderGlobalState::Impl {
         // Do delayed removes out of the lock, but get the list of devices to destroy inside the
         // lock.
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
             std::vector<VkDevice> devicesToDestroy;
 
             for (auto it : mDeviceToPhysicalDevice) {
@@ -548,28 +1224,32 @@ class VkDecoderGlobalState::Impl {
             }
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        {
+            std::lock_guard<ContentionCountingLock> lock(mLock);
 
-        teardownInstanceLocked(instance);
+            teardownInstanceLocked(instance);
 
-        if (mRenderDocWithMultipleVkInstances) {
-            mRenderDocWithMultipleVkInstances->removeVkInstance(instance);
-        }
-        m_vk->vkDestroyInstance(instance, pAllocator);
+            if (mRenderDocWithMultipleVkInstances) {
+                mRenderDocWithMultipleVkInstances->removeVkInstance(instance);
+            }
+            m_vk->vkDestroyInstance(instance, pAllocator);
 
-        auto it = mPhysicalDeviceToInstance.begin();
+            auto it = mPhysicalDeviceToInstance.begin();
 
-        while (it != mPhysicalDeviceToInstance.end()) {
-            if (it->second == instance) {
-                it = mPhysicalDeviceToInstance.erase(it);
-            } else {
-                ++it;
+            while (it != mPhysicalDeviceToInstance.end()) {
+                if (it->second == instance) {
+                    it = mPhysicalDeviceToInstance.erase(it);
+                } else {
+                    ++it;
+                }
             }
+
+            auto* instInfo = android::base::find(mInstanceInfo, instance);
+            delete_VkInstance(instInfo->boxed);
+            mInstanceInfo.erase(instance);
         }
 
-        auto* instInfo = android::base::find(mInstanceInfo, instance);
-        delete_VkInstance(instInfo->boxed);
-        mInstanceInfo.erase(instance);
+        writeSavedPipelineCaches();
     }
 
     void on_vkDestroyInstance(android::base::BumpPool* pool, VkInstance boxed_instance,
@@ -605,7 +1285,7 @@ class VkDecoderGlobalState::Impl {
                                              validPhysicalDevices.data());
         if (res != VK_SUCCESS) return res;
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         if (m_emu->instanceSupportsExternalMemoryCapabilities) {
             PFN_vkGetPhysicalDeviceProperties2KHR getPhysdevProps2Func =
@@ -718,7 +1398,7 @@ class VkDecoderGlobalState::Impl {
         auto physicalDevice = unbox_VkPhysicalDevice(boxed_physicalDevice);
         auto vk = dispatch_VkPhysicalDevice(boxed_physicalDevice);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
         if (!physdevInfo) return;
@@ -825,7 +1505,7 @@ class VkDecoderGlobalState::Impl {
                 needEmulateCompressedImage = true;
             }
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
         if (!physdevInfo) {
@@ -910,7 +1590,7 @@ class VkDecoderGlobalState::Impl {
         auto physicalDevice = unbox_VkPhysicalDevice(boxed_physicalDevice);
         auto vk = dispatch_VkPhysicalDevice(boxed_physicalDevice);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
         if (!physdevInfo) return;
@@ -976,7 +1656,7 @@ class VkDecoderGlobalState::Impl {
         auto physicalDevice = unbox_VkPhysicalDevice(boxed_physicalDevice);
         auto vk = dispatch_VkPhysicalDevice(boxed_physicalDevice);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
         if (!physdevInfo) return;
@@ -1216,13 +1896,13 @@ class VkDecoderGlobalState::Impl {
             (android::base::getEnvironmentVariable("ANDROID_EMU_VK_ICD").compare("swiftshader") ==
              0);
 
-        std::unique_ptr<std::lock_guard<std::recursive_mutex>> lock = nullptr;
+        std::unique_ptr<std::lock_guard<ContentionCountingLock>> lock = nullptr;
 
         if (swiftshader) {
             if (mLogging) {
                 fprintf(stderr, "%s: acquire lock\n", __func__);
             }
-            lock = std::make_unique<std::lock_guard<std::recursive_mutex>>(mLock);
+            lock = std::make_unique<std::lock_guard<ContentionCountingLock>>(mLock);
         }
 
         if (mLogging) {
@@ -1243,7 +1923,7 @@ class VkDecoderGlobalState::Impl {
         }
 
         if (!swiftshader) {
-            lock = std::make_unique<std::lock_guard<std::recursive_mutex>>(mLock);
+            lock = std::make_unique<std::lock_guard<ContentionCountingLock>>(mLock);
         }
 
         mDeviceToPhysicalDevice[*pDevice] = physicalDevice;
@@ -1269,6 +1949,11 @@ class VkDecoderGlobalState::Impl {
         init_vulkan_dispatch_from_device(vk, *pDevice, dispatch_VkDevice(boxed));
         deviceInfo.externalFencePool =
             std::make_unique<ExternalFencePool<VulkanDispatch>>(dispatch_VkDevice(boxed), *pDevice);
+        initHostPipelineCacheLocked(dispatch_VkDevice(boxed), physicalDevice, *pDevice);
+        if (emulateTextureEtc2 || emulateTextureAstc) {
+            deviceInfo.decompPipelines = std::make_unique<GpuDecompressionPipelineManager>(
+                dispatch_VkDevice(boxed), *pDevice);
+        }
 
         if (mLogging) {
             fprintf(stderr, "%s: init vulkan dispatch from device (end)\n", __func__);
@@ -1329,7 +2014,7 @@ class VkDecoderGlobalState::Impl {
                              uint32_t queueFamilyIndex, uint32_t queueIndex, VkQueue* pQueue) {
         auto device = unbox_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         *pQueue = VK_NULL_HANDLE;
 
@@ -1350,6 +2035,82 @@ class VkDecoderGlobalState::Impl {
         *pQueue = (VkQueue)queueInfo->boxed;
     }
 
+    void initHostPipelineCacheLocked(VulkanDispatch* deviceDispatch,
+                                     VkPhysicalDevice physicalDevice, VkDevice device) {
+        auto* deviceInfo = android::base::find(mDeviceInfo, device);
+        auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
+        if (!deviceInfo || !physdevInfo) return;
+
+        std::vector<uint8_t> initialData = getPersistentPipelineCacheData(physdevInfo->props);
+        const VkPipelineCacheCreateInfo createInfo = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .initialDataSize = initialData.size(),
+            .pInitialData = initialData.data(),
+        };
+        auto hostPipelineCache = std::make_shared<HostPipelineCache>();
+        VkResult result = deviceDispatch->vkCreatePipelineCache(device, &createInfo, nullptr,
+                                                                &hostPipelineCache->cache);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "%s: failed to create host pipeline cache: %s\n", __func__,
+                    string_VkResult(result));
+            return;
+        }
+        deviceInfo->hostPipelineCache = std::move(hostPipelineCache);
+    }
+
+    void saveAndDestroyHostPipelineCacheLocked(VulkanDispatch* deviceDispatch,
+                                               VkPhysicalDevice physicalDevice, VkDevice device,
+                                               VkPipelineCache pipelineCache) {
+        auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
+        if (physdevInfo) {
+            // Other devices on the same physical device may have saved their pipelines since
+            // this cache was seeded. Merge them in, or this save would drop them.
+            std::vector<uint8_t> savedData = getPersistentPipelineCacheData(physdevInfo->props);
+            if (!savedData.empty()) {
+                const VkPipelineCacheCreateInfo createInfo = {
+                    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                    .pNext = nullptr,
+                    .flags = 0,
+                    .initialDataSize = savedData.size(),
+                    .pInitialData = savedData.data(),
+                };
+                VkPipelineCache savedCache = VK_NULL_HANDLE;
+                if (deviceDispatch->vkCreatePipelineCache(device, &createInfo, nullptr,
+                                                          &savedCache) == VK_SUCCESS) {
+                    deviceDispatch->vkMergePipelineCaches(device, pipelineCache, 1, &savedCache);
+                    deviceDispatch->vkDestroyPipelineCache(device, savedCache, nullptr);
+                }
+            }
+        }
+        size_t dataSize = 0;
+        if (physdevInfo && deviceDispatch->vkGetPipelineCacheData(device, pipelineCache, &dataSize,
+                                                                  nullptr) == VK_SUCCESS) {
+            std::vector<uint8_t> data(dataSize);
+            if (deviceDispatch->vkGetPipelineCacheData(device, pipelineCache, &dataSize,
+                                                       data.data()) == VK_SUCCESS) {
+                data.resize(dataSize);
+                savePersistentPipelineCacheData(physdevInfo->props, std::move(data));
+                mPipelineCachesToWrite.push_back(physdevInfo->props);
+            }
+        }
+        deviceDispatch->vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    }
+
+    // Writes the pipeline caches saved by destroyed devices to disk. Called
+    // without mLock held, so that the file I/O doesn't stall other guests.
+    void writeSavedPipelineCaches() {
+        std::vector<VkPhysicalDeviceProperties> toWrite;
+        {
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+            toWrite.swap(mPipelineCachesToWrite);
+        }
+        for (const auto& props : toWrite) {
+            writePersistentPipelineCacheData(props);
+        }
+    }
+
     void destroyDeviceLocked(VkDevice device, const VkAllocationCallbacks* pAllocator) {
         auto* deviceInfo = android::base::find(mDeviceInfo, device);
         if (!deviceInfo) return;
@@ -1367,16 +2128,33 @@ class VkDecoderGlobalState::Impl {
 
         VulkanDispatch* deviceDispatch = dispatch_VkDevice(deviceInfo->boxed);
 
-        // Destroy pooled external fences
-        auto deviceFences = deviceInfo->externalFencePool->popAll();
-        for (auto fence : deviceFences) {
-            deviceDispatch->vkDestroyFence(device, fence, pAllocator);
-            mFenceInfo.erase(fence);
+        {
+            std::lock_guard<ContentionCountingLock> fenceLock(mFenceLock);
+
+            // Destroy pooled external fences
+            auto deviceFences = deviceInfo->externalFencePool->popAll();
+            for (auto fence : deviceFences) {
+                deviceDispatch->vkDestroyFence(device, fence, pAllocator);
+                mFenceInfo.erase(fence);
+            }
+
+            for (auto fence : findDeviceObjects(device, mFenceInfo)) {
+                deviceDispatch->vkDestroyFence(device, fence, pAllocator);
+                mFenceInfo.erase(fence);
+            }
         }
 
-        for (auto fence : findDeviceObjects(device, mFenceInfo)) {
-            deviceDispatch->vkDestroyFence(device, fence, pAllocator);
-            mFenceInfo.erase(fence);
+        deviceInfo->decompPipelines.reset();
+
+        if (deviceInfo->hostPipelineCache) {
+            // Pipeline creation may still hold the cache without mLock.
+            HostPipelineCache* hostPipelineCache = deviceInfo->hostPipelineCache.get();
+            std::unique_lock<std::shared_mutex> hostCacheLock(hostPipelineCache->mutex);
+            saveAndDestroyHostPipelineCacheLocked(deviceDispatch, deviceInfo->physicalDevice,
+                                                  device, hostPipelineCache->cache);
+            hostPipelineCache->cache = VK_NULL_HANDLE;
+            hostCacheLock.unlock();
+            deviceInfo->hostPipelineCache.reset();
         }
 
         // Run the underlying API call.
@@ -1389,13 +2167,17 @@ class VkDecoderGlobalState::Impl {
                             const VkAllocationCallbacks* pAllocator) {
         auto device = unbox_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        {
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+
+            sBoxedHandleManager.processDelayedRemovesGlobalStateLocked(device);
+            destroyDeviceLocked(device, pAllocator);
 
-        sBoxedHandleManager.processDelayedRemovesGlobalStateLocked(device);
-        destroyDeviceLocked(device, pAllocator);
+            mDeviceInfo.erase(device);
+            mDeviceToPhysicalDevice.erase(device);
+        }
 
-        mDeviceInfo.erase(device);
-        mDeviceToPhysicalDevice.erase(device);
+        writeSavedPipelineCaches();
     }
 
     VkResult on_vkCreateBuffer(android::base::BumpPool* pool, VkDevice boxed_device,
@@ -1404,13 +2186,23 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
+        // Snapshots copy the buffer to save the memory dedicated to it.
+        VkBufferCreateInfo localCreateInfo;
+        if (mSnapshotsEnabled) {
+            localCreateInfo = *pCreateInfo;
+            localCreateInfo.usage |=
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            pCreateInfo = &localCreateInfo;
+        }
+
         VkResult result = vk->vkCreateBuffer(device, pCreateInfo, pAllocator, pBuffer);
 
         if (result == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mBufferLock);
             auto& bufInfo = mBufferInfo[*pBuffer];
             bufInfo.device = device;
             bufInfo.size = pCreateInfo->size;
+            bufInfo.transferable = mSnapshotsEnabled;
             *pBuffer = new_boxed_non_dispatchable_VkBuffer(*pBuffer);
         }
 
@@ -1424,7 +2216,7 @@ class VkDecoderGlobalState::Impl {
 
         vk->vkDestroyBuffer(device, buffer, pAllocator);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mBufferLock);
         mBufferInfo.erase(buffer);
     }
 
@@ -1445,7 +2237,7 @@ class VkDecoderGlobalState::Impl {
         VkResult result = vk->vkBindBufferMemory(device, buffer, memory, memoryOffset);
 
         if (result == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mBufferLock);
             setBufferMemoryBindInfoLocked(buffer, memory, memoryOffset);
         }
         return result;
@@ -1460,7 +2252,7 @@ class VkDecoderGlobalState::Impl {
         VkResult result = vk->vkBindBufferMemory2(device, bindInfoCount, pBindInfos);
 
         if (result == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mBufferLock);
             for (uint32_t i = 0; i < bindInfoCount; ++i) {
                 setBufferMemoryBindInfoLocked(pBindInfos[i].buffer, pBindInfos[i].memory,
                                               pBindInfos[i].memoryOffset);
@@ -1479,7 +2271,7 @@ class VkDecoderGlobalState::Impl {
         VkResult result = vk->vkBindBufferMemory2KHR(device, bindInfoCount, pBindInfos);
 
         if (result == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mBufferLock);
             for (uint32_t i = 0; i < bindInfoCount; ++i) {
                 setBufferMemoryBindInfoLocked(pBindInfos[i].buffer, pBindInfos[i].memory,
                                               pBindInfos[i].memoryOffset);
@@ -1495,7 +2287,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* deviceInfo = android::base::find(mDeviceInfo, device);
         if (!deviceInfo) {
@@ -1544,6 +2336,7 @@ class VkDecoderGlobalState::Impl {
             vk_find_struct<VkNativeBufferANDROID>(pCreateInfo);
 
         VkResult createRes = VK_SUCCESS;
+        bool transferable = false;
 
         if (nativeBufferANDROID) {
             auto memProps = memPropsOfDeviceLocked(device);
@@ -1554,6 +2347,14 @@ class VkDecoderGlobalState::Impl {
             if (createRes == VK_SUCCESS) {
                 *pImage = anbInfo->image;
             }
+        } else if (mSnapshotsEnabled &&
+                   supportsSnapshotTransfersLocked(deviceInfo->physicalDevice, *pCreateInfo)) {
+            // Snapshots copy the image to save the memory dedicated to it.
+            VkImageCreateInfo localCreateInfo = *pCreateInfo;
+            localCreateInfo.usage |=
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            createRes = vk->vkCreateImage(device, &localCreateInfo, pAllocator, pImage);
+            transferable = true;
         } else {
             createRes = vk->vkCreateImage(device, pCreateInfo, pAllocator, pImage);
         }
@@ -1576,20 +2377,46 @@ class VkDecoderGlobalState::Impl {
             }
         }
 
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto& imageInfo = mImageInfo[*pImage];
 
         if (nativeBufferANDROID) imageInfo.anbInfo = std::move(anbInfo);
 
         imageInfo.device = device;
         imageInfo.cmpInfo = std::move(cmpInfo);
+        imageInfo.format = pCreateInfo->format;
+        imageInfo.extent = pCreateInfo->extent;
+        imageInfo.mipLevels = pCreateInfo->mipLevels;
+        imageInfo.arrayLayers = pCreateInfo->arrayLayers;
+        imageInfo.samples = pCreateInfo->samples;
+        imageInfo.transferable = transferable;
+        imageInfo.layout = pCreateInfo->initialLayout;
 
         *pImage = new_boxed_non_dispatchable_VkImage(*pImage);
 
         return createRes;
     }
 
+    // Whether the image can be created with transfer usage added. Transient
+    // attachments can't, and have no contents to save anyway.
+    bool supportsSnapshotTransfersLocked(VkPhysicalDevice physicalDevice,
+                                         const VkImageCreateInfo& createInfo) {
+        if (createInfo.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) return false;
+        auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
+        if (!physdevInfo) return false;
+        VkImageFormatProperties formatProperties;
+        return dispatch_VkPhysicalDevice(physdevInfo->boxed)
+                   ->vkGetPhysicalDeviceImageFormatProperties(
+                       physicalDevice, createInfo.format, createInfo.imageType,
+                       createInfo.tiling,
+                       createInfo.usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                           VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                       createInfo.flags, &formatProperties) == VK_SUCCESS;
+    }
+
     void destroyImageLocked(VkDevice device, VulkanDispatch* deviceDispatch, VkImage image,
                             const VkAllocationCallbacks* pAllocator) {
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* imageInfo = android::base::find(mImageInfo, image);
         if (!imageInfo) return;
 
@@ -1603,14 +2430,9 @@ class VkDecoderGlobalState::Impl {
                     deviceDispatch->vkDestroyImage(device, image, nullptr);
                 }
 
-                deviceDispatch->vkDestroyDescriptorSetLayout(
-                    device, cmpInfo.decompDescriptorSetLayout, nullptr);
+                // The pipeline is shared by the device, only the descriptors are per image.
                 deviceDispatch->vkDestroyDescriptorPool(device, cmpInfo.decompDescriptorPool,
                                                         nullptr);
-                deviceDispatch->vkDestroyShaderModule(device, cmpInfo.decompShader, nullptr);
-                deviceDispatch->vkDestroyPipelineLayout(device, cmpInfo.decompPipelineLayout,
-                                                        nullptr);
-                deviceDispatch->vkDestroyPipeline(device, cmpInfo.decompPipeline, nullptr);
                 for (const auto& imageView : cmpInfo.sizeCompImageViews) {
                     deviceDispatch->vkDestroyImageView(device, imageView, nullptr);
                 }
@@ -1628,7 +2450,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyImageLocked(device, deviceDispatch, image, pAllocator);
     }
 
@@ -1640,7 +2462,7 @@ class VkDecoderGlobalState::Impl {
         if (VK_SUCCESS != result) {
             return result;
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         auto* deviceInfo = android::base::find(mDeviceInfo, device);
         if (!deviceInfo) return VK_ERROR_OUT_OF_HOST_MEMORY;
         auto* mapInfo = android::base::find(mMapInfo, memory);
@@ -1657,6 +2479,7 @@ class VkDecoderGlobalState::Impl {
         if (!deviceInfo->emulateTextureEtc2 && !deviceInfo->emulateTextureAstc) {
             return VK_SUCCESS;
         }
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* imageInfo = android::base::find(mImageInfo, image);
         if (!imageInfo) return VK_ERROR_OUT_OF_HOST_MEMORY;
         CompressedImageInfo& cmp = imageInfo->cmpInfo;
@@ -1681,10 +2504,12 @@ class VkDecoderGlobalState::Impl {
             return VK_ERROR_OUT_OF_HOST_MEMORY;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* deviceInfo = android::base::find(mDeviceInfo, device);
         auto* imageInfo = android::base::find(mImageInfo, pCreateInfo->image);
         if (!deviceInfo || !imageInfo) return VK_ERROR_OUT_OF_HOST_MEMORY;
+        const VkImage image = pCreateInfo->image;
         VkImageViewCreateInfo createInfo;
         bool needEmulatedAlpha = false;
         if (deviceInfo->emulateTextureEtc2 || deviceInfo->emulateTextureAstc) {
@@ -1721,6 +2546,7 @@ class VkDecoderGlobalState::Impl {
         auto& imageViewInfo = mImageViewInfo[*pView];
         imageViewInfo.device = device;
         imageViewInfo.needEmulatedAlpha = needEmulatedAlpha;
+        imageViewInfo.image = image;
 
         *pView = new_boxed_non_dispatchable_VkImageView(*pView);
 
@@ -1733,7 +2559,7 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkDevice(boxed_device);
 
         vk->vkDestroyImageView(device, imageView, pAllocator);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mImageLock);
         mImageViewInfo.erase(imageView);
     }
 
@@ -1746,7 +2572,7 @@ class VkDecoderGlobalState::Impl {
         if (result != VK_SUCCESS) {
             return result;
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mImageLock);
         auto& samplerInfo = mSamplerInfo[*pSampler];
         samplerInfo.device = device;
         deepcopy_VkSamplerCreateInfo(
@@ -1772,6 +2598,7 @@ class VkDecoderGlobalState::Impl {
                               const VkAllocationCallbacks* pAllocator) {
         deviceDispatch->vkDestroySampler(device, sampler, pAllocator);
 
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* samplerInfo = android::base::find(mSamplerInfo, sampler);
         if (!samplerInfo) return;
 
@@ -1786,7 +2613,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mImageLock);
         destroySamplerLocked(device, deviceDispatch, sampler, pAllocator);
     }
 
@@ -1829,7 +2656,7 @@ class VkDecoderGlobalState::Impl {
 
         if (res != VK_SUCCESS) return res;
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto& semaphoreInfo = mSemaphoreInfo[*pSemaphore];
         semaphoreInfo.device = device;
@@ -1861,7 +2688,7 @@ class VkDecoderGlobalState::Impl {
             ExternalFencePool<VulkanDispatch>* externalFencePool = nullptr;
             vk_struct_chain_remove(exportFenceInfoPtr, &createInfo);
             {
-                std::lock_guard<std::recursive_mutex> lock(mLock);
+                std::lock_guard<ContentionCountingLock> lock(mLock);
                 auto* deviceInfo = android::base::find(mDeviceInfo, device);
                 if (!deviceInfo) return VK_ERROR_OUT_OF_HOST_MEMORY;
                 externalFencePool = deviceInfo->externalFencePool.get();
@@ -1880,7 +2707,8 @@ class VkDecoderGlobalState::Impl {
         }
 
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+            std::lock_guard<ContentionCountingLock> fenceLock(mFenceLock);
 
             DCHECK(fenceReused || mFenceInfo.find(*pFence) == mFenceInfo.end());
             // Create FenceInfo for *pFence.
@@ -1906,7 +2734,7 @@ class VkDecoderGlobalState::Impl {
         std::vector<VkFence> externalFences;
 
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
             for (uint32_t i = 0; i < fenceCount; i++) {
                 if (pFences[i] == VK_NULL_HANDLE) continue;
 
@@ -1937,7 +2765,7 @@ class VkDecoderGlobalState::Impl {
             deviceInfo->externalFencePool->add(fence);
 
             {
-                std::lock_guard<std::recursive_mutex> lock(mLock);
+                std::lock_guard<ContentionCountingLock> lock(mFenceLock);
                 auto boxed_fence = unboxed_to_boxed_non_dispatchable_VkFence(fence);
                 delete_VkFence(boxed_fence);
                 set_boxed_non_dispatchable_VkFence(boxed_fence, replacement);
@@ -1962,7 +2790,7 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkDevice(boxed_device);
 
 #ifdef _WIN32
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* infoPtr = android::base::find(mSemaphoreInfo,
                                             mExternalSemaphoresById[pImportSemaphoreFdInfo->fd]);
@@ -2007,7 +2835,7 @@ class VkDecoderGlobalState::Impl {
         if (result != VK_SUCCESS) {
             return result;
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         mSemaphoreInfo[pGetFdInfo->semaphore].externalHandle = handle;
         int nextId = genSemaphoreId();
         mExternalSemaphoresById[nextId] = pGetFdInfo->semaphore;
@@ -2018,7 +2846,7 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         mSemaphoreInfo[pGetFdInfo->semaphore].externalHandle = *pFd;
         // No next id; its already an fd
@@ -2045,7 +2873,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroySemaphoreLocked(device, deviceDispatch, semaphore, pAllocator);
     }
 
@@ -2055,7 +2883,8 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkDevice(boxed_device);
 
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+            std::lock_guard<ContentionCountingLock> fenceLock(mFenceLock);
             // External fences are just slated for recycling. This addresses known
             // behavior where the guest might destroy the fence prematurely. b/228221208
             if (mFenceInfo[fence].external) {
@@ -2082,7 +2911,7 @@ class VkDecoderGlobalState::Impl {
         auto res = vk->vkCreateDescriptorSetLayout(device, pCreateInfo, pAllocator, pSetLayout);
 
         if (res == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
             auto& info = mDescriptorSetLayoutInfo[*pSetLayout];
             info.device = device;
             *pSetLayout = new_boxed_non_dispatchable_VkDescriptorSetLayout(*pSetLayout);
@@ -2105,7 +2934,7 @@ class VkDecoderGlobalState::Impl {
 
         vk->vkDestroyDescriptorSetLayout(device, descriptorSetLayout, pAllocator);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
         mDescriptorSetLayoutInfo.erase(descriptorSetLayout);
     }
 
@@ -2119,7 +2948,7 @@ class VkDecoderGlobalState::Impl {
         auto res = vk->vkCreateDescriptorPool(device, pCreateInfo, pAllocator, pDescriptorPool);
 
         if (res == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
             auto& info = mDescriptorPoolInfo[*pDescriptorPool];
             info.device = device;
             *pDescriptorPool = new_boxed_non_dispatchable_VkDescriptorPool(*pDescriptorPool);
@@ -2191,7 +3020,7 @@ class VkDecoderGlobalState::Impl {
 
         vk->vkDestroyDescriptorPool(device, descriptorPool, pAllocator);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
         cleanupDescriptorPoolAllocedSetsLocked(descriptorPool, true /* destroy */);
         mDescriptorPoolInfo.erase(descriptorPool);
     }
@@ -2205,7 +3034,7 @@ class VkDecoderGlobalState::Impl {
         auto res = vk->vkResetDescriptorPool(device, descriptorPool, flags);
 
         if (res == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
             cleanupDescriptorPoolAllocedSetsLocked(descriptorPool);
         }
 
@@ -2239,7 +3068,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
 
         auto allocValidationRes = validateDescriptorSetAllocLocked(pAllocateInfo);
         if (allocValidationRes != VK_SUCCESS) return allocValidationRes;
@@ -2273,7 +3102,7 @@ class VkDecoderGlobalState::Impl {
             vk->vkFreeDescriptorSets(device, descriptorPool, descriptorSetCount, pDescriptorSets);
 
         if (res == VK_SUCCESS) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
 
             for (uint32_t i = 0; i < descriptorSetCount; ++i) {
                 auto* setInfo = android::base::find(mDescriptorSetInfo, pDescriptorSets[i]);
@@ -2313,7 +3142,6 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
         on_vkUpdateDescriptorSetsImpl(pool, vk, device, descriptorWriteCount, pDescriptorWrites,
                                       descriptorCopyCount, pDescriptorCopies);
     }
@@ -2323,6 +3151,7 @@ class VkDecoderGlobalState::Impl {
                                        const VkWriteDescriptorSet* pDescriptorWrites,
                                        uint32_t descriptorCopyCount,
                                        const VkCopyDescriptorSet* pDescriptorCopies) {
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         bool needEmulateWriteDescriptor = false;
         // c++ seems to allow for 0-size array allocation
         std::unique_ptr<bool[]> descriptorWritesNeedDeepCopy(new bool[descriptorWriteCount]);
@@ -2438,7 +3267,7 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto& shaderModuleInfo = mShaderModuleInfo[*pShaderModule];
         shaderModuleInfo.device = device;
@@ -2462,7 +3291,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyShaderModuleLocked(device, deviceDispatch, shaderModule, pAllocator);
     }
 
@@ -2479,10 +3308,11 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto& pipelineCacheInfo = mPipelineCacheInfo[*pPipelineCache];
         pipelineCacheInfo.device = device;
+        pipelineCacheInfo.useHostCache = pCreateInfo->initialDataSize == 0;
 
         *pPipelineCache = new_boxed_non_dispatchable_VkPipelineCache(*pPipelineCache);
 
@@ -2492,6 +3322,17 @@ class VkDecoderGlobalState::Impl {
     void destroyPipelineCacheLocked(VkDevice device, VulkanDispatch* deviceDispatch,
                                     VkPipelineCache pipelineCache,
                                     const VkAllocationCallbacks* pAllocator) {
+        auto* deviceInfo = android::base::find(mDeviceInfo, device);
+        auto* pipelineCacheInfo = android::base::find(mPipelineCacheInfo, pipelineCache);
+        // Caches whose pipelines went through the host cache have nothing to add.
+        if (deviceInfo && deviceInfo->hostPipelineCache && pipelineCacheInfo &&
+            !pipelineCacheInfo->useHostCache) {
+            HostPipelineCache* hostPipelineCache = deviceInfo->hostPipelineCache.get();
+            std::unique_lock<std::shared_mutex> hostCacheLock(hostPipelineCache->mutex);
+            deviceDispatch->vkMergePipelineCaches(device, hostPipelineCache->cache, 1,
+                                                  &pipelineCache);
+        }
+
         deviceDispatch->vkDestroyPipelineCache(device, pipelineCache, pAllocator);
 
         mPipelineCacheInfo.erase(pipelineCache);
@@ -2503,7 +3344,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyPipelineCacheLocked(device, deviceDispatch, pipelineCache, pAllocator);
     }
 
@@ -2515,13 +3356,38 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        VkResult result = deviceDispatch->vkCreateGraphicsPipelines(
-            device, pipelineCache, createInfoCount, pCreateInfos, pAllocator, pPipelines);
+        std::shared_ptr<HostPipelineCache> hostPipelineCache;
+        {
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+            auto* pipelineCacheInfo = android::base::find(mPipelineCacheInfo, pipelineCache);
+            auto* deviceInfo = android::base::find(mDeviceInfo, device);
+            if (deviceInfo && (pipelineCache == VK_NULL_HANDLE ||
+                               (pipelineCacheInfo && pipelineCacheInfo->useHostCache))) {
+                hostPipelineCache = deviceInfo->hostPipelineCache;
+            }
+        }
+
+        VkResult result = VK_ERROR_INITIALIZATION_FAILED;
+        bool created = false;
+        if (hostPipelineCache) {
+            std::shared_lock<std::shared_mutex> hostCacheLock(hostPipelineCache->mutex);
+            // Gone if the device is being destroyed.
+            if (hostPipelineCache->cache != VK_NULL_HANDLE) {
+                result = deviceDispatch->vkCreateGraphicsPipelines(
+                    device, hostPipelineCache->cache, createInfoCount, pCreateInfos, pAllocator,
+                    pPipelines);
+                created = true;
+            }
+        }
+        if (!created) {
+            result = deviceDispatch->vkCreateGraphicsPipelines(
+                device, pipelineCache, createInfoCount, pCreateInfos, pAllocator, pPipelines);
+        }
         if (result != VK_SUCCESS) {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         for (uint32_t i = 0; i < createInfoCount; i++) {
             auto& pipelineInfo = mPipelineInfo[pPipelines[i]];
@@ -2545,7 +3411,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyPipelineLocked(device, deviceDispatch, pipeline, pAllocator);
     }
 
@@ -2556,7 +3422,8 @@ class VkDecoderGlobalState::Impl {
         auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
         auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto srcIt = mImageInfo.find(srcImage);
         if (srcIt == mImageInfo.end()) {
             return;
@@ -2622,7 +3489,9 @@ class VkDecoderGlobalState::Impl {
         auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
         auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
         auto* imageInfo = android::base::find(mImageInfo, srcImage);
         auto* bufferInfo = android::base::find(mBufferInfo, dstBuffer);
         if (!imageInfo || !bufferInfo) return;
@@ -2662,7 +3531,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
         vk->vkGetImageMemoryRequirements(device, image, pMemoryRequirements);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         updateImageMemorySizeLocked(device, image, pMemoryRequirements);
     }
 
@@ -2671,7 +3540,7 @@ class VkDecoderGlobalState::Impl {
                                           VkMemoryRequirements2* pMemoryRequirements) {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto physicalDevice = mDeviceToPhysicalDevice[device];
         auto* physdevInfo = android::base::find(mPhysdevInfo, physicalDevice);
@@ -2709,7 +3578,10 @@ class VkDecoderGlobalState::Impl {
         auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
         auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         auto* imageInfo = android::base::find(mImageInfo, dstImage);
         if (!imageInfo) return;
         auto* bufferInfo = android::base::find(mBufferInfo, srcBuffer);
@@ -2771,6 +3643,14 @@ class VkDecoderGlobalState::Impl {
             cmp.astcTexture->on_vkCmdCopyBufferToImage(commandBuffer, astcData, bufferInfo->size,
                                                        dstImage, dstImageLayout, regionCount,
                                                        pRegions, context);
+            // The decompression runs on a worker thread. Make sure it lands before the copy
+            // executes on the GPU.
+            if (cmp.astcTexture->successfullyDecompressed()) {
+                std::shared_future<void> pending = cmp.astcTexture->pendingDecompression();
+                if (pending.valid()) {
+                    cmdBufferInfo->pendingCpuWork.push_back(std::move(pending));
+                }
+            }
         }
     }
 
@@ -2821,7 +3701,9 @@ class VkDecoderGlobalState::Impl {
                                      pImageMemoryBarriers);
             return;
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         CommandBufferInfo* cmdBufferInfo = android::base::find(mCmdBufferInfo, commandBuffer);
         if (!cmdBufferInfo) {
             return;
@@ -2831,6 +3713,12 @@ class VkDecoderGlobalState::Impl {
         if (!deviceInfo) {
             return;
         }
+        if (mSnapshotsEnabled) {
+            for (uint32_t i = 0; i < imageMemoryBarrierCount; ++i) {
+                cmdBufferInfo->imageLayouts[pImageMemoryBarriers[i].image] =
+                    pImageMemoryBarriers[i].newLayout;
+            }
+        }
         if (!deviceInfo->emulateTextureEtc2 && !deviceInfo->emulateTextureAstc) {
             vk->vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, dependencyFlags,
                                      memoryBarrierCount, pMemoryBarriers, bufferMemoryBarrierCount,
@@ -2890,7 +3778,8 @@ class VkDecoderGlobalState::Impl {
                         srcBarrier.oldLayout, srcBarrier.newLayout);
             }
 
-            VkResult result = imageInfo->cmpInfo.initDecomp(vk, cmdBufferInfo->device, image);
+            VkResult result = imageInfo->cmpInfo.initDecomp(
+                vk, cmdBufferInfo->device, deviceInfo->decompPipelines.get(), image);
             if (result != VK_SUCCESS) {
                 fprintf(stderr, "WARNING: texture decompression failed\n");
                 continue;
@@ -3121,7 +4010,7 @@ class VkDecoderGlobalState::Impl {
 
         VkMemoryPropertyFlags memoryPropertyFlags;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
 
             auto* physdev = android::base::find(mDeviceToPhysicalDevice, device);
             if (!physdev) {
@@ -3269,13 +4158,18 @@ class VkDecoderGlobalState::Impl {
         externalMemoryHandle.release();
 #endif
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         mMapInfo[*pMemory] = MappedMemoryInfo();
         auto& mapInfo = mMapInfo[*pMemory];
         mapInfo.size = localAllocInfo.allocationSize;
         mapInfo.device = device;
         mapInfo.memoryIndex = localAllocInfo.memoryTypeIndex;
+        if (dedicatedAllocInfoPtr) {
+            mapInfo.dedicatedImage = dedicatedAllocInfoPtr->image;
+            mapInfo.dedicatedBuffer = dedicatedAllocInfoPtr->buffer;
+        }
+        mapInfo.imported = importCbInfoPtr != nullptr || importBufferInfoPtr != nullptr;
 #ifdef VK_MVK_moltenvk
         if (importCbInfoPtr && m_emu->instanceSupportsMoltenVK) {
             mapInfo.mtlTexture = getColorBufferMTLTexture(importCbInfoPtr->colorBuffer);
@@ -3365,7 +4259,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         freeMemoryLocked(vk, device, memory, pAllocator);
     }
@@ -3373,7 +4267,7 @@ class VkDecoderGlobalState::Impl {
     VkResult on_vkMapMemory(android::base::BumpPool* pool, VkDevice, VkDeviceMemory memory,
                             VkDeviceSize offset, VkDeviceSize size, VkMemoryMapFlags flags,
                             void** ppData) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         return on_vkMapMemoryLocked(0, memory, offset, size, flags, ppData);
     }
     VkResult on_vkMapMemoryLocked(VkDevice, VkDeviceMemory memory, VkDeviceSize offset,
@@ -3391,7 +4285,7 @@ class VkDecoderGlobalState::Impl {
     }
 
     uint8_t* getMappedHostPointer(VkDeviceMemory memory) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* info = android::base::find(mMapInfo, memory);
         if (!info) return nullptr;
@@ -3400,7 +4294,7 @@ class VkDecoderGlobalState::Impl {
     }
 
     VkDeviceSize getDeviceMemorySize(VkDeviceMemory memory) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* info = android::base::find(mMapInfo, memory);
         if (!info) return 0;
@@ -3507,7 +4401,11 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        // The image may share memory with a ColorBuffer that has uploads in flight.
+        waitForPendingStagingUploads();
+
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
 
         auto* imageInfo = android::base::find(mImageInfo, image);
         if (!imageInfo) {
@@ -3537,7 +4435,10 @@ class VkDecoderGlobalState::Impl {
         auto queue = unbox_VkQueue(boxed_queue);
         auto vk = dispatch_VkQueue(boxed_queue);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        // The copy into the ColorBuffer must not race uploads still in flight to it.
+        waitForPendingStagingUploads();
+
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* queueInfo = android::base::find(mQueueInfo, queue);
         if (!queueInfo) return VK_ERROR_INITIALIZATION_FAILED;
@@ -3548,6 +4449,7 @@ class VkDecoderGlobalState::Impl {
             mRenderDocWithMultipleVkInstances->onFrameDelimiter(vkInstance);
         }
 
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* imageInfo = android::base::find(mImageInfo, image);
         auto anbInfo = imageInfo->anbInfo;
 
@@ -3578,7 +4480,7 @@ class VkDecoderGlobalState::Impl {
                     "while GLDirectMem is not enabled!\n");
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         if (mLogging) {
             fprintf(stderr, "%s: deviceMemory: 0x%llx pAddress: 0x%llx\n", __func__,
@@ -3601,7 +4503,7 @@ class VkDecoderGlobalState::Impl {
                                                  VkDevice boxed_device, VkDeviceMemory memory,
                                                  uint64_t* pAddress, uint64_t* pSize,
                                                  uint64_t* pHostmemId) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         struct MemEntry entry = {0};
 
         auto* info = android::base::find(mMapInfo, memory);
@@ -3734,7 +4636,7 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         for (uint32_t i = 0; i < pAllocateInfo->commandBufferCount; i++) {
             mCmdBufferInfo[pCommandBuffers[i]] = CommandBufferInfo();
             mCmdBufferInfo[pCommandBuffers[i]].device = device;
@@ -3758,7 +4660,7 @@ class VkDecoderGlobalState::Impl {
         if (result != VK_SUCCESS) {
             return result;
         }
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         mCmdPoolInfo[*pCommandPool] = CommandPoolInfo();
         auto& cmdPoolInfo = mCmdPoolInfo[*pCommandPool];
         cmdPoolInfo.device = device;
@@ -3776,7 +4678,7 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkDevice(boxed_device);
 
         vk->vkDestroyCommandPool(device, commandPool, pAllocator);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         const auto* cmdPoolInfo = android::base::find(mCmdPoolInfo, commandPool);
         if (cmdPoolInfo) {
             removeCommandBufferInfo(cmdPoolInfo->cmdBuffers);
@@ -3803,10 +4705,17 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
 
         vk->vkCmdExecuteCommands(commandBuffer, commandBufferCount, pCommandBuffers);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         CommandBufferInfo& cmdBuffer = mCmdBufferInfo[commandBuffer];
         cmdBuffer.subCmds.insert(cmdBuffer.subCmds.end(), pCommandBuffers,
                                  pCommandBuffers + commandBufferCount);
+        for (uint32_t i = 0; i < commandBufferCount; i++) {
+            const auto* subCmdInfo = android::base::find(mCmdBufferInfo, pCommandBuffers[i]);
+            if (!subCmdInfo) continue;
+            for (const auto& [image, layout] : subCmdInfo->imageLayouts) {
+                cmdBuffer.imageLayouts[image] = layout;
+            }
+        }
     }
 
     VkResult on_vkQueueSubmit(android::base::BumpPool* pool, VkQueue boxed_queue,
@@ -3814,9 +4723,14 @@ class VkDecoderGlobalState::Impl {
         auto queue = unbox_VkQueue(boxed_queue);
         auto vk = dispatch_VkQueue(boxed_queue);
 
+        // ColorBuffer uploads from the guest's render control stream may still be
+        // executing on the emulation queue; they must land before this submission.
+        waitForPendingStagingUploads();
+
         Lock* ql;
+        std::vector<std::shared_future<void>> pendingCpuWork;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
 
             {
                 auto* queueInfo = android::base::find(mQueueInfo, queue);
@@ -3825,10 +4739,26 @@ class VkDecoderGlobalState::Impl {
                 }
             }
 
-            for (uint32_t i = 0; i < submitCount; i++) {
-                const VkSubmitInfo& submit = pSubmits[i];
-                for (uint32_t c = 0; c < submit.commandBufferCount; c++) {
-                    executePreprocessRecursive(0, submit.pCommandBuffers[c]);
+            {
+                std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
+                for (uint32_t i = 0; i < submitCount; i++) {
+                    const VkSubmitInfo& submit = pSubmits[i];
+                    for (uint32_t c = 0; c < submit.commandBufferCount; c++) {
+                        executePreprocessRecursive(0, submit.pCommandBuffers[c], &pendingCpuWork);
+                    }
+                }
+            }
+
+            if (mSnapshotsEnabled) {
+                // Snapshots wait for the devices to be idle, by which time the
+                // images are in the layouts the submitted work left them in.
+                std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+                std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
+                for (uint32_t i = 0; i < submitCount; i++) {
+                    const VkSubmitInfo& submit = pSubmits[i];
+                    for (uint32_t c = 0; c < submit.commandBufferCount; c++) {
+                        applyImageLayoutsLocked(submit.pCommandBuffers[c]);
+                    }
                 }
             }
 
@@ -3837,6 +4767,12 @@ class VkDecoderGlobalState::Impl {
             ql = queueInfo->lock;
         }
 
+        // Waited for without the locks, so that a slow decompression only holds
+        // up this submission.
+        for (const auto& pending : pendingCpuWork) {
+            pending.wait();
+        }
+
         AutoLock qlock(*ql);
         auto result = vk->vkQueueSubmit(queue, submitCount, pSubmits, fence);
 
@@ -3844,7 +4780,7 @@ class VkDecoderGlobalState::Impl {
         // in FenceInfo, so that other threads (e.g. SyncThread) can call
         // waitForFence() on this fence.
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
             auto* fenceInfo = android::base::find(mFenceInfo, fence);
             if (fenceInfo) {
                 fenceInfo->state = FenceInfo::State::kWaitable;
@@ -3864,7 +4800,7 @@ class VkDecoderGlobalState::Impl {
 
         Lock* ql;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mLock);
             auto* queueInfo = android::base::find(mQueueInfo, queue);
             if (!queueInfo) return VK_SUCCESS;
             ql = queueInfo->lock;
@@ -3882,15 +4818,17 @@ class VkDecoderGlobalState::Impl {
 
         VkResult result = vk->vkResetCommandBuffer(commandBuffer, flags);
         if (VK_SUCCESS == result) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
             auto& bufferInfo = mCmdBufferInfo[commandBuffer];
             bufferInfo.preprocessFuncs.clear();
+            bufferInfo.pendingCpuWork.clear();
             bufferInfo.subCmds.clear();
             bufferInfo.computePipeline = VK_NULL_HANDLE;
             bufferInfo.firstSet = 0;
             bufferInfo.descriptorLayout = VK_NULL_HANDLE;
             bufferInfo.descriptorSets.clear();
             bufferInfo.dynamicOffsets.clear();
+            bufferInfo.imageLayouts.clear();
         }
         return result;
     }
@@ -3903,7 +4841,7 @@ class VkDecoderGlobalState::Impl {
 
         if (!device) return;
         vk->vkFreeCommandBuffers(device, commandPool, commandBufferCount, pCommandBuffers);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         for (uint32_t i = 0; i < commandBufferCount; i++) {
             const auto& cmdBufferInfoIt = mCmdBufferInfo.find(pCommandBuffers[i]);
             if (cmdBufferInfoIt != mCmdBufferInfo.end()) {
@@ -4037,7 +4975,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         auto* info = android::base::find(mDescriptorUpdateTemplateInfo, descriptorUpdateTemplate);
         if (!info) return;
 
@@ -4183,9 +5121,11 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         mCmdBufferInfo[commandBuffer].preprocessFuncs.clear();
+        mCmdBufferInfo[commandBuffer].pendingCpuWork.clear();
         mCmdBufferInfo[commandBuffer].subCmds.clear();
+        mCmdBufferInfo[commandBuffer].imageLayouts.clear();
         return VK_SUCCESS;
     }
 
@@ -4222,7 +5162,7 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
         vk->vkCmdBindPipeline(commandBuffer, pipelineBindPoint, pipeline);
         if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
             auto* cmdBufferInfo = android::base::find(mCmdBufferInfo, commandBuffer);
             if (cmdBufferInfo) {
                 if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
@@ -4244,7 +5184,7 @@ class VkDecoderGlobalState::Impl {
                                     descriptorSetCount, pDescriptorSets, dynamicOffsetCount,
                                     pDynamicOffsets);
         if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
             auto* cmdBufferInfo = android::base::find(mCmdBufferInfo, commandBuffer);
             if (cmdBufferInfo) {
                 cmdBufferInfo->descriptorLayout = layout;
@@ -4268,7 +5208,7 @@ class VkDecoderGlobalState::Impl {
         auto vk = dispatch_VkDevice(boxed_device);
         VkRenderPassCreateInfo createInfo;
         bool needReformat = false;
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto* deviceInfo = android::base::find(mDeviceInfo, device);
         if (!deviceInfo) return VK_ERROR_OUT_OF_HOST_MEMORY;
@@ -4298,6 +5238,9 @@ class VkDecoderGlobalState::Impl {
 
         auto& renderPassInfo = mRenderPassInfo[*pRenderPass];
         renderPassInfo.device = device;
+        for (uint32_t i = 0; i < pCreateInfo->attachmentCount; i++) {
+            renderPassInfo.finalLayouts.push_back(pCreateInfo->pAttachments[i].finalLayout);
+        }
 
         *pRenderPass = new_boxed_non_dispatchable_VkRenderPass(*pRenderPass);
 
@@ -4310,7 +5253,7 @@ class VkDecoderGlobalState::Impl {
                                     VkRenderPass* pRenderPass) {
         auto device = unbox_VkDevice(boxed_device);
         auto vk = dispatch_VkDevice(boxed_device);
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         VkResult res = vk->vkCreateRenderPass2(device, pCreateInfo, pAllocator, pRenderPass);
         if (res != VK_SUCCESS) {
@@ -4319,6 +5262,9 @@ class VkDecoderGlobalState::Impl {
 
         auto& renderPassInfo = mRenderPassInfo[*pRenderPass];
         renderPassInfo.device = device;
+        for (uint32_t i = 0; i < pCreateInfo->attachmentCount; i++) {
+            renderPassInfo.finalLayouts.push_back(pCreateInfo->pAttachments[i].finalLayout);
+        }
 
         *pRenderPass = new_boxed_non_dispatchable_VkRenderPass(*pRenderPass);
 
@@ -4337,10 +5283,75 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyRenderPassLocked(device, deviceDispatch, renderPass, pAllocator);
     }
 
+    void on_vkCmdBeginRenderPass(android::base::BumpPool* pool,
+                                 VkCommandBuffer boxed_commandBuffer,
+                                 const VkRenderPassBeginInfo* pRenderPassBegin,
+                                 VkSubpassContents contents) {
+        auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
+        auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
+
+        vk->vkCmdBeginRenderPass(commandBuffer, pRenderPassBegin, contents);
+        recordRenderPassImageLayouts(commandBuffer, pRenderPassBegin);
+    }
+
+    void on_vkCmdBeginRenderPass2(android::base::BumpPool* pool,
+                                  VkCommandBuffer boxed_commandBuffer,
+                                  const VkRenderPassBeginInfo* pRenderPassBegin,
+                                  const VkSubpassBeginInfo* pSubpassBeginInfo) {
+        auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
+        auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
+
+        vk->vkCmdBeginRenderPass2(commandBuffer, pRenderPassBegin, pSubpassBeginInfo);
+        recordRenderPassImageLayouts(commandBuffer, pRenderPassBegin);
+    }
+
+    void on_vkCmdBeginRenderPass2KHR(android::base::BumpPool* pool,
+                                     VkCommandBuffer boxed_commandBuffer,
+                                     const VkRenderPassBeginInfo* pRenderPassBegin,
+                                     const VkSubpassBeginInfo* pSubpassBeginInfo) {
+        auto commandBuffer = unbox_VkCommandBuffer(boxed_commandBuffer);
+        auto vk = dispatch_VkCommandBuffer(boxed_commandBuffer);
+
+        vk->vkCmdBeginRenderPass2KHR(commandBuffer, pRenderPassBegin, pSubpassBeginInfo);
+        recordRenderPassImageLayouts(commandBuffer, pRenderPassBegin);
+    }
+
+    // A render pass leaves each attachment in its final layout by the time
+    // the render pass ends.
+    void recordRenderPassImageLayouts(VkCommandBuffer commandBuffer,
+                                      const VkRenderPassBeginInfo* pRenderPassBegin) {
+        if (!mSnapshotsEnabled || !pRenderPassBegin) return;
+
+        std::lock_guard<ContentionCountingLock> lock(mLock);
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
+        auto* cmdBufferInfo = android::base::find(mCmdBufferInfo, commandBuffer);
+        auto* renderPassInfo = android::base::find(mRenderPassInfo, pRenderPassBegin->renderPass);
+        auto* framebufferInfo =
+            android::base::find(mFramebufferInfo, pRenderPassBegin->framebuffer);
+        if (!cmdBufferInfo || !renderPassInfo || !framebufferInfo) return;
+
+        const VkImageView* attachments = framebufferInfo->attachments.data();
+        size_t attachmentCount = framebufferInfo->attachments.size();
+        if (const auto* attachmentBeginInfo =
+                vk_find_struct<VkRenderPassAttachmentBeginInfo>(pRenderPassBegin)) {
+            attachments = attachmentBeginInfo->pAttachments;
+            attachmentCount = attachmentBeginInfo->attachmentCount;
+        }
+        attachmentCount = std::min(attachmentCount, renderPassInfo->finalLayouts.size());
+        for (size_t i = 0; i < attachmentCount; i++) {
+            const auto* imageViewInfo = android::base::find(mImageViewInfo, attachments[i]);
+            if (imageViewInfo) {
+                cmdBufferInfo->imageLayouts[imageViewInfo->image] =
+                    renderPassInfo->finalLayouts[i];
+            }
+        }
+    }
+
     void on_vkCmdCopyQueryPoolResults(android::base::BumpPool* pool,
                                       VkCommandBuffer boxed_commandBuffer,
                                       VkQueryPool queryPool,
@@ -4356,6 +5367,7 @@ class VkDecoderGlobalState::Impl {
             // Some drivers don't seem to handle stride==0 very well.
             // In fact, the spec does not say what should happen with stride==0.
             // So we just use the largest stride possible.
+            std::lock_guard<ContentionCountingLock> lock(mBufferLock);
             stride = mBufferInfo[dstBuffer].size - dstOffset;
         }
         vk->vkCmdCopyQueryPoolResults(commandBuffer, queryPool, firstQuery,
@@ -4376,10 +5388,14 @@ class VkDecoderGlobalState::Impl {
             return result;
         }
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
 
         auto& framebufferInfo = mFramebufferInfo[*pFramebuffer];
         framebufferInfo.device = device;
+        if (!(pCreateInfo->flags & VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT)) {
+            framebufferInfo.attachments.assign(
+                pCreateInfo->pAttachments, pCreateInfo->pAttachments + pCreateInfo->attachmentCount);
+        }
 
         *pFramebuffer = new_boxed_non_dispatchable_VkFramebuffer(*pFramebuffer);
 
@@ -4400,7 +5416,7 @@ class VkDecoderGlobalState::Impl {
         auto device = unbox_VkDevice(boxed_device);
         auto deviceDispatch = dispatch_VkDevice(boxed_device);
 
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         destroyFramebufferLocked(device, deviceDispatch, framebuffer, pAllocator);
     }
 
@@ -4420,6 +5436,9 @@ class VkDecoderGlobalState::Impl {
         const bool needTimelineSubmitInfoWorkaround = true;
         (void)needTimelineSubmitInfoWorkaround;
 
+        // Same as on_vkQueueSubmit(): ColorBuffer uploads must land first.
+        waitForPendingStagingUploads();
+
         bool hasTimelineSemaphoreSubmitInfo = false;
 
         for (uint32_t i = 0; i < bindInfoCount; ++i) {
@@ -4678,25 +5697,29 @@ class VkDecoderGlobalState::Impl {
         const uint32_t* pDescriptorSetWhichPool, const uint32_t* pDescriptorSetPendingAllocation,
         const uint32_t* pDescriptorWriteStartingIndices, uint32_t pendingDescriptorWriteCount,
         const VkWriteDescriptorSet* pPendingDescriptorWrites) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
-
         VkDevice device;
 
         auto queue = unbox_VkQueue(boxed_queue);
         auto vk = dispatch_VkQueue(boxed_queue);
 
-        auto* queueInfo = android::base::find(mQueueInfo, queue);
-        if (queueInfo) {
-            device = queueInfo->device;
-        } else {
-            GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
-                << "queue " << queue << "(boxed: " << boxed_queue << ") with no device registered";
+        {
+            std::lock_guard<ContentionCountingLock> lock(mLock);
+            auto* queueInfo = android::base::find(mQueueInfo, queue);
+            if (queueInfo) {
+                device = queueInfo->device;
+            } else {
+                GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
+                    << "queue " << queue << "(boxed: " << boxed_queue
+                    << ") with no device registered";
+            }
         }
 
         std::vector<VkDescriptorSet> setsToUpdate(descriptorSetCount, nullptr);
 
         bool didAlloc = false;
 
+        // Released before the writes, which take mImageLock.
+        std::unique_lock<ContentionCountingLock> descriptorLock(mDescriptorLock);
         for (uint32_t i = 0; i < descriptorSetCount; ++i) {
             uint64_t poolId = pDescriptorSetPoolIds[i];
             uint32_t whichPool = pDescriptorSetWhichPool[i];
@@ -4708,6 +5731,7 @@ class VkDecoderGlobalState::Impl {
 
             if (didAllocThisTime) didAlloc = true;
         }
+        descriptorLock.unlock();
 
         if (didAlloc) {
             std::vector<VkWriteDescriptorSet> writeDescriptorSetsForHostDriver(
@@ -4740,7 +5764,7 @@ class VkDecoderGlobalState::Impl {
     void on_vkCollectDescriptorPoolIdsGOOGLE(android::base::BumpPool* pool, VkDevice device,
                                              VkDescriptorPool descriptorPool,
                                              uint32_t* pPoolIdCount, uint64_t* pPoolIds) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mDescriptorLock);
         auto& info = mDescriptorPoolInfo[descriptorPool];
         *pPoolIdCount = (uint32_t)info.poolIds.size();
 
@@ -4806,7 +5830,7 @@ class VkDecoderGlobalState::Impl {
         StaticLock* fenceLock;
         ConditionVariable* cv;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
 
             fence = unbox_VkFence(boxed_fence);
             if (fence == VK_NULL_HANDLE || mFenceInfo.find(fence) == mFenceInfo.end()) {
@@ -4832,19 +5856,33 @@ class VkDecoderGlobalState::Impl {
             cv = &mFenceInfo[fence].cv;
         }
 
-        fenceLock->lock();
-        cv->wait(fenceLock, [this, fence] {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+        // The time spent waiting for the guest to submit the fence counts
+        // towards |timeout| too.
+        const uint64_t startUs = android::base::getUnixTimeUs();
+        const uint64_t deadlineUs = startUs + timeout / 1000;
+        auto takeWaitable = [this, fence] {
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
             if (mFenceInfo[fence].state == FenceInfo::State::kWaitable) {
                 mFenceInfo[fence].state = FenceInfo::State::kWaiting;
                 return true;
             }
             return false;
-        });
+        };
+        fenceLock->lock();
+        bool submitted = takeWaitable();
+        while (!submitted && android::base::getUnixTimeUs() < deadlineUs) {
+            cv->timedWait(fenceLock, deadlineUs);
+            submitted = takeWaitable();
+        }
         fenceLock->unlock();
+        if (!submitted) {
+            return VK_TIMEOUT;
+        }
+        const uint64_t elapsedNs = (android::base::getUnixTimeUs() - startUs) * 1000;
+        timeout = timeout > elapsedNs ? timeout - elapsedNs : 0;
 
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
             if (mFenceInfo.find(fence) == mFenceInfo.end()) {
                 GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
                     << "Fence was destroyed before vkWaitForFences call.";
@@ -4855,12 +5893,86 @@ class VkDecoderGlobalState::Impl {
                                    /* waitAll */ false, timeout);
     }
 
+    VkResult waitForAnyFence(uint32_t fenceCount, const VkFence* boxed_fences, uint64_t timeout,
+                             VkBool32* pCompleted) {
+        struct DeviceFences {
+            VulkanDispatch* vk = nullptr;
+            std::vector<VkFence> fences;
+            std::vector<uint32_t> indices;
+        };
+        std::unordered_map<VkDevice, DeviceFences> submitted;
+        {
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
+            for (uint32_t i = 0; i < fenceCount; ++i) {
+                VkFence fence = unbox_VkFence(boxed_fences[i]);
+                auto* fenceInfo = android::base::find(mFenceInfo, fence);
+                // As in |waitForFence|, unknown fences could be semaphores.
+                pCompleted[i] = fence == VK_NULL_HANDLE || !fenceInfo;
+                if (pCompleted[i] || fenceInfo->state == FenceInfo::State::kNotWaitable) {
+                    continue;
+                }
+                fenceInfo->state = FenceInfo::State::kWaiting;
+                auto& deviceFences = submitted[fenceInfo->device];
+                deviceFences.vk = fenceInfo->vk;
+                deviceFences.fences.push_back(fence);
+                deviceFences.indices.push_back(i);
+            }
+        }
+
+        bool anyCompleted = false;
+        for (uint32_t i = 0; i < fenceCount; ++i) {
+            anyCompleted = anyCompleted || pCompleted[i];
+        }
+        if (submitted.empty()) {
+            return anyCompleted ? VK_SUCCESS : VK_NOT_READY;
+        }
+
+        // vkWaitForFences() takes the fences of one device only, so block on the
+        // device with the most fences and just poll the others.
+        auto blocking = submitted.begin();
+        for (auto it = submitted.begin(); it != submitted.end(); ++it) {
+            if (it->second.fences.size() > blocking->second.fences.size()) {
+                blocking = it;
+            }
+        }
+        VkResult result = VK_SUCCESS;
+        for (auto it = submitted.begin(); it != submitted.end(); ++it) {
+            const VkDevice device = it->first;
+            const DeviceFences& deviceFences = it->second;
+            const uint64_t deviceTimeout = (it == blocking && !anyCompleted) ? timeout : 0;
+            const VkResult waitResult = deviceFences.vk->vkWaitForFences(
+                device, static_cast<uint32_t>(deviceFences.fences.size()),
+                deviceFences.fences.data(), /* waitAll */ VK_FALSE, deviceTimeout);
+            if (waitResult == VK_TIMEOUT) {
+                continue;
+            }
+            for (size_t j = 0; j < deviceFences.fences.size(); ++j) {
+                // Errors complete the waits, like signaled fences do.
+                const VkResult status =
+                    waitResult == VK_SUCCESS
+                        ? deviceFences.vk->vkGetFenceStatus(device, deviceFences.fences[j])
+                        : waitResult;
+                if (status != VK_NOT_READY) {
+                    pCompleted[deviceFences.indices[j]] = VK_TRUE;
+                    anyCompleted = true;
+                }
+                if (status != VK_SUCCESS && status != VK_NOT_READY && result == VK_SUCCESS) {
+                    result = status;
+                }
+            }
+        }
+        if (result == VK_SUCCESS && !anyCompleted) {
+            result = VK_TIMEOUT;
+        }
+        return result;
+    }
+
     VkResult getFenceStatus(VkFence boxed_fence) {
         VkDevice device;
         VkFence fence;
         VulkanDispatch* vk;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mFenceLock);
 
             fence = unbox_VkFence(boxed_fence);
             if (fence == VK_NULL_HANDLE || mFenceInfo.find(fence) == mFenceInfo.end()) {
@@ -4876,11 +5988,22 @@ class VkDecoderGlobalState::Impl {
         return vk->vkGetFenceStatus(device, fence);
     }
 
+    VkDecoderGlobalState::LockContentionStats getLockContentionStats() const {
+        return {
+            .globalLockContentions = mLock.contentionCount(),
+            .imageLockContentions = mImageLock.contentionCount(),
+            .bufferLockContentions = mBufferLock.contentionCount(),
+            .descriptorLockContentions = mDescriptorLock.contentionCount(),
+            .cmdBufferLockContentions = mCmdBufferLock.contentionCount(),
+            .fenceLockContentions = mFenceLock.contentionCount(),
+        };
+    }
+
     AsyncResult registerQsriCallback(VkImage boxed_image, VkQsriTimeline::Callback callback) {
         VkImage image;
         std::shared_ptr<AndroidNativeBufferInfo> anbInfo;
         {
-            std::lock_guard<std::recursive_mutex> lock(mLock);
+            std::lock_guard<ContentionCountingLock> lock(mImageLock);
 
             image = unbox_VkImage(boxed_image);
 
@@ -5403,6 +6526,7 @@ class VkDecoderGlobalState::Impl {
         if (!deviceInfo->emulateTextureEtc2 && !deviceInfo->emulateTextureAstc) {
             return;
         }
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
         auto* imageInfo = android::base::find(mImageInfo, image);
         if (!imageInfo) return;
         CompressedImageInfo& cmpInfo = imageInfo->cmpInfo;
@@ -5416,7 +6540,7 @@ class VkDecoderGlobalState::Impl {
 
     // Whether the VkInstance associated with this physical device was created by ANGLE
     bool isAngleInstance(VkPhysicalDevice physicalDevice, goldfish_vk::VulkanDispatch* vk) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         VkInstance* instance = android::base::find(mPhysicalDeviceToInstance, physicalDevice);
         if (!instance) return false;
         InstanceInfo* instanceInfo = android::base::find(mInstanceInfo, *instance);
@@ -5581,12 +6705,30 @@ class VkDecoderGlobalState::Impl {
         }
     }
 
-    void executePreprocessRecursive(int level, VkCommandBuffer cmdBuffer) {
+    // Callers must hold mImageLock and mCmdBufferLock.
+    void applyImageLayoutsLocked(VkCommandBuffer cmdBuffer) {
+        const auto* cmdBufferInfo = android::base::find(mCmdBufferInfo, cmdBuffer);
+        if (!cmdBufferInfo) return;
+        for (const auto& [image, layout] : cmdBufferInfo->imageLayouts) {
+            auto* imageInfo = android::base::find(mImageInfo, image);
+            if (imageInfo) {
+                imageInfo->layout = layout;
+            }
+        }
+    }
+
+    // Callers must hold mCmdBufferLock. CPU work the command buffer needs done
+    // before it executes is added to |pendingCpuWork|, for the caller to wait
+    // for once it has released its locks.
+    void executePreprocessRecursive(int level, VkCommandBuffer cmdBuffer,
+                                    std::vector<std::shared_future<void>>* pendingCpuWork) {
         auto* cmdBufferInfo = android::base::find(mCmdBufferInfo, cmdBuffer);
         if (!cmdBufferInfo) return;
         for (const auto& func : cmdBufferInfo->preprocessFuncs) {
             func();
         }
+        pendingCpuWork->insert(pendingCpuWork->end(), cmdBufferInfo->pendingCpuWork.begin(),
+                               cmdBufferInfo->pendingCpuWork.end());
         // TODO: fix
         // for (const auto& subCmd : cmdBufferInfo->subCmds) {
         // executePreprocessRecursive(level + 1, subCmd);
@@ -5634,6 +6776,10 @@ class VkDecoderGlobalState::Impl {
             }
         }
 
+        std::lock_guard<ContentionCountingLock> imageLock(mImageLock);
+        std::lock_guard<ContentionCountingLock> bufferLock(mBufferLock);
+        std::lock_guard<ContentionCountingLock> descriptorLock(mDescriptorLock);
+        std::lock_guard<ContentionCountingLock> cmdBufferLock(mCmdBufferLock);
         for (uint32_t i = 0; i < devicesToDestroy.size(); ++i) {
             VkDevice deviceToDestroy = devicesToDestroy[i];
             VulkanDispatch* deviceToDestroyDispatch = devicesToDestroyDispatches[i];
@@ -5740,6 +6886,9 @@ class VkDecoderGlobalState::Impl {
     typedef std::function<void()> PreprocessFunc;
     struct CommandBufferInfo {
         std::vector<PreprocessFunc> preprocessFuncs = {};
+        // Work on other threads, like ASTC decompression, that has to finish
+        // before the command buffer executes.
+        std::vector<std::shared_future<void>> pendingCpuWork = {};
         std::vector<VkCommandBuffer> subCmds = {};
         VkDevice device = 0;
         VkCommandPool cmdPool = nullptr;
@@ -5750,6 +6899,12 @@ class VkDecoderGlobalState::Impl {
         std::vector<VkDescriptorSet> descriptorSets;
         std::vector<uint32_t> dynamicOffsets;
         uint32_t sequenceNumber = 0;
+        // With snapshots enabled, the layout each image is left in by the
+        // barriers and render passes recorded so far, including those of the
+        // secondary command buffers executed. Applied to ImageInfo::layout
+        // when the command buffer is submitted. Synchronization2 barriers are
+        // not routed through here and are missed.
+        std::unordered_map<VkImage, VkImageLayout> imageLayouts;
     };
 
     struct CommandPoolInfo {
@@ -5758,6 +6913,7 @@ class VkDecoderGlobalState::Impl {
         std::unordered_set<VkCommandBuffer> cmdBuffers = {};
     };
 
+    // Callers must hold mCmdBufferLock.
     void removeCommandBufferInfo(const std::unordered_set<VkCommandBuffer>& cmdBuffers) {
         for (const auto& cmdBuffer : cmdBuffers) {
             mCmdBufferInfo.erase(cmdBuffer);
@@ -5867,12 +7023,12 @@ class VkDecoderGlobalState::Impl {
 
     void registerDescriptorUpdateTemplate(VkDescriptorUpdateTemplate descriptorUpdateTemplate,
                                           const DescriptorUpdateTemplateInfo& info) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         mDescriptorUpdateTemplateInfo[descriptorUpdateTemplate] = info;
     }
 
     void unregisterDescriptorUpdateTemplate(VkDescriptorUpdateTemplate descriptorUpdateTemplate) {
-        std::lock_guard<std::recursive_mutex> lock(mLock);
+        std::lock_guard<ContentionCountingLock> lock(mLock);
         mDescriptorUpdateTemplateInfo.erase(descriptorUpdateTemplate);
     }
 
@@ -5893,7 +7049,29 @@ class VkDecoderGlobalState::Impl {
     bool mUseOldMemoryCleanupPath = false;
     bool mGuestUsesAngle = false;
 
-    std::recursive_mutex mLock;
+    // Guards all object tracking tables except those that live in their own
+    // shard below. When a shard lock is needed together with mLock, mLock must
+    // be acquired first.
+    ContentionCountingLock mLock;
+
+    // Shards for the tables that per-draw and per-submit handlers touch the
+    // most. When several are needed at once, take them in declaration order.
+    // Guards mImageInfo, mImageViewInfo and mSamplerInfo.
+    ContentionCountingLock mImageLock;
+    // Guards mBufferInfo.
+    ContentionCountingLock mBufferLock;
+    // Guards mDescriptorSetLayoutInfo, mDescriptorPoolInfo and
+    // mDescriptorSetInfo.
+    ContentionCountingLock mDescriptorLock;
+    // Guards mCmdBufferInfo and mCmdPoolInfo.
+    ContentionCountingLock mCmdBufferLock;
+    // Guards mFenceInfo. Fence bookkeeping is touched by the SyncThread waiting
+    // on fences from every guest.
+    ContentionCountingLock mFenceLock;
+
+    // Physical devices whose pipeline cache data was saved by a destroyed
+    // device and still has to be written to disk. Guarded by mLock.
+    std::vector<VkPhysicalDeviceProperties> mPipelineCachesToWrite;
 
     // We always map the whole size on host.
     // This makes it much easier to implement
@@ -5918,6 +7096,12 @@ class VkDecoderGlobalState::Impl {
         VkDevice device = VK_NULL_HANDLE;
         MTLTextureRef mtlTexture = nullptr;
         uint32_t memoryIndex = 0;
+        // The image or buffer this memory is dedicated to, if any. Its
+        // contents can only be read through that.
+        VkImage dedicatedImage = VK_NULL_HANDLE;
+        VkBuffer dedicatedBuffer = VK_NULL_HANDLE;
+        // Backs a ColorBuffer or Buffer, which snapshot their own contents.
+        bool imported = false;
     };
 
     struct InstanceInfo {
@@ -5935,6 +7119,19 @@ class VkDecoderGlobalState::Impl {
         VkPhysicalDevice boxed = nullptr;
     };
 
+    // Host-owned pipeline cache of a device, seeded from the persistent cache.
+    // Pipelines the guest creates without a cache, or with a cache it created
+    // without data, go through it. Other guest caches are merged into it when
+    // destroyed. Guest caches are never seeded from it, so that guests only get
+    // back the data of their own pipelines.
+    struct HostPipelineCache {
+        VkPipelineCache cache = VK_NULL_HANDLE;
+        // Merging into the cache and destroying it need exclusive access;
+        // pipeline creation can share it. |cache| is null once the device is
+        // destroyed, while pipeline creation may still hold this.
+        std::shared_mutex mutex;
+    };
+
     struct DeviceInfo {
         std::unordered_map<uint32_t, std::vector<VkQueue>> queues;
         std::vector<std::string> enabledExtensionNames;
@@ -5943,6 +7140,9 @@ class VkDecoderGlobalState::Impl {
         VkPhysicalDevice physicalDevice;
         VkDevice boxed = nullptr;
         std::unique_ptr<ExternalFencePool<VulkanDispatch>> externalFencePool = nullptr;
+        std::shared_ptr<HostPipelineCache> hostPipelineCache = nullptr;
+        // Compute pipelines decompressing emulated compressed textures, shared by all images.
+        std::unique_ptr<GpuDecompressionPipelineManager> decompPipelines = nullptr;
 
         // True if this is a compressed image that needs to be decompressed on the GPU (with our
         // compute shader)
@@ -6015,17 +7215,31 @@ class VkDecoderGlobalState::Impl {
         VkDeviceMemory memory = 0;
         VkDeviceSize memoryOffset = 0;
         VkDeviceSize size;
+        // Created with transfer usage, so that snapshots can copy it.
+        bool transferable = false;
     };
 
     struct ImageInfo {
         VkDevice device;
         std::shared_ptr<AndroidNativeBufferInfo> anbInfo;
         CompressedImageInfo cmpInfo;
+        // For snapshots of the memory dedicated to the image.
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent3D extent = {};
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+        bool transferable = false;
+        // The layout the submitted work leaves the image in, only tracked
+        // with snapshots enabled. See CommandBufferInfo::imageLayouts.
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
     };
 
     struct ImageViewInfo {
         VkDevice device;
         bool needEmulatedAlpha = false;
+        // The image the guest created the view of.
+        VkImage image = VK_NULL_HANDLE;
     };
 
     struct SamplerInfo {
@@ -6111,6 +7325,8 @@ class VkDecoderGlobalState::Impl {
 
     struct PipelineCacheInfo {
         VkDevice device;
+        // Created without data, pipelines go through the host cache instead.
+        bool useHostCache = false;
     };
 
     struct PipelineInfo {
@@ -6119,10 +7335,13 @@ class VkDecoderGlobalState::Impl {
 
     struct RenderPassInfo {
         VkDevice device;
+        std::vector<VkImageLayout> finalLayouts;
     };
 
     struct FramebufferInfo {
         VkDevice device;
+        // Empty for imageless framebuffers.
+        std::vector<VkImageView> attachments;
     };
 
     bool isBindingFeasibleForAlloc(const DescriptorPoolInfo::PoolState& poolState,
@@ -6252,6 +7471,7 @@ class VkDecoderGlobalState::Impl {
     std::unordered_map<VkFramebuffer, FramebufferInfo> mFramebufferInfo;
 
     std::unordered_map<VkSemaphore, SemaphoreInfo> mSemaphoreInfo;
+    // Guarded by mFenceLock.
     std::unordered_map<VkFence, FenceInfo> mFenceInfo;
 
     std::unordered_map<VkDescriptorSetLayout, DescriptorSetLayoutInfo> mDescriptorSetLayoutInfo;
@@ -6372,6 +7592,14 @@ void VkDecoderGlobalState::load(android::base::Stream* stream, GfxApiLogger& gfx
     mImpl->load(stream, gfxLogger, healthMonitor);
 }
 
+void VkDecoderGlobalState::saveMemoryContents(android::base::Stream* stream) {
+    mImpl->saveMemoryContents(stream);
+}
+
+void VkDecoderGlobalState::loadMemoryContents(android::base::Stream* stream) {
+    mImpl->loadMemoryContents(stream);
+}
+
 void VkDecoderGlobalState::lock() { mImpl->lock(); }
 
 void VkDecoderGlobalState::unlock() { mImpl->unlock(); }
@@ -7133,6 +8361,26 @@ void VkDecoderGlobalState::on_vkDestroyRenderPass(android::base::BumpPool* pool,
     mImpl->on_vkDestroyRenderPass(pool, boxed_device, renderPass, pAllocator);
 }
 
+void VkDecoderGlobalState::on_vkCmdBeginRenderPass(android::base::BumpPool* pool,
+                                                   VkCommandBuffer commandBuffer,
+                                                   const VkRenderPassBeginInfo* pRenderPassBegin,
+                                                   VkSubpassContents contents) {
+    mImpl->on_vkCmdBeginRenderPass(pool, commandBuffer, pRenderPassBegin, contents);
+}
+
+void VkDecoderGlobalState::on_vkCmdBeginRenderPass2(android::base::BumpPool* pool,
+                                                    VkCommandBuffer commandBuffer,
+                                                    const VkRenderPassBeginInfo* pRenderPassBegin,
+                                                    const VkSubpassBeginInfo* pSubpassBeginInfo) {
+    mImpl->on_vkCmdBeginRenderPass2(pool, commandBuffer, pRenderPassBegin, pSubpassBeginInfo);
+}
+
+void VkDecoderGlobalState::on_vkCmdBeginRenderPass2KHR(
+    android::base::BumpPool* pool, VkCommandBuffer commandBuffer,
+    const VkRenderPassBeginInfo* pRenderPassBegin, const VkSubpassBeginInfo* pSubpassBeginInfo) {
+    mImpl->on_vkCmdBeginRenderPass2KHR(pool, commandBuffer, pRenderPassBegin, pSubpassBeginInfo);
+}
+
 VkResult VkDecoderGlobalState::on_vkCreateFramebuffer(android::base::BumpPool* pool,
                                                       VkDevice boxed_device,
                                                       const VkFramebufferCreateInfo* pCreateInfo,
@@ -7290,10 +8538,19 @@ VkResult VkDecoderGlobalState::waitForFence(VkFence boxed_fence, uint64_t timeou
     return mImpl->waitForFence(boxed_fence, timeout);
 }
 
+VkResult VkDecoderGlobalState::waitForAnyFence(uint32_t fenceCount, const VkFence* boxed_fences,
+                                               uint64_t timeout, VkBool32* pCompleted) {
+    return mImpl->waitForAnyFence(fenceCount, boxed_fences, timeout, pCompleted);
+}
+
 VkResult VkDecoderGlobalState::getFenceStatus(VkFence boxed_fence) {
     return mImpl->getFenceStatus(boxed_fence);
 }
 
+VkDecoderGlobalState::LockContentionStats VkDecoderGlobalState::getLockContentionStats() const {
+    return mImpl->getLockContentionStats();
+}
+
 AsyncResult VkDecoderGlobalState::registerQsriCallback(VkImage image,
                                                     VkQsriTimeline::Callback callback) {
     return mImpl->registerQsriCallback(image, std::move(callback));
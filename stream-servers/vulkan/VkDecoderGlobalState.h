@@ -80,6 +80,11 @@ class VkDecoderGlobalState {
     void load(android::base::Stream* stream, emugl::GfxApiLogger& gfxLogger,
               emugl::HealthMonitor<>& healthMonitor);
 
+    // The contents of the VkDeviceMemory the guest allocated, which save()
+    // and load() put after the API trace.
+    void saveMemoryContents(android::base::Stream* stream);
+    void loadMemoryContents(android::base::Stream* stream);
+
     // Lock/unlock of global state to serve as a global lock
     void lock();
     void unlock();
@@ -545,6 +550,15 @@ class VkDecoderGlobalState {
                                        VkRenderPass* pRenderPass);
     void on_vkDestroyRenderPass(android::base::BumpPool* pool, VkDevice device,
                                 VkRenderPass renderPass, const VkAllocationCallbacks* pAllocator);
+    void on_vkCmdBeginRenderPass(android::base::BumpPool* pool, VkCommandBuffer commandBuffer,
+                                 const VkRenderPassBeginInfo* pRenderPassBegin,
+                                 VkSubpassContents contents);
+    void on_vkCmdBeginRenderPass2(android::base::BumpPool* pool, VkCommandBuffer commandBuffer,
+                                  const VkRenderPassBeginInfo* pRenderPassBegin,
+                                  const VkSubpassBeginInfo* pSubpassBeginInfo);
+    void on_vkCmdBeginRenderPass2KHR(android::base::BumpPool* pool, VkCommandBuffer commandBuffer,
+                                     const VkRenderPassBeginInfo* pRenderPassBegin,
+                                     const VkSubpassBeginInfo* pSubpassBeginInfo);
     VkResult on_vkCreateFramebuffer(android::base::BumpPool* pool, VkDevice device,
                                     const VkFramebufferCreateInfo* pCreateInfo,
                                     const VkAllocationCallbacks* pAllocator,
@@ -627,10 +641,32 @@ class VkDecoderGlobalState {
                         std::optional<uint64_t> allocationSize = std::nullopt);
 
     // Fence waits
+    // Waits up to |timeout| nanoseconds for the guest to submit the boxed fence and for it to be
+    // signaled. Returns VK_TIMEOUT if the guest hasn't submitted it in time.
     VkResult waitForFence(VkFence boxed_fence, uint64_t timeout);
 
+    // Waits up to |timeout| nanoseconds for any of the boxed fences to be signaled, with one
+    // vkWaitForFences(waitAll = VK_FALSE) call for all of those of a device. Fences the guest
+    // hasn't submitted yet are left out. Sets |pCompleted[i]| for each fence whose wait is over,
+    // because it is signaled, unknown or failed. Returns VK_NOT_READY if there was nothing to wait
+    // for, VK_TIMEOUT if no wait is over, and the first error of the waits otherwise.
+    VkResult waitForAnyFence(uint32_t fenceCount, const VkFence* boxed_fences, uint64_t timeout,
+                             VkBool32* pCompleted);
+
     VkResult getFenceStatus(VkFence boxed_fence);
 
+    // Number of times a thread had to block on another thread to acquire the
+    // lock guarding each shard of the object tracking tables.
+    struct LockContentionStats {
+        uint64_t globalLockContentions = 0;
+        uint64_t imageLockContentions = 0;
+        uint64_t bufferLockContentions = 0;
+        uint64_t descriptorLockContentions = 0;
+        uint64_t cmdBufferLockContentions = 0;
+        uint64_t fenceLockContentions = 0;
+    };
+    LockContentionStats getLockContentionStats() const;
+
     // Wait for present (vkQueueSignalReleaseImageANDROID). This explicitly
     // requires the image to be presented again versus how many times it's been
     // presented so far, so it ends up incrementing a "target present count"
@@ -15,9 +15,19 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+
 #include "VkDecoderGlobalState.cpp"
 
+#include "aemu/base/files/MemStream.h"
 #include "aemu/base/testing/TestUtils.h"
+#include "host-common/GraphicsAgentFactory.h"
+#include "host-common/misc.h"
+#include "host-common/testing/MockGraphicsAgentFactory.h"
 
 namespace goldfish_vk {
 namespace {
@@ -142,5 +152,478 @@ TEST_F(VkDecoderGlobalStateExternalFenceDeathTest, undestroyedFences) {
             "fences still not destroyed."));
 }
 
+TEST(VkDecoderGlobalStateContentionCountingLockTest, recursiveLockIsNotContention) {
+    ContentionCountingLock lock;
+    lock.lock();
+    lock.lock();
+    lock.unlock();
+    lock.unlock();
+    EXPECT_EQ(lock.contentionCount(), 0);
+}
+
+TEST(VkDecoderGlobalStateContentionCountingLockTest, countsBlockedAcquisitions) {
+    ContentionCountingLock lock;
+    std::atomic<bool> locked = false;
+    std::atomic<bool> release = false;
+
+    std::thread holder([&] {
+        std::lock_guard<ContentionCountingLock> guard(lock);
+        locked = true;
+        while (!release) std::this_thread::yield();
+    });
+    while (!locked) std::this_thread::yield();
+
+    std::thread waiter([&] { std::lock_guard<ContentionCountingLock> guard(lock); });
+    while (lock.contentionCount() == 0) std::this_thread::yield();
+    release = true;
+
+    holder.join();
+    waiter.join();
+    EXPECT_EQ(lock.contentionCount(), 1);
+}
+
+// SwiftShader Vulkan doesn't work on Windows.
+#ifndef _WIN32
+// Snapshots the memory contents of objects created on the host driver the way
+// the decoder would create them for the guest.
+class VkDecoderGlobalStateSnapshotTest : public Test {
+protected:
+    static constexpr VkDeviceSize kMemorySize = 64 * 1024;
+    static constexpr VkExtent2D kImageExtent = {64, 32};
+
+    static void SetUpTestSuite() {
+        android::emulation::injectGraphicsAgents(android::emulation::MockGraphicsAgentFactory());
+    }
+
+    void SetUp() override {
+        feature_set_enabled_override(kFeature_Vulkan, true);
+        feature_set_enabled_override(kFeature_VulkanSnapshots, true);
+        set_emugl_vm_operations(*getGraphicsAgents()->vm);
+        ASSERT_NE(nullptr, createGlobalVkEmulation(emugl::vkDispatch(false /* not for testing */)));
+        mState = std::make_unique<VkDecoderGlobalState>();
+
+        const VkApplicationInfo appInfo = {
+            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+            .apiVersion = VK_MAKE_VERSION(1, 1, 0),
+        };
+        const VkInstanceCreateInfo instanceCi = {
+            .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+            .pApplicationInfo = &appInfo,
+        };
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateInstance(&mPool, &instanceCi, nullptr, &mInstance));
+        uint32_t physicalDeviceCount = 0;
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkEnumeratePhysicalDevices(
+                                  &mPool, mInstance, &physicalDeviceCount, nullptr));
+        ASSERT_GT(physicalDeviceCount, 0u);
+        std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
+        ASSERT_EQ(VK_SUCCESS,
+                  mState->on_vkEnumeratePhysicalDevices(&mPool, mInstance, &physicalDeviceCount,
+                                                        physicalDevices.data()));
+        mPhysicalDevice = physicalDevices[0];
+        mState->on_vkGetPhysicalDeviceMemoryProperties(&mPool, mPhysicalDevice,
+                                                       &mMemoryProperties);
+
+        // Queue family 0 of SwiftShader does graphics and transfers.
+        const float priority = 1.0f;
+        const VkDeviceQueueCreateInfo queueCi = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = 0,
+            .queueCount = 1,
+            .pQueuePriorities = &priority,
+        };
+        const VkDeviceCreateInfo deviceCi = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .queueCreateInfoCount = 1,
+            .pQueueCreateInfos = &queueCi,
+        };
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateDevice(&mPool, mPhysicalDevice, &deviceCi,
+                                                        nullptr, &mDevice));
+        mState->on_vkGetDeviceQueue(&mPool, mDevice, 0, 0, &mQueue);
+        ASSERT_NE(VK_NULL_HANDLE, mQueue);
+        mVk = dispatch_VkDevice(mDevice);
+
+        const VkCommandPoolCreateInfo commandPoolCi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = 0,
+        };
+        VkCommandPool commandPool;
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateCommandPool(&mPool, mDevice, &commandPoolCi,
+                                                             nullptr, &commandPool));
+        const VkCommandBufferAllocateInfo commandBufferAi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = unbox_VkCommandPool(commandPool),
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkAllocateCommandBuffers(&mPool, mDevice,
+                                                                  &commandBufferAi,
+                                                                  &mCommandBuffer));
+    }
+
+    void TearDown() override {
+        if (mDevice) {
+            mState->on_vkDestroyDevice(&mPool, mDevice, nullptr);
+        }
+        if (mInstance) {
+            mState->on_vkDestroyInstance(&mPool, mInstance, nullptr);
+        }
+        mState.reset();
+        teardownGlobalVkEmulation();
+        feature_set_enabled_override(kFeature_ExternalBlob, false);
+    }
+
+    VkDevice device() const { return unbox_VkDevice(mDevice); }
+
+    uint32_t hostVisibleMemoryTypeIndex(uint32_t memoryTypeBits) const {
+        for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++) {
+            if ((memoryTypeBits & (1u << i)) && (mMemoryProperties.memoryTypes[i].propertyFlags &
+                                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+                return i;
+            }
+        }
+        ADD_FAILURE() << "No host visible memory type in " << memoryTypeBits;
+        return 0;
+    }
+
+    // Returns the unboxed memory, as the decoder passes it on. The test reads
+    // and writes all memory through host mappings, so it is always host
+    // visible. With external blobs, the host leaves host visible memory
+    // unmapped for the guest to map through virtio-gpu, so that snapshots
+    // can't save it from the mapping.
+    VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryTypeBits, bool hostMapped,
+                                  VkImage dedicatedImage = VK_NULL_HANDLE) {
+        feature_set_enabled_override(kFeature_ExternalBlob, !hostMapped);
+        const VkMemoryDedicatedAllocateInfo dedicatedAi = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+            .image = dedicatedImage,
+        };
+        const VkMemoryAllocateInfo allocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = dedicatedImage ? &dedicatedAi : nullptr,
+            .allocationSize = size,
+            .memoryTypeIndex = hostVisibleMemoryTypeIndex(memoryTypeBits),
+        };
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        EXPECT_EQ(VK_SUCCESS,
+                  mState->on_vkAllocateMemory(&mPool, mDevice, &allocateInfo, nullptr, &memory));
+        feature_set_enabled_override(kFeature_ExternalBlob, false);
+        return unbox_VkDeviceMemory(memory);
+    }
+
+    // Copies |size| bytes from or to |memory| through the host mapping of the
+    // decoder, or else a mapping of its own.
+    void accessMemory(VkDeviceMemory memory, VkDeviceSize size,
+                      const std::function<void(uint8_t*)>& access) {
+        void* ptr = nullptr;
+        if (mState->on_vkMapMemory(&mPool, mDevice, memory, 0, size, 0, &ptr) == VK_SUCCESS) {
+            access(static_cast<uint8_t*>(ptr));
+            return;
+        }
+        ASSERT_EQ(VK_SUCCESS, mVk->vkMapMemory(device(), memory, 0, size, 0, &ptr));
+        access(static_cast<uint8_t*>(ptr));
+        mVk->vkUnmapMemory(device(), memory);
+    }
+
+    void writeMemory(VkDeviceMemory memory, const std::vector<uint8_t>& contents) {
+        accessMemory(memory, contents.size(),
+                     [&](uint8_t* ptr) { memcpy(ptr, contents.data(), contents.size()); });
+    }
+
+    std::vector<uint8_t> readMemory(VkDeviceMemory memory, VkDeviceSize size) {
+        std::vector<uint8_t> contents(size);
+        accessMemory(memory, size, [&](uint8_t* ptr) { memcpy(contents.data(), ptr, size); });
+        return contents;
+    }
+
+    // Records through the decoder, which tracks the image layouts that
+    // snapshots go by, and waits for the work to finish.
+    void submit(const std::function<void(VkCommandBuffer)>& record) {
+        const VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkBeginCommandBuffer(&mPool, mCommandBuffer, &beginInfo,
+                                                              mGfxLogger));
+        record(mCommandBuffer);
+        ASSERT_EQ(VK_SUCCESS,
+                  mState->on_vkEndCommandBuffer(&mPool, mCommandBuffer, mGfxLogger));
+        const VkCommandBuffer commandBuffer = unbox_VkCommandBuffer(mCommandBuffer);
+        const VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &commandBuffer,
+        };
+        ASSERT_EQ(VK_SUCCESS,
+                  mState->on_vkQueueSubmit(&mPool, mQueue, 1, &submitInfo, VK_NULL_HANDLE));
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkQueueWaitIdle(&mPool, mQueue));
+    }
+
+    // An RGBA8 color attachment with its own memory, which render passes
+    // clear and leave in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+    struct RenderTarget {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    };
+
+    void createRenderTarget(RenderTarget* target) {
+        const VkImageCreateInfo imageCi = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent = {kImageExtent.width, kImageExtent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        VkImage image;
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateImage(&mPool, mDevice, &imageCi, nullptr, &image));
+        target->image = unbox_VkImage(image);
+        VkMemoryRequirements memReqs;
+        mVk->vkGetImageMemoryRequirements(device(), target->image, &memReqs);
+        target->memory = allocateMemory(memReqs.size, memReqs.memoryTypeBits,
+                                        /*hostMapped=*/false, target->image);
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkBindImageMemory(&mPool, mDevice, target->image,
+                                                           target->memory, 0));
+
+        const VkImageViewCreateInfo viewCi = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = target->image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = imageCi.format,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        };
+        VkImageView view;
+        ASSERT_EQ(VK_SUCCESS,
+                  mState->on_vkCreateImageView(&mPool, mDevice, &viewCi, nullptr, &view));
+        const VkImageView unboxedView = unbox_VkImageView(view);
+
+        const VkAttachmentDescription attachment = {
+            .format = imageCi.format,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        };
+        const VkAttachmentReference colorAttachment = {
+            .attachment = 0,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+        const VkSubpassDescription subpass = {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &colorAttachment,
+        };
+        const VkRenderPassCreateInfo renderPassCi = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments = &attachment,
+            .subpassCount = 1,
+            .pSubpasses = &subpass,
+        };
+        VkRenderPass renderPass;
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateRenderPass(&mPool, mDevice, &renderPassCi,
+                                                            nullptr, &renderPass));
+        target->renderPass = unbox_VkRenderPass(renderPass);
+
+        const VkFramebufferCreateInfo framebufferCi = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = target->renderPass,
+            .attachmentCount = 1,
+            .pAttachments = &unboxedView,
+            .width = kImageExtent.width,
+            .height = kImageExtent.height,
+            .layers = 1,
+        };
+        VkFramebuffer framebuffer;
+        ASSERT_EQ(VK_SUCCESS, mState->on_vkCreateFramebuffer(&mPool, mDevice, &framebufferCi,
+                                                             nullptr, &framebuffer));
+        target->framebuffer = unbox_VkFramebuffer(framebuffer);
+    }
+
+    void clearRenderTarget(const RenderTarget& target, const VkClearColorValue& color) {
+        submit([&](VkCommandBuffer commandBuffer) {
+            const VkClearValue clearValue = {.color = color};
+            const VkRenderPassBeginInfo beginInfo = {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                .renderPass = target.renderPass,
+                .framebuffer = target.framebuffer,
+                .renderArea = {{0, 0}, kImageExtent},
+                .clearValueCount = 1,
+                .pClearValues = &clearValue,
+            };
+            mState->on_vkCmdBeginRenderPass(&mPool, commandBuffer, &beginInfo,
+                                            VK_SUBPASS_CONTENTS_INLINE);
+            mVk->vkCmdEndRenderPass(unbox_VkCommandBuffer(commandBuffer));
+        });
+    }
+
+    // Copies the render target out through a buffer the decoder doesn't know
+    // of, and returns its texels.
+    std::vector<uint32_t> readRenderTarget(const RenderTarget& target) {
+        const VkDeviceSize size = kImageExtent.width * kImageExtent.height * sizeof(uint32_t);
+        const VkBufferCreateInfo bufferCi = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        VkBuffer buffer;
+        EXPECT_EQ(VK_SUCCESS, mVk->vkCreateBuffer(device(), &bufferCi, nullptr, &buffer));
+        VkMemoryRequirements memReqs;
+        mVk->vkGetBufferMemoryRequirements(device(), buffer, &memReqs);
+        const VkMemoryAllocateInfo allocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = memReqs.size,
+            .memoryTypeIndex = hostVisibleMemoryTypeIndex(memReqs.memoryTypeBits),
+        };
+        VkDeviceMemory memory;
+        EXPECT_EQ(VK_SUCCESS, mVk->vkAllocateMemory(device(), &allocateInfo, nullptr, &memory));
+        EXPECT_EQ(VK_SUCCESS, mVk->vkBindBufferMemory(device(), buffer, memory, 0));
+
+        submit([&](VkCommandBuffer commandBuffer) {
+            VkImageMemoryBarrier barrier = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = target.image,
+                .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+            };
+            mState->on_vkCmdPipelineBarrier(&mPool, commandBuffer,
+                                            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                                            nullptr, 1, &barrier);
+            const VkBufferImageCopy region = {
+                .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .imageExtent = {kImageExtent.width, kImageExtent.height, 1},
+            };
+            mVk->vkCmdCopyImageToBuffer(unbox_VkCommandBuffer(commandBuffer), target.image,
+                                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                                        &region);
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            mState->on_vkCmdPipelineBarrier(&mPool, commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                                            nullptr, 1, &barrier);
+            const VkMemoryBarrier hostBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            };
+            mVk->vkCmdPipelineBarrier(unbox_VkCommandBuffer(commandBuffer),
+                                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                      0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        });
+
+        std::vector<uint32_t> texels(kImageExtent.width * kImageExtent.height);
+        void* ptr = nullptr;
+        EXPECT_EQ(VK_SUCCESS, mVk->vkMapMemory(device(), memory, 0, size, 0, &ptr));
+        if (ptr) {
+            const VkMappedMemoryRange range = {
+                .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                .memory = memory,
+                .size = VK_WHOLE_SIZE,
+            };
+            mVk->vkInvalidateMappedMemoryRanges(device(), 1, &range);
+            memcpy(texels.data(), ptr, size);
+            mVk->vkUnmapMemory(device(), memory);
+        }
+        mVk->vkFreeMemory(device(), memory, nullptr);
+        mVk->vkDestroyBuffer(device(), buffer, nullptr);
+        return texels;
+    }
+
+    static std::vector<uint8_t> randomBytes(size_t size, uint32_t seed) {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    std::unique_ptr<VkDecoderGlobalState> mState;
+    android::base::BumpPool mPool;
+    emugl::GfxApiLogger mGfxLogger;
+    VkInstance mInstance = VK_NULL_HANDLE;
+    VkPhysicalDevice mPhysicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties mMemoryProperties = {};
+    VkDevice mDevice = VK_NULL_HANDLE;
+    VkQueue mQueue = VK_NULL_HANDLE;
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+    VulkanDispatch* mVk = nullptr;
+};
+
+TEST_F(VkDecoderGlobalStateSnapshotTest, memoryContentsRoundTrip) {
+    // Saved from the host mapping.
+    const VkDeviceMemory mapped = allocateMemory(kMemorySize, ~0u, /*hostMapped=*/true);
+    // Nothing is dedicated to it, saved through a buffer aliasing it.
+    const VkDeviceMemory aliased = allocateMemory(kMemorySize, ~0u, /*hostMapped=*/false);
+    // Saved through the image, in the layout the render pass left it in.
+    RenderTarget target;
+    ASSERT_NO_FATAL_FAILURE(createRenderTarget(&target));
+
+    const auto mappedContents = randomBytes(kMemorySize, 1);
+    const auto aliasedContents = randomBytes(kMemorySize, 2);
+    writeMemory(mapped, mappedContents);
+    writeMemory(aliased, aliasedContents);
+    const VkClearColorValue savedColor = {.float32 = {1.0f, 0.0f, 1.0f, 1.0f}};
+    clearRenderTarget(target, savedColor);
+
+    android::base::MemStream stream;
+    mState->saveMemoryContents(&stream);
+
+    writeMemory(mapped, std::vector<uint8_t>(kMemorySize, 0));
+    writeMemory(aliased, std::vector<uint8_t>(kMemorySize, 0));
+    clearRenderTarget(target, {.float32 = {0.0f, 1.0f, 0.0f, 0.0f}});
+
+    mState->loadMemoryContents(&stream);
+
+    EXPECT_EQ(mappedContents, readMemory(mapped, kMemorySize));
+    EXPECT_EQ(aliasedContents, readMemory(aliased, kMemorySize));
+    const auto texels = readRenderTarget(target);
+    const std::vector<uint32_t> expectedTexels(texels.size(), 0xffff00ffu);
+    EXPECT_EQ(expectedTexels, texels);
+}
+
+TEST_F(VkDecoderGlobalStateSnapshotTest, memoryContentsOfOtherVersionAreSkipped) {
+    const VkDeviceMemory mapped = allocateMemory(kMemorySize, ~0u, /*hostMapped=*/true);
+    const auto contents = randomBytes(kMemorySize, 3);
+    writeMemory(mapped, contents);
+
+    android::base::MemStream saved;
+    mState->saveMemoryContents(&saved);
+    saved.putBe32(0x12345678);
+
+    // The version is the first big endian word.
+    auto data = saved.buffer();
+    data[3]++;
+    android::base::MemStream stream(std::move(data));
+
+    const std::vector<uint8_t> cleared(kMemorySize, 0);
+    writeMemory(mapped, cleared);
+    mState->loadMemoryContents(&stream);
+
+    EXPECT_EQ(cleared, readMemory(mapped, kMemorySize));
+    // What follows the contents is still read correctly.
+    EXPECT_EQ(0x12345678u, stream.getBe32());
+}
+#endif
+
 }  // namespace
 }  // namespace goldfish_vk
@@ -14,6 +14,8 @@
 
 #include "VkFormatUtils.h"
 
+#include <algorithm>
+#include <cinttypes>
 #include <unordered_map>
 
 namespace {
@@ -191,3 +193,120 @@ bool getFormatTransferInfo(VkFormat format, uint32_t width, uint32_t height,
 
     return true;
 }
+
+bool getFormatTransferInfo(VkFormat format, uint32_t x, uint32_t y, uint32_t width,
+                           uint32_t height, VkDeviceSize* outStagingBufferCopySize,
+                           std::vector<VkBufferImageCopy>* outBufferImageCopies) {
+    const FormatPlaneLayouts* formatInfo = getFormatPlaneLayouts(format);
+    if (formatInfo == nullptr) {
+        ERR("Unhandled format: %s", string_VkFormat(format));
+        return false;
+    }
+    if (formatInfo->planeLayouts.size() != 1) {
+        ERR("Unhandled subregion transfer for multi-planar format: %s", string_VkFormat(format));
+        return false;
+    }
+
+    const FormatPlaneLayout& planeInfo = formatInfo->planeLayouts[0];
+    if (outBufferImageCopies) {
+        outBufferImageCopies->emplace_back(VkBufferImageCopy{
+            .bufferOffset = 0,
+            .bufferRowLength = width,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+                {
+                    .aspectMask = planeInfo.aspectMask,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            .imageOffset =
+                {
+                    .x = static_cast<int32_t>(x),
+                    .y = static_cast<int32_t>(y),
+                    .z = 0,
+                },
+            .imageExtent =
+                {
+                    .width = width,
+                    .height = height,
+                    .depth = 1,
+                },
+        });
+    }
+    if (outStagingBufferCopySize) {
+        *outStagingBufferCopySize =
+            static_cast<VkDeviceSize>(width) * height * planeInfo.sampleIncrementBytes;
+    }
+
+    return true;
+}
+
+bool getFormatTransferInfoWithPlaneLayout(VkFormat format, uint32_t width, uint32_t height,
+                                          const std::vector<VkDeviceSize>& planeOffsets,
+                                          const std::vector<uint32_t>& planeRowLengths,
+                                          VkDeviceSize* outStagingBufferCopySize,
+                                          std::vector<VkBufferImageCopy>* outBufferImageCopies) {
+    const FormatPlaneLayouts* formatInfo = getFormatPlaneLayouts(format);
+    if (formatInfo == nullptr) {
+        ERR("Unhandled format: %s", string_VkFormat(format));
+        return false;
+    }
+    const size_t planeCount = formatInfo->planeLayouts.size();
+    if (planeOffsets.size() != planeCount || planeRowLengths.size() != planeCount) {
+        ERR("Format %s has %zu planes, got %zu offsets and %zu row lengths.",
+            string_VkFormat(format), planeCount, planeOffsets.size(), planeRowLengths.size());
+        return false;
+    }
+
+    VkDeviceSize stagingBufferCopySize = 0;
+    for (size_t i = 0; i < planeCount; ++i) {
+        const FormatPlaneLayout& planeInfo = formatInfo->planeLayouts[i];
+        // Subsampled planes of odd sized images cover the last column and row.
+        const uint32_t planeWidth =
+            (width + planeInfo.horizontalSubsampling - 1) / planeInfo.horizontalSubsampling;
+        const uint32_t planeHeight =
+            (height + planeInfo.verticalSubsampling - 1) / planeInfo.verticalSubsampling;
+        const uint32_t planeBpp = planeInfo.sampleIncrementBytes;
+        if (planeRowLengths[i] < planeWidth || planeOffsets[i] % planeBpp != 0) {
+            ERR("Invalid layout for plane %zu of %s: offset %" PRIu64 ", row length %u.", i,
+                string_VkFormat(format), static_cast<uint64_t>(planeOffsets[i]),
+                planeRowLengths[i]);
+            return false;
+        }
+        if (outBufferImageCopies) {
+            outBufferImageCopies->emplace_back(VkBufferImageCopy{
+                .bufferOffset = planeOffsets[i],
+                .bufferRowLength = planeRowLengths[i],
+                .bufferImageHeight = 0,
+                .imageSubresource =
+                    {
+                        .aspectMask = planeInfo.aspectMask,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                .imageOffset =
+                    {
+                        .x = 0,
+                        .y = 0,
+                        .z = 0,
+                    },
+                .imageExtent =
+                    {
+                        .width = planeWidth,
+                        .height = planeHeight,
+                        .depth = 1,
+                    },
+            });
+        }
+        const VkDeviceSize planeSize =
+            static_cast<VkDeviceSize>(planeRowLengths[i]) * planeBpp * planeHeight;
+        stagingBufferCopySize = std::max(stagingBufferCopySize, planeOffsets[i] + planeSize);
+    }
+    if (outStagingBufferCopySize) {
+        *outStagingBufferCopySize = stagingBufferCopySize;
+    }
+
+    return true;
+}
@@ -655,3 +655,20 @@ constexpr bool formatRequiresSamplerYcbcrConversion(VkFormat format) {
 bool getFormatTransferInfo(VkFormat format, uint32_t width, uint32_t height,
                            VkDeviceSize* outStagingBufferCopySize,
                            std::vector<VkBufferImageCopy>* outBufferImageCopies);
+
+// Same as above, but for the |width| x |height| region at (|x|, |y|) of a
+// single plane image. The region is tightly packed in the staging buffer.
+bool getFormatTransferInfo(VkFormat format, uint32_t x, uint32_t y, uint32_t width,
+                           uint32_t height, VkDeviceSize* outStagingBufferCopySize,
+                           std::vector<VkBufferImageCopy>* outBufferImageCopies);
+
+// Same as the first getFormatTransferInfo(), but with plane i at
+// |planeOffsets[i]| bytes in the staging buffer and rows of |planeRowLengths[i]|
+// texels. This lets the copies take planes that are padded or ordered
+// differently than in the image, as in the guest YUV layouts, without
+// repacking them on the CPU.
+bool getFormatTransferInfoWithPlaneLayout(VkFormat format, uint32_t width, uint32_t height,
+                                          const std::vector<VkDeviceSize>& planeOffsets,
+                                          const std::vector<uint32_t>& planeRowLengths,
+                                          VkDeviceSize* outStagingBufferCopySize,
+                                          std::vector<VkBufferImageCopy>* outBufferImageCopies);
@@ -110,6 +110,45 @@ TEST(VkFormatUtilsTest, GetTransferInfoRGBA) {
                                    })));
 }
 
+TEST(VkFormatUtilsTest, GetSubregionTransferInfoRGBA) {
+    const VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+
+    VkDeviceSize bufferCopySize;
+    std::vector<VkBufferImageCopy> bufferImageCopies;
+    ASSERT_THAT(getFormatTransferInfo(format, 4, 2, 8, 3, &bufferCopySize, &bufferImageCopies),
+                IsTrue());
+    EXPECT_THAT(bufferCopySize, Eq(96));
+    ASSERT_THAT(bufferImageCopies, ElementsAre(EqsVkBufferImageCopy(VkBufferImageCopy{
+                                       .bufferOffset = 0,
+                                       .bufferRowLength = 8,
+                                       .bufferImageHeight = 0,
+                                       .imageSubresource =
+                                           {
+                                               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                               .mipLevel = 0,
+                                               .baseArrayLayer = 0,
+                                               .layerCount = 1,
+                                           },
+                                       .imageOffset =
+                                           {
+                                               .x = 4,
+                                               .y = 2,
+                                               .z = 0,
+                                           },
+                                       .imageExtent =
+                                           {
+                                               .width = 8,
+                                               .height = 3,
+                                               .depth = 1,
+                                           },
+                                   })));
+}
+
+TEST(VkFormatUtilsTest, GetSubregionTransferInfoMultiPlanar) {
+    const VkFormat format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+    ASSERT_THAT(getFormatTransferInfo(format, 2, 2, 4, 4, nullptr, nullptr), IsFalse());
+}
+
 TEST(VkFormatUtilsTest, GetTransferInfoNV12OrNV21) {
     const VkFormat format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
     const uint32_t width = 16;
@@ -256,4 +295,127 @@ TEST(VkFormatUtilsTest, GetTransferInfoYV12OrYV21) {
                             })));
 }
 
+TEST(VkFormatUtilsTest, GetTransferInfoWithPlaneLayoutYV12) {
+    const VkFormat format = VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM;
+    const uint32_t width = 20;
+    const uint32_t height = 8;
+
+    // YV12: luma rows padded to 32 bytes, then the Cr plane, then the Cb plane.
+    VkDeviceSize bufferCopySize;
+    std::vector<VkBufferImageCopy> bufferImageCopies;
+    ASSERT_THAT(getFormatTransferInfoWithPlaneLayout(format, width, height, {0, 320, 256},
+                                                     {32, 16, 16}, &bufferCopySize,
+                                                     &bufferImageCopies),
+                IsTrue());
+    EXPECT_THAT(bufferCopySize, Eq(384));
+    ASSERT_THAT(bufferImageCopies,
+                ElementsAre(EqsVkBufferImageCopy(VkBufferImageCopy{
+                                .bufferOffset = 0,
+                                .bufferRowLength = 32,
+                                .bufferImageHeight = 0,
+                                .imageSubresource =
+                                    {
+                                        .aspectMask = VK_IMAGE_ASPECT_PLANE_0_BIT,
+                                        .mipLevel = 0,
+                                        .baseArrayLayer = 0,
+                                        .layerCount = 1,
+                                    },
+                                .imageOffset =
+                                    {
+                                        .x = 0,
+                                        .y = 0,
+                                        .z = 0,
+                                    },
+                                .imageExtent =
+                                    {
+                                        .width = 20,
+                                        .height = 8,
+                                        .depth = 1,
+                                    },
+                            }),
+                            EqsVkBufferImageCopy(VkBufferImageCopy{
+                                .bufferOffset = 320,
+                                .bufferRowLength = 16,
+                                .bufferImageHeight = 0,
+                                .imageSubresource =
+                                    {
+                                        .aspectMask = VK_IMAGE_ASPECT_PLANE_1_BIT,
+                                        .mipLevel = 0,
+                                        .baseArrayLayer = 0,
+                                        .layerCount = 1,
+                                    },
+                                .imageOffset =
+                                    {
+                                        .x = 0,
+                                        .y = 0,
+                                        .z = 0,
+                                    },
+                                .imageExtent =
+                                    {
+                                        .width = 10,
+                                        .height = 4,
+                                        .depth = 1,
+                                    },
+                            }),
+                            EqsVkBufferImageCopy(VkBufferImageCopy{
+                                .bufferOffset = 256,
+                                .bufferRowLength = 16,
+                                .bufferImageHeight = 0,
+                                .imageSubresource =
+                                    {
+                                        .aspectMask = VK_IMAGE_ASPECT_PLANE_2_BIT,
+                                        .mipLevel = 0,
+                                        .baseArrayLayer = 0,
+                                        .layerCount = 1,
+                                    },
+                                .imageOffset =
+                                    {
+                                        .x = 0,
+                                        .y = 0,
+                                        .z = 0,
+                                    },
+                                .imageExtent =
+                                    {
+                                        .width = 10,
+                                        .height = 4,
+                                        .depth = 1,
+                                    },
+                            })));
+}
+
+TEST(VkFormatUtilsTest, GetTransferInfoWithPlaneLayoutOddSize) {
+    const VkFormat format = VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM;
+
+    // The chroma planes of a 21x9 image are 11x5.
+    VkDeviceSize bufferCopySize;
+    std::vector<VkBufferImageCopy> bufferImageCopies;
+    ASSERT_THAT(getFormatTransferInfoWithPlaneLayout(format, 21, 9, {0, 368, 288}, {32, 16, 16},
+                                                     &bufferCopySize, &bufferImageCopies),
+                IsTrue());
+    EXPECT_THAT(bufferCopySize, Eq(448));
+    ASSERT_THAT(bufferImageCopies.size(), Eq(3u));
+    EXPECT_THAT(bufferImageCopies[0].imageExtent.width, Eq(21u));
+    EXPECT_THAT(bufferImageCopies[0].imageExtent.height, Eq(9u));
+    for (size_t i = 1; i < 3; ++i) {
+        EXPECT_THAT(bufferImageCopies[i].imageExtent.width, Eq(11u));
+        EXPECT_THAT(bufferImageCopies[i].imageExtent.height, Eq(5u));
+    }
+}
+
+TEST(VkFormatUtilsTest, GetTransferInfoWithPlaneLayoutInvalid) {
+    const VkFormat format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+
+    // Missing plane.
+    EXPECT_THAT(getFormatTransferInfoWithPlaneLayout(format, 16, 16, {0}, {16}, nullptr, nullptr),
+                IsFalse());
+    // Rows shorter than the plane.
+    EXPECT_THAT(
+        getFormatTransferInfoWithPlaneLayout(format, 16, 16, {0, 256}, {16, 4}, nullptr, nullptr),
+        IsFalse());
+    // Interleaved chroma not aligned to its 2 byte texels.
+    EXPECT_THAT(
+        getFormatTransferInfoWithPlaneLayout(format, 16, 16, {0, 257}, {16, 8}, nullptr, nullptr),
+        IsFalse());
+}
+
 }  // namespace
\ No newline at end of file
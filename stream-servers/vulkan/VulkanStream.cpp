@@ -19,6 +19,7 @@
 
 #include "IOStream.h"
 #include "aemu/base/BumpPool.h"
+#include "aemu/base/system/System.h"
 #include "host-common/GfxstreamFatalError.h"
 #include "host-common/feature_control.h"
 
@@ -29,7 +30,10 @@ using emugl::FatalError;
 
 namespace goldfish_vk {
 
-VulkanStream::VulkanStream(IOStream* stream) : mStream(stream) {
+VulkanStream::VulkanStream(IOStream* stream)
+    : mDeferCommits(android::base::getEnvironmentVariable("ANDROID_EMU_VK_IMMEDIATE_REPLIES") !=
+                    "1"),
+      mStream(stream) {
     unsetHandleMapping();
 
     if (feature_is_enabled(kFeature_VulkanNullOptionalStrings)) {
@@ -131,7 +135,7 @@ void VulkanStream::loadStringArrayInPlaceWithStreamPtr(char*** forOutput, uint8_
 
 ssize_t VulkanStream::read(void* buffer, size_t size) {
     commitWrite();
-    if (!mStream->readFully(buffer, size)) {
+    if (!mStream->readback(buffer, size)) {
         GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
             << "Could not read back " << size << " bytes";
     }
@@ -157,6 +161,19 @@ void VulkanStream::commitWrite() {
             << "Tried to commit write to vulkan pipe with invalid pipe!";
     }
 
+    if (mDeferCommits) {
+        if (mWritePos) {
+            unsigned char* dst = mStream->alloc(mWritePos);
+            if (!dst) {
+                GFXSTREAM_ABORT(FatalError(ABORT_REASON_OTHER))
+                    << "Could not allocate " << mWritePos << " bytes to commit!";
+            }
+            memcpy(dst, mWriteBuffer.data(), mWritePos);
+            mWritePos = 0;
+        }
+        return;
+    }
+
     int written = mStream->writeFully(mWriteBuffer.data(), mWritePos);
 
     if (written) {
@@ -166,6 +183,8 @@ void VulkanStream::commitWrite() {
     mWritePos = 0;
 }
 
+void VulkanStream::setDeferCommits(bool defer) { mDeferCommits = defer; }
+
 void VulkanStream::clearPool() { mPool.freeAll(); }
 
 void VulkanStream::setHandleMapping(VulkanHandleMapping* mapping) {
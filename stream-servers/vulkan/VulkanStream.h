@@ -63,6 +63,13 @@ class VulkanStream : public android::base::Stream {
 
     void commitWrite();
 
+    // While commits are deferred, commitWrite() only appends the data to the
+    // IOStream's own buffer, and the owner of the IOStream flush()es it once
+    // per batch of commands. IOStream::alloc() and read() still flush it when
+    // needed. On by default, ANDROID_EMU_VK_IMMEDIATE_REPLIES=1 writes each
+    // commit out on its own.
+    void setDeferCommits(bool defer);
+
     // Frees everything that got alloc'ed.
     void clearPool();
 
@@ -78,6 +85,7 @@ class VulkanStream : public android::base::Stream {
     size_t remainingWriteBufferSize() const;
     ssize_t bufferedWrite(const void* buffer, size_t size);
     android::base::BumpPool mPool;
+    bool mDeferCommits;
     size_t mWritePos = 0;
     std::vector<uint8_t> mWriteBuffer;
     IOStream* mStream = nullptr;
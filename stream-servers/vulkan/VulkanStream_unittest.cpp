@@ -16,11 +16,11 @@
 #include "VulkanStream.h"
 
 #include <string.h>
-#include <vulkan.h>
+#include <vulkan/vulkan.h>
 
 #include "IOStream.h"
-#include "android/base/ArraySize.h"
-#include "android/base/BumpPool.h"
+#include "aemu/base/ArraySize.h"
+#include "aemu/base/BumpPool.h"
 #include "common/goldfish_vk_deepcopy.h"
 #include "common/goldfish_vk_extension_structs.h"
 #include "common/goldfish_vk_marshaling.h"
@@ -36,21 +36,25 @@ class TestStream : public IOStream {
     static constexpr size_t kBufSize = 1024;
     TestStream() : IOStream(kBufSize) {}
 
+    size_t numWrites() const { return mNumWrites; }
+
    protected:
     void* getDmaForReading(uint64_t guest_paddr) override { return nullptr; }
     void unlockDma(uint64_t guest_paddr) override {}
 
-    // VulkanStream should never use these functions.
     void* allocBuffer(size_t minSize) override {
-        fprintf(stderr, "%s: FATAL: not intended for use!\n", __func__);
-        abort();
+        if (mAllocBuffer.size() < minSize) {
+            mAllocBuffer.resize(minSize);
+        }
+        return mAllocBuffer.data();
     }
 
     int commitBuffer(size_t size) override {
-        fprintf(stderr, "%s: FATAL: not intended for use!\n", __func__);
-        abort();
+        append(mAllocBuffer.data(), size);
+        return 0;
     }
 
+    // VulkanStream should never use these functions.
     const unsigned char* readRaw(void* buf, size_t* inout_len) override {
         fprintf(stderr, "%s: FATAL: not intended for use!\n", __func__);
         abort();
@@ -66,19 +70,10 @@ class TestStream : public IOStream {
         abort();
     }
 
+    // Like the real streams, anything alloc()ed before goes out first.
     int writeFully(const void* buffer, size_t size) override {
-        if (mBuffer.size() < mWriteCursor + size) {
-            mBuffer.resize(mWriteCursor + size);
-        }
-
-        memcpy(mBuffer.data() + mWriteCursor, buffer, size);
-
-        mWriteCursor += size;
-
-        if (mReadCursor == mWriteCursor) {
-            clear();
-        }
-        return 0;
+        memcpy(alloc(size), buffer, size);
+        return flush();
     }
 
     const unsigned char* readFully(void* buf, size_t len) override {
@@ -94,6 +89,21 @@ class TestStream : public IOStream {
     }
 
    private:
+    void append(const void* buffer, size_t size) {
+        ++mNumWrites;
+        if (mBuffer.size() < mWriteCursor + size) {
+            mBuffer.resize(mWriteCursor + size);
+        }
+
+        memcpy(mBuffer.data() + mWriteCursor, buffer, size);
+
+        mWriteCursor += size;
+
+        if (mReadCursor == mWriteCursor) {
+            clear();
+        }
+    }
+
     void clear() {
         mBuffer.clear();
         mReadCursor = 0;
@@ -102,7 +112,9 @@ class TestStream : public IOStream {
 
     size_t mReadCursor = 0;
     size_t mWriteCursor = 0;
+    size_t mNumWrites = 0;
     std::vector<char> mBuffer;
+    std::vector<char> mAllocBuffer;
 };
 
 // Just see whether the test class is OK
@@ -119,6 +131,53 @@ TEST(VulkanStream, Basic) {
     EXPECT_EQ(testString, stream.getString());
 }
 
+// Deferred commits reach the IOStream in a single write when it is flushed,
+// or before anything is read back.
+TEST(VulkanStream, DeferredCommits) {
+    TestStream testStream;
+    VulkanStream stream(&testStream);
+    stream.setDeferCommits(true);
+
+    stream.putBe32(1);
+    stream.commitWrite();
+    stream.putBe32(2);
+    stream.commitWrite();
+    EXPECT_EQ(0u, testStream.numWrites());
+
+    testStream.flush();
+    EXPECT_EQ(1u, testStream.numWrites());
+    testStream.flush();
+    EXPECT_EQ(1u, testStream.numWrites());
+
+    stream.putBe32(3);
+    stream.commitWrite();
+    EXPECT_EQ(1u, stream.getBe32());
+    EXPECT_EQ(2u, testStream.numWrites());
+    EXPECT_EQ(2u, stream.getBe32());
+    EXPECT_EQ(3u, stream.getBe32());
+
+    // Commits that don't fit in the IOStream's buffer push out the pending ones.
+    std::vector<uint8_t> large(TestStream::kBufSize);
+    stream.putBe32(4);
+    stream.commitWrite();
+    stream.write(large.data(), large.size());
+    stream.commitWrite();
+    EXPECT_EQ(3u, testStream.numWrites());
+    EXPECT_EQ(4u, stream.getBe32());
+
+    // Immediate commits keep their order with the deferred ones.
+    std::vector<uint8_t> readLarge(large.size());
+    stream.read(readLarge.data(), readLarge.size());
+    stream.putBe32(5);
+    stream.commitWrite();
+    stream.setDeferCommits(false);
+    stream.putBe32(6);
+    stream.commitWrite();
+    EXPECT_EQ(5u, testStream.numWrites());
+    EXPECT_EQ(5u, stream.getBe32());
+    EXPECT_EQ(6u, stream.getBe32());
+}
+
 // Try a "basic" Vulkan struct (VkInstanceCreateInfo)
 TEST(VulkanStream, testMarshalVulkanStruct) {
     TestStream testStream;
@@ -0,0 +1,770 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "YUVConverterVk.h"
+
+#include <string.h>
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <iterator>
+
+#include "host-common/logging.h"
+#include "vulkan/vk_enum_string_helper.h"
+#include "vulkan/vk_util.h"
+
+namespace YUVConverterVkShader {
+#include "vulkan/CompositorFragmentShader.h"
+#include "vulkan/CompositorVertexShader.h"
+}  // namespace YUVConverterVkShader
+
+namespace {
+
+// The formats setupVkColorBuffer() uses for YUV ColorBuffers.
+constexpr const VkFormat kYUVFormats[] = {
+    VK_FORMAT_G8_B8R8_2PLANE_420_UNORM,
+    VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16,
+    VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM,
+};
+
+// Descriptors a combined image sampler with a Y'CbCr conversion may take up
+// in a pool, at most one per plane.
+constexpr const uint32_t kMaxCombinedImageSamplerDescriptorCount = 3;
+
+constexpr const VkFormat kTargetFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+// Keep in sync with vulkan/Compositor.vert.
+struct Vertex {
+    alignas(8) glm::vec2 pos;
+    alignas(8) glm::vec2 tex;
+};
+
+struct UniformBufferBinding {
+    alignas(16) glm::mat4 positionTransform;
+    alignas(16) glm::mat4 texCoordTransform;
+};
+
+const Vertex kVertices[] = {
+    // clang-format off
+    { .pos = {-1.0f, -1.0f}, .tex = {0.0f, 0.0f}},
+    { .pos = { 1.0f, -1.0f}, .tex = {1.0f, 0.0f}},
+    { .pos = { 1.0f,  1.0f}, .tex = {1.0f, 1.0f}},
+    { .pos = {-1.0f,  1.0f}, .tex = {0.0f, 1.0f}},
+    // clang-format on
+};
+
+const uint16_t kIndices[] = {0, 1, 2, 2, 3, 0};
+
+VkShaderModule createShaderModule(const goldfish_vk::VulkanDispatch& vk, VkDevice device,
+                                  const uint32_t* code, size_t codeSize) {
+    const VkShaderModuleCreateInfo shaderModuleCi = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = codeSize,
+        .pCode = code,
+    };
+    VkShaderModule res = VK_NULL_HANDLE;
+    VK_CHECK(vk.vkCreateShaderModule(device, &shaderModuleCi, nullptr, &res));
+    return res;
+}
+
+}  // namespace
+
+YUVConverterVk::Conversion::Conversion(const goldfish_vk::VulkanDispatch& vk, VkDevice device)
+    : m_vk(vk), m_vkDevice(device) {}
+
+YUVConverterVk::Conversion::~Conversion() {
+    m_vk.vkDestroyFramebuffer(m_vkDevice, m_framebuffer, nullptr);
+    m_vk.vkDestroyImageView(m_vkDevice, m_targetImageView, nullptr);
+    m_vk.vkDestroyImage(m_vkDevice, m_targetImage, nullptr);
+    m_vk.vkFreeMemory(m_vkDevice, m_targetMemory, nullptr);
+    m_vk.vkDestroyDescriptorPool(m_vkDevice, m_descriptorPool, nullptr);
+    m_vk.vkDestroyImageView(m_vkDevice, m_sourceImageView, nullptr);
+}
+
+std::unique_ptr<YUVConverterVk> YUVConverterVk::create(const goldfish_vk::VulkanDispatch& vk,
+                                                       VkDevice device,
+                                                       VkPhysicalDevice physicalDevice) {
+    if (!vk.vkCreateSamplerYcbcrConversion) {
+        ERR("YUVConverterVk: vkCreateSamplerYcbcrConversion is not available.");
+        return nullptr;
+    }
+    auto res =
+        std::unique_ptr<YUVConverterVk>(new YUVConverterVk(vk, device, physicalDevice));
+    if (!res->setUpRenderPass() || !res->setUpBuffers()) {
+        return nullptr;
+    }
+    for (VkFormat format : kYUVFormats) {
+        res->setUpFormat(format);
+    }
+    if (res->m_formats.empty()) {
+        return nullptr;
+    }
+    return res;
+}
+
+YUVConverterVk::YUVConverterVk(const goldfish_vk::VulkanDispatch& vk, VkDevice device,
+                               VkPhysicalDevice physicalDevice)
+    : m_vk(vk), m_vkDevice(device), m_vkPhysicalDevice(physicalDevice) {}
+
+YUVConverterVk::~YUVConverterVk() {
+    for (auto& [format, resources] : m_formats) {
+        destroyFormat(&resources);
+    }
+    m_vk.vkDestroyBuffer(m_vkDevice, m_uniformBuffer, nullptr);
+    m_vk.vkFreeMemory(m_vkDevice, m_uniformMemory, nullptr);
+    m_vk.vkDestroyBuffer(m_vkDevice, m_indexBuffer, nullptr);
+    m_vk.vkFreeMemory(m_vkDevice, m_indexMemory, nullptr);
+    m_vk.vkDestroyBuffer(m_vkDevice, m_vertexBuffer, nullptr);
+    m_vk.vkFreeMemory(m_vkDevice, m_vertexMemory, nullptr);
+    m_vk.vkDestroyRenderPass(m_vkDevice, m_renderPass, nullptr);
+}
+
+bool YUVConverterVk::canConvert(VkFormat format, VkImageTiling tiling) const {
+    auto it = m_formats.find(format);
+    if (it == m_formats.end()) {
+        return false;
+    }
+    const VkFormatFeatureFlags features = tiling == VK_IMAGE_TILING_LINEAR
+                                              ? it->second.formatProperties.linearTilingFeatures
+                                              : it->second.formatProperties.optimalTilingFeatures;
+    return (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
+           (features & (VK_FORMAT_FEATURE_MIDPOINT_CHROMA_SAMPLES_BIT |
+                        VK_FORMAT_FEATURE_COSITED_CHROMA_SAMPLES_BIT));
+}
+
+bool YUVConverterVk::setUpRenderPass() {
+    const VkAttachmentDescription colorAttachment = {
+        .format = kTargetFormat,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        // The quad covers the whole target.
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    };
+    const VkAttachmentReference colorAttachmentRef = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    const VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colorAttachmentRef,
+    };
+    const VkSubpassDependency subpassDependencies[] = {
+        VkSubpassDependency{
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        },
+        // The target is copied out right after the render pass.
+        VkSubpassDependency{
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        },
+    };
+    const VkRenderPassCreateInfo renderPassCi = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &colorAttachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = static_cast<uint32_t>(std::size(subpassDependencies)),
+        .pDependencies = subpassDependencies,
+    };
+    VkResult res = m_vk.vkCreateRenderPass(m_vkDevice, &renderPassCi, nullptr, &m_renderPass);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to create the render pass: %s.", string_VkResult(res));
+        return false;
+    }
+    return true;
+}
+
+bool YUVConverterVk::createHostVisibleBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                             const void* data, VkBuffer* outBuffer,
+                                             VkDeviceMemory* outMemory) {
+    const VkBufferCreateInfo bufferCi = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VK_CHECK(m_vk.vkCreateBuffer(m_vkDevice, &bufferCi, nullptr, outBuffer));
+
+    VkMemoryRequirements memRequirements;
+    m_vk.vkGetBufferMemoryRequirements(m_vkDevice, *outBuffer, &memRequirements);
+    auto memoryTypeIndex = vk_util::findMemoryType(
+        &m_vk, m_vkPhysicalDevice, memRequirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (!memoryTypeIndex) {
+        ERR("YUVConverterVk: no host visible memory type for a buffer.");
+        return false;
+    }
+    const VkMemoryAllocateInfo memAllocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = *memoryTypeIndex,
+    };
+    VK_CHECK(m_vk.vkAllocateMemory(m_vkDevice, &memAllocInfo, nullptr, outMemory));
+    VK_CHECK(m_vk.vkBindBufferMemory(m_vkDevice, *outBuffer, *outMemory, 0));
+
+    void* mapped = nullptr;
+    VK_CHECK(m_vk.vkMapMemory(m_vkDevice, *outMemory, 0, size, 0, &mapped));
+    memcpy(mapped, data, size);
+    m_vk.vkUnmapMemory(m_vkDevice, *outMemory);
+    return true;
+}
+
+bool YUVConverterVk::setUpBuffers() {
+    // The quad and the image have the same size, so that each pixel samples
+    // the texel it converts.
+    const UniformBufferBinding uniforms = {
+        .positionTransform = glm::mat4(1.0f),
+        .texCoordTransform = glm::mat4(1.0f),
+    };
+    return createHostVisibleBuffer(sizeof(kVertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                   kVertices, &m_vertexBuffer, &m_vertexMemory) &&
+           createHostVisibleBuffer(sizeof(kIndices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, kIndices,
+                                   &m_indexBuffer, &m_indexMemory) &&
+           createHostVisibleBuffer(sizeof(uniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                   &uniforms, &m_uniformBuffer, &m_uniformMemory);
+}
+
+bool YUVConverterVk::setUpFormat(VkFormat format) {
+    FormatResources resources;
+    m_vk.vkGetPhysicalDeviceFormatProperties(m_vkPhysicalDevice, format,
+                                             &resources.formatProperties);
+    const VkFormatFeatureFlags features = resources.formatProperties.optimalTilingFeatures |
+                                          resources.formatProperties.linearTilingFeatures;
+    if (!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        return false;
+    }
+    // YUVConverter samples every plane with GL_NEAREST, so that each 2x2
+    // block of pixels takes the chroma of the texel in its middle. Midpoint
+    // chroma samples with nearest filtering give the same result.
+    VkChromaLocation chromaLocation;
+    if (features & VK_FORMAT_FEATURE_MIDPOINT_CHROMA_SAMPLES_BIT) {
+        chromaLocation = VK_CHROMA_LOCATION_MIDPOINT;
+    } else if (features & VK_FORMAT_FEATURE_COSITED_CHROMA_SAMPLES_BIT) {
+        chromaLocation = VK_CHROMA_LOCATION_COSITED_EVEN;
+    } else {
+        return false;
+    }
+
+    const VkSamplerYcbcrConversionCreateInfo ycbcrConversionCi = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO,
+        .pNext = nullptr,
+        .format = format,
+        .ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601,
+        .ycbcrRange = VK_SAMPLER_YCBCR_RANGE_ITU_NARROW,
+        .components =
+            {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+            },
+        .xChromaOffset = chromaLocation,
+        .yChromaOffset = chromaLocation,
+        .chromaFilter = VK_FILTER_NEAREST,
+        .forceExplicitReconstruction = VK_FALSE,
+    };
+    VkResult res = m_vk.vkCreateSamplerYcbcrConversion(m_vkDevice, &ycbcrConversionCi, nullptr,
+                                                       &resources.ycbcrConversion);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to create the Y'CbCr conversion of %s: %s.",
+            string_VkFormat(format), string_VkResult(res));
+        return false;
+    }
+
+    const VkSamplerYcbcrConversionInfo ycbcrConversionInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .pNext = nullptr,
+        .conversion = resources.ycbcrConversion,
+    };
+    // Samplers with a Y'CbCr conversion must clamp to edge, and filter like
+    // the conversion does.
+    const VkSamplerCreateInfo samplerCi = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = &ycbcrConversionInfo,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = VK_FALSE,
+        .maxAnisotropy = 1.0f,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .minLod = 0.0f,
+        .maxLod = 0.0f,
+        .borderColor = VK_BORDER_COLOR_INT_TRANSPARENT_BLACK,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+    VK_CHECK(m_vk.vkCreateSampler(m_vkDevice, &samplerCi, nullptr, &resources.sampler));
+
+    // Keep in sync with vulkan/Compositor.frag and vulkan/Compositor.vert.
+    const VkDescriptorSetLayoutBinding layoutBindings[] = {
+        VkDescriptorSetLayoutBinding{
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .pImmutableSamplers = &resources.sampler,
+        },
+        VkDescriptorSetLayoutBinding{
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+            .pImmutableSamplers = nullptr,
+        },
+    };
+    const VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCi = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .bindingCount = static_cast<uint32_t>(std::size(layoutBindings)),
+        .pBindings = layoutBindings,
+    };
+    VK_CHECK(m_vk.vkCreateDescriptorSetLayout(m_vkDevice, &descriptorSetLayoutCi, nullptr,
+                                              &resources.descriptorSetLayout));
+
+    const VkPipelineLayoutCreateInfo pipelineLayoutCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &resources.descriptorSetLayout,
+        .pushConstantRangeCount = 0,
+    };
+    VK_CHECK(m_vk.vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutCi, nullptr,
+                                         &resources.pipelineLayout));
+
+    const VkShaderModule vertShaderMod =
+        createShaderModule(m_vk, m_vkDevice, YUVConverterVkShader::compositorVertexShader,
+                           sizeof(YUVConverterVkShader::compositorVertexShader));
+    const VkShaderModule fragShaderMod =
+        createShaderModule(m_vk, m_vkDevice, YUVConverterVkShader::compositorFragmentShader,
+                           sizeof(YUVConverterVkShader::compositorFragmentShader));
+    const VkPipelineShaderStageCreateInfo shaderStageCis[] = {
+        VkPipelineShaderStageCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = vertShaderMod,
+            .pName = "main",
+        },
+        VkPipelineShaderStageCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = fragShaderMod,
+            .pName = "main",
+        },
+    };
+
+    const VkVertexInputBindingDescription vertexBindingDescription = {
+        .binding = 0,
+        .stride = sizeof(Vertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+    const VkVertexInputAttributeDescription vertexAttributeDescriptions[] = {
+        VkVertexInputAttributeDescription{
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(Vertex, pos),
+        },
+        VkVertexInputAttributeDescription{
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(Vertex, tex),
+        },
+    };
+    const VkPipelineVertexInputStateCreateInfo vertexInputStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &vertexBindingDescription,
+        .vertexAttributeDescriptionCount =
+            static_cast<uint32_t>(std::size(vertexAttributeDescriptions)),
+        .pVertexAttributeDescriptions = vertexAttributeDescriptions,
+    };
+    const VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE,
+    };
+    const VkPipelineViewportStateCreateInfo viewportStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        // The viewport state is dynamic.
+        .pViewports = nullptr,
+        .scissorCount = 1,
+        // The scissor state is dynamic.
+        .pScissors = nullptr,
+    };
+    const VkPipelineRasterizationStateCreateInfo rasterizerStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+        .depthBiasConstantFactor = 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = 0.0f,
+        .lineWidth = 1.0f,
+    };
+    const VkPipelineMultisampleStateCreateInfo multisampleStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .sampleShadingEnable = VK_FALSE,
+        .minSampleShading = 1.0f,
+        .pSampleMask = nullptr,
+        .alphaToCoverageEnable = VK_FALSE,
+        .alphaToOneEnable = VK_FALSE,
+    };
+    const VkPipelineColorBlendAttachmentState colorBlendAttachment = {
+        .blendEnable = VK_FALSE,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+    const VkPipelineColorBlendStateCreateInfo colorBlendStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .attachmentCount = 1,
+        .pAttachments = &colorBlendAttachment,
+    };
+    const VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
+    };
+    const VkPipelineDynamicStateCreateInfo dynamicStateCi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = std::size(dynamicStates),
+        .pDynamicStates = dynamicStates,
+    };
+    const VkGraphicsPipelineCreateInfo graphicsPipelineCi = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = static_cast<uint32_t>(std::size(shaderStageCis)),
+        .pStages = shaderStageCis,
+        .pVertexInputState = &vertexInputStateCi,
+        .pInputAssemblyState = &inputAssemblyStateCi,
+        .pViewportState = &viewportStateCi,
+        .pRasterizationState = &rasterizerStateCi,
+        .pMultisampleState = &multisampleStateCi,
+        .pDepthStencilState = nullptr,
+        .pColorBlendState = &colorBlendStateCi,
+        .pDynamicState = &dynamicStateCi,
+        .layout = resources.pipelineLayout,
+        .renderPass = m_renderPass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+    res = m_vk.vkCreateGraphicsPipelines(m_vkDevice, VK_NULL_HANDLE, 1, &graphicsPipelineCi,
+                                         nullptr, &resources.pipeline);
+    m_vk.vkDestroyShaderModule(m_vkDevice, vertShaderMod, nullptr);
+    m_vk.vkDestroyShaderModule(m_vkDevice, fragShaderMod, nullptr);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to create the pipeline of %s: %s.", string_VkFormat(format),
+            string_VkResult(res));
+        destroyFormat(&resources);
+        return false;
+    }
+
+    m_formats.emplace(format, resources);
+    return true;
+}
+
+void YUVConverterVk::destroyFormat(FormatResources* resources) {
+    m_vk.vkDestroyPipeline(m_vkDevice, resources->pipeline, nullptr);
+    m_vk.vkDestroyPipelineLayout(m_vkDevice, resources->pipelineLayout, nullptr);
+    m_vk.vkDestroyDescriptorSetLayout(m_vkDevice, resources->descriptorSetLayout, nullptr);
+    m_vk.vkDestroySampler(m_vkDevice, resources->sampler, nullptr);
+    m_vk.vkDestroySamplerYcbcrConversion(m_vkDevice, resources->ycbcrConversion, nullptr);
+}
+
+std::unique_ptr<YUVConverterVk::Conversion> YUVConverterVk::recordConversion(
+    VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkExtent2D extent,
+    const VkRect2D& region, VkBuffer buffer, VkDeviceSize bufferOffset) {
+    auto formatIt = m_formats.find(format);
+    if (formatIt == m_formats.end()) {
+        ERR("YUVConverterVk: no conversion for %s.", string_VkFormat(format));
+        return nullptr;
+    }
+    const FormatResources& resources = formatIt->second;
+    const uint32_t x = static_cast<uint32_t>(region.offset.x);
+    const uint32_t y = static_cast<uint32_t>(region.offset.y);
+    if (region.offset.x < 0 || region.offset.y < 0 || region.extent.width == 0 ||
+        region.extent.height == 0 || x > extent.width ||
+        region.extent.width > extent.width - x || y > extent.height ||
+        region.extent.height > extent.height - y) {
+        ERR("YUVConverterVk: region (%d, %d, %u, %u) out of bounds of %ux%u.", region.offset.x,
+            region.offset.y, region.extent.width, region.extent.height, extent.width,
+            extent.height);
+        return nullptr;
+    }
+
+    auto conversion = std::unique_ptr<Conversion>(new Conversion(m_vk, m_vkDevice));
+
+    const VkSamplerYcbcrConversionInfo ycbcrConversionInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .pNext = nullptr,
+        .conversion = resources.ycbcrConversion,
+    };
+    const VkImageViewCreateInfo sourceImageViewCi = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = &ycbcrConversionInfo,
+        .flags = 0,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .components =
+            {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+            },
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    VkResult res = m_vk.vkCreateImageView(m_vkDevice, &sourceImageViewCi, nullptr,
+                                          &conversion->m_sourceImageView);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to create the view of a %s image: %s.",
+            string_VkFormat(format), string_VkResult(res));
+        return nullptr;
+    }
+
+    // A pool of its own, as the conversion is freed once its command buffer
+    // is done, in any order with the others.
+    const VkDescriptorPoolSize descriptorPoolSizes[] = {
+        VkDescriptorPoolSize{
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = kMaxCombinedImageSamplerDescriptorCount,
+        },
+        VkDescriptorPoolSize{
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+        },
+    };
+    const VkDescriptorPoolCreateInfo descriptorPoolCi = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = 0,
+        .maxSets = 1,
+        .poolSizeCount = static_cast<uint32_t>(std::size(descriptorPoolSizes)),
+        .pPoolSizes = descriptorPoolSizes,
+    };
+    VK_CHECK(m_vk.vkCreateDescriptorPool(m_vkDevice, &descriptorPoolCi, nullptr,
+                                         &conversion->m_descriptorPool));
+    const VkDescriptorSetAllocateInfo descriptorSetAllocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = conversion->m_descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &resources.descriptorSetLayout,
+    };
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VK_CHECK(m_vk.vkAllocateDescriptorSets(m_vkDevice, &descriptorSetAllocInfo, &descriptorSet));
+
+    const VkDescriptorImageInfo imageInfo = {
+        // Immutable.
+        .sampler = VK_NULL_HANDLE,
+        .imageView = conversion->m_sourceImageView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    const VkDescriptorBufferInfo bufferInfo = {
+        .buffer = m_uniformBuffer,
+        .offset = 0,
+        .range = sizeof(UniformBufferBinding),
+    };
+    const VkWriteDescriptorSet descriptorSetWrites[] = {
+        VkWriteDescriptorSet{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &imageInfo,
+        },
+        VkWriteDescriptorSet{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSet,
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .pBufferInfo = &bufferInfo,
+        },
+    };
+    m_vk.vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(std::size(descriptorSetWrites)),
+                                descriptorSetWrites, 0, nullptr);
+
+    // The whole image is converted, and only |region| copied out, so that
+    // chroma is sampled the same way whatever the region.
+    const VkImageCreateInfo targetImageCi = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = kTargetFormat,
+        .extent = {extent.width, extent.height, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    res = m_vk.vkCreateImage(m_vkDevice, &targetImageCi, nullptr, &conversion->m_targetImage);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to create a %ux%u target image: %s.", extent.width,
+            extent.height, string_VkResult(res));
+        return nullptr;
+    }
+    VkMemoryRequirements memRequirements;
+    m_vk.vkGetImageMemoryRequirements(m_vkDevice, conversion->m_targetImage, &memRequirements);
+    auto memoryTypeIndex =
+        vk_util::findMemoryType(&m_vk, m_vkPhysicalDevice, memRequirements.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (!memoryTypeIndex) {
+        ERR("YUVConverterVk: no device local memory type for the target image.");
+        return nullptr;
+    }
+    const VkMemoryAllocateInfo memAllocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = *memoryTypeIndex,
+    };
+    res = m_vk.vkAllocateMemory(m_vkDevice, &memAllocInfo, nullptr, &conversion->m_targetMemory);
+    if (res != VK_SUCCESS) {
+        ERR("YUVConverterVk: failed to allocate the target image memory: %s.",
+            string_VkResult(res));
+        return nullptr;
+    }
+    VK_CHECK(m_vk.vkBindImageMemory(m_vkDevice, conversion->m_targetImage,
+                                    conversion->m_targetMemory, 0));
+
+    const VkImageViewCreateInfo targetImageViewCi = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .image = conversion->m_targetImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = kTargetFormat,
+        .components =
+            {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+            },
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    VK_CHECK(m_vk.vkCreateImageView(m_vkDevice, &targetImageViewCi, nullptr,
+                                    &conversion->m_targetImageView));
+
+    const VkFramebufferCreateInfo framebufferCi = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .flags = 0,
+        .renderPass = m_renderPass,
+        .attachmentCount = 1,
+        .pAttachments = &conversion->m_targetImageView,
+        .width = extent.width,
+        .height = extent.height,
+        .layers = 1,
+    };
+    VK_CHECK(m_vk.vkCreateFramebuffer(m_vkDevice, &framebufferCi, nullptr,
+                                      &conversion->m_framebuffer));
+
+    const VkRect2D renderArea = {
+        .offset = {0, 0},
+        .extent = extent,
+    };
+    const VkRenderPassBeginInfo renderPassBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = m_renderPass,
+        .framebuffer = conversion->m_framebuffer,
+        .renderArea = renderArea,
+        .clearValueCount = 0,
+        .pClearValues = nullptr,
+    };
+    m_vk.vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    m_vk.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, resources.pipeline);
+    const VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = static_cast<float>(extent.width),
+        .height = static_cast<float>(extent.height),
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    m_vk.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    m_vk.vkCmdSetScissor(commandBuffer, 0, 1, &renderArea);
+    const VkDeviceSize vertexBufferOffset = 0;
+    m_vk.vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffer, &vertexBufferOffset);
+    m_vk.vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    m_vk.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                 resources.pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    m_vk.vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(std::size(kIndices)), 1, 0, 0, 0);
+    m_vk.vkCmdEndRenderPass(commandBuffer);
+
+    const VkBufferImageCopy bufferImageCopy = {
+        .bufferOffset = bufferOffset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageOffset = {region.offset.x, region.offset.y, 0},
+        .imageExtent = {region.extent.width, region.extent.height, 1},
+    };
+    m_vk.vkCmdCopyImageToBuffer(commandBuffer, conversion->m_targetImage,
+                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                                &bufferImageCopy);
+
+    return conversion;
+}
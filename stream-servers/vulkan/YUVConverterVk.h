@@ -0,0 +1,111 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "vulkan/cereal/common/goldfish_vk_dispatch.h"
+
+// Converts multi-planar YUV images to RGBA8 on the GPU, the Vulkan counterpart
+// of YUVConverter. The image is sampled through a VkSamplerYcbcrConversion
+// with the BT.601 narrow range model YUVConverter uses, and drawn into an
+// RGBA8 image with the compositor shaders.
+//
+// YUVConverter scales Cb by 0.96 before its matrix, which the fixed function
+// conversion can't do. Blue and green differ by up to a few percent for
+// strongly saturated colors.
+//
+// Not thread safe. VkEmulation only uses it under sVkEmulationLock.
+class YUVConverterVk {
+   public:
+    // Returns nullptr if none of the YUV ColorBuffer formats can be sampled
+    // through a Y'CbCr conversion. The device must have been created with the
+    // samplerYcbcrConversion feature.
+    static std::unique_ptr<YUVConverterVk> create(const goldfish_vk::VulkanDispatch& vk,
+                                                  VkDevice device,
+                                                  VkPhysicalDevice physicalDevice);
+    ~YUVConverterVk();
+
+    bool canConvert(VkFormat format, VkImageTiling tiling) const;
+
+    // The objects used by one conversion. They must outlive the execution of
+    // the command buffer it was recorded into.
+    class Conversion {
+       public:
+        ~Conversion();
+
+       private:
+        friend class YUVConverterVk;
+        Conversion(const goldfish_vk::VulkanDispatch& vk, VkDevice device);
+
+        const goldfish_vk::VulkanDispatch& m_vk;
+        const VkDevice m_vkDevice;
+        VkImageView m_sourceImageView = VK_NULL_HANDLE;
+        VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+        VkImage m_targetImage = VK_NULL_HANDLE;
+        VkDeviceMemory m_targetMemory = VK_NULL_HANDLE;
+        VkImageView m_targetImageView = VK_NULL_HANDLE;
+        VkFramebuffer m_framebuffer = VK_NULL_HANDLE;
+    };
+
+    // Records into |commandBuffer| the conversion of the |extent| sized |image|
+    // and the copy of its |region| into |buffer| at |bufferOffset|, as tightly
+    // packed RGBA8 rows. |image| must be in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and have been created with
+    // VK_IMAGE_USAGE_SAMPLED_BIT. Returns nullptr on failure, with nothing
+    // recorded.
+    std::unique_ptr<Conversion> recordConversion(VkCommandBuffer commandBuffer, VkImage image,
+                                                 VkFormat format, VkExtent2D extent,
+                                                 const VkRect2D& region, VkBuffer buffer,
+                                                 VkDeviceSize bufferOffset);
+
+   private:
+    YUVConverterVk(const goldfish_vk::VulkanDispatch& vk, VkDevice device,
+                   VkPhysicalDevice physicalDevice);
+
+    // The sampler Y'CbCr conversion of a format, and the pipeline sampling
+    // through it. The conversion is baked into the descriptor set layout as
+    // an immutable sampler.
+    struct FormatResources {
+        VkFormatProperties formatProperties = {};
+        VkSamplerYcbcrConversion ycbcrConversion = VK_NULL_HANDLE;
+        VkSampler sampler = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+    };
+
+    bool setUpRenderPass();
+    bool setUpBuffers();
+    bool setUpFormat(VkFormat format);
+    void destroyFormat(FormatResources* resources);
+    bool createHostVisibleBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const void* data,
+                                 VkBuffer* outBuffer, VkDeviceMemory* outMemory);
+
+    const goldfish_vk::VulkanDispatch& m_vk;
+    const VkDevice m_vkDevice;
+    const VkPhysicalDevice m_vkPhysicalDevice;
+    VkRenderPass m_renderPass = VK_NULL_HANDLE;
+    VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory m_vertexMemory = VK_NULL_HANDLE;
+    VkBuffer m_indexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory m_indexMemory = VK_NULL_HANDLE;
+    VkBuffer m_uniformBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory m_uniformMemory = VK_NULL_HANDLE;
+    std::unordered_map<VkFormat, FormatResources> m_formats;
+};
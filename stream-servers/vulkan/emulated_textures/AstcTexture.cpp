@@ -17,10 +17,14 @@
 #include <atomic>
 #include <chrono>
 #include <cstring>
+#include <functional>
+#include <list>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 #include "aemu/base/HealthMonitor.h"
+#include "aemu/base/threads/WorkerThread.h"
 #include "host-common/logging.h"
 #include "stream-servers/vulkan/vk_util.h"
 
@@ -32,9 +36,187 @@ using std::chrono::milliseconds;
 // Print stats each time we decompress this many pixels:
 constexpr uint64_t kProcessedPixelsLogInterval = 10'000'000;
 
+// Maximum amount of memory used by the decompressed texture cache, counting both the compressed
+// and decompressed data of each entry.
+constexpr size_t kDecompressedCacheBudget = 256 * 1024 * 1024;
+
 std::atomic<uint64_t> pixels_processed = 0;
 std::atomic<uint64_t> ms_elapsed = 0;
 std::atomic<int64_t> bytes_used = 0;
+std::atomic<uint64_t> cache_hits = 0;
+std::atomic<uint64_t> cache_misses = 0;
+
+// 64-bit FNV-1a, consuming 8 bytes at a time. Only used to index the decompressed texture cache:
+// entries are compared byte for byte on lookup, so collisions are harmless.
+uint64_t hashAstcData(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// LRU cache of decompressed ASTC images, keyed on the compressed data. Games commonly upload the
+// same textures over and over (e.g. when streaming levels in and out), and a memcpy is much
+// cheaper than decompressing the data again.
+//
+// Thread-safety: not thread safe. Only used from the decompression thread.
+class DecompressedAstcCache {
+   public:
+    struct Key {
+        uint64_t hash;
+        size_t astcSize;
+        uint32_t width;
+        uint32_t height;
+        uint32_t blockWidth;
+        uint32_t blockHeight;
+
+        bool operator==(const Key& other) const {
+            return hash == other.hash && astcSize == other.astcSize && width == other.width &&
+                   height == other.height && blockWidth == other.blockWidth &&
+                   blockHeight == other.blockHeight;
+        }
+    };
+
+    explicit DecompressedAstcCache(size_t budget) : mBudget(budget) {}
+
+    // If `astcData` was previously decompressed with the same parameters, copies the decompressed
+    // image to `output` and returns true.
+    bool lookup(const Key& key, const uint8_t* astcData, uint8_t* output) {
+        auto it = mIndex.find(key);
+        if (it == mIndex.end()) return false;
+        const Entry& entry = *it->second;
+        if (memcmp(entry.astcData.data(), astcData, entry.astcData.size()) != 0) return false;
+        memcpy(output, entry.rgbaData.data(), entry.rgbaData.size());
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+        return true;
+    }
+
+    void insert(const Key& key, std::vector<uint8_t> astcData, const uint8_t* rgbaData,
+                size_t rgbaSize) {
+        const size_t entrySize = astcData.size() + rgbaSize;
+        // Don't let a single huge texture flush the whole cache.
+        if (entrySize > mBudget / 4) return;
+
+        auto it = mIndex.find(key);
+        if (it != mIndex.end()) erase(it->second);
+        while (!mEntries.empty() && mSize + entrySize > mBudget) {
+            erase(std::prev(mEntries.end()));
+        }
+
+        mEntries.push_front(
+            {key, std::move(astcData), std::vector<uint8_t>(rgbaData, rgbaData + rgbaSize)});
+        mIndex[key] = mEntries.begin();
+        mSize += entrySize;
+    }
+
+   private:
+    struct Entry {
+        Key key;
+        std::vector<uint8_t> astcData;
+        std::vector<uint8_t> rgbaData;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& k) const { return k.hash; }
+    };
+
+    void erase(std::list<Entry>::iterator entry) {
+        mSize -= entry->astcData.size() + entry->rgbaData.size();
+        mIndex.erase(entry->key);
+        mEntries.erase(entry);
+    }
+
+    const size_t mBudget;
+    size_t mSize = 0;
+    std::list<Entry> mEntries;  // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> mIndex;
+};
+
+// Runs decompression jobs in order on a dedicated thread, so that the decoder thread doesn't have
+// to wait for them. Each job is itself split across the AstcCpuDecompressor worker threads, which
+// only decompress one image at a time anyway.
+class DecompressionThread {
+   public:
+    static DecompressionThread& get() {
+        static DecompressionThread instance;
+        return instance;
+    }
+
+    std::future<void> enqueue(std::function<void()> job) {
+        return mWorker.enqueue(Job{std::move(job)});
+    }
+
+    DecompressedAstcCache& cache() { return mCache; }
+
+   private:
+    struct Job {
+        std::function<void()> run;  // An empty job stops the thread
+    };
+
+    DecompressionThread()
+        : mWorker([](Job job) {
+              using android::base::WorkerProcessingResult;
+              if (!job.run) return WorkerProcessingResult::Stop;
+              job.run();
+              return WorkerProcessingResult::Continue;
+          }),
+          mCache(kDecompressedCacheBudget) {
+        mWorker.start();
+    }
+
+    ~DecompressionThread() {
+        mWorker.enqueue(Job{});
+        mWorker.join();
+    }
+
+    android::base::WorkerThread<Job> mWorker;
+    DecompressedAstcCache mCache;
+};
+
+// A single region of a texture to decompress.
+struct RegionJob {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> astcData;  // Private copy of the compressed data
+    uint8_t* output;                // Where to write the decompressed data
+};
+
+// Decompresses all the regions, using the cache when possible. Returns 0 on success, or the
+// decompressor status code of the first failure.
+int32_t decompressRegions(AstcCpuDecompressor* decompressor, uint32_t blockWidth,
+                          uint32_t blockHeight, std::vector<RegionJob>& regions) {
+    DecompressedAstcCache& cache = DecompressionThread::get().cache();
+    for (auto& region : regions) {
+        const DecompressedAstcCache::Key key = {
+            .hash = hashAstcData(region.astcData.data(), region.astcData.size()),
+            .astcSize = region.astcData.size(),
+            .width = region.width,
+            .height = region.height,
+            .blockWidth = blockWidth,
+            .blockHeight = blockHeight,
+        };
+        if (cache.lookup(key, region.astcData.data(), region.output)) {
+            cache_hits++;
+            continue;
+        }
+        cache_misses++;
+
+        int32_t status = decompressor->decompress(region.width, region.height, blockWidth,
+                                                  blockHeight, region.astcData.data(),
+                                                  region.astcData.size(), region.output);
+        if (status != 0) return status;
+        cache.insert(key, std::move(region.astcData), region.output,
+                     region.width * region.height * 4);
+    }
+    return 0;
+}
 
 uint32_t mipmapSize(uint32_t size, uint32_t mipLevel) {
     return std::max<uint32_t>(size >> mipLevel, 1);
@@ -73,7 +255,11 @@ AstcTexture::AstcTexture(VulkanDispatch* vk, VkDevice device, VkPhysicalDevice p
       mBlockHeight(blockHeight),
       mDecompressor(decompressor) {}
 
-AstcTexture::~AstcTexture() { destroyVkBuffer(); }
+AstcTexture::~AstcTexture() {
+    // The decompression thread may still be writing to our buffer.
+    if (mPendingDecompression.valid()) mPendingDecompression.wait();
+    destroyVkBuffer();
+}
 
 bool AstcTexture::canDecompressOnCpu() const { return mDecompressor->available(); }
 
@@ -165,19 +351,11 @@ void AstcTexture::on_vkCmdCopyBufferToImage(VkCommandBuffer commandBuffer, uint8
                                             const VkDecoderContext& context) {
     auto watchdog =
         WATCHDOG_BUILDER(*context.healthMonitor, "AstcTexture::on_vkCmdCopyBufferToImage").build();
-    auto start_time = std::chrono::steady_clock::now();
     mSuccess = false;
     size_t decompSize = 0;  // How many bytes we need to hold the decompressed data
 
-    // Holds extra data about the region
-    struct RegionInfo {
-        uint32_t width;           // actual width (ie: mipmap width)
-        uint32_t height;          // actual height (ie: mipmap height)
-        uint32_t compressedSize;  // size of ASTC data for that region
-    };
-
-    std::vector<RegionInfo> regionInfos;
-    regionInfos.reserve(regionCount);
+    std::vector<RegionJob> regionJobs;
+    regionJobs.reserve(regionCount);
 
     // Make a copy of the regions and update the buffer offset of each to reflect the
     // correct location of the decompressed data
@@ -202,7 +380,7 @@ void AstcTexture::on_vkCmdCopyBufferToImage(VkCommandBuffer commandBuffer, uint8
 
         decompRegion.bufferOffset = decompSize;
         decompSize += width * height * 4;
-        regionInfos.push_back({width, height, compressedSize});
+        regionJobs.push_back({width, height, {}, nullptr});
     }
 
     // Create a new VkBuffer to hold the decompressed data
@@ -212,49 +390,65 @@ void AstcTexture::on_vkCmdCopyBufferToImage(VkCommandBuffer commandBuffer, uint8
         return;
     }
 
-    // Decompress each region
-    for (int i = 0; i < regionCount; i++) {
-        const auto& compRegion = pRegions[i];
-        const auto& decompRegion = decompRegions[i];
-        const auto& regionInfo = regionInfos[i];
-
-        int32_t status = mDecompressor->decompress(
-            regionInfo.width, regionInfo.height, mBlockWidth, mBlockHeight,
-            srcAstcData + compRegion.bufferOffset, regionInfo.compressedSize,
-            decompData + decompRegion.bufferOffset);
-
-        if (status != 0) {
-            WARN("ASTC CPU decompression failed: %s - will try compute shader instead.",
-                 mDecompressor->getStatusString(status));
-            mVk->vkUnmapMemory(mDevice, mDecompBufferMemory);
-            destroyVkBuffer();
-            return;
-        }
+    // The guest is free to overwrite or free the source buffer as soon as this command is
+    // recorded, so the worker needs its own copy of the compressed data.
+    for (uint32_t i = 0; i < regionCount; i++) {
+        const uint8_t* astcRegionData = srcAstcData + pRegions[i].bufferOffset;
+        RegionJob& job = regionJobs[i];
+        const size_t compressedSize = ((job.width + mBlockWidth - 1) / mBlockWidth) *
+                                      ((job.height + mBlockHeight - 1) / mBlockHeight) * 16;
+        job.astcData.assign(astcRegionData, astcRegionData + compressedSize);
+        job.output = decompData + decompRegions[i].bufferOffset;
     }
 
-    mVk->vkUnmapMemory(mDevice, mDecompBufferMemory);
-
-    // Finally, actually copy the buffer to the image
+    // Record the copy right away. The decompression only needs to complete before the command
+    // buffer is submitted, which the caller enforces through pendingDecompression().
     mVk->vkCmdCopyBufferToImage(commandBuffer, mDecompBuffer, dstImage, dstImageLayout,
                                 decompRegions.size(), decompRegions.data());
-
     mSuccess = true;
-    auto end_time = std::chrono::steady_clock::now();
-
-    // Compute stats
-    pixels_processed += decompSize / 4;
-    ms_elapsed += std::chrono::duration_cast<milliseconds>(end_time - start_time).count();
 
-    uint64_t total_pixels = pixels_processed.load();
-    uint64_t total_time = ms_elapsed.load();
-
-    if (total_pixels >= kProcessedPixelsLogInterval && total_time > 0) {
-        pixels_processed.store(0);
-        ms_elapsed.store(0);
-        INFO("ASTC CPU decompression: %.2f Mpix in %.2f seconds (%.2f Mpix/s). Total mem: %.2f MB",
-             total_pixels / 1'000'000.0, total_time / 1000.0,
-             (float)total_pixels / total_time / 1000.0, bytes_used / 1000000.0);
-    }
+    mPendingDecompression =
+        DecompressionThread::get()
+            .enqueue([vk = mVk, device = mDevice, memory = mDecompBufferMemory,
+                      decompressor = mDecompressor, blockWidth = mBlockWidth,
+                      blockHeight = mBlockHeight, decompSize,
+                      regionJobs = std::move(regionJobs)]() mutable {
+                auto start_time = std::chrono::steady_clock::now();
+
+                int32_t status = decompressRegions(decompressor, blockWidth, blockHeight,
+                                                   regionJobs);
+                vk->vkUnmapMemory(device, memory);
+
+                // At this point the copy has already been recorded, so it's too late to fall back
+                // to the compute shader. This only happens if astcenc can't allocate its context.
+                if (status != 0) {
+                    ERR("ASTC CPU decompression failed: %s - texture contents are undefined.",
+                        decompressor->getStatusString(status));
+                    return;
+                }
+
+                auto end_time = std::chrono::steady_clock::now();
+
+                // Compute stats
+                pixels_processed += decompSize / 4;
+                ms_elapsed +=
+                    std::chrono::duration_cast<milliseconds>(end_time - start_time).count();
+
+                uint64_t total_pixels = pixels_processed.load();
+                uint64_t total_time = ms_elapsed.load();
+
+                if (total_pixels >= kProcessedPixelsLogInterval && total_time > 0) {
+                    pixels_processed.store(0);
+                    ms_elapsed.store(0);
+                    INFO("ASTC CPU decompression: %.2f Mpix in %.2f seconds (%.2f Mpix/s). Total "
+                         "mem: %.2f MB. Cache hits: %llu, misses: %llu",
+                         total_pixels / 1'000'000.0, total_time / 1000.0,
+                         (float)total_pixels / total_time / 1000.0, bytes_used / 1000000.0,
+                         (unsigned long long)cache_hits.load(),
+                         (unsigned long long)cache_misses.load());
+                }
+            })
+            .share();
 }
 
 }  // namespace goldfish_vk
@@ -13,6 +13,8 @@
 // limitations under the License.
 #pragma once
 
+#include <future>
+
 #include "compressedTextureFormats/AstcCpuDecompressor.h"
 #include "stream-servers/vulkan/VkDecoderContext.h"
 #include "vulkan/cereal/common/goldfish_vk_dispatch.h"
@@ -32,9 +34,19 @@ class AstcTexture {
     // Whether we're able to decompress ASTC textures on the CPU
     bool canDecompressOnCpu() const;
 
-    // Whether this texture was successfully decompressed on the CPU
+    // Whether this texture was successfully decompressed on the CPU. The decompression itself may
+    // still be running: call pendingDecompression() to wait for it before submitting the command
+    // buffer.
     bool successfullyDecompressed() const { return mSuccess; }
 
+    // Returns a future that becomes ready once the decompressed data recorded by the last call to
+    // on_vkCmdCopyBufferToImage() has been fully written to the staging buffer. The future stays
+    // valid even if this object is destroyed.
+    std::shared_future<void> pendingDecompression() const { return mPendingDecompression; }
+
+    // Records a copy of the decompressed texture to dstImage, and queues the decompression of
+    // srcAstcData on a worker thread. The compressed data is copied before returning, so the
+    // caller doesn't need to keep it alive.
     void on_vkCmdCopyBufferToImage(VkCommandBuffer commandBuffer, uint8_t* srcAstcData,
                                    size_t astcDataSize, VkImage dstImage,
                                    VkImageLayout dstImageLayout, uint32_t regionCount,
@@ -55,6 +67,7 @@ class AstcTexture {
     VkBuffer mDecompBuffer = VK_NULL_HANDLE;              // VkBuffer of the decompressed image
     VkDeviceMemory mDecompBufferMemory = VK_NULL_HANDLE;  // Memory of the decompressed image
     uint64_t mBufferSize = 0;                             // Size of the decompressed image
+    std::shared_future<void> mPendingDecompression;       // Decompression in flight, if any
     AstcCpuDecompressor* mDecompressor;
 };
 
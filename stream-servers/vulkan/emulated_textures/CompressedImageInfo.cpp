@@ -14,8 +14,6 @@
 
 #include "CompressedImageInfo.h"
 
-#include "aemu/base/ArraySize.h"
-#include "stream-servers/vulkan/DecompressionShaders.h"
 #include "stream-servers/vulkan/VkFormatUtils.h"
 
 #include <cstring>
@@ -24,35 +22,6 @@ namespace goldfish_vk {
 
 namespace {
 
-using android::base::arraySize;
-
-struct Etc2PushConstant {
-    uint32_t compFormat;
-    uint32_t baseLayer;
-};
-
-struct AstcPushConstant {
-    uint32_t blockSize[2];
-    uint32_t compFormat;
-    uint32_t baseLayer;
-    uint32_t sRGB;
-    uint32_t smallBlock;
-};
-
-SpvFileEntry loadDecompressionShaderSource(const char* filename) {
-    size_t numDecompressionShaderFileEntries = arraySize(sDecompressionShaderFileEntries);
-
-    for (size_t i = 0; i < numDecompressionShaderFileEntries; ++i) {
-        if (!strcmp(filename, sDecompressionShaderFileEntries[i].name)) {
-            return sDecompressionShaderFileEntries[i];
-        }
-    }
-
-    SpvFileEntry invalid = {filename, nullptr, 0};
-    fprintf(stderr, "WARNING: shader source open failed! %s\n", filename);
-    return invalid;
-}
-
 VkImageView createDefaultImageView(goldfish_vk::VulkanDispatch* vk, VkDevice device, VkImage image,
                                    VkFormat format, VkImageType imageType, uint32_t mipLevel,
                                    uint32_t layerCount) {
@@ -373,8 +342,9 @@ void CompressedImageInfo::createSizeCompImages(goldfish_vk::VulkanDispatch* vk)
 }
 
 VkResult CompressedImageInfo::initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevice device,
+                                         GpuDecompressionPipelineManager* pipelineManager,
                                          VkImage image) {
-    if (decompPipeline != 0) {
+    if (decompPipeline != nullptr) {
         return VK_SUCCESS;
     }
     // TODO: release resources on failure
@@ -389,109 +359,15 @@ VkResult CompressedImageInfo::initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevi
         }                                                                                          \
     }
 
-    std::string shaderSrcFileName;
-    switch (compFormat) {
-        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
-        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
-        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
-        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
-            shaderSrcFileName = "Etc2RGB8_";
-            break;
-        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
-        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
-            shaderSrcFileName = "Etc2RGBA8_";
-            break;
-        case VK_FORMAT_EAC_R11_UNORM_BLOCK:
-            shaderSrcFileName = "EacR11Unorm_";
-            break;
-        case VK_FORMAT_EAC_R11_SNORM_BLOCK:
-            shaderSrcFileName = "EacR11Snorm_";
-            break;
-        case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
-            shaderSrcFileName = "EacRG11Unorm_";
-            break;
-        case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
-            shaderSrcFileName = "EacRG11Snorm_";
-            break;
-        case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_5x4_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_6x5_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_8x5_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_8x6_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_10x5_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_10x6_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_10x8_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_10x10_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_12x10_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_12x12_UNORM_BLOCK:
-        case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_5x4_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_6x5_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_8x5_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_8x6_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_10x5_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_10x6_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_10x8_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_10x10_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_12x10_SRGB_BLOCK:
-        case VK_FORMAT_ASTC_12x12_SRGB_BLOCK:
-            shaderSrcFileName = "Astc_";
-            break;
-        default:
-            shaderSrcFileName = "Etc2RGB8_";
-            break;
+    if (!pipelineManager) {
+        return VK_ERROR_INITIALIZATION_FAILED;
     }
-    if (imageType == VK_IMAGE_TYPE_1D) {
-        shaderSrcFileName += "1DArray.spv";
-    } else if (imageType == VK_IMAGE_TYPE_3D) {
-        shaderSrcFileName += "3D.spv";
-    } else {
-        shaderSrcFileName += "2DArray.spv";
-    }
-
-    SpvFileEntry shaderSource = loadDecompressionShaderSource(shaderSrcFileName.c_str());
-
-    if (!shaderSource.size) {
-        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    const GpuDecompressionPipeline* pipeline = pipelineManager->getPipeline(compFormat, imageType);
+    VkDescriptorSetLayout descriptorSetLayout = pipelineManager->getDescriptorSetLayout();
+    if (!pipeline || !descriptorSetLayout) {
+        return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    VkShaderModuleCreateInfo shaderInfo = {};
-    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderInfo.codeSize = shaderSource.size;
-    // DecompressionShaders.h declares everything as aligned to 4 bytes,
-    // so it is safe to cast
-    shaderInfo.pCode = reinterpret_cast<const uint32_t*>(shaderSource.base);
-    _RETURN_ON_FAILURE(vk->vkCreateShaderModule(device, &shaderInfo, nullptr, &decompShader));
-
-    VkDescriptorSetLayoutBinding dsLayoutBindings[] = {
-        {
-            0,                                 // bindings
-            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  // descriptorType
-            1,                                 // descriptorCount
-            VK_SHADER_STAGE_COMPUTE_BIT,       // stageFlags
-            0,                                 // pImmutableSamplers
-        },
-        {
-            1,                                 // bindings
-            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  // descriptorType
-            1,                                 // descriptorCount
-            VK_SHADER_STAGE_COMPUTE_BIT,       // stageFlags
-            0,                                 // pImmutableSamplers
-        },
-    };
-    VkDescriptorSetLayoutCreateInfo dsLayoutInfo = {};
-    dsLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    dsLayoutInfo.bindingCount = sizeof(dsLayoutBindings) / sizeof(VkDescriptorSetLayoutBinding);
-    dsLayoutInfo.pBindings = dsLayoutBindings;
-    _RETURN_ON_FAILURE(vk->vkCreateDescriptorSetLayout(device, &dsLayoutInfo, nullptr,
-                                                       &decompDescriptorSetLayout));
-
     VkDescriptorPoolSize poolSize[1] = {
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 * mipLevels},
     };
@@ -503,7 +379,7 @@ VkResult CompressedImageInfo::initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevi
     dsPoolInfo.pPoolSizes = poolSize;
     _RETURN_ON_FAILURE(
         vk->vkCreateDescriptorPool(device, &dsPoolInfo, nullptr, &decompDescriptorPool));
-    std::vector<VkDescriptorSetLayout> layouts(mipLevels, decompDescriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(mipLevels, descriptorSetLayout);
 
     VkDescriptorSetAllocateInfo dsInfo = {};
     dsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -513,33 +389,7 @@ VkResult CompressedImageInfo::initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevi
     decompDescriptorSets.resize(mipLevels);
     _RETURN_ON_FAILURE(vk->vkAllocateDescriptorSets(device, &dsInfo, decompDescriptorSets.data()));
 
-    VkPushConstantRange pushConstant = {};
-    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    pushConstant.offset = 0;
-    if (isEtc2) {
-        pushConstant.size = sizeof(Etc2PushConstant);
-    } else if (isAstc) {
-        pushConstant.size = sizeof(AstcPushConstant);
-    }
-
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &decompDescriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
-    _RETURN_ON_FAILURE(
-        vk->vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &decompPipelineLayout));
-
-    VkComputePipelineCreateInfo computePipelineInfo = {};
-    computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    computePipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    computePipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    computePipelineInfo.stage.module = decompShader;
-    computePipelineInfo.stage.pName = "main";
-    computePipelineInfo.layout = decompPipelineLayout;
-    _RETURN_ON_FAILURE(
-        vk->vkCreateComputePipelines(device, 0, 1, &computePipelineInfo, nullptr, &decompPipeline));
+    decompPipeline = pipeline;
 
     VkFormat intermediateFormat = decompFormat;
     switch (compFormat) {
@@ -635,7 +485,8 @@ void CompressedImageInfo::cmdDecompress(goldfish_vk::VulkanDispatch* vk,
                                         VkAccessFlags dstAccessMask, uint32_t baseMipLevel,
                                         uint32_t levelCount, uint32_t baseLayer,
                                         uint32_t _layerCount) {
-    vk->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, decompPipeline);
+    vk->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          decompPipeline->pipeline);
     int dispatchZ = _layerCount;
 
     if (isEtc2) {
@@ -645,8 +496,9 @@ void CompressedImageInfo::cmdDecompress(goldfish_vk::VulkanDispatch* vk,
             pushConstant.baseLayer = 0;
             dispatchZ = extent.depth;
         }
-        vk->vkCmdPushConstants(commandBuffer, decompPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
-                               sizeof(pushConstant), &pushConstant);
+        vk->vkCmdPushConstants(commandBuffer, decompPipeline->pipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstant),
+                               &pushConstant);
     } else if (isAstc) {
         uint32_t srgb = false;
         uint32_t smallBlock = false;
@@ -696,13 +548,14 @@ void CompressedImageInfo::cmdDecompress(goldfish_vk::VulkanDispatch* vk,
             pushConstant.baseLayer = 0;
             dispatchZ = extent.depth;
         }
-        vk->vkCmdPushConstants(commandBuffer, decompPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
-                               sizeof(pushConstant), &pushConstant);
+        vk->vkCmdPushConstants(commandBuffer, decompPipeline->pipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstant),
+                               &pushConstant);
     }
     for (uint32_t i = baseMipLevel; i < baseMipLevel + levelCount; i++) {
         vk->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                                    decompPipelineLayout, 0, 1, decompDescriptorSets.data() + i, 0,
-                                    nullptr);
+                                    decompPipeline->pipelineLayout, 0, 1,
+                                    decompDescriptorSets.data() + i, 0, nullptr);
 
         vk->vkCmdDispatch(commandBuffer, sizeCompMipmapWidth(i), sizeCompMipmapHeight(i),
                           dispatchZ);
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "stream-servers/vulkan/emulated_textures/AstcTexture.h"
+#include "stream-servers/vulkan/emulated_textures/GpuDecompressionPipeline.h"
 #include "vulkan/cereal/common/goldfish_vk_dispatch.h"
 #include "vulkan/vulkan.h"
 
@@ -46,12 +47,10 @@ struct CompressedImageInfo {
     uint32_t layerCount;
     uint32_t mipLevels = 1;
     std::unique_ptr<AstcTexture> astcTexture = nullptr;
-    VkDescriptorSetLayout decompDescriptorSetLayout = 0;
     VkDescriptorPool decompDescriptorPool = 0;
     std::vector<VkDescriptorSet> decompDescriptorSets = {};
-    VkShaderModule decompShader = 0;
-    VkPipelineLayout decompPipelineLayout = 0;
-    VkPipeline decompPipeline = 0;
+    // Shared by the images of the device, owned by its GpuDecompressionPipelineManager
+    const GpuDecompressionPipeline* decompPipeline = nullptr;
     std::vector<VkImageView> sizeCompImageViews = {};
     std::vector<VkImageView> decompImageViews = {};
 
@@ -70,7 +69,8 @@ struct CompressedImageInfo {
 
     void createSizeCompImages(goldfish_vk::VulkanDispatch* vk);
 
-    VkResult initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevice device, VkImage image);
+    VkResult initDecomp(goldfish_vk::VulkanDispatch* vk, VkDevice device,
+                        GpuDecompressionPipelineManager* pipelineManager, VkImage image);
 
     void cmdDecompress(goldfish_vk::VulkanDispatch* vk, VkCommandBuffer commandBuffer,
                        VkPipelineStageFlags dstStageMask, VkImageLayout newLayout,
@@ -0,0 +1,269 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "GpuDecompressionPipeline.h"
+
+#include "aemu/base/ArraySize.h"
+#include "stream-servers/vulkan/DecompressionShaders.h"
+
+#include <cstring>
+
+namespace goldfish_vk {
+
+namespace {
+
+using android::base::arraySize;
+
+SpvFileEntry loadDecompressionShaderSource(const char* filename) {
+    size_t numDecompressionShaderFileEntries = arraySize(sDecompressionShaderFileEntries);
+
+    for (size_t i = 0; i < numDecompressionShaderFileEntries; ++i) {
+        if (!strcmp(filename, sDecompressionShaderFileEntries[i].name)) {
+            return sDecompressionShaderFileEntries[i];
+        }
+    }
+
+    SpvFileEntry invalid = {filename, nullptr, 0};
+    fprintf(stderr, "WARNING: shader source open failed! %s\n", filename);
+    return invalid;
+}
+
+bool isAstcFormat(VkFormat compressedFormat) {
+    switch (compressedFormat) {
+        case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_5x4_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_6x5_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_8x5_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_8x6_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_10x5_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_10x6_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_10x8_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_10x10_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_12x10_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_12x12_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_5x4_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_6x5_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_8x5_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_8x6_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_10x5_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_10x6_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_10x8_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_10x10_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_12x10_SRGB_BLOCK:
+        case VK_FORMAT_ASTC_12x12_SRGB_BLOCK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::string getShaderFileName(VkFormat compressedFormat, VkImageType imageType) {
+    std::string shaderSrcFileName;
+    switch (compressedFormat) {
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+            shaderSrcFileName = "Etc2RGB8_";
+            break;
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            shaderSrcFileName = "Etc2RGBA8_";
+            break;
+        case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+            shaderSrcFileName = "EacR11Unorm_";
+            break;
+        case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+            shaderSrcFileName = "EacR11Snorm_";
+            break;
+        case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+            shaderSrcFileName = "EacRG11Unorm_";
+            break;
+        case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+            shaderSrcFileName = "EacRG11Snorm_";
+            break;
+        default:
+            shaderSrcFileName = isAstcFormat(compressedFormat) ? "Astc_" : "Etc2RGB8_";
+            break;
+    }
+    if (imageType == VK_IMAGE_TYPE_1D) {
+        shaderSrcFileName += "1DArray.spv";
+    } else if (imageType == VK_IMAGE_TYPE_3D) {
+        shaderSrcFileName += "3D.spv";
+    } else {
+        shaderSrcFileName += "2DArray.spv";
+    }
+    return shaderSrcFileName;
+}
+
+}  // namespace
+
+GpuDecompressionPipelineManager::GpuDecompressionPipelineManager(VulkanDispatch* vk,
+                                                                 VkDevice device)
+    : mVk(vk), mDevice(device) {}
+
+GpuDecompressionPipelineManager::~GpuDecompressionPipelineManager() {
+    for (const auto& it : mPipelines) {
+        mVk->vkDestroyPipeline(mDevice, it.second.pipeline, nullptr);
+    }
+    for (const auto& it : mPipelineLayouts) {
+        mVk->vkDestroyPipelineLayout(mDevice, it.second, nullptr);
+    }
+    if (mDescriptorSetLayout) {
+        mVk->vkDestroyDescriptorSetLayout(mDevice, mDescriptorSetLayout, nullptr);
+    }
+}
+
+VkDescriptorSetLayout GpuDecompressionPipelineManager::getDescriptorSetLayout() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return getDescriptorSetLayoutLocked();
+}
+
+VkDescriptorSetLayout GpuDecompressionPipelineManager::getDescriptorSetLayoutLocked() {
+    if (mDescriptorSetLayout) {
+        return mDescriptorSetLayout;
+    }
+
+    VkDescriptorSetLayoutBinding dsLayoutBindings[] = {
+        {
+            0,                                 // bindings
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  // descriptorType
+            1,                                 // descriptorCount
+            VK_SHADER_STAGE_COMPUTE_BIT,       // stageFlags
+            0,                                 // pImmutableSamplers
+        },
+        {
+            1,                                 // bindings
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  // descriptorType
+            1,                                 // descriptorCount
+            VK_SHADER_STAGE_COMPUTE_BIT,       // stageFlags
+            0,                                 // pImmutableSamplers
+        },
+    };
+    VkDescriptorSetLayoutCreateInfo dsLayoutInfo = {};
+    dsLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    dsLayoutInfo.bindingCount = sizeof(dsLayoutBindings) / sizeof(VkDescriptorSetLayoutBinding);
+    dsLayoutInfo.pBindings = dsLayoutBindings;
+    VkResult result =
+        mVk->vkCreateDescriptorSetLayout(mDevice, &dsLayoutInfo, nullptr, &mDescriptorSetLayout);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Warning: %s: failed to create the descriptor set layout: %d\n", __func__,
+                result);
+        mDescriptorSetLayout = VK_NULL_HANDLE;
+    }
+    return mDescriptorSetLayout;
+}
+
+VkPipelineLayout GpuDecompressionPipelineManager::getPipelineLayoutLocked(
+    uint32_t pushConstantSize) {
+    auto it = mPipelineLayouts.find(pushConstantSize);
+    if (it != mPipelineLayouts.end()) {
+        return it->second;
+    }
+
+    VkDescriptorSetLayout descriptorSetLayout = getDescriptorSetLayoutLocked();
+    if (!descriptorSetLayout) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkPushConstantRange pushConstant = {};
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstant.offset = 0;
+    pushConstant.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkResult result =
+        mVk->vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Warning: %s: failed to create the pipeline layout: %d\n", __func__,
+                result);
+        return VK_NULL_HANDLE;
+    }
+    mPipelineLayouts[pushConstantSize] = pipelineLayout;
+    return pipelineLayout;
+}
+
+const GpuDecompressionPipeline* GpuDecompressionPipelineManager::getPipeline(
+    VkFormat compressedFormat, VkImageType imageType) {
+    const std::string shaderSrcFileName = getShaderFileName(compressedFormat, imageType);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mPipelines.find(shaderSrcFileName);
+    if (it != mPipelines.end()) {
+        return &it->second;
+    }
+
+    const uint32_t pushConstantSize =
+        isAstcFormat(compressedFormat) ? sizeof(AstcPushConstant) : sizeof(Etc2PushConstant);
+    VkPipelineLayout pipelineLayout = getPipelineLayoutLocked(pushConstantSize);
+    if (!pipelineLayout) {
+        return nullptr;
+    }
+
+    SpvFileEntry shaderSource = loadDecompressionShaderSource(shaderSrcFileName.c_str());
+    if (!shaderSource.size) {
+        return nullptr;
+    }
+
+    VkShaderModuleCreateInfo shaderInfo = {};
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.codeSize = shaderSource.size;
+    // DecompressionShaders.h declares everything as aligned to 4 bytes,
+    // so it is safe to cast
+    shaderInfo.pCode = reinterpret_cast<const uint32_t*>(shaderSource.base);
+    VkShaderModule shader = VK_NULL_HANDLE;
+    VkResult result = mVk->vkCreateShaderModule(mDevice, &shaderInfo, nullptr, &shader);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Warning: %s: failed to create the shader module %s: %d\n", __func__,
+                shaderSrcFileName.c_str(), result);
+        return nullptr;
+    }
+
+    VkComputePipelineCreateInfo computePipelineInfo = {};
+    computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computePipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePipelineInfo.stage.module = shader;
+    computePipelineInfo.stage.pName = "main";
+    computePipelineInfo.layout = pipelineLayout;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    result = mVk->vkCreateComputePipelines(mDevice, 0, 1, &computePipelineInfo, nullptr, &pipeline);
+    // The pipeline doesn't need the shader module once created.
+    mVk->vkDestroyShaderModule(mDevice, shader, nullptr);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Warning: %s: failed to create the pipeline for %s: %d\n", __func__,
+                shaderSrcFileName.c_str(), result);
+        return nullptr;
+    }
+
+    GpuDecompressionPipeline& entry = mPipelines[shaderSrcFileName];
+    entry.pipelineLayout = pipelineLayout;
+    entry.pipeline = pipeline;
+    return &entry;
+}
+
+}  // namespace goldfish_vk
@@ -0,0 +1,79 @@
+// Copyright 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "vulkan/cereal/common/goldfish_vk_dispatch.h"
+#include "vulkan/vulkan.h"
+
+namespace goldfish_vk {
+
+// Push constants of the decompression shaders.
+struct Etc2PushConstant {
+    uint32_t compFormat;
+    uint32_t baseLayer;
+};
+
+struct AstcPushConstant {
+    uint32_t blockSize[2];
+    uint32_t compFormat;
+    uint32_t baseLayer;
+    uint32_t sRGB;
+    uint32_t smallBlock;
+};
+
+// A compute pipeline that decompresses images of a compressed format and image type. It reads the
+// size compatible image at binding 0 and writes the decompressed image at binding 1 of set 0.
+struct GpuDecompressionPipeline {
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+// Creates the decompression pipelines of a device on first use, and shares them between all the
+// emulated compressed images of the device. Everything is destroyed with the manager, which must
+// happen before the device is destroyed.
+class GpuDecompressionPipelineManager {
+   public:
+    GpuDecompressionPipelineManager(VulkanDispatch* vk, VkDevice device);
+    ~GpuDecompressionPipelineManager();
+
+    GpuDecompressionPipelineManager(const GpuDecompressionPipelineManager&) = delete;
+    GpuDecompressionPipelineManager& operator=(const GpuDecompressionPipelineManager&) = delete;
+
+    // Layout of the descriptor sets the pipelines use. Returns VK_NULL_HANDLE on failure.
+    VkDescriptorSetLayout getDescriptorSetLayout();
+
+    // Returns nullptr on failure. The pipeline stays valid until the manager is destroyed.
+    const GpuDecompressionPipeline* getPipeline(VkFormat compressedFormat, VkImageType imageType);
+
+   private:
+    VkDescriptorSetLayout getDescriptorSetLayoutLocked();
+    VkPipelineLayout getPipelineLayoutLocked(uint32_t pushConstantSize);
+
+    VulkanDispatch* mVk;
+    VkDevice mDevice;
+    std::mutex mMutex;
+    VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
+    // By push constant size, which is all that differs between the pipeline layouts.
+    std::unordered_map<uint32_t, VkPipelineLayout> mPipelineLayouts;
+    // By shader, several formats share one.
+    std::unordered_map<std::string, GpuDecompressionPipeline> mPipelines;
+};
+
+}  // namespace goldfish_vk